@@ -0,0 +1,76 @@
+#include "utils.h"
+
+Arena::~Arena()
+{
+	Release();
+}
+
+void Arena::Reserve(size_t bytes)
+{
+	bytes = AlignUp(bytes);
+	Reset();
+
+	// Keep the block if the new load is of a similar size, so reloading the same
+	// (or a slightly smaller) model does not touch the OS allocator at all
+	if (m_block && bytes <= m_capacity && bytes * 4 >= m_capacity)
+	{
+		m_stats.reuses++;
+		return;
+	}
+
+	Release();
+	if (bytes == 0) return;
+
+	m_block = (uint8_t*)_aligned_malloc(bytes, Alignment);
+	m_capacity = bytes;
+	m_stats.bytesReserved = bytes;
+	m_stats.blockAllocations++;
+}
+
+void Arena::Reset()
+{
+	for (void* ptr : m_overflow)
+		_aligned_free(ptr);
+	m_overflow.clear();
+	m_stats.bytesReserved -= m_overflowBytes;
+	m_overflowBytes = 0;
+
+	m_offset = 0;
+	m_stats.bytesUsed = 0;
+	m_stats.allocations = 0;
+}
+
+void Arena::Release()
+{
+	Reset();
+	if (m_block)
+		_aligned_free(m_block);
+	m_block = nullptr;
+	m_capacity = 0;
+	m_stats.bytesReserved = 0;
+}
+
+void* Arena::AllocateBytes(size_t bytes)
+{
+	bytes = AlignUp(bytes);
+	if (bytes == 0) return nullptr;
+
+	m_stats.allocations++;
+	m_stats.bytesUsed += bytes;
+	m_stats.peakBytesUsed = std::max(m_stats.peakBytesUsed, m_stats.bytesUsed);
+
+	if (m_offset + bytes <= m_capacity)
+	{
+		void* ptr = m_block + m_offset;
+		m_offset += bytes;
+		return ptr;
+	}
+
+	// Caller under-reserved: fall back to a separate block that lives until the next Reset
+	void* ptr = _aligned_malloc(bytes, Alignment);
+	m_overflow.push_back(ptr);
+	m_overflowBytes += bytes;
+	m_stats.bytesReserved += bytes;
+	m_stats.blockAllocations++;
+	return ptr;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+struct ArenaStats
+{
+	size_t bytesReserved = 0;		// total capacity currently held from the OS
+	size_t bytesUsed = 0;			// handed out since the last Reset
+	size_t peakBytesUsed = 0;		// largest bytesUsed seen over the arena's lifetime
+	size_t allocations = 0;			// Allocate calls since the last Reset
+	size_t blockAllocations = 0;	// lifetime count of blocks requested from the OS
+	size_t reuses = 0;				// loads that fit into the already reserved block
+};
+
+// Linear allocator handing out 64-byte aligned chunks from one big block.
+// Nothing is freed individually: Reset() drops every allocation but keeps the
+// block for the next load of a similar size, Release() gives it back to the OS.
+class Arena
+{
+public:
+	static const size_t Alignment = 64;
+
+	Arena() = default;
+	~Arena();
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	template<typename T>
+	T* Allocate(size_t count) { return static_cast<T*>(AllocateBytes(sizeof(T) * count)); }
+
+	// Bytes Allocate<T>(count) will consume, for sizing Reserve up front
+	template<typename T>
+	static size_t SizeOf(size_t count) { return AlignUp(sizeof(T) * count); }
+
+	void Reserve(size_t bytes);
+	void Reset();
+	void Release();
+
+	const ArenaStats& GetStats() const { return m_stats; }
+
+private:
+	void* AllocateBytes(size_t bytes);
+	static size_t AlignUp(size_t bytes) { return (bytes + Alignment - 1) & ~(Alignment - 1); }
+
+private:
+	uint8_t* m_block = nullptr;
+	size_t m_capacity = 0;
+	size_t m_offset = 0;
+	// Allocations that did not fit into m_block, freed on the next Reset
+	std::vector<void*> m_overflow;
+	size_t m_overflowBytes = 0;
+	ArenaStats m_stats;
+};
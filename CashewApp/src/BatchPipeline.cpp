@@ -0,0 +1,318 @@
+#include "utils.h"
+#include <filesystem>
+#include <fstream>
+
+static float MillisecondsSince(std::chrono::steady_clock::time_point begin)
+{
+	return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static std::string GetExtension(const std::filesystem::path& path)
+{
+	std::string extension = path.extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return (char)tolower(c); });
+	return extension;
+}
+
+BatchPipeline::BatchPipeline(const BatchOptions& options)
+	: m_options(options)
+{
+	int hardwareThreads = std::max(1, (int)std::thread::hardware_concurrency());
+	m_options.readers = m_options.readers > 0 ? m_options.readers : hardwareThreads;
+	m_options.parsers = m_options.parsers > 0 ? m_options.parsers : hardwareThreads;
+	m_options.checkers = m_options.checkers > 0 ? m_options.checkers : hardwareThreads;
+	m_options.statisticians = m_options.statisticians > 0 ? m_options.statisticians : hardwareThreads;
+	m_options.queueDepth = std::max(1, m_options.queueDepth);
+}
+
+std::vector<std::string> BatchPipeline::FindModels(const std::string& directory)
+{
+	std::vector<std::string> paths;
+	std::error_code error;
+	for (std::filesystem::recursive_directory_iterator it(directory, error), end; !error && it != end; it.increment(error))
+	{
+		std::string extension = GetExtension(it->path());
+		bool isModel = extension == ".json" || extension == ".stl" || extension == ".ply";
+		if (it->is_regular_file(error) && isModel)
+			paths.push_back(it->path().string());
+	}
+	if (error)
+		std::cerr << "Error: cannot list " << directory << ": " << error.message() << std::endl;
+
+	std::sort(paths.begin(), paths.end());
+	return paths;
+}
+
+BatchSummary BatchPipeline::Run(const std::vector<std::string>& paths, std::vector<BatchFileResult>& results) const
+{
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+	// One queue in front of every stage and one in front of the report
+	ItemQueue source(m_options.queueDepth), parseQueue(m_options.queueDepth), topologyQueue(m_options.queueDepth),
+		statisticsQueue(m_options.queueDepth), reportQueue(m_options.queueDepth);
+
+	std::vector<std::thread> threads;
+	threads.emplace_back([&]()
+		{
+			for (int i = 0; i < (int)paths.size(); i++)
+			{
+				std::unique_ptr<BatchItem> item = std::make_unique<BatchItem>();
+				item->index = i;
+				item->result.path = paths[i];
+				source.Push(std::move(item));
+			}
+			source.Close();
+		});
+	StartStage(m_options.readers, source, parseQueue, [this](BatchItem& item) { Read(item); }, threads);
+	StartStage(m_options.parsers, parseQueue, topologyQueue, [this](BatchItem& item) { Parse(item); }, threads);
+	StartStage(m_options.checkers, topologyQueue, statisticsQueue, [this](BatchItem& item) { CheckTopology(item); }, threads);
+	StartStage(m_options.statisticians, statisticsQueue, reportQueue, [this](BatchItem& item) { CalculateStatistics(item); }, threads);
+
+	// The report stage is this thread: files finish out of order, so each goes to its own row
+	BatchSummary summary;
+	results.assign(paths.size(), BatchFileResult());
+	std::unique_ptr<BatchItem> item;
+	while (reportQueue.Pop(item))
+	{
+		const BatchFileResult& result = item->result;
+		summary.files++;
+		summary.loaded += result.loaded ? 1 : 0;
+		summary.closed += result.closed ? 1 : 0;
+		summary.bytes += result.bytes;
+		summary.stageSeconds[(int)BatchStage::Read] += result.readMs / 1000.0;
+		summary.stageSeconds[(int)BatchStage::Parse] += result.parseMs / 1000.0;
+		summary.stageSeconds[(int)BatchStage::Topology] += result.topologyMs / 1000.0;
+		summary.stageSeconds[(int)BatchStage::Statistics] += result.statsMs / 1000.0;
+		results[item->index] = std::move(item->result);
+	}
+	for (std::thread& thread : threads)
+		thread.join();
+
+	summary.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	summary.filesPerSecond = summary.seconds > 0.0 ? summary.files / summary.seconds : 0.0;
+	summary.megabytesPerSecond = summary.seconds > 0.0 ? summary.bytes / (1024.0 * 1024.0) / summary.seconds : 0.0;
+	summary.queues[(int)BatchStage::Read] = parseQueue.GetStats();
+	summary.queues[(int)BatchStage::Parse] = topologyQueue.GetStats();
+	summary.queues[(int)BatchStage::Topology] = statisticsQueue.GetStats();
+	summary.queues[(int)BatchStage::Statistics] = reportQueue.GetStats();
+	return summary;
+}
+
+void BatchPipeline::StartStage(int workers, ItemQueue& input, ItemQueue& output, std::function<void(BatchItem&)> work,
+	std::vector<std::thread>& threads)
+{
+	std::shared_ptr<std::atomic<int>> running = std::make_shared<std::atomic<int>>(workers);
+	for (int w = 0; w < workers; w++)
+	{
+		threads.emplace_back([&input, &output, work, running]()
+			{
+				std::unique_ptr<BatchItem> item;
+				while (input.Pop(item))
+				{
+					work(*item);
+					output.Push(std::move(item));
+				}
+				if (--*running == 0) output.Close();
+			});
+	}
+}
+
+void BatchPipeline::Read(BatchItem& item) const
+{
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	BatchFileResult& result = item.result;
+
+	std::error_code error;
+	result.bytes = std::filesystem::file_size(result.path, error);
+	if (error) result.bytes = 0;
+
+	// Binary models are mapped by their loader, which only touches the pages it reads
+	if (GetExtension(result.path) == ".json" && result.bytes > 0)
+	{
+		std::ifstream file(result.path, std::ios::binary);
+		item.text.resize(result.bytes);
+		if (!file.read(item.text.data(), item.text.size()))
+			item.text.clear();
+	}
+	result.readMs = MillisecondsSince(begin);
+}
+
+void BatchPipeline::Parse(BatchItem& item) const
+{
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	BatchFileResult& result = item.result;
+
+	item.parser = std::make_unique<Parser>();
+	item.parser->SetLogging(false);
+	if (GetExtension(result.path) == ".json")
+		result.loaded = !item.text.empty() && item.parser->ParseJSON(item.text.data(), item.text.size(), m_options.scale, glm::vec3(1.f));
+	else
+		result.loaded = item.parser->LoadFile(result.path.c_str(), m_options.scale, glm::vec3(1.f));
+	if (!result.loaded)
+	{
+		// One write, so lines from parsers failing at the same time don't interleave
+		std::cerr << ("Error: cannot load " + result.path + ".\n");
+		item.parser.reset();
+	}
+	else
+	{
+		result.triangles = (uint32_t)item.parser->GetMesh()->triangles.size();
+		result.vertices = (uint32_t)item.parser->GetMesh()->vertices.size();
+	}
+
+	// The document has been turned into a mesh; nothing needs the text any more
+	std::vector<char>().swap(item.text);
+	result.parseMs = MillisecondsSince(begin);
+}
+
+void BatchPipeline::CheckTopology(BatchItem& item) const
+{
+	if (!item.parser) return;
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+	item.result.closed = item.parser->GetMesh()->triangles.size() > 0 && item.parser->IsClosedMesh();
+	item.parser->CalculateVertexNormals();
+
+	item.result.topologyMs = MillisecondsSince(begin);
+}
+
+void BatchPipeline::CalculateStatistics(BatchItem& item) const
+{
+	if (!item.parser) return;
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	BatchFileResult& result = item.result;
+
+	// One pass for all of them; Parser's own area functions each walk the mesh and print
+	float minArea = std::numeric_limits<float>::max(), maxArea = 0.f;
+	double totalArea = 0.0;
+	for (const Triangle& triangle : item.parser->GetMesh()->triangles)
+	{
+		float area = item.parser->CalculateArea(triangle);
+		if (!(area > 0.f))
+		{
+			result.degenerateTriangles++;
+			continue;
+		}
+		minArea = std::min(minArea, area);
+		maxArea = std::max(maxArea, area);
+		totalArea += area;
+	}
+	result.minArea = result.triangles > result.degenerateTriangles ? minArea : 0.f;
+	result.maxArea = maxArea;
+	result.totalArea = (float)totalArea;
+	// Over the triangles the sum took, like the smallest and largest area
+	uint32_t measured = result.triangles - result.degenerateTriangles;
+	result.averageArea = measured > 0 ? (float)(totalArea / measured) : 0.f;
+
+	// Only the numbers travel on to the report
+	item.parser.reset();
+	result.statsMs = MillisecondsSince(begin);
+}
+
+static std::string EscapeJSON(const std::string& text)
+{
+	std::string escaped;
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\') escaped += '\\';
+		if ((unsigned char)c < 0x20)
+		{
+			char code[8];
+			snprintf(code, sizeof(code), "\\u%04x", c);
+			escaped += code;
+			continue;
+		}
+		escaped += c;
+	}
+	return escaped;
+}
+
+bool BatchPipeline::WriteReport(const std::string& path, const std::vector<BatchFileResult>& results, const BatchSummary& summary)
+{
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp)
+	{
+		std::cerr << "Error: cannot write report " << path << "." << std::endl;
+		return false;
+	}
+
+	if (GetExtension(path) == ".json")
+	{
+		fprintf(fp, "{\n  \"summary\": { \"files\": %d, \"loaded\": %d, \"closed\": %d, \"bytes\": %llu, \"seconds\": %.3f, "
+			"\"filesPerSecond\": %.2f, \"megabytesPerSecond\": %.2f },\n  \"files\": [\n",
+			summary.files, summary.loaded, summary.closed, (unsigned long long)summary.bytes, summary.seconds,
+			summary.filesPerSecond, summary.megabytesPerSecond);
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const BatchFileResult& r = results[i];
+			fprintf(fp, "    { \"path\": \"%s\", \"bytes\": %llu, \"loaded\": %s, \"closed\": %s, \"triangles\": %u, \"vertices\": %u, "
+				"\"degenerateTriangles\": %u, \"minArea\": %g, \"maxArea\": %g, \"averageArea\": %g, \"totalArea\": %g, "
+				"\"readMs\": %.3f, \"parseMs\": %.3f, \"topologyMs\": %.3f, \"statsMs\": %.3f }%s\n",
+				EscapeJSON(r.path).c_str(), (unsigned long long)r.bytes, r.loaded ? "true" : "false", r.closed ? "true" : "false",
+				r.triangles, r.vertices, r.degenerateTriangles, r.minArea, r.maxArea, r.averageArea, r.totalArea,
+				r.readMs, r.parseMs, r.topologyMs, r.statsMs, i + 1 < results.size() ? "," : "");
+		}
+		fprintf(fp, "  ]\n}\n");
+	}
+	else
+	{
+		fprintf(fp, "path,bytes,loaded,closed,triangles,vertices,degenerate_triangles,min_area,max_area,average_area,total_area,"
+			"read_ms,parse_ms,topology_ms,stats_ms\n");
+		for (const BatchFileResult& r : results)
+		{
+			// Quoted, with quotes doubled, so commas in file names don't shift the columns
+			std::string quoted = "\"";
+			for (char c : r.path)
+				quoted += c == '"' ? std::string("\"\"") : std::string(1, c);
+			quoted += "\"";
+			fprintf(fp, "%s,%llu,%d,%d,%u,%u,%u,%g,%g,%g,%g,%.3f,%.3f,%.3f,%.3f\n", quoted.c_str(), (unsigned long long)r.bytes,
+				r.loaded ? 1 : 0, r.closed ? 1 : 0, r.triangles, r.vertices, r.degenerateTriangles, r.minArea, r.maxArea, r.averageArea,
+				r.totalArea, r.readMs, r.parseMs, r.topologyMs, r.statsMs);
+		}
+	}
+
+	bool written = ferror(fp) == 0;
+	fclose(fp);
+	if (!written) std::cerr << "Error: failed writing report " << path << "." << std::endl;
+	return written;
+}
+
+std::string BatchPipeline::FormatSummary(const BatchSummary& summary)
+{
+	char line[256];
+	snprintf(line, sizeof(line), "%d files, %.1fMB in %.2fs: %.1f files/s, %.1f MB/s; %d loaded, %d closed\n", summary.files,
+		summary.bytes / (1024.0 * 1024.0), summary.seconds, summary.filesPerSecond, summary.megabytesPerSecond, summary.loaded, summary.closed);
+	std::string text = line;
+
+	// Busy time per stage, and how long the threads on either side of each queue waited on it.
+	// Producers waiting on a full queue point at the stage after it as the one to give threads.
+	const char* stageNames[] = { "read", "parse", "topology", "statistics" };
+	const char* nextNames[] = { "parse", "topology", "statistics", "report" };
+	for (int s = 0; s < (int)BatchStage::Count; s++)
+	{
+		const BoundedQueueStats& queue = summary.queues[s];
+		snprintf(line, sizeof(line), "%-10s %8.2fs busy | to %-10s peak %zu queued, producers waited %.2fs, consumers waited %.2fs\n",
+			stageNames[s], summary.stageSeconds[s], nextNames[s], queue.peakDepth, queue.pushWaitSeconds, queue.popWaitSeconds);
+		text += line;
+	}
+	return text;
+}
+
+bool BatchPipeline::RunDirectory(const std::string& directory, const std::string& reportPath, const BatchOptions& options)
+{
+	std::vector<std::string> paths = FindModels(directory);
+	if (paths.empty())
+	{
+		std::cerr << "Error: no models in " << directory << "." << std::endl;
+		return false;
+	}
+
+	BatchPipeline pipeline(options);
+	std::vector<BatchFileResult> results;
+	BatchSummary summary = pipeline.Run(paths, results);
+
+	std::cout << FormatSummary(summary);
+	if (!WriteReport(reportPath, results, summary)) return false;
+	std::cout << "Report written to " << reportPath << std::endl;
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+#pragma once
+
+// What the batch found out about one model: one row of the report
+struct BatchFileResult
+{
+	std::string path;
+	uint64_t bytes = 0;
+	bool loaded = false;
+	bool closed = false;
+	uint32_t triangles = 0, vertices = 0;
+	uint32_t degenerateTriangles = 0;	// zero area, left out of the area statistics
+	float minArea = 0.f, maxArea = 0.f, averageArea = 0.f, totalArea = 0.f;
+	// Time each stage spent on this file, not counting waits in the queues
+	float readMs = 0.f, parseMs = 0.f, topologyMs = 0.f, statsMs = 0.f;
+};
+
+struct BatchOptions
+{
+	float scale = 1.f;
+	// Threads per stage; 0 uses one per hardware thread. Reading mostly waits on the disk,
+	// parsing and the topology checks are where the time goes.
+	int readers = 1;
+	int parsers = 0;
+	int checkers = 0;
+	int statisticians = 1;
+	// Models waiting between two stages. Bounds how many are in memory at once: a stage that
+	// gets ahead blocks until the next one catches up.
+	int queueDepth = 4;
+};
+
+enum class BatchStage
+{
+	Read,
+	Parse,
+	Topology,
+	Statistics,
+	Count
+};
+
+struct BatchSummary
+{
+	int files = 0, loaded = 0, closed = 0;
+	uint64_t bytes = 0;
+	double seconds = 0.0;
+	double filesPerSecond = 0.0, megabytesPerSecond = 0.0;
+	double stageSeconds[(int)BatchStage::Count] = {};
+	// The queue feeding each stage after the first, and the one feeding the report last
+	BoundedQueueStats queues[(int)BatchStage::Count];
+};
+
+// Validates whole directories of models for QA. Files stream through
+// read -> parse -> topology and normals -> statistics -> report, each stage on its own threads
+// with a bounded queue in between, so reading the next files overlaps parsing and checking
+// the ones before and memory stays bounded however many files there are.
+class BatchPipeline
+{
+public:
+	explicit BatchPipeline(const BatchOptions& options = BatchOptions());
+
+	// Every .json, .stl and .ply file under directory, sorted so reports from two runs line up
+	static std::vector<std::string> FindModels(const std::string& directory);
+
+	// Runs every path through the stages; results come back in the order of paths
+	BatchSummary Run(const std::vector<std::string>& paths, std::vector<BatchFileResult>& results) const;
+
+	// A .json path gets a JSON document with the summary and a file list, anything else CSV
+	static bool WriteReport(const std::string& path, const std::vector<BatchFileResult>& results, const BatchSummary& summary);
+	static std::string FormatSummary(const BatchSummary& summary);
+
+	// The command-line mode: processes the directory, writes the report and prints the summary.
+	// False if there was nothing to process or the report could not be written.
+	static bool RunDirectory(const std::string& directory, const std::string& reportPath, const BatchOptions& options);
+
+private:
+	struct BatchItem
+	{
+		int index = 0;
+		BatchFileResult result;
+		std::vector<char> text;				// JSON read ahead; the binary loaders map the file themselves
+		std::unique_ptr<Parser> parser;		// dropped once the statistics are taken
+	};
+	using ItemQueue = BoundedQueue<std::unique_ptr<BatchItem>>;
+
+	void Read(BatchItem& item) const;
+	void Parse(BatchItem& item) const;
+	void CheckTopology(BatchItem& item) const;
+	void CalculateStatistics(BatchItem& item) const;
+
+	// Starts workers threads moving items from input to output through work. The last one to
+	// run out of input closes output.
+	static void StartStage(int workers, ItemQueue& input, ItemQueue& output, std::function<void(BatchItem&)> work,
+		std::vector<std::thread>& threads);
+
+private:
+	BatchOptions m_options;
+};
\ No newline at end of file
@@ -0,0 +1,73 @@
+#pragma once
+
+struct BoundedQueueStats
+{
+	size_t pushes = 0;
+	size_t peakDepth = 0;		// most items waiting at once, never above the capacity
+	double pushWaitSeconds = 0.0;	// producers blocked on a full queue: the stage after it is the bottleneck
+	double popWaitSeconds = 0.0;	// consumers blocked on an empty queue: the stage before it is
+};
+
+// Hands items from one set of threads to another, holding at most capacity of them. Push blocks
+// while the queue is full, so a fast producer slows to the pace of its consumers instead of
+// piling up memory. Close once every producer is done; Pop then drains what is left and
+// returns false.
+template<typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t capacity) : m_capacity(std::max<size_t>(1, capacity)) {}
+
+	void Push(T item)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (m_items.size() >= m_capacity)
+		{
+			std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+			m_notFull.wait(lock, [this]() { return m_items.size() < m_capacity; });
+			m_stats.pushWaitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+		}
+		m_items.push_back(std::move(item));
+		m_stats.pushes++;
+		m_stats.peakDepth = std::max(m_stats.peakDepth, m_items.size());
+		m_notEmpty.notify_one();
+	}
+
+	bool Pop(T& item)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (m_items.empty() && !m_closed)
+		{
+			std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+			m_notEmpty.wait(lock, [this]() { return !m_items.empty() || m_closed; });
+			m_stats.popWaitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+		}
+		if (m_items.empty()) return false;
+		item = std::move(m_items.front());
+		m_items.pop_front();
+		m_notFull.notify_one();
+		return true;
+	}
+
+	void Close()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closed = true;
+		m_notEmpty.notify_all();
+	}
+
+	BoundedQueueStats GetStats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+private:
+	const size_t m_capacity;
+	std::deque<T> m_items;
+	bool m_closed = false;
+	BoundedQueueStats m_stats;
+	mutable std::mutex m_mutex;
+	std::condition_variable m_notFull;
+	std::condition_variable m_notEmpty;
+};
\ No newline at end of file
@@ -1,17 +1,76 @@
 #include "utils.h"
 
-Bvh::Bvh()
+Bvh::Bvh(Arena& arena)
+    : m_arena(arena)
 {
 
 }
 
-void Bvh::BuildBVH(std::vector<Triangle> triangles)
+// Spatial splits may duplicate references up to the budget; nodes scale with references
+static int GetReferenceCapacity(int triCount, const BvhBuildOptions& options)
 {
-    N = triangles.size();
-    m_triangles = triangles;
-    m_triIndices.resize(N);
-    m_BvhNodes = (BVHNode*)_aligned_malloc(sizeof(BVHNode) * N * 2, 64);
+    if (options.builder != BvhBuilder::SpatialSplit) return triCount;
+    return triCount + (int)(triCount * std::max(0.f, options.spatialSplitBudget));
+}
+
+// Records a compressed tree may need: one fewer than leaves, plus one per 8 references of
+// leaves too large for a child slot, which are split into halves of at least 8
+static int GetQuantizedCapacity(int refCapacity)
+{
+    return refCapacity + refCapacity / 8 + 1;
+}
+
+size_t Bvh::GetRequiredMemory(int triCount, const BvhBuildOptions& options)
+{
+    int refCapacity = GetReferenceCapacity(triCount, options);
+    size_t bytes = Arena::SizeOf<BVHNode>(refCapacity * 2) + Arena::SizeOf<int>(refCapacity) + Arena::SizeOf<float>(refCapacity * 2);
+    if (options.nodeFormat == BvhNodeFormat::Quantized16)
+        bytes += Arena::SizeOf<QuantizedBVHNode<uint16_t>>(GetQuantizedCapacity(refCapacity));
+    else if (options.nodeFormat == BvhNodeFormat::Quantized8)
+        bytes += Arena::SizeOf<QuantizedBVHNode<uint8_t>>(GetQuantizedCapacity(refCapacity));
+    return bytes;
+}
+
+void Bvh::BuildBVH(std::shared_ptr<const Mesh> mesh, const BvhBuildOptions& options)
+{
+    m_mesh = std::move(mesh);
+    m_options = options;
+    N = (int)m_mesh->triangles.size();
+    m_refCapacity = GetReferenceCapacity(N, options);
+    m_nodeFormat = BvhNodeFormat::Full;
+    m_quantizedNodes16 = nullptr;
+    m_quantizedNodes8 = nullptr;
+    // Nodes and indices live in the scene's arena, which the scene resets before every load
+    m_BvhNodes = m_arena.Allocate<BVHNode>(m_refCapacity * 2);
+    m_triIndices = m_arena.Allocate<int>(m_refCapacity);
+    m_buildAreas = m_arena.Allocate<float>(m_refCapacity * 2);
+    if (N == 0) return;
+
+    Rebuild();
 
+    SetNodeFormat(options.nodeFormat);
+}
+
+// Full build into the already allocated node and index arrays
+void Bvh::Rebuild()
+{
+    if (m_options.builder == BvhBuilder::SpatialSplit)
+        BuildSpatialSplit();
+    else if (m_options.builder == BvhBuilder::Linear)
+        BuildLinear();
+    else
+        BuildMidpoint();
+
+    ComputeLevels();
+    for (const std::vector<int>& level : m_levels)
+        for (int nodeIdx : level)
+            m_buildAreas[nodeIdx] = SurfaceArea(m_BvhNodes[nodeIdx]);
+    m_buildSAH = ComputeSAHCost();
+}
+
+void Bvh::BuildMidpoint()
+{
+    m_refCount = N;
     for (int i = 0; i < N; i++)
         m_triIndices[i] = i;
 
@@ -26,7 +85,358 @@ void Bvh::BuildBVH(std::vector<Triangle> triangles)
     Subdivide(m_rootNodeIdx);
 }
 
-void Bvh::Subdivide(int nodeIdx)
+void Bvh::ComputeLevels()
+{
+    // Group nodes by depth so refits can sweep a whole level in parallel
+    m_levels.clear();
+    m_levels.push_back({ m_rootNodeIdx });
+    while (true)
+    {
+        std::vector<int> next;
+        for (int nodeIdx : m_levels.back())
+        {
+            const BVHNode& node = m_BvhNodes[nodeIdx];
+            if (node.isLeaf()) continue;
+            next.push_back(node.leftFirst);
+            next.push_back(node.leftFirst + 1);
+        }
+        if (next.empty()) break;
+        m_levels.push_back(std::move(next));
+    }
+}
+
+float Bvh::SurfaceArea(const BVHNode& node)
+{
+    glm::vec3 e = node.aabbMax - node.aabbMin;
+    return std::max(0.f, 2.f * (e.x * e.y + e.y * e.z + e.z * e.x));
+}
+
+float Bvh::ComputeSAHCost() const
+{
+    if (N == 0) return 0.f;
+
+    float rootArea = SurfaceArea(m_BvhNodes[m_rootNodeIdx]);
+    if (rootArea <= 0.f) return 0.f;
+
+    float cost = 0.f;
+    for (const std::vector<int>& level : m_levels)
+        for (int nodeIdx : level)
+        {
+            const BVHNode& node = m_BvhNodes[nodeIdx];
+            float nodeCost = node.isLeaf() ? node.triCount * SAH_INTERSECTION_COST : SAH_TRAVERSAL_COST;
+            cost += SurfaceArea(node) * nodeCost;
+        }
+    return cost / rootArea;
+}
+
+BvhTreeStats Bvh::ComputeTreeStats() const
+{
+    BvhTreeStats stats;
+    if (N == 0) return stats;
+
+    float rootArea = SurfaceArea(m_BvhNodes[m_rootNodeIdx]);
+    stats.nodeCount = nodesUsed;
+    stats.minLeafSize = std::numeric_limits<int>::max();
+    stats.sahCost = ComputeSAHCost();
+    int leafDepthSum = 0, leafSizeSum = 0, interiorCount = 0;
+    float overlapSum = 0.f, overlapAreaSum = 0.f;
+    for (int depth = 0; depth < (int)m_levels.size(); depth++)
+        for (int nodeIdx : m_levels[depth])
+        {
+            const BVHNode& node = m_BvhNodes[nodeIdx];
+            if (node.isLeaf())
+            {
+                stats.leafCount++;
+                stats.maxDepth = std::max(stats.maxDepth, depth);
+                leafDepthSum += depth;
+                leafSizeSum += node.triCount;
+                stats.minLeafSize = std::min(stats.minLeafSize, node.triCount);
+                stats.maxLeafSize = std::max(stats.maxLeafSize, node.triCount);
+                int bucket = 0;
+                while ((1 << bucket) < node.triCount && bucket < BVH_LEAF_SIZE_BUCKETS - 1) bucket++;
+                stats.leafSizeHistogram[bucket]++;
+                continue;
+            }
+
+            const BVHNode& left = m_BvhNodes[node.leftFirst];
+            const BVHNode& right = m_BvhNodes[node.leftFirst + 1];
+            glm::vec3 e = fmaxf(fminf(left.aabbMax, right.aabbMax) - fmaxf(left.aabbMin, right.aabbMin), glm::vec3(0.f));
+            float overlapArea = 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+            float parentArea = SurfaceArea(node);
+            float overlap = parentArea > 0.f ? overlapArea / parentArea : 0.f;
+            overlapSum += overlap;
+            overlapAreaSum += overlapArea;
+            stats.maxSiblingOverlap = std::max(stats.maxSiblingOverlap, overlap);
+            interiorCount++;
+        }
+
+    stats.averageLeafDepth = (float)leafDepthSum / stats.leafCount;
+    stats.averageLeafSize = (float)leafSizeSum / stats.leafCount;
+    stats.averageSiblingOverlap = interiorCount > 0 ? overlapSum / interiorCount : 0.f;
+    stats.totalSiblingOverlap = rootArea > 0.f ? overlapAreaSum / rootArea : 0.f;
+    return stats;
+}
+
+void Bvh::Refit()
+{
+    RefitLevels(0, (int)m_levels.size() - 1);
+}
+
+void Bvh::RefitLevels(int firstLevel, int lastLevel)
+{
+    // Deepest level first; nodes on one level never depend on each other
+    for (int level = lastLevel; level >= firstLevel; level--)
+    {
+        const std::vector<int>& nodes = m_levels[level];
+        ParallelForRange((int)nodes.size(), [this, &nodes](int begin, int end)
+            {
+                for (int i = begin; i < end; i++)
+                {
+                    BVHNode& node = m_BvhNodes[nodes[i]];
+                    if (node.isLeaf())
+                    {
+                        UpdateNodeBounds(nodes[i]);
+                        continue;
+                    }
+                    const BVHNode& left = m_BvhNodes[node.leftFirst];
+                    const BVHNode& right = m_BvhNodes[node.leftFirst + 1];
+                    node.aabbMin = fminf(left.aabbMin, right.aabbMin);
+                    node.aabbMax = fmaxf(left.aabbMax, right.aabbMax);
+                }
+            }, 256);
+    }
+}
+
+BvhUpdateStats Bvh::UpdateGeometry(std::shared_ptr<const Mesh> mesh)
+{
+    BvhUpdateStats stats;
+    m_mesh = std::move(mesh);
+    if (N == 0) return stats;
+
+    Refit();
+    stats.sahRatio = m_buildSAH > 0.f ? ComputeSAHCost() / m_buildSAH : 1.f;
+
+    if (stats.sahRatio > m_fullRebuildThreshold ||
+        (stats.sahRatio > m_partialRebuildThreshold && !CanRebuildSubtrees()))
+    {
+        Rebuild();
+        stats.fullRebuild = true;
+        stats.sahRatio = 1.f;
+    }
+    else if (stats.sahRatio > m_partialRebuildThreshold && (int)m_levels.size() > m_partialRebuildDepth)
+    {
+        // Rebuild the subtrees at a fixed depth whose boxes grew the most. They own
+        // disjoint triangle ranges and node pairs, so they can be rebuilt in parallel.
+        std::vector<int> degraded;
+        for (int nodeIdx : m_levels[m_partialRebuildDepth])
+        {
+            const BVHNode& node = m_BvhNodes[nodeIdx];
+            if (!node.isLeaf() && SurfaceArea(node) > m_buildAreas[nodeIdx] * m_partialRebuildThreshold)
+                degraded.push_back(nodeIdx);
+        }
+        std::for_each(std::execution::par, degraded.begin(), degraded.end(),
+            [this](int nodeIdx) { RebuildSubtree(nodeIdx); });
+
+        // Rebuilt subtrees already have fresh bounds, only their ancestors need a refit
+        RefitLevels(0, m_partialRebuildDepth - 1);
+        ComputeLevels();
+        stats.subtreesRebuilt = (int)degraded.size();
+        stats.sahRatio = m_buildSAH > 0.f ? ComputeSAHCost() / m_buildSAH : 1.f;
+    }
+
+    RequantizeNodes();
+    return stats;
+}
+
+bool Bvh::CanRebuildSubtrees() const
+{
+    // Spatial splits duplicate references and hand out leaf ranges in whatever order the build
+    // threads finish, so a subtree's leaves are neither one range nor distinct triangles
+    if (m_options.builder == BvhBuilder::SpatialSplit) return false;
+    // Treelet restructuring puts any subset of a treelet's leaves under a new parent
+    if (m_options.builder == BvhBuilder::Linear && m_options.treeletOptimization) return false;
+    return true;
+}
+
+void Bvh::RebuildSubtree(int nodeIdx)
+{
+    // Reclaim the child pairs of the old subtree and find the triangle range it covers
+    std::vector<int> nodePairPool;
+    int first = std::numeric_limits<int>::max(), count = 0;
+    std::vector<int> stack = { nodeIdx };
+    while (!stack.empty())
+    {
+        const BVHNode& node = m_BvhNodes[stack.back()];
+        stack.pop_back();
+        if (node.isLeaf())
+        {
+            first = std::min(first, node.leftFirst);
+            count += node.triCount;
+            continue;
+        }
+        nodePairPool.push_back(node.leftFirst);
+        stack.push_back(node.leftFirst);
+        stack.push_back(node.leftFirst + 1);
+    }
+
+    BVHNode& node = m_BvhNodes[nodeIdx];
+    node.leftFirst = first;
+    node.triCount = count;
+    UpdateNodeBounds(nodeIdx);
+    // Splits stop once the old subtree's pairs run out, so the tree never grows
+    Subdivide(nodeIdx, &nodePairPool);
+
+    // The new subtree is the reference for its own future degradation
+    stack.push_back(nodeIdx);
+    while (!stack.empty())
+    {
+        int idx = stack.back();
+        stack.pop_back();
+        const BVHNode& child = m_BvhNodes[idx];
+        m_buildAreas[idx] = SurfaceArea(child);
+        if (child.isLeaf()) continue;
+        stack.push_back(child.leftFirst);
+        stack.push_back(child.leftFirst + 1);
+    }
+}
+
+void Bvh::RequantizeNodes()
+{
+    if (m_quantizedNodes16)
+        QuantizeTree(m_quantizedNodes16);
+    if (m_quantizedNodes8)
+        QuantizeTree(m_quantizedNodes8);
+}
+
+template<typename T>
+void Bvh::QuantizeTree(QuantizedBVHNode<T>* quantizedNodes)
+{
+    // The root box stays full precision
+    const BVHNode& root = m_BvhNodes[m_rootNodeIdx];
+    int nodeCount = 0;
+    m_quantizedRoot = QuantizeNodes(quantizedNodes, m_rootNodeIdx, root.aabbMin, root.aabbMax, nodeCount);
+    m_quantizedNodeCount = nodeCount;
+}
+
+void Bvh::SetNodeFormat(BvhNodeFormat format)
+{
+    m_nodeFormat = format;
+    if (N == 0) return;
+
+    // Child slots can't address references past this; such trees stay full precision
+    if (format != BvhNodeFormat::Full && m_refCapacity > QUANTIZED_MAX_REFERENCES)
+    {
+        std::cerr << "Error: " << m_refCapacity << " triangle references are too many for compressed nodes." << std::endl;
+        m_nodeFormat = BvhNodeFormat::Full;
+        return;
+    }
+
+    // Compressed trees are derived from the full one
+    if (format == BvhNodeFormat::Quantized16 && !m_quantizedNodes16)
+    {
+        m_quantizedNodes16 = m_arena.Allocate<QuantizedBVHNode<uint16_t>>(GetQuantizedCapacity(m_refCapacity));
+        QuantizeTree(m_quantizedNodes16);
+    }
+    else if (format == BvhNodeFormat::Quantized8 && !m_quantizedNodes8)
+    {
+        m_quantizedNodes8 = m_arena.Allocate<QuantizedBVHNode<uint8_t>>(GetQuantizedCapacity(m_refCapacity));
+        QuantizeTree(m_quantizedNodes8);
+    }
+}
+
+void Bvh::GetBounds(glm::vec3& bmin, glm::vec3& bmax) const
+{
+    if (N == 0)
+    {
+        bmin = bmax = glm::vec3(0);
+        return;
+    }
+    bmin = m_BvhNodes[m_rootNodeIdx].aabbMin;
+    bmax = m_BvhNodes[m_rootNodeIdx].aabbMax;
+}
+
+size_t Bvh::GetNodeMemory() const
+{
+    switch (m_nodeFormat)
+    {
+    case BvhNodeFormat::Quantized16: return m_quantizedNodeCount * sizeof(QuantizedBVHNode<uint16_t>);
+    case BvhNodeFormat::Quantized8: return m_quantizedNodeCount * sizeof(QuantizedBVHNode<uint8_t>);
+    default: return nodesUsed * sizeof(BVHNode);
+    }
+}
+
+// Quantized level q on an axis starting at origin; shared by compression and traversal so both round identically
+static inline float DecodeLevel(float origin, float step, int q)
+{
+    return origin + (float)q * step;
+}
+
+// bmin/bmax is the node's box as the traversal will decode it, which always contains the
+// exact box. Children are rounded outwards against it, so decoded boxes never lose a hit.
+template<typename T>
+int Bvh::QuantizeLeaf(QuantizedBVHNode<T>* quantizedNodes, int first, int count, int& nodeCount)
+{
+    if (count <= QUANTIZED_MAX_LEAF_SIZE)
+        return ~(first << QUANTIZED_LEAF_COUNT_BITS | count);
+
+    // Both halves span the whole box: the lowest and highest levels decode to its exact bounds
+    int recordIdx = nodeCount++;
+    QuantizedBVHNode<T>& quantizedNode = quantizedNodes[recordIdx];
+    for (int c = 0; c < 2; c++)
+        for (int a = 0; a < 3; a++)
+        {
+            quantizedNode.childMin[c][a] = 0;
+            quantizedNode.childMax[c][a] = std::numeric_limits<T>::max();
+        }
+    int leftCount = count / 2;
+    quantizedNode.child[0] = QuantizeLeaf(quantizedNodes, first, leftCount, nodeCount);
+    quantizedNode.child[1] = QuantizeLeaf(quantizedNodes, first + leftCount, count - leftCount, nodeCount);
+    return recordIdx;
+}
+
+template<typename T>
+int Bvh::QuantizeNodes(QuantizedBVHNode<T>* quantizedNodes, int nodeIdx, glm::vec3 bmin, glm::vec3 bmax, int& nodeCount) const
+{
+    const BVHNode& node = m_BvhNodes[nodeIdx];
+    if (node.isLeaf()) return QuantizeLeaf(quantizedNodes, node.leftFirst, node.triCount, nodeCount);
+    int recordIdx = nodeCount++;
+    QuantizedBVHNode<T>& quantizedNode = quantizedNodes[recordIdx];
+
+    const float maxLevel = (float)std::numeric_limits<T>::max();
+    glm::vec3 step = (bmax - bmin) * (1.f / maxLevel);
+    glm::vec3 childMin[2], childMax[2];
+    for (int c = 0; c < 2; c++)
+    {
+        const BVHNode& child = m_BvhNodes[node.leftFirst + c];
+        for (int a = 0; a < 3; a++)
+        {
+            if (step[a] <= 0.f)
+            {
+                quantizedNode.childMin[c][a] = 0;
+                quantizedNode.childMax[c][a] = 0;
+                childMin[c][a] = childMax[c][a] = bmin[a];
+                continue;
+            }
+            float lo = floorf((child.aabbMin[a] - bmin[a]) / step[a]);
+            float hi = ceilf((child.aabbMax[a] - bmin[a]) / step[a]);
+            int qmin = (int)std::clamp(lo, 0.f, maxLevel);
+            int qmax = (int)std::clamp(hi, 0.f, maxLevel);
+            // Guard against the decode rounding inwards by an ulp
+            while (qmin > 0 && DecodeLevel(bmin[a], step[a], qmin) > child.aabbMin[a]) qmin--;
+            while (qmax < (int)maxLevel && DecodeLevel(bmin[a], step[a], qmax) < child.aabbMax[a]) qmax++;
+            quantizedNode.childMin[c][a] = (T)qmin;
+            quantizedNode.childMax[c][a] = (T)qmax;
+            childMin[c][a] = DecodeLevel(bmin[a], step[a], qmin);
+            childMax[c][a] = qmax == (int)maxLevel ? bmax[a] : DecodeLevel(bmin[a], step[a], qmax);
+        }
+    }
+    // Children follow their parent, so a descent mostly reads forwards
+    for (int c = 0; c < 2; c++)
+        quantizedNode.child[c] = QuantizeNodes(quantizedNodes, node.leftFirst + c, childMin[c], childMax[c], nodeCount);
+    return recordIdx;
+}
+
+void Bvh::Subdivide(int nodeIdx, std::vector<int>* nodePairPool)
 {
     // terminate recursion
     BVHNode& node = m_BvhNodes[nodeIdx];
@@ -42,7 +452,7 @@ void Bvh::Subdivide(int nodeIdx)
     int j = i + node.triCount - 1;
     while (i <= j)
     {
-        if (m_triangles[m_triIndices[i]].centroid[axis] < splitPos)
+        if (m_mesh->triangles[m_triIndices[i]].centroid[axis] < splitPos)
             i++;
         else
             std::swap(m_triIndices[i], m_triIndices[j--]);
@@ -50,9 +460,20 @@ void Bvh::Subdivide(int nodeIdx)
     // abort split if one of the sides is empty
     int leftCount = i - node.leftFirst;
     if (leftCount == 0 || leftCount == node.triCount) return;
-    // create child nodes
-    int leftChildIdx = nodesUsed++;
-    int rightChildIdx = nodesUsed++;
+    // create child nodes, from the pool when rebuilding a subtree in place
+    int leftChildIdx;
+    if (nodePairPool)
+    {
+        if (nodePairPool->empty()) return;
+        leftChildIdx = nodePairPool->back();
+        nodePairPool->pop_back();
+    }
+    else
+    {
+        leftChildIdx = nodesUsed;
+        nodesUsed += 2;
+    }
+    int rightChildIdx = leftChildIdx + 1;
     m_BvhNodes[leftChildIdx].leftFirst = node.leftFirst;
     m_BvhNodes[leftChildIdx].triCount = leftCount;
     m_BvhNodes[rightChildIdx].leftFirst = i;
@@ -62,8 +483,8 @@ void Bvh::Subdivide(int nodeIdx)
     UpdateNodeBounds(leftChildIdx);
     UpdateNodeBounds(rightChildIdx);
     // recurse
-    Subdivide(leftChildIdx);
-    Subdivide(rightChildIdx);
+    Subdivide(leftChildIdx, nodePairPool);
+    Subdivide(rightChildIdx, nodePairPool);
 }
 
 void Bvh::UpdateNodeBounds(int nodeIdx)
@@ -74,7 +495,7 @@ void Bvh::UpdateNodeBounds(int nodeIdx)
     for (int first = node.leftFirst, i = 0; i < node.triCount; i++)
     {
         int leafTriIdx = m_triIndices[first + i];
-        Triangle& leafTri = m_triangles[leafTriIdx];
+        const Triangle& leafTri = m_mesh->triangles[leafTriIdx];
         node.aabbMin = fminf(node.aabbMin, leafTri.verticesPos[0]),
         node.aabbMin = fminf(node.aabbMin, leafTri.verticesPos[1]),
         node.aabbMin = fminf(node.aabbMin, leafTri.verticesPos[2]),
@@ -84,20 +505,139 @@ void Bvh::UpdateNodeBounds(int nodeIdx)
     }
 }
 
-void Bvh::IntersectBVH(Ray& ray, const int nodeIdx)
+template<bool AnyHit, bool Barycentrics>
+bool Bvh::Intersect(Ray& ray) const
+{
+    if (N == 0) return false;
+
+    switch (m_nodeFormat)
+    {
+    case BvhNodeFormat::Quantized16:
+    case BvhNodeFormat::Quantized8:
+    {
+        const BVHNode& root = m_BvhNodes[m_rootNodeIdx];
+        ray.nodesVisited++;
+        if (!IntersectAABB(ray, root.aabbMin, root.aabbMax)) return false;
+        if (m_nodeFormat == BvhNodeFormat::Quantized16)
+            return IntersectQuantized<AnyHit, Barycentrics>(ray, m_quantizedNodes16, m_quantizedRoot, root.aabbMin, root.aabbMax);
+        return IntersectQuantized<AnyHit, Barycentrics>(ray, m_quantizedNodes8, m_quantizedRoot, root.aabbMin, root.aabbMax);
+    }
+    default:
+        return IntersectBVH<AnyHit, Barycentrics>(ray, m_rootNodeIdx);
+    }
+}
+
+// The caller has already hit bmin/bmax, and counted the test; child boxes are decoded from this node on the fly
+template<bool AnyHit, bool Barycentrics, typename T>
+bool Bvh::IntersectQuantized(Ray& ray, const QuantizedBVHNode<T>* quantizedNodes, int child, glm::vec3 bmin, glm::vec3 bmax) const
+{
+    if (child < 0)
+    {
+        int first = ~child >> QUANTIZED_LEAF_COUNT_BITS, count = ~child & QUANTIZED_MAX_LEAF_SIZE;
+        bool hit = false;
+        for (int i = 0; i < count; i++)
+        {
+            const Triangle& triangle = m_mesh->triangles[m_triIndices[first + i]];
+            ray.trianglesTested++;
+            hit |= triangle.Intersect<Barycentrics>(ray);
+            if (AnyHit && hit) return true;
+        }
+        return hit;
+    }
+
+    const QuantizedBVHNode<T>& node = quantizedNodes[child];
+    const T maxLevel = std::numeric_limits<T>::max();
+    glm::vec3 step = (bmax - bmin) * (1.f / (float)maxLevel);
+    bool hit = false;
+    for (int c = 0; c < 2; c++)
+    {
+        glm::vec3 childMin, childMax;
+        for (int a = 0; a < 3; a++)
+        {
+            childMin[a] = DecodeLevel(bmin[a], step[a], node.childMin[c][a]);
+            childMax[a] = node.childMax[c][a] == maxLevel ? bmax[a] : DecodeLevel(bmin[a], step[a], node.childMax[c][a]);
+        }
+        ray.nodesVisited++;
+        if (IntersectAABB(ray, childMin, childMax))
+            hit |= IntersectQuantized<AnyHit, Barycentrics>(ray, quantizedNodes, node.child[c], childMin, childMax);
+        if (AnyHit && hit) return true;
+    }
+    return hit;
+}
+
+template<bool AnyHit, bool Barycentrics>
+bool Bvh::IntersectBVH(Ray& ray, const int nodeIdx) const
 {
     BVHNode& node = m_BvhNodes[nodeIdx];
-    if (!IntersectAABB(ray, node.aabbMin, node.aabbMax)) return;
+    ray.nodesVisited++;
+    if (!IntersectAABB(ray, node.aabbMin, node.aabbMax)) return false;
     if (node.isLeaf())
     {
+        bool hit = false;
         for (int i = 0; i < node.triCount; i++)
-            m_triangles[m_triIndices[node.leftFirst + i]].Intersect(ray);
+        {
+            const Triangle& triangle = m_mesh->triangles[m_triIndices[node.leftFirst + i]];
+            ray.trianglesTested++;
+            hit |= triangle.Intersect<Barycentrics>(ray);
+            if (AnyHit && hit) return true;
+        }
+        return hit;
     }
-    else
+    bool hit = IntersectBVH<AnyHit, Barycentrics>(ray, node.leftFirst);
+    if (AnyHit && hit) return true;
+    return IntersectBVH<AnyHit, Barycentrics>(ray, node.leftFirst + 1) || hit;
+}
+
+// Every kernel the scene selects between
+template bool Bvh::Intersect<false, true>(Ray& ray) const;
+template bool Bvh::Intersect<false, false>(Ray& ray) const;
+template bool Bvh::Intersect<true, false>(Ray& ray) const;
+
+void Bvh::ClosestPoint(PointQuery& query) const
+{
+    if (N == 0) return;
+    // Quantized nodes only pay off for rays; the full tree is always there
+    ClosestPointBVH(query, m_rootNodeIdx);
+}
+
+void Bvh::ClosestPointBVH(PointQuery& query, int nodeIdx) const
+{
+    const BVHNode& node = m_BvhNodes[nodeIdx];
+    if (node.isLeaf())
     {
-        IntersectBVH(ray, node.leftFirst);
-        IntersectBVH(ray, node.leftFirst + 1);
+        for (int i = 0; i < node.triCount; i++)
+        {
+            const Triangle& tri = m_mesh->triangles[m_triIndices[node.leftFirst + i]];
+            glm::vec3 closest = tri.ClosestPoint(query.P);
+            glm::vec3 d = closest - query.P;
+            float distSq = glm::dot(d, d);
+            if (distSq < query.distSq)
+            {
+                query.distSq = distSq;
+                query.closest = closest;
+                query.hitObjIdx = tri.id;
+            }
+        }
+        return;
     }
+
+    // Nearer child first, so the farther one is usually pruned
+    int near = node.leftFirst, far = node.leftFirst + 1;
+    float nearDistSq = DistanceSqToAABB(query.P, m_BvhNodes[near].aabbMin, m_BvhNodes[near].aabbMax);
+    float farDistSq = DistanceSqToAABB(query.P, m_BvhNodes[far].aabbMin, m_BvhNodes[far].aabbMax);
+    if (farDistSq < nearDistSq)
+    {
+        std::swap(near, far);
+        std::swap(nearDistSq, farDistSq);
+    }
+    if (nearDistSq < query.distSq) ClosestPointBVH(query, near);
+    if (farDistSq < query.distSq) ClosestPointBVH(query, far);
+}
+
+float Bvh::DistanceSqToAABB(const glm::vec3& p, const glm::vec3 bmin, const glm::vec3 bmax)
+{
+    glm::vec3 d = fmaxf(fmaxf(bmin - p, p - bmax), glm::vec3(0.f));
+    return glm::dot(d, d);
 }
 
 bool Bvh::IntersectAABB(const Ray& ray, const glm::vec3 bmin, const glm::vec3 bmax)
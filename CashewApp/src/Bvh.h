@@ -1,35 +1,202 @@
 #pragma once
 #define BINS 100
+#define SAH_TRAVERSAL_COST 1.0f
+#define SAH_INTERSECTION_COST 1.0f
+// Compressed trees pack a leaf's reference count into the low bits of its parent's child slot
+#define QUANTIZED_LEAF_COUNT_BITS 4
+#define QUANTIZED_MAX_LEAF_SIZE ((1 << QUANTIZED_LEAF_COUNT_BITS) - 1)
+#define QUANTIZED_MAX_REFERENCES (1 << (31 - QUANTIZED_LEAF_COUNT_BITS))
 
 // 32-bytes BVHNode, half a cache line - pure beauty
 struct BVHNode
 {
     glm::vec3 aabbMin, aabbMax;
     int leftFirst, triCount;
-    bool isLeaf() { return triCount > 0; };
+    bool isLeaf() const { return triCount > 0; };
+};
+
+// Compressed interior node: the bounds of both children, quantized relative to this node's
+// own box. Leaves get no record; their references are packed into the parent's child slot. A
+// tree of L leaves takes L - 1 records, 32 bytes each at 16 bits and 20 at 8, where the full
+// tree spends 64 on the two nodes each record replaces.
+template<typename T>
+struct QuantizedBVHNode
+{
+    T childMin[2][3], childMax[2][3];
+    // Per child: the index of its record when it is interior, otherwise ~(first reference <<
+    // QUANTIZED_LEAF_COUNT_BITS | reference count)
+    int child[2];
+};
+
+enum class BvhNodeFormat
+{
+    Full,
+    Quantized16,
+    Quantized8
+};
+
+enum class BvhBuilder
+{
+    Midpoint,       // halve the longest axis, fast to build
+    SpatialSplit,   // binned SAH that may clip triangles into both children (SBVH)
+    Linear          // Morton-ordered centroids split by their code bits (LBVH), fastest to build
+};
+
+struct BvhBuildOptions
+{
+    BvhBuilder builder = BvhBuilder::Midpoint;
+    BvhNodeFormat nodeFormat = BvhNodeFormat::Full;
+    // Extra triangle references spatial splits may create, as a fraction of the triangle count
+    float spatialSplitBudget = 0.3f;
+    // Linear builder only: restructure the larger subtrees as SAH-optimal treelets of up to 7 children
+    bool treeletOptimization = false;
 };
 
 struct Bin { AABB bounds; int priCount = 0; };
 
+#define BVH_LEAF_SIZE_BUCKETS 8
+
+// Shape of a built tree, for judging a builder on a given mesh
+struct BvhTreeStats
+{
+    int nodeCount = 0, leafCount = 0, maxDepth = 0;
+    float averageLeafDepth = 0.f;
+    int minLeafSize = 0, maxLeafSize = 0;
+    float averageLeafSize = 0.f;
+    // Leaves holding 1, 2, 3-4, 5-8, ... triangles; the last bucket takes everything bigger
+    int leafSizeHistogram[BVH_LEAF_SIZE_BUCKETS] = {};
+    float sahCost = 0.f;
+    // Surface area of the box shared by two siblings, relative to their parent's
+    float averageSiblingOverlap = 0.f, maxSiblingOverlap = 0.f;
+    // Shared areas summed over the tree relative to the root: the box tests per random ray spent where both children overlap
+    float totalSiblingOverlap = 0.f;
+};
+
+// What Bvh::UpdateGeometry had to do to keep up with a deformed mesh
+struct BvhUpdateStats
+{
+    float sahRatio = 1.f;       // SAH cost after the update relative to the last full build
+    int subtreesRebuilt = 0;
+    bool fullRebuild = false;
+};
+
 class Bvh
 {
 public:
-	Bvh();
+	Bvh(Arena& arena);
+
+    // Arena bytes BuildBVH needs for a mesh of triCount triangles
+    static size_t GetRequiredMemory(int triCount, const BvhBuildOptions& options = BvhBuildOptions());
+
+    void BuildBVH(std::shared_ptr<const Mesh> mesh, const BvhBuildOptions& options = BvhBuildOptions());
+
+    // Takes a deformed copy of the mesh (same triangles, moved vertices), refits the tree and
+    // rebuilds the worst subtrees, or everything, once SAH cost has degraded past the thresholds
+    BvhUpdateStats UpdateGeometry(std::shared_ptr<const Mesh> mesh);
+    void Refit();
+    void SetRebuildThresholds(float partial, float full) { m_partialRebuildThreshold = partial; m_fullRebuildThreshold = full; }
+    float ComputeSAHCost() const;
+    BvhTreeStats ComputeTreeStats() const;
 
-    void BuildBVH(std::vector<Triangle> tri);
+    // Switches the layout used for traversal, compressing the full-precision tree on first use
+    void SetNodeFormat(BvhNodeFormat format);
+    BvhNodeFormat GetNodeFormat() const { return m_nodeFormat; }
+    // Bytes of node data traversal touches in the current format
+    size_t GetNodeMemory() const;
 
     float EvaluateSAH(BVHNode& node, int axis, float pos);
-    void Subdivide(int nodeIdx);
+    void Subdivide(int nodeIdx, std::vector<int>* nodePairPool = nullptr);
     void UpdateNodeBounds(int nodeIdx);
 
-    void IntersectBVH(Ray& ray, const int nodeIdx);
-    bool IntersectAABB(const Ray& ray, const glm::vec3 bmin, const glm::vec3 bmax);
+    // Read-only: any number of threads may intersect the same tree while nothing rebuilds it.
+    // Kernels are picked at compile time: AnyHit stops at the first hit closer than ray.t, which
+    // is all a shadow ray needs; without Barycentrics u and v are left alone for flat shading.
+    // True if the ray hit something.
+    template<bool AnyHit = false, bool Barycentrics = true>
+    bool Intersect(Ray& ray) const;
+    template<bool AnyHit, bool Barycentrics>
+    bool IntersectBVH(Ray& ray, const int nodeIdx) const;
+    // Nearest surface point; subtrees whose box is farther away than the best so far are skipped
+    void ClosestPoint(PointQuery& query) const;
+    void ClosestPointBVH(PointQuery& query, int nodeIdx) const;
+    static float DistanceSqToAABB(const glm::vec3& p, const glm::vec3 bmin, const glm::vec3 bmax);
+    static bool IntersectAABB(const Ray& ray, const glm::vec3 bmin, const glm::vec3 bmax);
+
+    void GetBounds(glm::vec3& bmin, glm::vec3& bmax) const;
+    int GetNodeCount() const { return nodesUsed; }
+    // Triangle references in the leaves; above the triangle count when spatial splits duplicated some
+    int GetReferenceCount() const { return m_refCount; }
+    // The full-precision tree as built, for writing it out: leaves index GetReferences()
+    const BVHNode* GetNodes() const { return m_BvhNodes; }
+    const int* GetReferences() const { return m_triIndices; }
 
 private:
     int N = 0;
     int nodesUsed = 1;
+    int m_refCount = 0;
+    int m_refCapacity = 0;
+    BvhBuildOptions m_options;
     static const int m_rootNodeIdx = 0;
-    BVHNode* m_BvhNodes;
-    std::vector<Triangle> m_triangles;
-    std::vector<int> m_triIndices;
+    Arena& m_arena;
+    BVHNode* m_BvhNodes = nullptr;
+    int* m_triIndices = nullptr;
+    std::shared_ptr<const Mesh> m_mesh;
+
+    BvhNodeFormat m_nodeFormat = BvhNodeFormat::Full;
+    QuantizedBVHNode<uint16_t>* m_quantizedNodes16 = nullptr;
+    QuantizedBVHNode<uint8_t>* m_quantizedNodes8 = nullptr;
+    int m_quantizedRoot = 0;    // a record index or packed leaf, like QuantizedBVHNode::child
+    int m_quantizedNodeCount = 0;
+
+    // Build-time state refit quality is measured against
+    float* m_buildAreas = nullptr;
+    float m_buildSAH = 0.f;
+    std::vector<std::vector<int>> m_levels;
+    float m_partialRebuildThreshold = 1.2f, m_fullRebuildThreshold = 2.f;
+    static const int m_partialRebuildDepth = 6;
+
+    void Rebuild();
+    void BuildMidpoint();
+    void RebuildSubtree(int nodeIdx);
+    // RebuildSubtree re-partitions the one reference range a subtree's leaves cover, which only
+    // builders that keep every subtree's references contiguous and unduplicated guarantee
+    bool CanRebuildSubtrees() const;
+    void RefitLevels(int firstLevel, int lastLevel);
+    void ComputeLevels();
+    void RequantizeNodes();
+    static float SurfaceArea(const BVHNode& node);
+
+    // Spatial-split builder (BvhSpatialSplit.cpp)
+    struct SpatialReference { int triIdx; glm::vec3 bmin, bmax; };
+    // Shared by the subtrees that build concurrently
+    struct SpatialBuildState
+    {
+        std::atomic<int> nodesUsed{ 0 }, refCount{ 0 }, duplicateBudget{ 0 };
+        float rootArea = 0.f;
+    };
+    void BuildSpatialSplit();
+    void SubdivideSpatial(int nodeIdx, std::vector<SpatialReference>& refs, int depth, SpatialBuildState& state);
+    float FindObjectSplit(const std::vector<SpatialReference>& refs, const BVHNode& node, int& axis, float& splitPos, float& overlapArea) const;
+    float FindSpatialSplit(const std::vector<SpatialReference>& refs, const BVHNode& node, int duplicateBudget, int& axis, float& splitPos) const;
+    void SplitReference(const SpatialReference& ref, int axis, float pos, SpatialReference& left, SpatialReference& right) const;
+
+    // Linear builder (BvhLinear.cpp)
+    void BuildLinear();
+    template<typename Key>
+    void EmitLinear(int nodeIdx, const Key* codes, int first, int count, std::atomic<int>& nodesUsedShared);
+    void OptimizeTreelets();
+    void OptimizeTreelet(int nodeIdx, std::vector<float>& subtreeCosts);
+
+    // Compresses the subtree under nodeIdx depth first, appending its records; returns what
+    // refers to it, a record index or packed leaf
+    template<typename T>
+    int QuantizeNodes(QuantizedBVHNode<T>* quantizedNodes, int nodeIdx, glm::vec3 bmin, glm::vec3 bmax, int& nodeCount) const;
+    // A leaf with more references than a child slot holds becomes records whose children all
+    // share its box
+    template<typename T>
+    static int QuantizeLeaf(QuantizedBVHNode<T>* quantizedNodes, int first, int count, int& nodeCount);
+    template<typename T>
+    void QuantizeTree(QuantizedBVHNode<T>* quantizedNodes);
+    template<bool AnyHit, bool Barycentrics, typename T>
+    bool IntersectQuantized(Ray& ray, const QuantizedBVHNode<T>* quantizedNodes, int child, glm::vec3 bmin, glm::vec3 bmax) const;
 };
\ No newline at end of file
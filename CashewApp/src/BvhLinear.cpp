@@ -0,0 +1,283 @@
+#include "utils.h"
+
+// Linear BVH builder (LBVH, Lauterbach et al. 2009). Triangle centroids are quantized onto a
+// grid, ordered along the Morton curve with a parallel radix sort, and the tree falls out of
+// the sorted codes: every node splits its range where the highest differing code bit flips.
+// No split is ever evaluated, so the build is a sort plus a linear pass. Splits at Morton
+// cell boundaries ignore the actual geometry, so the tree can afterwards be restructured
+// bottom-up as small treelets with the lowest SAH cost (Karras and Aila 2013).
+
+// Beyond this many triangles 10 bits per axis leave too many centroids sharing a code
+#define LBVH_WIDE_CODES_ABOVE (1 << 20)
+#define LBVH_MAX_LEAF_SIZE 2
+// Ranges bigger than this emit their two children concurrently
+#define LBVH_PARALLEL_MIN_TRIANGLES 4096
+#define LBVH_TREELET_LEAVES 7
+// Smallest subtree worth a treelet: enough triangles to fill its 7 leaves
+#define LBVH_TREELET_MIN_TRIANGLES 8
+
+static int HighestSetBit(uint64_t v)
+{
+    int bit = 0;
+    for (int step = 32; step > 0; step >>= 1)
+    {
+        if (v >> step)
+        {
+            v >>= step;
+            bit += step;
+        }
+    }
+    return bit;
+}
+
+template<typename Key>
+static void SortByMortonCode(const std::vector<glm::vec3>& centroids, const glm::vec3& cmin, const glm::vec3& cmax, std::vector<Key>& codes, int* triIndices)
+{
+    int count = (int)centroids.size();
+    codes.resize(count);
+    ComputeMortonCodes(centroids.data(), count, cmin, cmax, codes.data());
+    std::vector<int> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    RadixSortPairs(codes, order);
+    std::copy(order.begin(), order.end(), triIndices);
+}
+
+void Bvh::BuildLinear()
+{
+    m_refCount = N;
+
+    // Centroids gathered into a packed array for the code pass, their bounds reduced over chunks
+    std::vector<glm::vec3> centroids(N);
+    std::mutex boundsMutex;
+    glm::vec3 cmin(1e30f), cmax(-1e30f);
+    ParallelForRange(N, [&](int first, int last)
+        {
+            glm::vec3 localMin(1e30f), localMax(-1e30f);
+            for (int i = first; i < last; i++)
+            {
+                centroids[i] = m_mesh->triangles[i].centroid;
+                localMin = fminf(localMin, centroids[i]);
+                localMax = fmaxf(localMax, centroids[i]);
+            }
+            std::lock_guard<std::mutex> lock(boundsMutex);
+            cmin = fminf(cmin, localMin);
+            cmax = fmaxf(cmax, localMax);
+        });
+
+    std::atomic<int> nodesUsedShared{ 1 };
+    if (N > LBVH_WIDE_CODES_ABOVE)
+    {
+        std::vector<uint64_t> codes;
+        SortByMortonCode(centroids, cmin, cmax, codes, m_triIndices);
+        EmitLinear(m_rootNodeIdx, codes.data(), 0, N, nodesUsedShared);
+    }
+    else
+    {
+        std::vector<uint32_t> codes;
+        SortByMortonCode(centroids, cmin, cmax, codes, m_triIndices);
+        EmitLinear(m_rootNodeIdx, codes.data(), 0, N, nodesUsedShared);
+    }
+    nodesUsed = nodesUsedShared;
+
+    if (m_options.treeletOptimization)
+        OptimizeTreelets();
+}
+
+// Builds the subtree over sorted references [first, first + count) into nodeIdx, bounds included.
+// Child pairs come from the shared counter, so concurrent subtrees never write to the same place.
+template<typename Key>
+void Bvh::EmitLinear(int nodeIdx, const Key* codes, int first, int count, std::atomic<int>& nodesUsedShared)
+{
+    BVHNode& node = m_BvhNodes[nodeIdx];
+    if (count <= LBVH_MAX_LEAF_SIZE)
+    {
+        node.leftFirst = first;
+        node.triCount = count;
+        UpdateNodeBounds(nodeIdx);
+        return;
+    }
+
+    // The codes in the range share every bit above the highest one that differs between its
+    // ends; the split goes where that bit turns from 0 to 1. Identical codes are halved.
+    int split = first + count / 2;
+    Key firstCode = codes[first], lastCode = codes[first + count - 1];
+    if (firstCode != lastCode)
+    {
+        Key bit = (Key)1 << HighestSetBit((uint64_t)(firstCode ^ lastCode));
+        split = (int)(std::partition_point(codes + first, codes + first + count, [bit](Key code) { return (code & bit) == 0; }) - codes);
+    }
+
+    int leftChildIdx = nodesUsedShared.fetch_add(2);
+    node.leftFirst = leftChildIdx;
+    node.triCount = 0;
+    int leftCount = split - first;
+    if (count > LBVH_PARALLEL_MIN_TRIANGLES)
+    {
+        int sides[2] = { 0, 1 };
+        std::for_each(std::execution::par, sides, sides + 2, [&](int c)
+            {
+                if (c == 0) EmitLinear(leftChildIdx, codes, first, leftCount, nodesUsedShared);
+                else EmitLinear(leftChildIdx + 1, codes, split, count - leftCount, nodesUsedShared);
+            });
+    }
+    else
+    {
+        EmitLinear(leftChildIdx, codes, first, leftCount, nodesUsedShared);
+        EmitLinear(leftChildIdx + 1, codes, split, count - leftCount, nodesUsedShared);
+    }
+
+    const BVHNode& left = m_BvhNodes[leftChildIdx];
+    const BVHNode& right = m_BvhNodes[leftChildIdx + 1];
+    node.aabbMin = fminf(left.aabbMin, right.aabbMin);
+    node.aabbMax = fmaxf(left.aabbMax, right.aabbMax);
+}
+
+void Bvh::OptimizeTreelets()
+{
+    // Unnormalized SAH cost of every subtree, bottom-up, kept current as treelets change
+    ComputeLevels();
+    std::vector<float> subtreeCosts(nodesUsed, 0.f);
+    std::vector<int> subtreeTriangles(nodesUsed, 0);
+    for (int level = (int)m_levels.size() - 1; level >= 0; level--)
+        for (int nodeIdx : m_levels[level])
+        {
+            const BVHNode& node = m_BvhNodes[nodeIdx];
+            if (node.isLeaf())
+            {
+                subtreeCosts[nodeIdx] = SurfaceArea(node) * node.triCount * SAH_INTERSECTION_COST;
+                subtreeTriangles[nodeIdx] = node.triCount;
+                continue;
+            }
+            subtreeCosts[nodeIdx] = SurfaceArea(node) * SAH_TRAVERSAL_COST + subtreeCosts[node.leftFirst] + subtreeCosts[node.leftFirst + 1];
+            subtreeTriangles[nodeIdx] = subtreeTriangles[node.leftFirst] + subtreeTriangles[node.leftFirst + 1];
+        }
+
+    // Deepest level first, so every treelet is built from already optimized subtrees. Treelets
+    // rooted on one level are disjoint; restructuring only moves nodes below the level in hand.
+    for (int level = (int)m_levels.size() - 1; level >= 0; level--)
+    {
+        const std::vector<int>& nodes = m_levels[level];
+        ParallelForRange((int)nodes.size(), [&](int begin, int end)
+            {
+                for (int i = begin; i < end; i++)
+                {
+                    const BVHNode& node = m_BvhNodes[nodes[i]];
+                    if (node.isLeaf() || subtreeTriangles[nodes[i]] < LBVH_TREELET_MIN_TRIANGLES) continue;
+                    // Treelets below may have lowered the children's costs since the first pass
+                    subtreeCosts[nodes[i]] = SurfaceArea(node) * SAH_TRAVERSAL_COST + subtreeCosts[node.leftFirst] + subtreeCosts[node.leftFirst + 1];
+                    OptimizeTreelet(nodes[i], subtreeCosts);
+                }
+            }, 16);
+    }
+}
+
+// Grows a treelet under nodeIdx by repeatedly opening its largest subtree, then finds the
+// binary tree over those subtrees with the lowest SAH cost by dynamic programming over subsets
+// and rebuilds the treelet that way when it beats the current one
+void Bvh::OptimizeTreelet(int nodeIdx, std::vector<float>& subtreeCosts)
+{
+    const BVHNode& root = m_BvhNodes[nodeIdx];
+    int leaves[LBVH_TREELET_LEAVES], interiors[LBVH_TREELET_LEAVES];
+    int leafCount = 2, interiorCount = 1;
+    leaves[0] = root.leftFirst;
+    leaves[1] = root.leftFirst + 1;
+    interiors[0] = nodeIdx;
+    while (leafCount < LBVH_TREELET_LEAVES)
+    {
+        int largest = -1;
+        float largestArea = -1.f;
+        for (int i = 0; i < leafCount; i++)
+        {
+            const BVHNode& node = m_BvhNodes[leaves[i]];
+            if (!node.isLeaf() && SurfaceArea(node) > largestArea)
+            {
+                largest = i;
+                largestArea = SurfaceArea(node);
+            }
+        }
+        if (largest == -1) break;
+        int opened = leaves[largest];
+        interiors[interiorCount++] = opened;
+        leaves[largest] = m_BvhNodes[opened].leftFirst;
+        leaves[leafCount++] = m_BvhNodes[opened].leftFirst + 1;
+    }
+    if (leafCount < 3) return;
+
+    // Bounds, area and best cost of every subset of the treelet's subtrees
+    const int subsetCount = 1 << leafCount;
+    glm::vec3 subsetMin[1 << LBVH_TREELET_LEAVES], subsetMax[1 << LBVH_TREELET_LEAVES];
+    float bestCost[1 << LBVH_TREELET_LEAVES];
+    int bestPartition[1 << LBVH_TREELET_LEAVES];
+    for (int mask = 1; mask < subsetCount; mask++)
+    {
+        int lowest = 0;
+        while (!(mask & (1 << lowest))) lowest++;
+        const BVHNode& leaf = m_BvhNodes[leaves[lowest]];
+        int rest = mask & (mask - 1);
+        if (rest == 0)
+        {
+            subsetMin[mask] = leaf.aabbMin;
+            subsetMax[mask] = leaf.aabbMax;
+            bestCost[mask] = subtreeCosts[leaves[lowest]];
+            bestPartition[mask] = 0;
+            continue;
+        }
+        subsetMin[mask] = fminf(subsetMin[rest], leaf.aabbMin);
+        subsetMax[mask] = fmaxf(subsetMax[rest], leaf.aabbMax);
+
+        // Submasks are smaller than mask, so their costs are final; each split is tried once
+        float best = 1e30f;
+        int bestPart = 0;
+        for (int part = (mask - 1) & mask; part > 0; part = (part - 1) & mask)
+        {
+            if (part < (mask ^ part)) continue;
+            float cost = bestCost[part] + bestCost[mask ^ part];
+            if (cost < best)
+            {
+                best = cost;
+                bestPart = part;
+            }
+        }
+        glm::vec3 e = subsetMax[mask] - subsetMin[mask];
+        bestCost[mask] = std::max(0.f, 2.f * (e.x * e.y + e.y * e.z + e.z * e.x)) * SAH_TRAVERSAL_COST + best;
+        bestPartition[mask] = bestPart;
+    }
+    const int fullMask = subsetCount - 1;
+    if (bestCost[fullMask] >= subtreeCosts[nodeIdx] * 0.999f) return;
+
+    // The treelet's leaves move to new slots, so take them out first; the interior
+    // nodes' child pairs are reused, the root keeps its own
+    BVHNode leafNodes[LBVH_TREELET_LEAVES];
+    float leafCosts[LBVH_TREELET_LEAVES];
+    for (int i = 0; i < leafCount; i++)
+    {
+        leafNodes[i] = m_BvhNodes[leaves[i]];
+        leafCosts[i] = subtreeCosts[leaves[i]];
+    }
+    int pairPool[LBVH_TREELET_LEAVES];
+    int pairCount = 0;
+    for (int i = 0; i < interiorCount; i++)
+        pairPool[pairCount++] = m_BvhNodes[interiors[i]].leftFirst;
+
+    std::function<void(int, int)> place = [&](int idx, int mask)
+    {
+        if ((mask & (mask - 1)) == 0)
+        {
+            int leaf = 0;
+            while (!(mask & (1 << leaf))) leaf++;
+            m_BvhNodes[idx] = leafNodes[leaf];
+            subtreeCosts[idx] = leafCosts[leaf];
+            return;
+        }
+        int pair = pairPool[--pairCount];
+        BVHNode& node = m_BvhNodes[idx];
+        node.leftFirst = pair;
+        node.triCount = 0;
+        node.aabbMin = subsetMin[mask];
+        node.aabbMax = subsetMax[mask];
+        subtreeCosts[idx] = bestCost[mask];
+        place(pair, bestPartition[mask]);
+        place(pair + 1, mask ^ bestPartition[mask]);
+    };
+    place(nodeIdx, fullMask);
+}
@@ -0,0 +1,412 @@
+#include "utils.h"
+
+// Spatial-split BVH builder (SBVH, Stich et al. 2009), binned. Every node tries a binned SAH
+// object split; where its two halves would overlap, it also tries cutting the triangles at a
+// plane and referencing the clipped pieces from both children. Long thin triangles that make
+// object splits overlap badly end up in tight, disjoint boxes at the cost of a few duplicates.
+
+#define SPATIAL_MAX_LEAF_SIZE 4
+#define SPATIAL_MAX_DEPTH 64
+// Only try spatial splits where the object split's children overlap by this fraction of the root area
+#define SPATIAL_SPLIT_ALPHA 1e-5f
+// Small nodes have triangles spanning every bin, so clipping costs most there and gains least
+#define SPATIAL_MIN_REFS 16
+// Spatial bins clip every straddling triangle once per plane, so use fewer of them than object bins
+#define SPATIAL_BINS 32
+// Nodes with more references than this build their two children concurrently
+#define SPATIAL_PARALLEL_MIN_REFS 4096
+
+static float BoxArea(const glm::vec3& bmin, const glm::vec3& bmax)
+{
+    glm::vec3 e = bmax - bmin;
+    return std::max(0.f, 2.f * (e.x * e.y + e.y * e.z + e.z * e.x));
+}
+
+static bool IsEmpty(const glm::vec3& bmin, const glm::vec3& bmax)
+{
+    return bmin.x > bmax.x || bmin.y > bmax.y || bmin.z > bmax.z;
+}
+
+// Bounds of where the plane at pos along axis cuts a triangle whose vertices are sorted
+// along that axis. pos must lie within the triangle's extent.
+static void CrossSection(const glm::vec3 v[3], int axis, float pos, glm::vec3& outMin, glm::vec3& outMax)
+{
+    auto crossing = [&](const glm::vec3& p0, const glm::vec3& p1)
+    {
+        float d = p1[axis] - p0[axis];
+        glm::vec3 p = d > 0.f ? p0 + (p1 - p0) * ((pos - p0[axis]) / d) : p0;
+        p[axis] = pos;
+        return p;
+    };
+    glm::vec3 longEdge = crossing(v[0], v[2]);
+    glm::vec3 shortEdge = pos < v[1][axis] ? crossing(v[0], v[1]) : crossing(v[1], v[2]);
+    outMin = fminf(longEdge, shortEdge);
+    outMax = fmaxf(longEdge, shortEdge);
+}
+
+struct SpatialBin
+{
+    glm::vec3 bmin = glm::vec3(1e30f), bmax = glm::vec3(-1e30f);
+    int count = 0, entries = 0, exits = 0;
+};
+
+void Bvh::BuildSpatialSplit()
+{
+    std::vector<SpatialReference> refs(N);
+    BVHNode& root = m_BvhNodes[m_rootNodeIdx];
+    root.aabbMin = glm::vec3(1e30f);
+    root.aabbMax = glm::vec3(-1e30f);
+    for (int i = 0; i < N; i++)
+    {
+        const Triangle& tri = m_mesh->triangles[i];
+        SpatialReference& ref = refs[i];
+        ref.triIdx = i;
+        ref.bmin = fminf(fminf(tri.verticesPos[0], tri.verticesPos[1]), tri.verticesPos[2]);
+        ref.bmax = fmaxf(fmaxf(tri.verticesPos[0], tri.verticesPos[1]), tri.verticesPos[2]);
+        root.aabbMin = fminf(root.aabbMin, ref.bmin);
+        root.aabbMax = fmaxf(root.aabbMax, ref.bmax);
+    }
+
+    SpatialBuildState state;
+    state.nodesUsed = 1;
+    state.duplicateBudget = m_refCapacity - N;
+    state.rootArea = SurfaceArea(root);
+    SubdivideSpatial(m_rootNodeIdx, refs, 0, state);
+    nodesUsed = state.nodesUsed;
+    m_refCount = state.refCount;
+}
+
+// node's bounds are already set; refs are consumed. Leaves and child pairs take their slots
+// from the shared counters, so concurrent subtrees never write to the same place.
+void Bvh::SubdivideSpatial(int nodeIdx, std::vector<SpatialReference>& refs, int depth, SpatialBuildState& state)
+{
+    BVHNode& node = m_BvhNodes[nodeIdx];
+    int count = (int)refs.size();
+    auto makeLeaf = [&]()
+    {
+        int first = state.refCount.fetch_add(count);
+        node.leftFirst = first;
+        node.triCount = count;
+        for (int i = 0; i < count; i++)
+            m_triIndices[first + i] = refs[i].triIdx;
+    };
+    if (count <= 2 || depth >= SPATIAL_MAX_DEPTH)
+    {
+        makeLeaf();
+        return;
+    }
+
+    int objectAxis = -1, spatialAxis = -1;
+    float objectPos = 0.f, spatialPos = 0.f, overlapArea = 0.f;
+    float objectCost = FindObjectSplit(refs, node, objectAxis, objectPos, overlapArea);
+    float spatialCost = 1e30f;
+    int duplicateBudget = state.duplicateBudget.load();
+    if (duplicateBudget > 0 && count >= SPATIAL_MIN_REFS && overlapArea > SPATIAL_SPLIT_ALPHA * state.rootArea)
+        spatialCost = FindSpatialSplit(refs, node, duplicateBudget, spatialAxis, spatialPos);
+
+    float leafCost = count * SAH_INTERSECTION_COST;
+    if (std::min(objectCost, spatialCost) >= leafCost && count <= SPATIAL_MAX_LEAF_SIZE)
+    {
+        makeLeaf();
+        return;
+    }
+
+    std::vector<SpatialReference> left, right;
+    if (spatialCost < objectCost)
+    {
+        for (const SpatialReference& ref : refs)
+        {
+            if (ref.bmax[spatialAxis] <= spatialPos)
+                left.push_back(ref);
+            else if (ref.bmin[spatialAxis] >= spatialPos)
+                right.push_back(ref);
+            else
+            {
+                SpatialReference leftPart, rightPart;
+                SplitReference(ref, spatialAxis, spatialPos, leftPart, rightPart);
+                if (!IsEmpty(leftPart.bmin, leftPart.bmax)) left.push_back(leftPart);
+                if (!IsEmpty(rightPart.bmin, rightPart.bmax)) right.push_back(rightPart);
+            }
+        }
+        // Binning only estimates the straddlers and other subtrees spend the budget too;
+        // claim the duplicates up front and fall back to the object split if they don't fit
+        int duplicates = std::max(0, (int)(left.size() + right.size()) - count);
+        bool claimed = !left.empty() && !right.empty();
+        if (claimed && duplicates > 0)
+        {
+            if (state.duplicateBudget.fetch_sub(duplicates) < duplicates)
+            {
+                state.duplicateBudget.fetch_add(duplicates);
+                claimed = false;
+            }
+        }
+        if (!claimed)
+        {
+            left.clear();
+            right.clear();
+        }
+    }
+    if (left.empty() && right.empty() && objectAxis != -1)
+    {
+        for (const SpatialReference& ref : refs)
+        {
+            if ((ref.bmin[objectAxis] + ref.bmax[objectAxis]) * 0.5f < objectPos)
+                left.push_back(ref);
+            else
+                right.push_back(ref);
+        }
+    }
+    if (left.empty() || right.empty())
+    {
+        // No usable split plane (e.g. coincident centroids): halve the list so recursion still terminates
+        if (count <= SPATIAL_MAX_LEAF_SIZE)
+        {
+            makeLeaf();
+            return;
+        }
+        left.assign(refs.begin(), refs.begin() + count / 2);
+        right.assign(refs.begin() + count / 2, refs.end());
+    }
+
+    // Release the parent's list before going deeper
+    std::vector<SpatialReference>().swap(refs);
+
+    int leftChildIdx = state.nodesUsed.fetch_add(2);
+    node.leftFirst = leftChildIdx;
+    node.triCount = 0;
+    std::vector<SpatialReference>* children[2] = { &left, &right };
+    for (int c = 0; c < 2; c++)
+    {
+        BVHNode& child = m_BvhNodes[leftChildIdx + c];
+        child.aabbMin = glm::vec3(1e30f);
+        child.aabbMax = glm::vec3(-1e30f);
+        for (const SpatialReference& ref : *children[c])
+        {
+            child.aabbMin = fminf(child.aabbMin, ref.bmin);
+            child.aabbMax = fmaxf(child.aabbMax, ref.bmax);
+        }
+    }
+    if ((int)(left.size() + right.size()) > SPATIAL_PARALLEL_MIN_REFS)
+    {
+        int sides[2] = { 0, 1 };
+        std::for_each(std::execution::par, sides, sides + 2, [&](int c)
+        {
+            SubdivideSpatial(leftChildIdx + c, *children[c], depth + 1, state);
+        });
+    }
+    else
+    {
+        SubdivideSpatial(leftChildIdx, left, depth + 1, state);
+        SubdivideSpatial(leftChildIdx + 1, right, depth + 1, state);
+    }
+}
+
+// Binned SAH over reference centroids. Returns the normalized cost, the split plane
+// and the area where the two resulting children would overlap.
+float Bvh::FindObjectSplit(const std::vector<SpatialReference>& refs, const BVHNode& node, int& axis, float& splitPos, float& overlapArea) const
+{
+    glm::vec3 centroidMin(1e30f), centroidMax(-1e30f);
+    for (const SpatialReference& ref : refs)
+    {
+        glm::vec3 centroid = (ref.bmin + ref.bmax) * 0.5f;
+        centroidMin = fminf(centroidMin, centroid);
+        centroidMax = fmaxf(centroidMax, centroid);
+    }
+
+    float bestCost = 1e30f;
+    for (int a = 0; a < 3; a++)
+    {
+        float extent = centroidMax[a] - centroidMin[a];
+        if (extent <= 0.f) continue;
+
+        SpatialBin bins[BINS];
+        float scale = BINS / extent;
+        for (const SpatialReference& ref : refs)
+        {
+            float centroid = (ref.bmin[a] + ref.bmax[a]) * 0.5f;
+            int b = std::min(BINS - 1, (int)((centroid - centroidMin[a]) * scale));
+            bins[b].count++;
+            bins[b].bmin = fminf(bins[b].bmin, ref.bmin);
+            bins[b].bmax = fmaxf(bins[b].bmax, ref.bmax);
+        }
+
+        // Sweep from the right to get every right-hand side, then evaluate planes from the left
+        glm::vec3 rightMin[BINS], rightMax[BINS];
+        int rightCount[BINS];
+        glm::vec3 accMin(1e30f), accMax(-1e30f);
+        int accCount = 0;
+        for (int b = BINS - 1; b > 0; b--)
+        {
+            accMin = fminf(accMin, bins[b].bmin);
+            accMax = fmaxf(accMax, bins[b].bmax);
+            accCount += bins[b].count;
+            rightMin[b] = accMin;
+            rightMax[b] = accMax;
+            rightCount[b] = accCount;
+        }
+        accMin = glm::vec3(1e30f);
+        accMax = glm::vec3(-1e30f);
+        accCount = 0;
+        for (int b = 1; b < BINS; b++)
+        {
+            accMin = fminf(accMin, bins[b - 1].bmin);
+            accMax = fmaxf(accMax, bins[b - 1].bmax);
+            accCount += bins[b - 1].count;
+            if (accCount == 0 || rightCount[b] == 0) continue;
+            float cost = BoxArea(accMin, accMax) * accCount + BoxArea(rightMin[b], rightMax[b]) * rightCount[b];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                axis = a;
+                splitPos = centroidMin[a] + extent * b / BINS;
+                glm::vec3 overlapMin = fmaxf(accMin, rightMin[b]), overlapMax = fminf(accMax, rightMax[b]);
+                overlapArea = IsEmpty(overlapMin, overlapMax) ? 0.f : BoxArea(overlapMin, overlapMax);
+            }
+        }
+    }
+    if (bestCost >= 1e30f) return 1e30f;
+
+    float nodeArea = SurfaceArea(node);
+    return SAH_TRAVERSAL_COST + SAH_INTERSECTION_COST * bestCost / std::max(nodeArea, 1e-20f);
+}
+
+// Binned spatial split: every reference is chopped at the bin planes it crosses, so bin bounds
+// hold only the clipped pieces. Entry/exit counts give the reference count on either side.
+float Bvh::FindSpatialSplit(const std::vector<SpatialReference>& refs, const BVHNode& node, int duplicateBudget, int& axis, float& splitPos) const
+{
+    int count = (int)refs.size();
+    float bestCost = 1e30f;
+    for (int a = 0; a < 3; a++)
+    {
+        float origin = node.aabbMin[a];
+        float binWidth = (node.aabbMax[a] - origin) / SPATIAL_BINS;
+        if (binWidth <= 0.f) continue;
+
+        SpatialBin bins[SPATIAL_BINS];
+        for (const SpatialReference& ref : refs)
+        {
+            int firstBin = std::clamp((int)((ref.bmin[a] - origin) / binWidth), 0, SPATIAL_BINS - 1);
+            int lastBin = std::clamp((int)((ref.bmax[a] - origin) / binWidth), firstBin, SPATIAL_BINS - 1);
+            bins[firstBin].entries++;
+            bins[lastBin].exits++;
+
+            if (firstBin == lastBin)
+            {
+                bins[firstBin].bmin = fminf(bins[firstBin].bmin, ref.bmin);
+                bins[firstBin].bmax = fmaxf(bins[firstBin].bmax, ref.bmax);
+                continue;
+            }
+
+            // Walk the triangle's slices bin by bin; each plane's crossing points bound both
+            // the slice before and the slice after it
+            const Triangle& tri = m_mesh->triangles[ref.triIdx];
+            glm::vec3 v[3] = { tri.verticesPos[0], tri.verticesPos[1], tri.verticesPos[2] };
+            if (v[1][a] < v[0][a]) std::swap(v[0], v[1]);
+            if (v[2][a] < v[1][a]) std::swap(v[1], v[2]);
+            if (v[1][a] < v[0][a]) std::swap(v[0], v[1]);
+
+            glm::vec3 planeMin, planeMax;
+            float lo = std::max(ref.bmin[a], v[0][a]);
+            CrossSection(v, a, lo, planeMin, planeMax);
+            for (int b = firstBin; b <= lastBin; b++)
+            {
+                float hi = b == lastBin ? std::min(ref.bmax[a], v[2][a]) : origin + binWidth * (b + 1);
+                glm::vec3 sliceMin = planeMin, sliceMax = planeMax;
+                CrossSection(v, a, hi, planeMin, planeMax);
+                sliceMin = fminf(sliceMin, planeMin);
+                sliceMax = fmaxf(sliceMax, planeMax);
+                for (int i = 0; i < 3; i++)
+                {
+                    if (v[i][a] > lo && v[i][a] < hi)
+                    {
+                        sliceMin = fminf(sliceMin, v[i]);
+                        sliceMax = fmaxf(sliceMax, v[i]);
+                    }
+                }
+                bins[b].bmin = fminf(bins[b].bmin, fmaxf(sliceMin, ref.bmin));
+                bins[b].bmax = fmaxf(bins[b].bmax, fminf(sliceMax, ref.bmax));
+                lo = hi;
+            }
+        }
+
+        glm::vec3 rightMin[SPATIAL_BINS], rightMax[SPATIAL_BINS];
+        int rightCount[SPATIAL_BINS];
+        glm::vec3 accMin(1e30f), accMax(-1e30f);
+        int accCount = 0;
+        for (int b = SPATIAL_BINS - 1; b > 0; b--)
+        {
+            accMin = fminf(accMin, bins[b].bmin);
+            accMax = fmaxf(accMax, bins[b].bmax);
+            accCount += bins[b].exits;
+            rightMin[b] = accMin;
+            rightMax[b] = accMax;
+            rightCount[b] = accCount;
+        }
+        accMin = glm::vec3(1e30f);
+        accMax = glm::vec3(-1e30f);
+        accCount = 0;
+        for (int b = 1; b < SPATIAL_BINS; b++)
+        {
+            accMin = fminf(accMin, bins[b - 1].bmin);
+            accMax = fmaxf(accMax, bins[b - 1].bmax);
+            accCount += bins[b - 1].entries;
+            if (accCount == 0 || rightCount[b] == 0) continue;
+            if (accCount + rightCount[b] - count > duplicateBudget) continue;
+            if (IsEmpty(accMin, accMax) || IsEmpty(rightMin[b], rightMax[b])) continue;
+            float cost = BoxArea(accMin, accMax) * accCount + BoxArea(rightMin[b], rightMax[b]) * rightCount[b];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                axis = a;
+                splitPos = origin + binWidth * b;
+            }
+        }
+    }
+    if (bestCost >= 1e30f) return 1e30f;
+
+    float nodeArea = SurfaceArea(node);
+    return SAH_TRAVERSAL_COST + SAH_INTERSECTION_COST * bestCost / std::max(nodeArea, 1e-20f);
+}
+
+// Clips the triangle behind ref against the plane and returns the bounds of both pieces,
+// each limited to ref's own box (which may already be clipped). A side can come back empty.
+void Bvh::SplitReference(const SpatialReference& ref, int axis, float pos, SpatialReference& left, SpatialReference& right) const
+{
+    left.triIdx = right.triIdx = ref.triIdx;
+    left.bmin = right.bmin = glm::vec3(1e30f);
+    left.bmax = right.bmax = glm::vec3(-1e30f);
+
+    const Triangle& tri = m_mesh->triangles[ref.triIdx];
+    for (int e = 0; e < 3; e++)
+    {
+        const glm::vec3& v0 = tri.verticesPos[e];
+        const glm::vec3& v1 = tri.verticesPos[(e + 1) % 3];
+        float p0 = v0[axis], p1 = v1[axis];
+        if (p0 <= pos)
+        {
+            left.bmin = fminf(left.bmin, v0);
+            left.bmax = fmaxf(left.bmax, v0);
+        }
+        if (p0 >= pos)
+        {
+            right.bmin = fminf(right.bmin, v0);
+            right.bmax = fmaxf(right.bmax, v0);
+        }
+        if ((p0 < pos && p1 > pos) || (p0 > pos && p1 < pos))
+        {
+            glm::vec3 crossing = v0 + (v1 - v0) * ((pos - p0) / (p1 - p0));
+            crossing[axis] = pos;
+            left.bmin = fminf(left.bmin, crossing);
+            left.bmax = fmaxf(left.bmax, crossing);
+            right.bmin = fminf(right.bmin, crossing);
+            right.bmax = fmaxf(right.bmax, crossing);
+        }
+    }
+
+    left.bmax[axis] = std::min(left.bmax[axis], pos);
+    right.bmin[axis] = std::max(right.bmin[axis], pos);
+    left.bmin = fmaxf(left.bmin, ref.bmin);
+    left.bmax = fminf(left.bmax, ref.bmax);
+    right.bmin = fmaxf(right.bmin, ref.bmin);
+    right.bmax = fminf(right.bmax, ref.bmax);
+}
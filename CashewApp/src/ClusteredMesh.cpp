@@ -0,0 +1,718 @@
+#include "utils.h"
+#include <cstdio>
+#include <random>
+
+#define CLUSTER_FILE_MAGIC 0x53554c43u	// "CLUS"
+#define CLUSTER_FILE_VERSION 1
+// Centroids are counting-sorted into a 32^3 grid whose cells follow the Morton curve
+#define CLUSTER_GRID_BITS 5
+#define CLUSTER_GRID_CELLS (1 << (3 * CLUSTER_GRID_BITS))
+// Triangles buffered per grid cell while scattering into the sorted file
+#define CLUSTER_SCATTER_BUFFER 8
+// Sections start on cache lines, which also keeps the mapped nodes aligned
+#define CLUSTER_FILE_ALIGNMENT 64
+// The top tree is traversed with a fixed stack, so Open rejects any deeper than it holds
+#define CLUSTER_TOP_STACK_SIZE 64
+// Cluster trees are traversed recursively; a midpoint build of one cluster stays far shallower
+#define CLUSTER_MAX_TREE_DEPTH 256
+
+struct ClusteredMesh::FileHeader
+{
+	uint32_t magic, version;
+	// Triangles are stored as raw structs; a build with another layout can't read them
+	uint32_t triangleSize;
+	uint32_t clusterCount, topNodeCount;
+	uint64_t triangleCount;
+	uint64_t topNodesOffset, recordsOffset;
+	float boundsMin[3], boundsMax[3];
+};
+
+struct ClusteredMesh::ClusterRecord
+{
+	uint64_t offset;
+	uint32_t nodeCount, triangleCount;
+	float boundsMin[3], boundsMax[3];
+};
+
+// Whether nodes[0] roots a proper tree: every child pair lies after its parent and inside the
+// array and is reached once, no leaf is deeper than maxDepth and every leaf range ends by
+// leafLimit. Anything read from a file is checked before it is traversed.
+static bool IsTreeValid(const BVHNode* nodes, uint32_t nodeCount, uint64_t leafLimit, int maxDepth)
+{
+	if (nodeCount == 0) return false;
+	std::vector<bool> reached(nodeCount, false);
+	std::vector<std::pair<int, int>> stack = { { 0, 0 } };	// node and its depth
+	reached[0] = true;
+	while (!stack.empty())
+	{
+		int nodeIdx = stack.back().first, depth = stack.back().second;
+		stack.pop_back();
+		const BVHNode& node = nodes[nodeIdx];
+		if (node.triCount < 0 || depth > maxDepth) return false;
+		if (node.isLeaf())
+		{
+			if (node.leftFirst < 0 || (uint64_t)node.leftFirst + node.triCount > leafLimit) return false;
+			continue;
+		}
+		int left = node.leftFirst;
+		if (left <= nodeIdx || (uint64_t)left + 1 >= nodeCount || reached[left] || reached[left + 1]) return false;
+		reached[left] = reached[left + 1] = true;
+		stack.push_back({ left, depth + 1 });
+		stack.push_back({ left + 1, depth + 1 });
+	}
+	return true;
+}
+
+static bool SeekTo(FILE* file, uint64_t offset)
+{
+#ifdef WL_PLATFORM_WINDOWS
+	return _fseeki64(file, (long long)offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+static bool WritePadding(FILE* file, uint64_t& offset)
+{
+	static const uint8_t zeros[CLUSTER_FILE_ALIGNMENT] = {};
+	size_t padding = (size_t)((CLUSTER_FILE_ALIGNMENT - offset % CLUSTER_FILE_ALIGNMENT) % CLUSTER_FILE_ALIGNMENT);
+	offset += padding;
+	return padding == 0 || fwrite(zeros, 1, padding, file) == padding;
+}
+
+static uint32_t SpreadBits(uint32_t v)
+{
+	uint32_t result = 0;
+	for (int bit = 0; bit < CLUSTER_GRID_BITS; bit++)
+		result |= ((v >> bit) & 1u) << (bit * 3);
+	return result;
+}
+
+static int GetGridCell(const glm::vec3& centroid, const glm::vec3& bmin, const glm::vec3& scale)
+{
+	const int maxCoord = (1 << CLUSTER_GRID_BITS) - 1;
+	uint32_t cell = 0;
+	for (int a = 0; a < 3; a++)
+	{
+		int coord = std::clamp((int)((centroid[a] - bmin[a]) * scale[a]), 0, maxCoord);
+		cell |= SpreadBits((uint32_t)coord) << a;
+	}
+	return (int)cell;
+}
+
+struct ClusterBounds
+{
+	glm::vec3 bmin, bmax;
+};
+
+static int GetLongestAxis(const glm::vec3& extent)
+{
+	int axis = extent.y > extent.x ? 1 : 0;
+	return extent.z > extent[axis] ? 2 : axis;
+}
+
+// Splits triangles into parts of at most maxTriangles by median cuts along the longest axis,
+// so every part is a compact piece of the surface
+static void SplitIntoClusters(std::vector<Triangle>& triangles, size_t first, size_t count, int maxTriangles, std::vector<std::pair<size_t, size_t>>& parts)
+{
+	if (count <= (size_t)maxTriangles)
+	{
+		parts.emplace_back(first, count);
+		return;
+	}
+	glm::vec3 cmin(1e30f), cmax(-1e30f);
+	for (size_t i = first; i < first + count; i++)
+	{
+		cmin = fminf(cmin, triangles[i].centroid);
+		cmax = fmaxf(cmax, triangles[i].centroid);
+	}
+	int axis = GetLongestAxis(cmax - cmin);
+
+	// Parts come out equally full: the left side gets a whole number of clusters' worth
+	size_t partCount = (count + maxTriangles - 1) / maxTriangles;
+	size_t leftCount = count * (partCount / 2) / partCount;
+	std::nth_element(triangles.begin() + first, triangles.begin() + first + leftCount, triangles.begin() + first + count,
+		[axis](const Triangle& a, const Triangle& b) { return a.centroid[axis] < b.centroid[axis]; });
+	SplitIntoClusters(triangles, first, leftCount, maxTriangles, parts);
+	SplitIntoClusters(triangles, first + leftCount, count - leftCount, maxTriangles, parts);
+}
+
+// Median split over cluster bounds down to one cluster per leaf; nodeIdx is already allocated
+static void BuildTopTree(std::vector<BVHNode>& nodes, int nodeIdx, const std::vector<ClusterBounds>& bounds, std::vector<int>& order, int first, int count)
+{
+	glm::vec3 cmin(1e30f), cmax(-1e30f);
+	nodes[nodeIdx].aabbMin = glm::vec3(1e30f);
+	nodes[nodeIdx].aabbMax = glm::vec3(-1e30f);
+	for (int i = first; i < first + count; i++)
+	{
+		const ClusterBounds& box = bounds[order[i]];
+		nodes[nodeIdx].aabbMin = fminf(nodes[nodeIdx].aabbMin, box.bmin);
+		nodes[nodeIdx].aabbMax = fmaxf(nodes[nodeIdx].aabbMax, box.bmax);
+		cmin = fminf(cmin, (box.bmin + box.bmax) * 0.5f);
+		cmax = fmaxf(cmax, (box.bmin + box.bmax) * 0.5f);
+	}
+	if (count == 1)
+	{
+		nodes[nodeIdx].leftFirst = order[first];
+		nodes[nodeIdx].triCount = 1;
+		return;
+	}
+
+	int axis = GetLongestAxis(cmax - cmin);
+	int leftCount = count / 2;
+	std::nth_element(order.begin() + first, order.begin() + first + leftCount, order.begin() + first + count, [&bounds, axis](int a, int b)
+		{
+			return bounds[a].bmin[axis] + bounds[a].bmax[axis] < bounds[b].bmin[axis] + bounds[b].bmax[axis];
+		});
+
+	// Siblings sit next to each other, as in the other trees
+	int leftIdx = (int)nodes.size();
+	nodes.resize(nodes.size() + 2);
+	nodes[nodeIdx].leftFirst = leftIdx;
+	nodes[nodeIdx].triCount = 0;
+	BuildTopTree(nodes, leftIdx, bounds, order, first, leftCount);
+	BuildTopTree(nodes, leftIdx + 1, bounds, order, first + leftCount, count - leftCount);
+}
+
+bool ClusteredMesh::Build(const Mesh& mesh, const std::string& path, const ClusterBuildOptions& options)
+{
+	size_t next = 0;
+	return Build([&mesh, &next](Triangle& triangle)
+		{
+			if (next == mesh.triangles.size()) return false;
+			triangle = mesh.triangles[next++];
+			return true;
+		}, path, options);
+}
+
+bool ClusteredMesh::Build(const std::function<bool(Triangle&)>& nextTriangle, const std::string& path, const ClusterBuildOptions& options)
+{
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	std::string spillPath = path + ".spill", sortedPath = path + ".sorted";
+	// Temporaries go whichever way the build ends
+	auto fail = [&](FILE* a, FILE* b, const char* what)
+	{
+		if (a) fclose(a);
+		if (b) fclose(b);
+		std::remove(spillPath.c_str());
+		std::remove(sortedPath.c_str());
+		std::cout << "Cluster build failed: " << what << std::endl;
+		return false;
+	};
+
+	// Pass 1: spill the incoming triangles to disk and find the centroid bounds
+	FILE* spill = fopen(spillPath.c_str(), "wb");
+	if (!spill) return fail(nullptr, nullptr, "cannot write the spill file");
+	uint64_t triangleCount = 0;
+	glm::vec3 cmin(1e30f), cmax(-1e30f);
+	Triangle triangle;
+	while (nextTriangle(triangle))
+	{
+		if (fwrite(&triangle, sizeof(Triangle), 1, spill) != 1) return fail(spill, nullptr, "spill write");
+		cmin = fminf(cmin, triangle.centroid);
+		cmax = fmaxf(cmax, triangle.centroid);
+		triangleCount++;
+	}
+	fclose(spill);
+	if (triangleCount == 0) return fail(nullptr, nullptr, "no triangles");
+
+	// Pass 2: count triangles per grid cell
+	glm::vec3 scale;
+	for (int a = 0; a < 3; a++)
+		scale[a] = cmax[a] > cmin[a] ? (1 << CLUSTER_GRID_BITS) / (cmax[a] - cmin[a]) : 0.f;
+	std::vector<uint64_t> cellStarts(CLUSTER_GRID_CELLS + 1, 0);
+	spill = fopen(spillPath.c_str(), "rb");
+	if (!spill) return fail(nullptr, nullptr, "cannot read the spill file");
+	for (uint64_t i = 0; i < triangleCount; i++)
+	{
+		if (fread(&triangle, sizeof(Triangle), 1, spill) != 1) return fail(spill, nullptr, "spill read");
+		cellStarts[GetGridCell(triangle.centroid, cmin, scale) + 1]++;
+	}
+	std::partial_sum(cellStarts.begin(), cellStarts.end(), cellStarts.begin());
+
+	// Pass 3: scatter into a file ordered by cell, through small per-cell buffers
+	FILE* sorted = fopen(sortedPath.c_str(), "w+b");
+	if (!sorted) return fail(spill, nullptr, "cannot write the sorted file");
+	std::vector<uint64_t> cellCursors(cellStarts.begin(), cellStarts.end() - 1);
+	std::vector<std::vector<Triangle>> cellBuffers(CLUSTER_GRID_CELLS);
+	auto flushCell = [&](int cell)
+	{
+		std::vector<Triangle>& buffer = cellBuffers[cell];
+		if (buffer.empty()) return true;
+		bool written = SeekTo(sorted, cellCursors[cell] * sizeof(Triangle)) && fwrite(buffer.data(), sizeof(Triangle), buffer.size(), sorted) == buffer.size();
+		cellCursors[cell] += buffer.size();
+		buffer.clear();
+		return written;
+	};
+	SeekTo(spill, 0);
+	for (uint64_t i = 0; i < triangleCount; i++)
+	{
+		if (fread(&triangle, sizeof(Triangle), 1, spill) != 1) return fail(spill, sorted, "spill read");
+		int cell = GetGridCell(triangle.centroid, cmin, scale);
+		cellBuffers[cell].push_back(triangle);
+		if (cellBuffers[cell].size() == CLUSTER_SCATTER_BUFFER && !flushCell(cell)) return fail(spill, sorted, "sorted write");
+	}
+	for (int cell = 0; cell < CLUSTER_GRID_CELLS; cell++)
+		if (!flushCell(cell)) return fail(spill, sorted, "sorted write");
+	cellBuffers = std::vector<std::vector<Triangle>>();
+	fclose(spill);
+	std::remove(spillPath.c_str());
+	spill = nullptr;
+
+	// Pass 4: walk the cells along the curve, group them into clusters and write each with its tree
+	FILE* out = fopen(path.c_str(), "wb");
+	if (!out) return fail(nullptr, sorted, "cannot write the cluster file");
+	FileHeader header = {};
+	uint64_t offset = sizeof(FileHeader);
+	if (fwrite(&header, sizeof(header), 1, out) != 1 || !WritePadding(out, offset)) return fail(out, sorted, "write");
+
+	std::vector<ClusterRecord> records;
+	std::vector<ClusterBounds> clusterBounds;
+	std::vector<Triangle> pending;
+	std::vector<std::pair<size_t, size_t>> parts;
+	Arena arena;
+	BvhBuildOptions buildOptions = options.buildOptions;
+	buildOptions.nodeFormat = BvhNodeFormat::Full;
+	int clusterTriangles = std::max(1, options.clusterTriangles);
+	auto writeClusters = [&]()
+	{
+		parts.clear();
+		SplitIntoClusters(pending, 0, pending.size(), clusterTriangles, parts);
+		for (const std::pair<size_t, size_t>& part : parts)
+		{
+			std::shared_ptr<Mesh> clusterMesh = std::make_shared<Mesh>();
+			clusterMesh->triangles.assign(pending.begin() + part.first, pending.begin() + part.first + part.second);
+			arena.Reset();
+			Bvh bvh(arena);
+			bvh.BuildBVH(clusterMesh, buildOptions);
+
+			// Triangles go out in leaf order, so the leaves index them without an indirection
+			ClusterRecord record = {};
+			record.offset = offset;
+			record.nodeCount = (uint32_t)bvh.GetNodeCount();
+			record.triangleCount = (uint32_t)bvh.GetReferenceCount();
+			std::vector<Triangle> leafOrder(record.triangleCount);
+			for (uint32_t i = 0; i < record.triangleCount; i++)
+				leafOrder[i] = clusterMesh->triangles[bvh.GetReferences()[i]];
+			if (fwrite(bvh.GetNodes(), sizeof(BVHNode), record.nodeCount, out) != record.nodeCount) return false;
+			if (fwrite(leafOrder.data(), sizeof(Triangle), leafOrder.size(), out) != leafOrder.size()) return false;
+			offset += record.nodeCount * sizeof(BVHNode) + leafOrder.size() * sizeof(Triangle);
+			if (!WritePadding(out, offset)) return false;
+
+			ClusterBounds& box = clusterBounds.emplace_back();
+			box.bmin = bvh.GetNodes()[0].aabbMin;
+			box.bmax = bvh.GetNodes()[0].aabbMax;
+			for (int a = 0; a < 3; a++)
+			{
+				record.boundsMin[a] = box.bmin[a];
+				record.boundsMax[a] = box.bmax[a];
+			}
+			records.push_back(record);
+		}
+		pending.clear();
+		return true;
+	};
+	SeekTo(sorted, 0);
+	for (int cell = 0; cell < CLUSTER_GRID_CELLS; cell++)
+	{
+		size_t cellCount = (size_t)(cellStarts[cell + 1] - cellStarts[cell]);
+		if (cellCount == 0) continue;
+		// Cells are packed whole while they fit; a cell bigger than a cluster is split on its own
+		if (!pending.empty() && pending.size() + cellCount > (size_t)clusterTriangles && !writeClusters()) return fail(out, sorted, "cluster write");
+		size_t previous = pending.size();
+		pending.resize(previous + cellCount);
+		if (fread(pending.data() + previous, sizeof(Triangle), cellCount, sorted) != cellCount) return fail(out, sorted, "sorted read");
+		if (pending.size() >= (size_t)clusterTriangles && !writeClusters()) return fail(out, sorted, "cluster write");
+	}
+	if (!pending.empty() && !writeClusters()) return fail(out, sorted, "cluster write");
+	fclose(sorted);
+	std::remove(sortedPath.c_str());
+
+	// Top tree and cluster table last, once every cluster's place and bounds are known
+	std::vector<BVHNode> topNodes(1);
+	std::vector<int> order(records.size());
+	std::iota(order.begin(), order.end(), 0);
+	BuildTopTree(topNodes, 0, clusterBounds, order, 0, (int)records.size());
+
+	header.magic = CLUSTER_FILE_MAGIC;
+	header.version = CLUSTER_FILE_VERSION;
+	header.triangleSize = sizeof(Triangle);
+	header.clusterCount = (uint32_t)records.size();
+	header.topNodeCount = (uint32_t)topNodes.size();
+	header.triangleCount = triangleCount;
+	header.topNodesOffset = offset;
+	for (int a = 0; a < 3; a++)
+	{
+		header.boundsMin[a] = topNodes[0].aabbMin[a];
+		header.boundsMax[a] = topNodes[0].aabbMax[a];
+	}
+	bool written = fwrite(topNodes.data(), sizeof(BVHNode), topNodes.size(), out) == topNodes.size();
+	offset += topNodes.size() * sizeof(BVHNode);
+	written = written && WritePadding(out, offset);
+	header.recordsOffset = offset;
+	written = written && fwrite(records.data(), sizeof(ClusterRecord), records.size(), out) == records.size();
+	written = written && SeekTo(out, 0) && fwrite(&header, sizeof(header), 1, out) == 1;
+	written = fclose(out) == 0 && written;
+	if (!written)
+	{
+		std::remove(path.c_str());
+		return fail(nullptr, nullptr, "write");
+	}
+
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	std::cout << "Wrote " << triangleCount << " triangles as " << records.size() << " clusters to " << path << " ("
+		<< (offset + records.size() * sizeof(ClusterRecord)) / (1024.0 * 1024.0) << "MB) in "
+		<< std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count() / 1000.0 << "s" << std::endl;
+	return true;
+}
+
+bool ClusteredMesh::Open(const std::string& path, size_t cacheBudget)
+{
+	m_header = nullptr;
+	if (!m_file.Open(path) || m_file.GetSize() < sizeof(FileHeader)) return false;
+
+	// Everything the mapping is trusted with is checked against the file size first: the
+	// sections, the top tree and where each cluster lies. A cluster's own tree is checked when
+	// it is read.
+	const FileHeader* header = reinterpret_cast<const FileHeader*>(m_file.GetData());
+	uint64_t size = m_file.GetSize();
+	auto fits = [size](uint64_t offset, uint64_t bytes) { return offset <= size && bytes <= size - offset; };
+	bool valid = header->magic == CLUSTER_FILE_MAGIC && header->version == CLUSTER_FILE_VERSION && header->triangleSize == sizeof(Triangle)
+		&& header->clusterCount > 0 && header->topNodeCount > 0
+		&& fits(header->topNodesOffset, (uint64_t)header->topNodeCount * sizeof(BVHNode))
+		&& fits(header->recordsOffset, (uint64_t)header->clusterCount * sizeof(ClusterRecord));
+	const BVHNode* topNodes = valid ? reinterpret_cast<const BVHNode*>(m_file.GetData() + header->topNodesOffset) : nullptr;
+	const ClusterRecord* records = valid ? reinterpret_cast<const ClusterRecord*>(m_file.GetData() + header->recordsOffset) : nullptr;
+	valid = valid && IsTreeValid(topNodes, header->topNodeCount, header->clusterCount, CLUSTER_TOP_STACK_SIZE - 1);
+	for (uint32_t i = 0; valid && i < header->clusterCount; i++)
+		valid = records[i].nodeCount > 0
+			&& fits(records[i].offset, (uint64_t)records[i].nodeCount * sizeof(BVHNode) + (uint64_t)records[i].triangleCount * sizeof(Triangle));
+	if (!valid)
+	{
+		std::cerr << "Error: " << path << " is not a valid cluster file." << std::endl;
+		m_file.Close();
+		return false;
+	}
+	m_header = header;
+	m_topNodes = topNodes;
+	m_records = records;
+
+	std::lock_guard<std::mutex> lock(m_cache.mutex);
+	m_cache.resident.assign(header->clusterCount, nullptr);
+	m_cache.lruPositions.assign(header->clusterCount, m_cache.lru.end());
+	m_cache.lru.clear();
+	m_cache.stats = ClusterCacheStats();
+	m_cache.stats.budgetBytes = cacheBudget;
+	return true;
+}
+
+void ClusteredMesh::SetCacheBudget(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(m_cache.mutex);
+	m_cache.stats.budgetBytes = bytes;
+	EvictOverBudget();
+}
+
+void ClusteredMesh::EvictOverBudget() const
+{
+	// The most recent cluster always stays, even when it alone exceeds the budget. Evicted
+	// clusters a query still holds are freed when it lets go.
+	while (m_cache.stats.residentBytes > m_cache.stats.budgetBytes && m_cache.lru.size() > 1)
+	{
+		int clusterIdx = m_cache.lru.back();
+		m_cache.lru.pop_back();
+		m_cache.lruPositions[clusterIdx] = m_cache.lru.end();
+		m_cache.stats.residentBytes -= m_cache.resident[clusterIdx]->bytes;
+		m_cache.stats.residentClusters--;
+		m_cache.stats.evictions++;
+		m_cache.resident[clusterIdx].reset();
+	}
+}
+
+std::shared_ptr<const ClusteredMesh::LoadedCluster> ClusteredMesh::ReadCluster(int clusterIdx) const
+{
+	const ClusterRecord& record = m_records[clusterIdx];
+	std::shared_ptr<LoadedCluster> cluster = std::make_shared<LoadedCluster>();
+	cluster->nodes.resize(record.nodeCount);
+	cluster->triangles.resize(record.triangleCount);
+	uint64_t nodeBytes = (uint64_t)record.nodeCount * sizeof(BVHNode);
+	// Plain reads rather than the mapping, so the cache alone decides what stays in memory
+	if (!m_file.ReadAt(record.offset, cluster->nodes.data(), nodeBytes)
+		|| !m_file.ReadAt(record.offset + nodeBytes, cluster->triangles.data(), (size_t)record.triangleCount * sizeof(Triangle)))
+		return nullptr;
+	// A corrupt tree is skipped like a failed read; queries carry on without the cluster
+	if (!IsTreeValid(cluster->nodes.data(), record.nodeCount, record.triangleCount, CLUSTER_MAX_TREE_DEPTH))
+		return nullptr;
+	cluster->bytes = nodeBytes + (size_t)record.triangleCount * sizeof(Triangle);
+	return cluster;
+}
+
+std::shared_ptr<const ClusteredMesh::LoadedCluster> ClusteredMesh::AcquireCluster(int clusterIdx) const
+{
+	{
+		std::lock_guard<std::mutex> lock(m_cache.mutex);
+		if (m_cache.resident[clusterIdx])
+		{
+			m_cache.stats.hits++;
+			m_cache.lru.splice(m_cache.lru.begin(), m_cache.lru, m_cache.lruPositions[clusterIdx]);
+			return m_cache.resident[clusterIdx];
+		}
+		m_cache.stats.misses++;
+	}
+
+	// Read outside the lock so other threads keep hitting resident clusters meanwhile
+	std::shared_ptr<const LoadedCluster> cluster = ReadCluster(clusterIdx);
+	if (!cluster) return nullptr;
+
+	std::lock_guard<std::mutex> lock(m_cache.mutex);
+	// Another thread may have read the same cluster first; keep one copy
+	if (m_cache.resident[clusterIdx]) return m_cache.resident[clusterIdx];
+	m_cache.resident[clusterIdx] = cluster;
+	m_cache.lru.push_front(clusterIdx);
+	m_cache.lruPositions[clusterIdx] = m_cache.lru.begin();
+	m_cache.stats.bytesRead += cluster->bytes;
+	m_cache.stats.residentBytes += cluster->bytes;
+	m_cache.stats.residentClusters++;
+	m_cache.stats.peakResidentBytes = std::max(m_cache.stats.peakResidentBytes, m_cache.stats.residentBytes);
+	EvictOverBudget();
+	return cluster;
+}
+
+// Entry distance into the box, or 1e30f on a miss
+static float IntersectAABBDistance(const Ray& ray, const glm::vec3& bmin, const glm::vec3& bmax)
+{
+	float tx1 = (bmin.x - ray.O.x) / ray.D.x, tx2 = (bmax.x - ray.O.x) / ray.D.x;
+	float tmin = std::min(tx1, tx2), tmax = std::max(tx1, tx2);
+	float ty1 = (bmin.y - ray.O.y) / ray.D.y, ty2 = (bmax.y - ray.O.y) / ray.D.y;
+	tmin = std::max(tmin, std::min(ty1, ty2)), tmax = std::min(tmax, std::max(ty1, ty2));
+	float tz1 = (bmin.z - ray.O.z) / ray.D.z, tz2 = (bmax.z - ray.O.z) / ray.D.z;
+	tmin = std::max(tmin, std::min(tz1, tz2)), tmax = std::min(tmax, std::max(tz1, tz2));
+	return tmax >= tmin && tmin < ray.t && tmax > 0 ? tmin : 1e30f;
+}
+
+void ClusteredMesh::Intersect(Ray& ray) const
+{
+	if (!m_header) return;
+	float tBefore = ray.t;
+
+	// Nearest cluster first: farther ones are mostly culled by the hit before they are ever read
+	int stack[CLUSTER_TOP_STACK_SIZE];
+	int stackSize = 0;
+	ray.nodesVisited++;
+	if (IntersectAABBDistance(ray, m_topNodes[0].aabbMin, m_topNodes[0].aabbMax) < ray.t) stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const BVHNode& node = m_topNodes[stack[--stackSize]];
+		// The box was hit when pushed, but the ray may have got shorter since
+		if (IntersectAABBDistance(ray, node.aabbMin, node.aabbMax) >= ray.t) continue;
+		if (node.isLeaf())
+		{
+			std::shared_ptr<const LoadedCluster> cluster = AcquireCluster(node.leftFirst);
+			const Triangle* hitTriangle = cluster ? IntersectCluster(*cluster, ray, 0) : nullptr;
+			// Copied while the cluster is held: it may be evicted before the hit is shaded
+			if (hitTriangle)
+			{
+				ray.faceNormal = hitTriangle->normal;
+				ray.colour = hitTriangle->colour;
+			}
+			continue;
+		}
+
+		int near = node.leftFirst, far = node.leftFirst + 1;
+		ray.nodesVisited += 2;
+		float nearDistance = IntersectAABBDistance(ray, m_topNodes[near].aabbMin, m_topNodes[near].aabbMax);
+		float farDistance = IntersectAABBDistance(ray, m_topNodes[far].aabbMin, m_topNodes[far].aabbMax);
+		if (farDistance < nearDistance)
+		{
+			std::swap(near, far);
+			std::swap(nearDistance, farDistance);
+		}
+		if (farDistance < ray.t) stack[stackSize++] = far;
+		if (nearDistance < ray.t) stack[stackSize++] = near;
+	}
+
+	if (ray.t < tBefore) ray.hitInstIdx = -1;
+}
+
+const Triangle* ClusteredMesh::IntersectCluster(const LoadedCluster& cluster, Ray& ray, int nodeIdx)
+{
+	const BVHNode& node = cluster.nodes[nodeIdx];
+	ray.nodesVisited++;
+	if (!Bvh::IntersectAABB(ray, node.aabbMin, node.aabbMax)) return nullptr;
+	if (node.isLeaf())
+	{
+		ray.trianglesTested += node.triCount;
+		const Triangle* hitTriangle = nullptr;
+		for (int i = 0; i < node.triCount; i++)
+		{
+			const Triangle& triangle = cluster.triangles[node.leftFirst + i];
+			if (triangle.Intersect(ray)) hitTriangle = &triangle;
+		}
+		return hitTriangle;
+	}
+	// The second child can only replace a hit from the first with a nearer one
+	const Triangle* nearHit = IntersectCluster(cluster, ray, node.leftFirst);
+	const Triangle* farHit = IntersectCluster(cluster, ray, node.leftFirst + 1);
+	return farHit ? farHit : nearHit;
+}
+
+void ClusteredMesh::ClosestPoint(PointQuery& query) const
+{
+	if (!m_header) return;
+	float distSqBefore = query.distSq;
+
+	int stack[CLUSTER_TOP_STACK_SIZE];
+	int stackSize = 0;
+	if (Bvh::DistanceSqToAABB(query.P, m_topNodes[0].aabbMin, m_topNodes[0].aabbMax) < query.distSq) stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const BVHNode& node = m_topNodes[stack[--stackSize]];
+		if (Bvh::DistanceSqToAABB(query.P, node.aabbMin, node.aabbMax) >= query.distSq) continue;
+		if (node.isLeaf())
+		{
+			std::shared_ptr<const LoadedCluster> cluster = AcquireCluster(node.leftFirst);
+			if (cluster) ClosestPointCluster(*cluster, query, 0);
+			continue;
+		}
+
+		int near = node.leftFirst, far = node.leftFirst + 1;
+		float nearDistSq = Bvh::DistanceSqToAABB(query.P, m_topNodes[near].aabbMin, m_topNodes[near].aabbMax);
+		float farDistSq = Bvh::DistanceSqToAABB(query.P, m_topNodes[far].aabbMin, m_topNodes[far].aabbMax);
+		if (farDistSq < nearDistSq)
+		{
+			std::swap(near, far);
+			std::swap(nearDistSq, farDistSq);
+		}
+		if (farDistSq < query.distSq) stack[stackSize++] = far;
+		if (nearDistSq < query.distSq) stack[stackSize++] = near;
+	}
+
+	if (query.distSq < distSqBefore) query.hitInstIdx = -1;
+}
+
+void ClusteredMesh::ClosestPointCluster(const LoadedCluster& cluster, PointQuery& query, int nodeIdx)
+{
+	const BVHNode& node = cluster.nodes[nodeIdx];
+	if (node.isLeaf())
+	{
+		for (int i = 0; i < node.triCount; i++)
+		{
+			const Triangle& tri = cluster.triangles[node.leftFirst + i];
+			glm::vec3 closest = tri.ClosestPoint(query.P);
+			glm::vec3 d = closest - query.P;
+			float distSq = glm::dot(d, d);
+			if (distSq < query.distSq)
+			{
+				query.distSq = distSq;
+				query.closest = closest;
+				query.hitObjIdx = tri.id;
+			}
+		}
+		return;
+	}
+
+	int near = node.leftFirst, far = node.leftFirst + 1;
+	float nearDistSq = Bvh::DistanceSqToAABB(query.P, cluster.nodes[near].aabbMin, cluster.nodes[near].aabbMax);
+	float farDistSq = Bvh::DistanceSqToAABB(query.P, cluster.nodes[far].aabbMin, cluster.nodes[far].aabbMax);
+	if (farDistSq < nearDistSq)
+	{
+		std::swap(near, far);
+		std::swap(nearDistSq, farDistSq);
+	}
+	if (nearDistSq < query.distSq) ClosestPointCluster(cluster, query, near);
+	if (farDistSq < query.distSq) ClosestPointCluster(cluster, query, far);
+}
+
+void ClusteredMesh::GetBounds(glm::vec3& bmin, glm::vec3& bmax) const
+{
+	if (!m_header)
+	{
+		bmin = glm::vec3(1e30f);
+		bmax = glm::vec3(-1e30f);
+		return;
+	}
+	bmin = m_topNodes[0].aabbMin;
+	bmax = m_topNodes[0].aabbMax;
+}
+
+uint64_t ClusteredMesh::GetTriangleCount() const
+{
+	return m_header ? m_header->triangleCount : 0;
+}
+
+int ClusteredMesh::GetClusterCount() const
+{
+	return m_header ? (int)m_header->clusterCount : 0;
+}
+
+ClusterCacheStats ClusteredMesh::GetCacheStats() const
+{
+	std::lock_guard<std::mutex> lock(m_cache.mutex);
+	return m_cache.stats;
+}
+
+bool ClusteredMesh::RunBenchmark(const std::string& path, size_t cacheBudget, int rayCount)
+{
+	ClusteredMesh probe;
+	if (!probe.Open(path, cacheBudget))
+	{
+		std::cerr << "Error: could not open " << path << "." << std::endl;
+		return false;
+	}
+
+	glm::vec3 bmin, bmax;
+	probe.GetBounds(bmin, bmax);
+	glm::vec3 centre = (bmin + bmax) * 0.5f;
+	float radius = glm::length(bmax - bmin) * 0.5f;
+
+	// Rays from a sphere around the model towards points inside it, fixed up front
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<float> unit(-1.f, 1.f);
+	std::vector<Ray> rays;
+	rays.reserve(rayCount);
+	for (int i = 0; i < rayCount; i++)
+	{
+		glm::vec3 origin = centre + glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) + glm::vec3(1e-3f)) * radius * 1.5f;
+		glm::vec3 target = centre + glm::vec3(unit(rng), unit(rng), unit(rng)) * (bmax - bmin) * 0.25f;
+		rays.emplace_back(origin, glm::normalize(target - origin));
+	}
+
+	size_t fileBytes = (size_t)probe.m_file.GetSize();
+	std::string result = std::to_string(probe.GetTriangleCount()) + " triangles in " + std::to_string(probe.GetClusterCount()) + " clusters, "
+		+ std::to_string(fileBytes / (1024 * 1024)) + "MB on disk\n";
+	size_t budgets[3] = { cacheBudget / 4, cacheBudget, fileBytes };
+	for (size_t budget : budgets)
+	{
+		ClusteredMesh mesh;
+		mesh.Open(path, budget);
+		size_t memoryBefore = GetCurrentMemoryUsage();
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+		std::atomic<int> hits{ 0 };
+		ParallelForRange(rayCount, [&](int first, int last)
+			{
+				int localHits = 0;
+				for (int i = first; i < last; i++)
+				{
+					Ray ray = rays[i];
+					mesh.Intersect(ray);
+					localHits += ray.hitObjIdx != -1;
+				}
+				hits += localHits;
+			}, 256);
+
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		double seconds = std::chrono::duration<double>(end - begin).count();
+		ClusterCacheStats stats = mesh.GetCacheStats();
+		size_t memoryAfter = GetCurrentMemoryUsage();
+		char line[256];
+		snprintf(line, sizeof(line), "Budget %zuMB: %.0f rays/s, %d hits, %.1f%% cache hits, %llu evictions, %.1fMB read, peak resident %.1fMB, process +%.1fMB\n",
+			budget / (1024 * 1024), seconds > 0 ? rayCount / seconds : 0.0, hits.load(),
+			100.0 * stats.hits / std::max<uint64_t>(1, stats.hits + stats.misses), (unsigned long long)stats.evictions,
+			stats.bytesRead / (1024.0 * 1024.0), stats.peakResidentBytes / (1024.0 * 1024.0),
+			memoryAfter > memoryBefore ? (memoryAfter - memoryBefore) / (1024.0 * 1024.0) : 0.0);
+		result += line;
+	}
+	std::cout << result;
+	return true;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+struct ClusterBuildOptions
+{
+	// Triangles per cluster, the unit the cache pages in and out
+	int clusterTriangles = 32768;
+	// Builder for the per-cluster trees; they are always stored at full precision
+	BvhBuildOptions buildOptions;
+};
+
+struct ClusterCacheStats
+{
+	uint64_t hits = 0, misses = 0, evictions = 0;
+	uint64_t bytesRead = 0;
+	size_t budgetBytes = 0;
+	size_t residentBytes = 0, peakResidentBytes = 0;
+	int residentClusters = 0;
+};
+
+// A mesh kept on disk as spatially coherent clusters, each with its own BVH, under a top-level
+// tree over the cluster bounds. The top tree is read straight from a memory-mapped file; clusters
+// are read in on first touch and kept in an LRU cache of a fixed byte budget, so memory stays
+// bounded however large the mesh is. Queries may run on any number of threads.
+class ClusteredMesh
+{
+public:
+	// Streams triangles from nextTriangle (false once there are no more) into a cluster file at
+	// path. Only one cluster, one grid cell and the per-cluster summaries are ever held in memory;
+	// the rest goes through temporary files next to path.
+	static bool Build(const std::function<bool(Triangle&)>& nextTriangle, const std::string& path, const ClusterBuildOptions& options = ClusterBuildOptions());
+	// Same, from a mesh that is already loaded
+	static bool Build(const Mesh& mesh, const std::string& path, const ClusterBuildOptions& options = ClusterBuildOptions());
+
+	bool Open(const std::string& path, size_t cacheBudget);
+	// Evicts least recently used clusters until the new budget is met
+	void SetCacheBudget(size_t bytes);
+
+	// Hits leave hitInstIdx at -1; hitObjIdx is the triangle's index in the source mesh
+	void Intersect(Ray& ray) const;
+	void ClosestPoint(PointQuery& query) const;
+
+	void GetBounds(glm::vec3& bmin, glm::vec3& bmax) const;
+	uint64_t GetTriangleCount() const;
+	int GetClusterCount() const;
+	ClusterCacheStats GetCacheStats() const;
+
+	// Traces random rays through the bounds with several cache budgets and reports rays/sec,
+	// hit rate and resident memory for each; false if the file can't be opened
+	static bool RunBenchmark(const std::string& path, size_t cacheBudget, int rayCount);
+
+private:
+	struct FileHeader;
+	struct ClusterRecord;
+	struct LoadedCluster
+	{
+		std::vector<BVHNode> nodes;
+		std::vector<Triangle> triangles;	// in leaf order, leaves index them directly
+		size_t bytes = 0;
+	};
+
+	std::shared_ptr<const LoadedCluster> AcquireCluster(int clusterIdx) const;
+	std::shared_ptr<const LoadedCluster> ReadCluster(int clusterIdx) const;
+	void EvictOverBudget() const;
+	// The triangle the ray now ends on, if this cluster shortened it
+	static const Triangle* IntersectCluster(const LoadedCluster& cluster, Ray& ray, int nodeIdx);
+	static void ClosestPointCluster(const LoadedCluster& cluster, PointQuery& query, int nodeIdx);
+
+private:
+	MappedFile m_file;
+	const FileHeader* m_header = nullptr;
+	const BVHNode* m_topNodes = nullptr;
+	const ClusterRecord* m_records = nullptr;
+
+	// Queries are const; the cache behind them is not
+	struct Cache
+	{
+		std::mutex mutex;
+		std::vector<std::shared_ptr<const LoadedCluster>> resident;	// per cluster, empty while paged out
+		std::vector<std::list<int>::iterator> lruPositions;
+		std::list<int> lru;											// most recently used first
+		ClusterCacheStats stats;
+	};
+	mutable Cache m_cache;
+};
@@ -0,0 +1,79 @@
+#include "utils.h"
+
+FrameQueue::FrameQueue(int bufferCount)
+	: m_buffers(std::max(2, bufferCount)), m_states(m_buffers.size(), BufferState::Free)
+{
+}
+
+FrameBuffer* FrameQueue::AcquireBack(uint32_t width, uint32_t height)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	int idx = -1;
+	for (int i = 0; i < (int)m_buffers.size() && idx == -1; i++)
+		if (m_states[i] == BufferState::Free) idx = i;
+	if (idx == -1)
+	{
+		// Nobody presented the last frame in time: it is dropped rather than making the renderer wait
+		if (m_readyIdx == -1) return nullptr;
+		idx = m_readyIdx;
+		m_readyIdx = -1;
+	}
+
+	FrameBuffer& frame = m_buffers[idx];
+	size_t pixelCount = (size_t)width * height;
+	if (frame.capacity < pixelCount)
+	{
+		frame.pixels.reset(new uint32_t[pixelCount]);
+		frame.capacity = pixelCount;
+	}
+	frame.width = width;
+	frame.height = height;
+	m_states[idx] = BufferState::Rendering;
+	return &frame;
+}
+
+void FrameQueue::Submit(FrameBuffer* frame)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_readyIdx != -1) m_states[m_readyIdx] = BufferState::Free;
+	m_readyIdx = GetIndex(frame);
+	m_states[m_readyIdx] = BufferState::Ready;
+	frame->frameIndex = ++m_submitted;
+	m_readyChanged.notify_all();
+}
+
+FrameBuffer* FrameQueue::AcquireFront()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_readyIdx == -1 ? nullptr : TakeReady();
+}
+
+FrameBuffer* FrameQueue::WaitForFront()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_readyChanged.wait(lock, [this]() { return m_readyIdx != -1; });
+	return TakeReady();
+}
+
+FrameBuffer* FrameQueue::TakeReady()
+{
+	FrameBuffer* frame = &m_buffers[m_readyIdx];
+	m_states[m_readyIdx] = BufferState::Presenting;
+	m_readyIdx = -1;
+	return frame;
+}
+
+void FrameQueue::Release(FrameBuffer* frame)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_states[GetIndex(frame)] = BufferState::Free;
+}
+
+size_t FrameQueue::GetMemoryUsage() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	size_t bytes = 0;
+	for (const FrameBuffer& frame : m_buffers)
+		bytes += frame.capacity * sizeof(uint32_t);
+	return bytes;
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+
+// One RGBA8 frame and the size it was rendered at
+struct FrameBuffer
+{
+	std::unique_ptr<uint32_t[]> pixels;
+	size_t capacity = 0;		// in pixels; kept when the frame shrinks, so resizing back costs nothing
+	uint32_t width = 0, height = 0;
+	uint64_t frameIndex = 0;	// counts submitted frames, so a consumer can tell how many it skipped
+};
+
+// A ring of frame buffers passed from whoever renders to whoever presents, without copying.
+// It works as a mailbox: the renderer never waits for presentation, and a finished frame nobody
+// took yet is replaced by the next one. With three buffers one can be presented, one wait and one
+// be rendered at the same time; both sides may run on different threads.
+class FrameQueue
+{
+public:
+	explicit FrameQueue(int bufferCount = 3);
+
+	// A buffer to render width x height into. Allocates only the first time a buffer has to hold
+	// that many pixels; if every buffer is taken, the finished frame still waiting is reused.
+	FrameBuffer* AcquireBack(uint32_t width, uint32_t height);
+	// Hands a rendered buffer over as the newest finished frame
+	void Submit(FrameBuffer* frame);
+
+	// The newest finished frame, or null if none arrived since the last one was taken. It stays
+	// the caller's until Release.
+	FrameBuffer* AcquireFront();
+	// Headless consumers: blocks until a frame is finished, then takes it like AcquireFront
+	FrameBuffer* WaitForFront();
+	void Release(FrameBuffer* frame);
+
+	size_t GetMemoryUsage() const;
+
+private:
+	enum class BufferState
+	{
+		Free,
+		Rendering,
+		Ready,
+		Presenting
+	};
+
+	int GetIndex(const FrameBuffer* frame) const { return (int)(frame - m_buffers.data()); }
+	// Moves the ready frame to the consumer; the caller holds the lock and has checked there is one
+	FrameBuffer* TakeReady();
+
+private:
+	// Sized once, so the pointers handed out stay valid
+	std::vector<FrameBuffer> m_buffers;
+	std::vector<BufferState> m_states;
+	int m_readyIdx = -1;
+	uint64_t m_submitted = 0;
+	mutable std::mutex m_mutex;
+	std::condition_variable m_readyChanged;
+};
\ No newline at end of file
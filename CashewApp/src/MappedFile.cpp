@@ -0,0 +1,118 @@
+#include "utils.h"
+
+#ifdef WL_PLATFORM_WINDOWS
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other)
+	{
+		Close();
+		std::swap(m_data, other.m_data);
+		std::swap(m_size, other.m_size);
+		std::swap(m_file, other.m_file);
+		std::swap(m_mapping, other.m_mapping);
+	}
+	return *this;
+}
+
+bool MappedFile::Open(const std::string& path)
+{
+	Close();
+#ifdef WL_PLATFORM_WINDOWS
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	m_file = (intptr_t)file;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+	m_size = (uint64_t)size.QuadPart;
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping)
+	{
+		Close();
+		return false;
+	}
+	m_mapping = (intptr_t)mapping;
+	m_data = static_cast<uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+	int file = open(path.c_str(), O_RDONLY);
+	if (file < 0) return false;
+	m_file = file;
+	struct stat info;
+	if (fstat(file, &info) != 0 || info.st_size == 0)
+	{
+		Close();
+		return false;
+	}
+	m_size = (uint64_t)info.st_size;
+	void* data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, file, 0);
+	m_data = data == MAP_FAILED ? nullptr : static_cast<uint8_t*>(data);
+#endif
+	if (!m_data)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::Close()
+{
+#ifdef WL_PLATFORM_WINDOWS
+	if (m_data) UnmapViewOfFile(m_data);
+	if (m_mapping != -1) CloseHandle((HANDLE)m_mapping);
+	if (m_file != -1) CloseHandle((HANDLE)m_file);
+#else
+	if (m_data) munmap(m_data, m_size);
+	if (m_file != -1) close((int)m_file);
+#endif
+	m_data = nullptr;
+	m_size = 0;
+	m_file = -1;
+	m_mapping = -1;
+}
+
+bool MappedFile::ReadAt(uint64_t offset, void* buffer, size_t bytes) const
+{
+	if (m_file == -1 || offset + bytes > m_size) return false;
+	uint8_t* out = static_cast<uint8_t*>(buffer);
+	while (bytes > 0)
+	{
+#ifdef WL_PLATFORM_WINDOWS
+		// An explicit offset leaves the handle's shared file pointer alone
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = (DWORD)offset;
+		overlapped.OffsetHigh = (DWORD)(offset >> 32);
+		DWORD chunk = (DWORD)std::min<size_t>(bytes, 1u << 30), read = 0;
+		if (!ReadFile((HANDLE)m_file, out, chunk, &read, &overlapped) || read == 0) return false;
+#else
+		ssize_t read = pread((int)m_file, out, std::min<size_t>(bytes, 1u << 30), (off_t)offset);
+		if (read <= 0) return false;
+#endif
+		out += read;
+		offset += read;
+		bytes -= read;
+	}
+	return true;
+}
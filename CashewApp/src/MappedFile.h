@@ -0,0 +1,32 @@
+#pragma once
+
+// Read-only file mapped into the address space. Mapping costs no memory until pages are
+// touched, so files far larger than RAM can be opened; ReadAt copies a range without going
+// through the mapping, for data whose residency the caller wants to manage itself.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const std::string& path);
+	void Close();
+
+	bool IsOpen() const { return m_data != nullptr; }
+	const uint8_t* GetData() const { return m_data; }
+	uint64_t GetSize() const { return m_size; }
+
+	// Positioned read, safe to call from several threads at once
+	bool ReadAt(uint64_t offset, void* buffer, size_t bytes) const;
+
+private:
+	uint8_t* m_data = nullptr;
+	uint64_t m_size = 0;
+	intptr_t m_file = -1;
+	intptr_t m_mapping = -1;
+};
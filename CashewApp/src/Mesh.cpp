@@ -0,0 +1,353 @@
+#include "utils.h"
+
+void BuildVertexFaceAdjacency(Mesh& mesh)
+{
+	int vertexCount = (int)mesh.vertices.size();
+	int cornerCount = (int)mesh.triangles.size() * 3;
+
+	// Counting pass: how many corners reference each vertex
+	std::unique_ptr<std::atomic<int>[]> counts(new std::atomic<int>[vertexCount]);
+	ParallelForRange(vertexCount, [&counts](int begin, int end)
+		{
+			for (int v = begin; v < end; v++)
+				counts[v].store(0, std::memory_order_relaxed);
+		});
+	ParallelForRange(cornerCount, [&mesh, &counts](int begin, int end)
+		{
+			for (int c = begin; c < end; c++)
+				counts[mesh.triangles[c / 3].verIndices[c % 3]].fetch_add(1, std::memory_order_relaxed);
+		});
+
+	// Prefix sum turns the counts into row offsets
+	mesh.vertexCornerOffsets.assign(vertexCount + 1, 0);
+	for (int v = 0; v < vertexCount; v++)
+		mesh.vertexCornerOffsets[v + 1] = counts[v].load(std::memory_order_relaxed);
+	std::inclusive_scan(std::execution::par, mesh.vertexCornerOffsets.begin() + 1, mesh.vertexCornerOffsets.end(), mesh.vertexCornerOffsets.begin() + 1);
+
+	// Scatter pass, reusing the counters as per-row write cursors
+	ParallelForRange(vertexCount, [&mesh, &counts](int begin, int end)
+		{
+			for (int v = begin; v < end; v++)
+				counts[v].store(mesh.vertexCornerOffsets[v], std::memory_order_relaxed);
+		});
+	mesh.vertexCorners.resize(cornerCount);
+	ParallelForRange(cornerCount, [&mesh, &counts](int begin, int end)
+		{
+			for (int c = begin; c < end; c++)
+			{
+				int slot = counts[mesh.triangles[c / 3].verIndices[c % 3]].fetch_add(1, std::memory_order_relaxed);
+				mesh.vertexCorners[slot] = c;
+			}
+		});
+
+	// Rows come out in scheduling order; sort them so normals are bit-for-bit reproducible
+	ParallelForRange(vertexCount, [&mesh](int begin, int end)
+		{
+			for (int v = begin; v < end; v++)
+				std::sort(mesh.vertexCorners.begin() + mesh.vertexCornerOffsets[v], mesh.vertexCorners.begin() + mesh.vertexCornerOffsets[v + 1]);
+		});
+}
+
+void ComputeVertexNormals(Mesh& mesh, NormalWeighting weighting)
+{
+	int triangleCount = (int)mesh.triangles.size();
+	int vertexCount = (int)mesh.vertices.size();
+
+	// Per-face contribution, kept as flat float streams so the loops below vectorize
+	std::vector<float> faceNx(triangleCount), faceNy(triangleCount), faceNz(triangleCount);
+	std::vector<float> cornerWeights(weighting == NormalWeighting::Angle ? triangleCount * 3 : 0);
+	ParallelForRange(triangleCount, [&](int begin, int end)
+		{
+			for (int t = begin; t < end; t++)
+			{
+				const Triangle& triangle = mesh.triangles[t];
+				const glm::vec3& v0 = triangle.verticesPos[0];
+				const glm::vec3& v1 = triangle.verticesPos[1];
+				const glm::vec3& v2 = triangle.verticesPos[2];
+
+				// Same winding as the face normal computed while parsing; length is twice the area
+				glm::vec3 n = glm::cross(v2 - v0, v1 - v0);
+				float length = glm::length(n);
+				float scale = weighting == NormalWeighting::Area ? 0.5f : (length > 0.f ? 1.f / length : 0.f);
+				faceNx[t] = n.x * scale;
+				faceNy[t] = n.y * scale;
+				faceNz[t] = n.z * scale;
+
+				if (weighting == NormalWeighting::Angle)
+				{
+					for (int k = 0; k < 3; k++)
+					{
+						glm::vec3 a = triangle.verticesPos[(k + 1) % 3] - triangle.verticesPos[k];
+						glm::vec3 b = triangle.verticesPos[(k + 2) % 3] - triangle.verticesPos[k];
+						float denom = glm::length(a) * glm::length(b);
+						cornerWeights[t * 3 + k] = denom > 0.f ? acosf(std::clamp(glm::dot(a, b) / denom, -1.f, 1.f)) : 0.f;
+					}
+				}
+			}
+		});
+
+	// Gather per vertex: every vertex owns its output, so no atomics are needed
+	ParallelForRange(vertexCount, [&](int begin, int end)
+		{
+			for (int v = begin; v < end; v++)
+			{
+				float nx = 0.f, ny = 0.f, nz = 0.f;
+				for (int i = mesh.vertexCornerOffsets[v]; i < mesh.vertexCornerOffsets[v + 1]; i++)
+				{
+					int corner = mesh.vertexCorners[i];
+					int face = corner / 3;
+					float w = weighting == NormalWeighting::Angle ? cornerWeights[corner] : 1.f;
+					nx += faceNx[face] * w;
+					ny += faceNy[face] * w;
+					nz += faceNz[face] * w;
+				}
+				float length = sqrtf(nx * nx + ny * ny + nz * nz);
+				float invLength = length > 0.f ? 1.f / length : 0.f;
+				mesh.vertices[v].normal = glm::vec3(nx * invLength, ny * invLength, nz * invLength);
+			}
+		});
+}
+
+void ReorderForLocality(Mesh& mesh)
+{
+	int triangleCount = (int)mesh.triangles.size();
+	int vertexCount = (int)mesh.vertices.size();
+
+	std::vector<glm::vec3> centroids(triangleCount);
+	for (int i = 0; i < triangleCount; i++)
+		centroids[i] = mesh.triangles[i].centroid;
+	std::vector<int> order = ComputeMortonOrder(centroids.data(), triangleCount);
+
+	// Vertices take new numbers in the order the sorted triangles first touch them; any
+	// that no triangle uses keep their relative order at the end
+	std::vector<int> vertexRemap(vertexCount, -1);
+	int nextVertex = 0;
+	for (int triIdx : order)
+	{
+		for (int corner = 0; corner < 3; corner++)
+		{
+			int v = mesh.triangles[triIdx].verIndices[corner];
+			if (v >= 0 && vertexRemap[v] == -1) vertexRemap[v] = nextVertex++;
+		}
+	}
+	for (int v = 0; v < vertexCount; v++)
+		if (vertexRemap[v] == -1) vertexRemap[v] = nextVertex++;
+
+	std::vector<Triangle> triangles(triangleCount);
+	ParallelForRange(triangleCount, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				Triangle& triangle = triangles[i];
+				triangle = mesh.triangles[order[i]];
+				// Hits report the id, and shading looks the triangle up by it
+				triangle.id = i;
+				for (int corner = 0; corner < 3; corner++)
+					if (triangle.verIndices[corner] >= 0) triangle.verIndices[corner] = vertexRemap[triangle.verIndices[corner]];
+			}
+		});
+	std::vector<Vertex> vertices(vertexCount);
+	for (int v = 0; v < vertexCount; v++)
+		vertices[vertexRemap[v]] = mesh.vertices[v];
+
+	mesh.triangles.swap(triangles);
+	mesh.vertices.swap(vertices);
+	if (!mesh.vertexCornerOffsets.empty())
+		BuildVertexFaceAdjacency(mesh);
+}
+
+WeldStats WeldVertices(Mesh& mesh, float tolerance)
+{
+	WeldStats stats;
+	int vertexCount = (int)mesh.vertices.size();
+	int triangleCount = (int)mesh.triangles.size();
+	if (vertexCount == 0) return stats;
+
+	glm::vec3 bmin(1e30f), bmax(-1e30f);
+	for (const Vertex& vertex : mesh.vertices)
+	{
+		bmin = fminf(bmin, vertex.position);
+		bmax = fmaxf(bmax, vertex.position);
+	}
+	float radius = tolerance * glm::length(bmax - bmin);
+	float radiusSq = radius * radius;
+
+	// Spatial hash on a grid of cells at least one radius wide, so every vertex within reach of
+	// another lies in its cell or one of the 26 around it. The key packs 21 bits of each cell
+	// coordinate, so cells grow past the radius when the mesh spans more than 2^21 of them.
+	const int maxCell = (1 << 21) - 1;
+	glm::vec3 extent = bmax - bmin;
+	float cellSize = std::max({ radius, extent.x / maxCell, extent.y / maxCell, extent.z / maxCell, 1e-30f });
+	auto cellOf = [&](const glm::vec3& p, int* cell)
+	{
+		for (int a = 0; a < 3; a++)
+			cell[a] = (int)std::min((float)maxCell, (p[a] - bmin[a]) / cellSize);
+	};
+	auto keyOf = [](int x, int y, int z) { return ((uint64_t)x << 42) | ((uint64_t)y << 21) | (uint64_t)z; };
+
+	std::vector<uint64_t> keys(vertexCount);
+	std::vector<int> sortedVertices(vertexCount);
+	ParallelForRange(vertexCount, [&](int begin, int end)
+		{
+			for (int v = begin; v < end; v++)
+			{
+				int cell[3];
+				cellOf(mesh.vertices[v].position, cell);
+				keys[v] = keyOf(cell[0], cell[1], cell[2]);
+				sortedVertices[v] = v;
+			}
+		});
+	// Stable, so each cell's vertices stay in index order
+	RadixSortPairs(keys, sortedVertices);
+
+	// Runs of the occupied cells in sorted order, found by key through an open-addressed table
+	std::vector<int> cellStarts;
+	for (int i = 0; i < vertexCount; i++)
+		if (i == 0 || keys[i] != keys[i - 1]) cellStarts.push_back(i);
+	int cellCount = (int)cellStarts.size();
+	cellStarts.push_back(vertexCount);
+	int tableBits = 1;
+	while ((1 << tableBits) < cellCount * 2) tableBits++;
+	const uint64_t tableMask = (1ull << tableBits) - 1;
+	auto slotOf = [tableBits](uint64_t key) { return (key * 0x9e3779b97f4a7c15ull) >> (64 - tableBits); };
+	std::vector<int> table((size_t)1 << tableBits, -1);
+	for (int cell = 0; cell < cellCount; cell++)
+	{
+		uint64_t slot = slotOf(keys[cellStarts[cell]]);
+		while (table[slot] != -1) slot = (slot + 1) & tableMask;
+		table[slot] = cell;
+	}
+	auto findCell = [&](uint64_t key)
+	{
+		for (uint64_t slot = slotOf(key); table[slot] != -1; slot = (slot + 1) & tableMask)
+			if (keys[cellStarts[table[slot]]] == key) return table[slot];
+		return -1;
+	};
+
+	// Every vertex points at the lowest numbered vertex within reach, which is never higher
+	// than itself, so chasing the pointers below always ends. Work goes by cell, so the
+	// neighbouring cells are looked up once for all the vertices sharing one.
+	std::vector<int> representative(vertexCount);
+	ParallelForRange(cellCount, [&](int begin, int end)
+		{
+			for (int cell = begin; cell < end; cell++)
+			{
+				uint64_t key = keys[cellStarts[cell]];
+				int cx = (int)(key >> 42), cy = (int)((key >> 21) & maxCell), cz = (int)(key & maxCell);
+				int neighbours[27], neighbourCount = 0;
+				for (int z = std::max(0, cz - 1); z <= std::min(maxCell, cz + 1); z++)
+					for (int y = std::max(0, cy - 1); y <= std::min(maxCell, cy + 1); y++)
+						for (int x = std::max(0, cx - 1); x <= std::min(maxCell, cx + 1); x++)
+						{
+							int neighbour = findCell(keyOf(x, y, z));
+							if (neighbour != -1) neighbours[neighbourCount++] = neighbour;
+						}
+
+				for (int i = cellStarts[cell]; i < cellStarts[cell + 1]; i++)
+				{
+					int v = sortedVertices[i];
+					const glm::vec3& p = mesh.vertices[v].position;
+					int best = v;
+					for (int n = 0; n < neighbourCount; n++)
+					{
+						for (int j = cellStarts[neighbours[n]]; j < cellStarts[neighbours[n] + 1]; j++)
+						{
+							int other = sortedVertices[j];
+							// Sorted by index within the cell: nothing further on can beat best
+							if (other >= best) break;
+							glm::vec3 d = mesh.vertices[other].position - p;
+							if (glm::dot(d, d) <= radiusSq) best = other;
+						}
+					}
+					representative[v] = best;
+				}
+			}
+		});
+
+	// Resolve chains to their root and number the survivors in their original order
+	std::vector<int> remap(vertexCount);
+	int survivors = 0;
+	for (int v = 0; v < vertexCount; v++)
+	{
+		int root = representative[v];
+		while (representative[root] != root) root = representative[root];
+		representative[v] = root;
+		remap[v] = root == v ? survivors++ : remap[root];
+	}
+	stats.verticesRemoved = vertexCount - survivors;
+
+	std::vector<Vertex> vertices(survivors);
+	for (int v = 0; v < vertexCount; v++)
+		if (representative[v] == v) vertices[remap[v]] = mesh.vertices[v];
+
+	// Corners of a merged vertex all take the position of its first corner, so seams close
+	std::vector<std::atomic<int>> firstCorner(survivors);
+	for (std::atomic<int>& corner : firstCorner)
+		corner.store(std::numeric_limits<int>::max(), std::memory_order_relaxed);
+	ParallelForRange(triangleCount, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				for (int corner = 0; corner < 3; corner++)
+				{
+					int v = mesh.triangles[i].verIndices[corner];
+					if (v < 0) continue;
+					std::atomic<int>& first = firstCorner[remap[v]];
+					int current = first.load(std::memory_order_relaxed);
+					while (i * 3 + corner < current && !first.compare_exchange_weak(current, i * 3 + corner, std::memory_order_relaxed)) {}
+				}
+			}
+		});
+	std::vector<glm::vec3> positions(survivors);
+	ParallelForRange(survivors, [&](int begin, int end)
+		{
+			for (int v = begin; v < end; v++)
+			{
+				int first = firstCorner[v].load(std::memory_order_relaxed);
+				if (first != std::numeric_limits<int>::max()) positions[v] = mesh.triangles[first / 3].verticesPos[first % 3];
+			}
+		});
+
+	// Remap and snap every triangle, then keep those that still span an area
+	std::vector<char> keep(triangleCount);
+	ParallelForRange(triangleCount, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				Triangle& triangle = mesh.triangles[i];
+				bool moved = false;
+				for (int corner = 0; corner < 3; corner++)
+				{
+					int& v = triangle.verIndices[corner];
+					if (v < 0) continue;
+					v = remap[v];
+					moved |= positions[v] != triangle.verticesPos[corner];
+					triangle.verticesPos[corner] = positions[v];
+				}
+				const int* indices = triangle.verIndices;
+				const glm::vec3* p = triangle.verticesPos;
+				bool repeated = indices[0] >= 0 && (indices[0] == indices[1] || indices[1] == indices[2] || indices[0] == indices[2]);
+				keep[i] = !repeated && glm::length(glm::cross(p[1] - p[0], p[2] - p[0])) > 0.f;
+				if (keep[i] && moved)
+				{
+					triangle.normal = glm::cross(glm::normalize(p[2] - p[0]), glm::normalize(p[1] - p[0]));
+					triangle.centroid = (p[0] + p[1] + p[2]) * 0.3333f;
+				}
+			}
+		});
+
+	std::vector<Triangle> triangles;
+	triangles.reserve(triangleCount);
+	for (int i = 0; i < triangleCount; i++)
+	{
+		if (!keep[i]) continue;
+		Triangle& triangle = triangles.emplace_back(mesh.triangles[i]);
+		triangle.id = (int)triangles.size() - 1;
+	}
+	stats.trianglesRemoved = triangleCount - (int)triangles.size();
+
+	mesh.triangles.swap(triangles);
+	mesh.vertices.swap(vertices);
+	BuildVertexFaceAdjacency(mesh);
+	return stats;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+enum class NormalWeighting
+{
+	Uniform,	// every adjacent face counts the same
+	Area,		// larger faces pull the normal harder
+	Angle		// weighted by the corner angle at the vertex, independent of tessellation
+};
+
+// Triangle soup plus shared vertices, produced once by the Parser.
+// The Scene and Bvh only ever see it through a shared_ptr<const Mesh>,
+// so a loaded model is never copied after parsing (animating one keeps a
+// single private copy for the deformed pose).
+struct Mesh
+{
+	std::vector<Triangle> triangles;
+	std::vector<Vertex> vertices;
+
+	// Vertex-to-face adjacency in CSR form: the corners touching vertex v are
+	// vertexCorners[vertexCornerOffsets[v] .. vertexCornerOffsets[v + 1]), where
+	// corner c is vertex c % 3 of triangle c / 3
+	std::vector<int> vertexCornerOffsets;
+	std::vector<int> vertexCorners;
+
+	size_t GetMemoryUsage() const
+	{
+		size_t bytes = sizeof(Mesh);
+		bytes += triangles.capacity() * sizeof(Triangle);
+		bytes += vertices.capacity() * sizeof(Vertex);
+		bytes += vertexCornerOffsets.capacity() * sizeof(int);
+		bytes += vertexCorners.capacity() * sizeof(int);
+		return bytes;
+	}
+};
+
+struct WeldStats
+{
+	int verticesRemoved = 0;
+	int trianglesRemoved = 0;
+};
+
+// Fills vertexCornerOffsets and vertexCorners from the triangles' vertex indices
+void BuildVertexFaceAdjacency(Mesh& mesh);
+// Recomputes every vertex normal from the current triangle positions using the CSR adjacency
+void ComputeVertexNormals(Mesh& mesh, NormalWeighting weighting);
+// Sorts the triangles along a Morton curve of their centroids and numbers the vertices by first
+// use, so triangles that share a leaf, and the vertices shading reads for them, sit together
+// in memory. Triangle ids and vertex indices are rewritten to match and adjacency is rebuilt;
+// hits found afterwards index the reordered mesh.
+void ReorderForLocality(Mesh& mesh);
+// Merges vertices closer than tolerance times the diagonal of the mesh bounds into the lowest
+// numbered of them, snapping the triangle corners that used them onto one position, then drops
+// triangles left with a repeated vertex or no area. Triangles keep their order and are
+// renumbered; adjacency is rebuilt but vertex normals must be recomputed.
+WeldStats WeldVertices(Mesh& mesh, float tolerance);
+// Splits every triangle into four at its edge midpoints, levels times. Shared edges get one
+// midpoint vertex, children keep the parent's face normal and sit next to each other in order.
+// Returns a new mesh with adjacency; vertex normals are interpolated until recomputed.
+std::shared_ptr<Mesh> SubdivideMesh(const Mesh& mesh, int levels);
+
+// Quadric error edge collapse (Garland & Heckbert) until about targetTriangles remain.
+// Open boundaries are held in place; the result has its own adjacency and vertex normals.
+std::shared_ptr<Mesh> SimplifyMesh(const Mesh& mesh, int targetTriangles);
+// Up to levelCount meshes, each simplified from the one before to a quarter of its triangles,
+// stopping before a level would fall under minTriangles. Touches nothing shared, so it may run
+// on a background thread while the mesh is rendered.
+std::vector<std::shared_ptr<const Mesh>> BuildLevelsOfDetail(const Mesh& mesh, int levelCount, int minTriangles = 256);
\ No newline at end of file
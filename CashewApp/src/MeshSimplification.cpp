@@ -0,0 +1,357 @@
+#include "utils.h"
+#include <array>
+#include <queue>
+
+// Boundary edges get a plane perpendicular to their face, weighted this much harder than the
+// surface, so open borders don't shrink as the interior is collapsed
+#define SIMPLIFY_BOUNDARY_WEIGHT 100.0
+// A collapse is rejected when it turns a surviving face further than this from its old normal
+#define SIMPLIFY_MIN_NORMAL_DOT 0.2f
+
+// Symmetric 4x4 error quadric, upper triangle only: a11 a12 a13 a14 a22 a23 a24 a33 a34 a44
+struct Quadric
+{
+	double a[10] = {};
+
+	Quadric() = default;
+	// Squared distance to the plane n.p + d = 0, scaled by weight
+	Quadric(const glm::dvec3& n, double d, double weight)
+	{
+		a[0] = n.x * n.x; a[1] = n.x * n.y; a[2] = n.x * n.z; a[3] = n.x * d;
+		a[4] = n.y * n.y; a[5] = n.y * n.z; a[6] = n.y * d;
+		a[7] = n.z * n.z; a[8] = n.z * d;
+		a[9] = d * d;
+		for (double& value : a) value *= weight;
+	}
+
+	Quadric& operator+=(const Quadric& other)
+	{
+		for (int i = 0; i < 10; i++) a[i] += other.a[i];
+		return *this;
+	}
+
+	double Evaluate(const glm::dvec3& p) const
+	{
+		return a[0] * p.x * p.x + 2.0 * a[1] * p.x * p.y + 2.0 * a[2] * p.x * p.z + 2.0 * a[3] * p.x
+			+ a[4] * p.y * p.y + 2.0 * a[5] * p.y * p.z + 2.0 * a[6] * p.y
+			+ a[7] * p.z * p.z + 2.0 * a[8] * p.z + a[9];
+	}
+
+	// Point of least error, if the 3x3 system is well conditioned
+	bool Minimize(glm::dvec3& p) const
+	{
+		glm::dmat3 A(a[0], a[1], a[2], a[1], a[4], a[5], a[2], a[5], a[7]);
+		double det = glm::determinant(A);
+		double scale = std::max({ fabs(a[0]), fabs(a[4]), fabs(a[7]) });
+		if (fabs(det) <= 1e-12 * scale * scale * scale) return false;
+		p = glm::inverse(A) * -glm::dvec3(a[3], a[6], a[8]);
+		return true;
+	}
+};
+
+struct CollapseCandidate
+{
+	double cost;
+	int v0, v1;
+	int version0, version1;
+	glm::vec3 position;
+
+	bool operator>(const CollapseCandidate& other) const { return cost > other.cost; }
+};
+
+class EdgeCollapser
+{
+public:
+	EdgeCollapser(const Mesh& mesh);
+	void Collapse(int targetTriangles);
+	std::shared_ptr<Mesh> Extract() const;
+
+private:
+	void PushCandidate(int v0, int v1);
+	void GatherNeighbours(int v, std::vector<int>& neighbours) const;
+	bool IsCollapseValid(int v0, int v1, const glm::vec3& position);
+	bool FlipsFaces(int v, int other, const glm::vec3& position) const;
+
+private:
+	const Mesh& m_mesh;
+	std::vector<glm::vec3> m_positions;
+	std::vector<Quadric> m_quadrics;
+	std::vector<int> m_versions;
+	std::vector<bool> m_vertexRemoved;
+	std::vector<std::vector<int>> m_vertexTriangles;
+	std::vector<std::array<int, 3>> m_triangles;
+	std::vector<bool> m_triangleRemoved;
+	int m_liveTriangles = 0;
+	std::priority_queue<CollapseCandidate, std::vector<CollapseCandidate>, std::greater<CollapseCandidate>> m_heap;
+	std::vector<int> m_scratch0, m_scratch1;
+};
+
+EdgeCollapser::EdgeCollapser(const Mesh& mesh)
+	: m_mesh(mesh)
+{
+	int vertexCount = (int)mesh.vertices.size();
+	int triangleCount = (int)mesh.triangles.size();
+	// Collapses work in the space the triangles were imported into: Vertex::position keeps the
+	// file's coordinates, so each vertex starts where a corner using it lies
+	m_positions.resize(vertexCount);
+	for (int v = 0; v < vertexCount; v++)
+	{
+		int offset = mesh.vertexCornerOffsets[v];
+		m_positions[v] = offset < mesh.vertexCornerOffsets[v + 1]
+			? mesh.triangles[mesh.vertexCorners[offset] / 3].verticesPos[mesh.vertexCorners[offset] % 3]
+			: mesh.vertices[v].position;
+	}
+	m_triangles.resize(triangleCount);
+	for (int t = 0; t < triangleCount; t++)
+		for (int k = 0; k < 3; k++)
+			m_triangles[t][k] = mesh.triangles[t].verIndices[k];
+	m_triangleRemoved.assign(triangleCount, false);
+	m_liveTriangles = triangleCount;
+	m_versions.assign(vertexCount, 0);
+	m_vertexRemoved.assign(vertexCount, false);
+
+	// The CSR adjacency becomes per-vertex lists, which collapses append to
+	m_vertexTriangles.resize(vertexCount);
+	ParallelForRange(vertexCount, [this, &mesh](int begin, int end)
+		{
+			for (int v = begin; v < end; v++)
+				for (int i = mesh.vertexCornerOffsets[v]; i < mesh.vertexCornerOffsets[v + 1]; i++)
+					m_vertexTriangles[v].push_back(mesh.vertexCorners[i] / 3);
+		});
+
+	// Face planes, area weighted, gathered per vertex like the normals
+	std::vector<Quadric> faceQuadrics(triangleCount);
+	ParallelForRange(triangleCount, [this, &faceQuadrics](int begin, int end)
+		{
+			for (int t = begin; t < end; t++)
+			{
+				glm::dvec3 p0 = m_positions[m_triangles[t][0]], p1 = m_positions[m_triangles[t][1]], p2 = m_positions[m_triangles[t][2]];
+				glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+				double length = glm::length(n);
+				if (length > 0.0) faceQuadrics[t] = Quadric(n / length, -glm::dot(n / length, p0), length * 0.5);
+			}
+		});
+	m_quadrics.resize(vertexCount);
+	ParallelForRange(vertexCount, [this, &faceQuadrics](int begin, int end)
+		{
+			for (int v = begin; v < end; v++)
+				for (int t : m_vertexTriangles[v])
+					m_quadrics[v] += faceQuadrics[t];
+		});
+
+	// An edge seen from only one face is a boundary; every edge is seen from its lower vertex once
+	std::vector<int> neighbours;
+	for (int v = 0; v < vertexCount; v++)
+	{
+		neighbours.clear();
+		for (int t : m_vertexTriangles[v])
+			for (int k = 0; k < 3; k++)
+				if (m_triangles[t][k] > v) neighbours.push_back(m_triangles[t][k]);
+		std::sort(neighbours.begin(), neighbours.end());
+		for (size_t i = 0; i < neighbours.size(); i++)
+		{
+			int n = neighbours[i];
+			if (i > 0 && neighbours[i - 1] == n) continue;
+			bool boundary = (i + 1 == neighbours.size() || neighbours[i + 1] != n);
+			if (boundary)
+			{
+				for (int t : m_vertexTriangles[v])
+				{
+					const std::array<int, 3>& tri = m_triangles[t];
+					if (tri[0] != n && tri[1] != n && tri[2] != n) continue;
+					glm::dvec3 p0 = m_positions[tri[0]], p1 = m_positions[tri[1]], p2 = m_positions[tri[2]];
+					glm::dvec3 faceNormal = glm::cross(p1 - p0, p2 - p0);
+					glm::dvec3 edge = glm::dvec3(m_positions[n]) - glm::dvec3(m_positions[v]);
+					glm::dvec3 planeNormal = glm::cross(edge, faceNormal);
+					double length = glm::length(planeNormal);
+					if (length <= 0.0) break;
+					planeNormal /= length;
+					Quadric constraint(planeNormal, -glm::dot(planeNormal, glm::dvec3(m_positions[v])), SIMPLIFY_BOUNDARY_WEIGHT * glm::dot(edge, edge));
+					m_quadrics[v] += constraint;
+					m_quadrics[n] += constraint;
+					break;
+				}
+			}
+			PushCandidate(v, n);
+		}
+	}
+}
+
+void EdgeCollapser::PushCandidate(int v0, int v1)
+{
+	Quadric q = m_quadrics[v0];
+	q += m_quadrics[v1];
+
+	// The optimum, or failing that the best of the endpoints and the midpoint
+	glm::dvec3 p0 = m_positions[v0], p1 = m_positions[v1];
+	glm::dvec3 best = (p0 + p1) * 0.5;
+	double cost = q.Evaluate(best);
+	glm::dvec3 optimum;
+	if (q.Minimize(optimum) && glm::length(optimum - best) <= glm::length(p1 - p0) * 2.0)
+	{
+		best = optimum;
+		cost = q.Evaluate(optimum);
+	}
+	else
+	{
+		for (const glm::dvec3& p : { p0, p1 })
+		{
+			double c = q.Evaluate(p);
+			if (c < cost) { cost = c; best = p; }
+		}
+	}
+	m_heap.push({ std::max(0.0, cost), v0, v1, m_versions[v0], m_versions[v1], glm::vec3(best) });
+}
+
+void EdgeCollapser::GatherNeighbours(int v, std::vector<int>& neighbours) const
+{
+	neighbours.clear();
+	for (int t : m_vertexTriangles[v])
+	{
+		if (m_triangleRemoved[t]) continue;
+		for (int k = 0; k < 3; k++)
+			if (m_triangles[t][k] != v) neighbours.push_back(m_triangles[t][k]);
+	}
+	std::sort(neighbours.begin(), neighbours.end());
+	neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+}
+
+bool EdgeCollapser::FlipsFaces(int v, int other, const glm::vec3& position) const
+{
+	for (int t : m_vertexTriangles[v])
+	{
+		const std::array<int, 3>& tri = m_triangles[t];
+		if (m_triangleRemoved[t] || tri[0] == other || tri[1] == other || tri[2] == other) continue;
+
+		glm::vec3 before[3], after[3];
+		for (int k = 0; k < 3; k++)
+		{
+			before[k] = m_positions[tri[k]];
+			after[k] = tri[k] == v ? position : before[k];
+		}
+		glm::vec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+		glm::vec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+		float length0 = glm::length(n0), length1 = glm::length(n1);
+		if (length1 <= 0.f) return true;
+		if (length0 > 0.f && glm::dot(n0, n1) < SIMPLIFY_MIN_NORMAL_DOT * length0 * length1) return true;
+	}
+	return false;
+}
+
+bool EdgeCollapser::IsCollapseValid(int v0, int v1, const glm::vec3& position)
+{
+	// Link condition: the endpoints may only share the one or two vertices opposite the edge,
+	// anything more pinches the surface into a non-manifold fin
+	GatherNeighbours(v0, m_scratch0);
+	GatherNeighbours(v1, m_scratch1);
+	int shared = 0;
+	for (size_t i = 0, j = 0; i < m_scratch0.size() && j < m_scratch1.size();)
+	{
+		if (m_scratch0[i] < m_scratch1[j]) i++;
+		else if (m_scratch0[i] > m_scratch1[j]) j++;
+		else { shared++; i++; j++; }
+	}
+	int edgeFaces = 0;
+	for (int t : m_vertexTriangles[v0])
+	{
+		const std::array<int, 3>& tri = m_triangles[t];
+		if (!m_triangleRemoved[t] && (tri[0] == v1 || tri[1] == v1 || tri[2] == v1)) edgeFaces++;
+	}
+	if (edgeFaces == 0 || shared > edgeFaces) return false;
+
+	return !FlipsFaces(v0, v1, position) && !FlipsFaces(v1, v0, position);
+}
+
+void EdgeCollapser::Collapse(int targetTriangles)
+{
+	while (m_liveTriangles > targetTriangles && !m_heap.empty())
+	{
+		CollapseCandidate candidate = m_heap.top();
+		m_heap.pop();
+		int v0 = candidate.v0, v1 = candidate.v1;
+		// Stale: an endpoint moved or vanished since this was queued
+		if (m_vertexRemoved[v0] || m_vertexRemoved[v1] || m_versions[v0] != candidate.version0 || m_versions[v1] != candidate.version1) continue;
+		if (!IsCollapseValid(v0, v1, candidate.position)) continue;
+
+		// v1 merges into v0: faces on the edge die, the rest of v1's faces move over
+		m_positions[v0] = candidate.position;
+		m_quadrics[v0] += m_quadrics[v1];
+		m_vertexRemoved[v1] = true;
+		for (int t : m_vertexTriangles[v1])
+		{
+			if (m_triangleRemoved[t]) continue;
+			std::array<int, 3>& tri = m_triangles[t];
+			if (tri[0] == v0 || tri[1] == v0 || tri[2] == v0)
+			{
+				m_triangleRemoved[t] = true;
+				m_liveTriangles--;
+				continue;
+			}
+			for (int k = 0; k < 3; k++)
+				if (tri[k] == v1) tri[k] = v0;
+			m_vertexTriangles[v0].push_back(t);
+		}
+		m_vertexTriangles[v1].clear();
+		std::vector<int>& faces = m_vertexTriangles[v0];
+		faces.erase(std::remove_if(faces.begin(), faces.end(), [this](int t) { return m_triangleRemoved[t]; }), faces.end());
+
+		// Every queued edge of v0 is now stale; requeue them with the merged quadric
+		m_versions[v0]++;
+		GatherNeighbours(v0, m_scratch0);
+		for (int n : m_scratch0)
+			PushCandidate(v0, n);
+	}
+}
+
+std::shared_ptr<Mesh> EdgeCollapser::Extract() const
+{
+	std::shared_ptr<Mesh> result = std::make_shared<Mesh>();
+	std::vector<int> remap(m_positions.size(), -1);
+	for (size_t v = 0; v < m_positions.size(); v++)
+	{
+		if (m_vertexRemoved[v] || m_vertexTriangles[v].empty()) continue;
+		remap[v] = (int)result->vertices.size();
+		// Still in file coordinates, like every parsed mesh; the triangles carry the moved corners
+		result->vertices.emplace_back(m_mesh.vertices[v].position);
+	}
+
+	result->triangles.reserve(m_liveTriangles);
+	for (size_t t = 0; t < m_triangles.size(); t++)
+	{
+		if (m_triangleRemoved[t]) continue;
+		const std::array<int, 3>& tri = m_triangles[t];
+		glm::vec3 v0 = m_positions[tri[0]], v1 = m_positions[tri[1]], v2 = m_positions[tri[2]];
+		// Same face normal convention as the parser
+		glm::vec3 normal = glm::cross(glm::normalize(v2 - v0), glm::normalize(v1 - v0));
+		result->triangles.emplace_back((int)result->triangles.size(), v0, v1, v2, remap[tri[0]], remap[tri[1]], remap[tri[2]], normal, m_mesh.triangles[t].colour);
+	}
+
+	BuildVertexFaceAdjacency(*result);
+	ComputeVertexNormals(*result, NormalWeighting::Area);
+	return result;
+}
+
+std::shared_ptr<Mesh> SimplifyMesh(const Mesh& mesh, int targetTriangles)
+{
+	EdgeCollapser collapser(mesh);
+	collapser.Collapse(targetTriangles);
+	return collapser.Extract();
+}
+
+std::vector<std::shared_ptr<const Mesh>> BuildLevelsOfDetail(const Mesh& mesh, int levelCount, int minTriangles)
+{
+	std::vector<std::shared_ptr<const Mesh>> levels;
+	const Mesh* previous = &mesh;
+	for (int level = 0; level < levelCount; level++)
+	{
+		// A quarter per level: one level per halving of the object's size on screen
+		int target = (int)previous->triangles.size() / 4;
+		if (target < minTriangles) break;
+		std::shared_ptr<Mesh> simplified = SimplifyMesh(*previous, target);
+		// Nothing left that can collapse without breaking the surface
+		if (simplified->triangles.size() >= previous->triangles.size()) break;
+		levels.push_back(simplified);
+		previous = simplified.get();
+	}
+	return levels;
+}
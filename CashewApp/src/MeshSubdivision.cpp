@@ -0,0 +1,109 @@
+#include "utils.h"
+
+// Each level quadruples the triangles; stop before corner indices would overflow an int
+#define SUBDIVIDE_MAX_CORNERS (std::numeric_limits<int>::max() / 4)
+
+// One 1-to-4 midpoint split. Every undirected edge gets one new vertex, found by sorting the
+// corners' edge keys, so triangles sharing an edge share its midpoint and the result stays
+// watertight wherever the input was.
+static std::shared_ptr<Mesh> SubdivideOnce(const Mesh& mesh)
+{
+	int triangleCount = (int)mesh.triangles.size();
+	int vertexCount = (int)mesh.vertices.size();
+	int cornerCount = triangleCount * 3;
+
+	// Corner c stands for the edge from its vertex to the next one round the triangle
+	std::vector<uint64_t> edgeKeys(cornerCount);
+	std::vector<int> edgeCorners(cornerCount);
+	ParallelForRange(cornerCount, [&](int begin, int end)
+		{
+			for (int c = begin; c < end; c++)
+			{
+				const Triangle& triangle = mesh.triangles[c / 3];
+				uint32_t a = (uint32_t)triangle.verIndices[c % 3];
+				uint32_t b = (uint32_t)triangle.verIndices[(c + 1) % 3];
+				edgeKeys[c] = ((uint64_t)std::min(a, b) << 32) | std::max(a, b);
+				edgeCorners[c] = c;
+			}
+		});
+	RadixSortPairs(edgeKeys, edgeCorners);
+
+	// Number the distinct edges: the first of each run of equal keys starts a new one
+	std::vector<int> edgeNumbers(cornerCount);
+	ParallelForRange(cornerCount, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+				edgeNumbers[i] = (i == 0 || edgeKeys[i] != edgeKeys[i - 1]) ? 1 : 0;
+		});
+	std::inclusive_scan(std::execution::par, edgeNumbers.begin(), edgeNumbers.end(), edgeNumbers.begin());
+	int edgeCount = cornerCount > 0 ? edgeNumbers.back() : 0;
+
+	std::shared_ptr<Mesh> result = std::make_shared<Mesh>();
+	result->vertices.resize((size_t)vertexCount + edgeCount);
+	result->triangles.resize((size_t)triangleCount * 4);
+	std::copy(std::execution::par, mesh.vertices.begin(), mesh.vertices.end(), result->vertices.begin());
+
+	// Midpoint vertex of every edge, and which one each corner's edge maps to
+	std::vector<int> cornerMidpoints(cornerCount);
+	ParallelForRange(cornerCount, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				int midpoint = vertexCount + edgeNumbers[i] - 1;
+				cornerMidpoints[edgeCorners[i]] = midpoint;
+				if (i > 0 && edgeKeys[i] == edgeKeys[i - 1]) continue;
+
+				const Vertex& a = mesh.vertices[edgeKeys[i] >> 32];
+				const Vertex& b = mesh.vertices[edgeKeys[i] & 0xffffffffu];
+				Vertex& vertex = result->vertices[midpoint];
+				vertex.position = (a.position + b.position) * 0.5f;
+				vertex.normal = a.normal + b.normal;
+				if (glm::dot(vertex.normal, vertex.normal) > 0.f) vertex.normal = glm::normalize(vertex.normal);
+			}
+		});
+
+	// The children of triangle t are 4t .. 4t + 3, so triangles keep their order and locality
+	ParallelForRange(triangleCount, [&](int begin, int end)
+		{
+			for (int t = begin; t < end; t++)
+			{
+				const Triangle& parent = mesh.triangles[t];
+				const glm::vec3* p = parent.verticesPos;
+				const int* v = parent.verIndices;
+				const int* m = &cornerMidpoints[t * 3];
+				// Midpoints of the import-transformed corners: both triangles on an edge hold the
+				// same two corner positions, so they compute the same midpoint
+				glm::vec3 p01 = (p[0] + p[1]) * 0.5f;
+				glm::vec3 p12 = (p[1] + p[2]) * 0.5f;
+				glm::vec3 p20 = (p[2] + p[0]) * 0.5f;
+
+				Triangle* children = &result->triangles[(size_t)t * 4];
+				children[0] = Triangle(t * 4, p[0], p01, p20, v[0], m[0], m[2], parent.normal, parent.colour);
+				children[1] = Triangle(t * 4 + 1, p01, p[1], p12, m[0], v[1], m[1], parent.normal, parent.colour);
+				children[2] = Triangle(t * 4 + 2, p20, p12, p[2], m[2], m[1], v[2], parent.normal, parent.colour);
+				children[3] = Triangle(t * 4 + 3, p01, p12, p20, m[0], m[1], m[2], parent.normal, parent.colour);
+			}
+		});
+
+	return result;
+}
+
+std::shared_ptr<Mesh> SubdivideMesh(const Mesh& mesh, int levels)
+{
+	std::shared_ptr<Mesh> result;
+	const Mesh* current = &mesh;
+	for (int level = 0; level < levels; level++)
+	{
+		if (current->triangles.size() * 3 > (size_t)SUBDIVIDE_MAX_CORNERS)
+		{
+			std::cerr << "Error: subdivision stopped after " << level << " levels, the mesh would be too large." << std::endl;
+			break;
+		}
+		result = SubdivideOnce(*current);
+		current = result.get();
+	}
+
+	if (!result) result = std::make_shared<Mesh>(mesh);
+	BuildVertexFaceAdjacency(*result);
+	return result;
+}
\ No newline at end of file
@@ -1,18 +1,14 @@
 #include "utils.h"
-#include <execution>
 #include <future>
 
 Parser::Parser()
 {
-
+	m_mesh = std::make_shared<Mesh>();
 }
 
 bool Parser::ParseFile(const char* fileName, float scale, glm::vec3 colour)
 {
-	m_triangles.clear();
-	m_vertices.clear();
-	m_edges.clear();
-	m_quadingles.clear();
+	size_t memoryBefore = GetCurrentMemoryUsage();
 
 	// Open the file
 	FILE* fp = fopen(fileName, "rb");
@@ -43,9 +39,32 @@ bool Parser::ParseFile(const char* fileName, float scale, glm::vec3 colour)
 	// Close the file
 	fclose(fp);
 
-	glm::mat4 rotateX = glm::mat4(1.0f);
-	rotateX = glm::scale(rotateX, glm::vec3(scale));
-	rotateX = glm::rotate(rotateX, PI / 2, glm::vec3(1, 0, 0));
+	return LoadDocument(doc, scale, colour, memoryBefore);
+}
+
+bool Parser::ParseJSON(const char* text, size_t length, float scale, glm::vec3 colour)
+{
+	size_t memoryBefore = GetCurrentMemoryUsage();
+
+	rapidjson::Document doc;
+	doc.Parse(text, length);
+	if (doc.HasParseError())
+	{
+		std::cerr << "Error: failed to parse JSON document." << std::endl;
+		return false;
+	}
+
+	return LoadDocument(doc, scale, colour, memoryBefore);
+}
+
+bool Parser::LoadDocument(const rapidjson::Document& doc, float scale, glm::vec3 colour, size_t memoryBefore)
+{
+	// Build into a fresh mesh so a scene still holding the previous one is unaffected
+	std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+	std::vector<Triangle>& triangles = mesh->triangles;
+	std::vector<Vertex>& vertices = mesh->vertices;
+
+	glm::mat4 rotateX = GetImportTransform(scale);
 
 	if (doc.HasMember("geometry_object") && doc["geometry_object"].IsObject())
 	{
@@ -54,14 +73,15 @@ bool Parser::ParseFile(const char* fileName, float scale, glm::vec3 colour)
 		if (geometryObject.HasMember("vertices") && geometryObject["vertices"].IsArray())
 		{
 			const rapidjson::Value& verticesData = geometryObject["vertices"];
-			for (rapidjson::SizeType i = 0; i < (verticesData.Size() - 2); i += 3)
+			vertices.reserve(verticesData.Size() / 3);
+			for (rapidjson::SizeType i = 0; i + 2 < verticesData.Size(); i += 3)
 			{
 				if (verticesData[i].IsFloat() && verticesData[i + 1].IsFloat() && verticesData[i + 2].IsFloat())
 				{
 					float x = verticesData[i].GetFloat();
 					float y = verticesData[i + 1].GetFloat();
 					float z = verticesData[i + 2].GetFloat();
-					m_vertices.push_back(Vertex(glm::vec3(x, y, z)));
+					vertices.emplace_back(glm::vec3(x, y, z));
 				}
 			}
 		}
@@ -70,82 +90,34 @@ bool Parser::ParseFile(const char* fileName, float scale, glm::vec3 colour)
 		if (geometryObject.HasMember("triangles") && geometryObject["triangles"].IsArray())
 		{
 			const rapidjson::Value& trianglesData = geometryObject["triangles"];
-			m_triangles.reserve(trianglesData.Size()/3);
+			triangles.reserve(trianglesData.Size()/3);
 			int triangleIdx = 0;
-			for (rapidjson::SizeType i = 0; i < (trianglesData.Size() - 2); i += 3)
+			for (rapidjson::SizeType i = 0; i + 2 < trianglesData.Size(); i += 3)
 			{
 				if (trianglesData[i].IsInt() && trianglesData[i + 1].IsInt() && trianglesData[i + 2].IsInt())
 				{
 					int vertex0Idx = trianglesData[i].GetInt();
 					int vertex1Idx = trianglesData[i+1].GetInt();
 					int vertex2Idx = trianglesData[i+2].GetInt();
+					int vertexCount = (int)vertices.size();
+					if (std::min({ vertex0Idx, vertex1Idx, vertex2Idx }) < 0 || std::max({ vertex0Idx, vertex1Idx, vertex2Idx }) >= vertexCount)
+					{
+						std::cerr << "Error: triangle " << triangleIdx << " uses a vertex the file doesn't have." << std::endl;
+						return false;
+					}
 
-					Vertex& vertex0 = m_vertices[vertex0Idx];
-					Vertex& vertex1 = m_vertices[vertex1Idx];
-					Vertex& vertex2 = m_vertices[vertex2Idx];
+					Vertex& vertex0 = vertices[vertex0Idx];
+					Vertex& vertex1 = vertices[vertex1Idx];
+					Vertex& vertex2 = vertices[vertex2Idx];
 
 					glm::vec3 v0 = glm::vec4(vertex0.GetPosition(), 1.f) * rotateX;
 					glm::vec3 v1 = glm::vec4(vertex1.GetPosition(), 1.f) * rotateX;
 					glm::vec3 v2 = glm::vec4(vertex2.GetPosition(), 1.f) * rotateX;
 
-					// Add face index to each of each vertices' struct (for calculating smooth normals after that)
-					vertex0.AddFace(triangleIdx);
-					vertex1.AddFace(triangleIdx);
-					vertex2.AddFace(triangleIdx);
-
 					glm::vec3 normal = cross(normalize(v2 - v0), normalize(v1 - v0));
 
-					Triangle newTriangle = Triangle(triangleIdx, v0, v1, v2, vertex0Idx, vertex1Idx, vertex2Idx, normal, colour);
-					m_triangles.push_back(newTriangle);
-					
-					// Find median of one triangle edge
-					glm::vec3 edgeMedian = (v1 - v0) / glm::vec3(2);
-
-					// Split triangle into four smaller ones
-					m_quadingles.push_back(Triangle(triangleIdx, v0, edgeMedian, newTriangle.centroid, normal));
-					m_quadingles.push_back(Triangle(triangleIdx +1, edgeMedian, v1, newTriangle.centroid, normal));
-					m_quadingles.push_back(Triangle(triangleIdx +2, v0, v2, newTriangle.centroid, normal));
-					m_quadingles.push_back(Triangle(triangleIdx +3, v1, v2, newTriangle.centroid, normal));
-
-					// Calculate edges for fast closed mesh calculation
-					Edge edge = Edge(vertex0Idx, vertex1Idx);
-					Edge edgeSwap = Edge(vertex1Idx, vertex0Idx);
-					auto itEdge = m_edges.find(edge);
-					auto itEdgeSwap = m_edges.find(edgeSwap);
-
-					// Check for both versions of edge in map - vertex1, vertex2 and vertex2, vertex1
-					// (normal comparison doesn't support this)
-					if (itEdge == m_edges.end() && itEdgeSwap == m_edges.end())
-						m_edges[edge].push_back(triangleIdx);
-					else if (itEdge != m_edges.end())
-						itEdge->second.push_back(triangleIdx);
-					else if (itEdgeSwap != m_edges.end())
-						itEdgeSwap->second.push_back(triangleIdx);
-
-					edge = Edge(vertex0Idx, vertex2Idx);
-					edgeSwap = Edge(vertex2Idx, vertex0Idx);
-					itEdge = m_edges.find(edge);
-					itEdgeSwap = m_edges.find(edgeSwap);
-
-					if (itEdge == m_edges.end() && itEdgeSwap == m_edges.end())
-						m_edges[edge].push_back(triangleIdx);
-					else if (itEdge != m_edges.end())
-						itEdge->second.push_back(triangleIdx);
-					else if (itEdgeSwap != m_edges.end())
-						itEdgeSwap->second.push_back(triangleIdx);
-
-					edge = Edge(vertex1Idx, vertex2Idx);
-					edgeSwap = Edge(vertex2Idx, vertex1Idx);
-					itEdge = m_edges.find(edge);
-					itEdgeSwap = m_edges.find(edgeSwap);
-
-					if (itEdge == m_edges.end() && itEdgeSwap == m_edges.end())
-						m_edges[edge].push_back(triangleIdx);
-					else if (itEdge != m_edges.end())
-						itEdge->second.push_back(triangleIdx);
-					else if (itEdgeSwap != m_edges.end())
-						itEdgeSwap->second.push_back(triangleIdx);
-						
+					triangles.emplace_back(triangleIdx, v0, v1, v2, vertex0Idx, vertex1Idx, vertex2Idx, normal, colour);
+
 					// Keep track of current triangle idx
 					triangleIdx++;
 				}
@@ -153,31 +125,58 @@ bool Parser::ParseFile(const char* fileName, float scale, glm::vec3 colour)
 		}
 	}
 
+	// The JSON document is still alive here, so this is the high-water mark of the load
+	CompleteLoad(std::move(mesh), memoryBefore);
 	return true;
 }
 
-const std::vector<Triangle>& Parser::GetTriangles() const
+WeldStats Parser::WeldVertices(float tolerance)
 {
-	return m_triangles;
+	WeldStats stats = ::WeldVertices(*m_mesh, tolerance);
+
+	if (m_logging)
+		std::cout << "Welding removed " << stats.verticesRemoved << " vertices and " << stats.trianglesRemoved << " triangles, "
+			<< m_mesh->vertices.size() << " vertices and " << m_mesh->triangles.size() << " triangles left" << std::endl;
+
+	return stats;
 }
 
-const std::vector<Vertex>& Parser::GetVertices() const
+void Parser::Subdivide(int levels)
 {
-	return m_vertices;
+	if (levels <= 0) return;
+
+	size_t triangleCount = m_mesh->triangles.size();
+	auto start = std::chrono::high_resolution_clock::now();
+	m_mesh = SubdivideMesh(*m_mesh, levels);
+	auto end = std::chrono::high_resolution_clock::now();
+
+	std::cout << "Subdivided " << triangleCount << " into " << m_mesh->triangles.size() << " triangles in "
+		<< std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
 }
 
-void Parser::CalculateVertexNormals()
+std::shared_ptr<const Mesh> Parser::GetMesh() const
 {
-	for (Vertex& vertex : m_vertices)
-	{
-		glm::vec3 averageNormal = glm::vec3(0);
-		for (int faceIdx : vertex.faces)
-		{
-			averageNormal += m_triangles[faceIdx].normal;
-		}
-		averageNormal /= (int)vertex.faces.size();
-		vertex.normal = averageNormal;
-	}
+	return m_mesh;
+}
+
+size_t Parser::GetPeakLoadMemory() const
+{
+	return m_peakLoadMemory;
+}
+
+void Parser::BuildVertexFaceAdjacency()
+{
+	::BuildVertexFaceAdjacency(*m_mesh);
+}
+
+void Parser::CalculateVertexNormals(NormalWeighting weighting)
+{
+	ComputeVertexNormals(*m_mesh, weighting);
+}
+
+void Parser::ReorderForLocality()
+{
+	::ReorderForLocality(*m_mesh);
 }
 
 float Parser::CalculateArea(const Triangle& triangle) const
@@ -195,7 +194,7 @@ float Parser::CalculateSmallestTriangleArea() const
 {
 	float minArea = 1e34f;
 	int triIdx = -1;
-	for (const auto& triangle : m_triangles)
+	for (const auto& triangle : m_mesh->triangles)
 	{
 		float area = CalculateArea(triangle);
 		if (area > 0 && area < minArea)
@@ -214,7 +213,7 @@ float Parser::CalculateLargestTriangleArea() const
 {
 	float maxArea = -1e34f;
 	int triIdx = -1;
-	for (const auto& triangle : m_triangles)
+	for (const auto& triangle : m_mesh->triangles)
 	{
 		float area = CalculateArea(triangle);
 		if (area > 0 && area > maxArea)
@@ -232,12 +231,12 @@ float Parser::CalculateLargestTriangleArea() const
 float Parser::CalculateAverageTriangleArea() const
 {
 	float areaSum = 0.f;
-	for (const auto& triangle : m_triangles)
+	for (const auto& triangle : m_mesh->triangles)
 	{
 		areaSum += CalculateArea(triangle);
 	}
 
-	areaSum /= static_cast<int>(m_triangles.size());
+	areaSum /= static_cast<int>(m_mesh->triangles.size());
 
 	std::cout << "Single thread: Average triangle area is " << areaSum << std::endl;
 
@@ -246,11 +245,11 @@ float Parser::CalculateAverageTriangleArea() const
 
 float Parser::CalculateSmallestAreaMultithreaded() const
 {
-	int trianglesCount = static_cast<int>(m_triangles.size());
+	int trianglesCount = static_cast<int>(m_mesh->triangles.size());
 
 	int triIdx = 0;
 	float minArea = 1e34f;
-	std::for_each(std::execution::par, m_triangles.begin(), m_triangles.end(),
+	std::for_each(std::execution::par, m_mesh->triangles.begin(), m_mesh->triangles.end(),
 		[this, &triIdx, &minArea](const Triangle& triangle)
 		{
 			float area = CalculateArea(triangle);
@@ -268,11 +267,11 @@ float Parser::CalculateSmallestAreaMultithreaded() const
 
 float Parser::CalculateLargestAreaMultithreaded() const
 {
-	int trianglesCount = static_cast<int>(m_triangles.size());
+	int trianglesCount = static_cast<int>(m_mesh->triangles.size());
 
 	int triIdx = 0;
 	float maxArea = -1e34f;
-	std::for_each(std::execution::par, m_triangles.begin(), m_triangles.end(),
+	std::for_each(std::execution::par, m_mesh->triangles.begin(), m_mesh->triangles.end(),
 		[this, &triIdx, &maxArea](const Triangle& triangle)
 		{
 			float area = CalculateArea(triangle);
@@ -290,7 +289,7 @@ float Parser::CalculateLargestAreaMultithreaded() const
 
 float Parser::CalculateAverageAreaMultithreaded() const
 {
-	int trianglesCount = static_cast<int>(m_triangles.size());
+	int trianglesCount = static_cast<int>(m_mesh->triangles.size());
 
 #if OWN_MULTI_THREADING
 	int num_threads = std::min(trianglesCount, (int)std::thread::hardware_concurrency());
@@ -308,7 +307,7 @@ float Parser::CalculateAverageAreaMultithreaded() const
 		for (int i = startIdx; i < endIdx; i++)
 		{
 			std::lock_guard<std::mutex> lock(mtx);
-			areaSum += CalculateArea(m_triangles[i]);
+			areaSum += CalculateArea(m_mesh->triangles[i]);
 		}
 	};
 
@@ -329,7 +328,7 @@ float Parser::CalculateAverageAreaMultithreaded() const
 #else
 	std::atomic<float> areaSum{ 0.f };
 
-	std::for_each(std::execution::par, m_triangles.begin(), m_triangles.end(),
+	std::for_each(std::execution::par, m_mesh->triangles.begin(), m_mesh->triangles.end(),
 		[this, &areaSum](const Triangle& triangle)
 		{
 			auto current = areaSum.load();
@@ -408,9 +407,28 @@ float Parser::CalculateAverageAreaCompared() const
 
 bool Parser::IsClosedMesh() const
 {
-	for (auto& edge : m_edges)
+	// Closed when every edge, whichever way round its triangles use it, is shared by two or
+	// more of them. Keys are sorted so equal edges sit next to each other.
+	int edgeCount = (int)m_mesh->triangles.size() * 3;
+	std::vector<uint64_t> keys(edgeCount);
+	std::vector<int> corners(edgeCount);
+	ParallelForRange(edgeCount, [&](int begin, int end)
+		{
+			for (int c = begin; c < end; c++)
+			{
+				const int* indices = m_mesh->triangles[c / 3].verIndices;
+				uint32_t a = (uint32_t)indices[c % 3], b = (uint32_t)indices[(c + 1) % 3];
+				keys[c] = ((uint64_t)std::min(a, b) << 32) | std::max(a, b);
+				corners[c] = c;
+			}
+		});
+	RadixSortPairs(keys, corners);
+
+	for (int c = 0; c < edgeCount; c++)
 	{
-		if (edge.second.size() < 2)
+		bool sharedBefore = c > 0 && keys[c - 1] == keys[c];
+		bool sharedAfter = c + 1 < edgeCount && keys[c + 1] == keys[c];
+		if (!sharedBefore && !sharedAfter)
 			return false;
 	}
 	return true;
@@ -7,9 +7,29 @@ public:
 	Parser();
 
 public:
+	// Picks the loader by extension: .stl and .ply are read as binary, anything else as JSON
+	bool LoadFile(const char* fileName, float scale, glm::vec3 colour);
 	bool ParseFile(const char* fileName, float scale, glm::vec3 colour);
+	// The same JSON model from text already in memory, for callers that read the file themselves
+	bool ParseJSON(const char* text, size_t length, float scale, glm::vec3 colour);
+	// Binary STL and binary little-endian PLY (ParserBinary.cpp); PLY polygons are split into fans
+	bool ParseSTL(const char* fileName, float scale, glm::vec3 colour);
+	bool ParsePLY(const char* fileName, float scale, glm::vec3 colour);
+	// Write the mesh's vertices as loaded, before scale and rotation, so loading the file again
+	// with the same scale gives back the same mesh
+	static bool WriteSTL(const Mesh& mesh, const std::string& path);
+	static bool WritePLY(const Mesh& mesh, const std::string& path);
+	// Loads a JSON model, writes it as STL and PLY next to it and times loading all three
+	static std::string CompareLoaders(const std::string& jsonPath, float scale);
+	// Before vertex normals: merges vertices within tolerance times the mesh's size and drops
+	// the triangles that collapse
+	WeldStats WeldVertices(float tolerance);
+	// Only runs when asked for: replaces the mesh with one levels of 1-to-4 midpoint splits finer
+	void Subdivide(int levels);
 
-	void CalculateVertexNormals();
+	void BuildVertexFaceAdjacency();
+	void CalculateVertexNormals(NormalWeighting weighting = NormalWeighting::Uniform);
+	void ReorderForLocality();
 
 	float CalculateArea(const Triangle& triangle) const;
 
@@ -27,12 +47,20 @@ public:
 
 	bool IsClosedMesh() const;
 
-	const std::vector<Triangle>& GetTriangles() const;
-	const std::vector<Vertex>& GetVertices() const;
+	std::shared_ptr<const Mesh> GetMesh() const;
+	size_t GetPeakLoadMemory() const;
+	// Off stops the per-load summary, for callers loading many files at once
+	void SetLogging(bool enabled) { m_logging = enabled; }
 
 private:
-	std::vector<Triangle> m_triangles;
-	std::vector<Triangle> m_quadingles;
-	std::vector<Vertex> m_vertices;
-	std::map<Edge, std::vector<int>> m_edges;
+	static glm::mat4 GetImportTransform(float scale);
+	// Shared by ParseFile and ParseJSON once the document is parsed
+	bool LoadDocument(const rapidjson::Document& doc, float scale, glm::vec3 colour, size_t memoryBefore);
+	// Shared tail of every loader: takes the mesh, builds its adjacency and reports memory
+	void CompleteLoad(std::shared_ptr<Mesh> mesh, size_t memoryBefore);
+
+private:
+	std::shared_ptr<Mesh> m_mesh;
+	size_t m_peakLoadMemory = 0;
+	bool m_logging = true;
 };
\ No newline at end of file
@@ -0,0 +1,553 @@
+#include "utils.h"
+#include <climits>
+#include <cstring>
+#include <sstream>
+
+// Binary mesh formats. Files are memory-mapped and decoded straight into the mesh's vertex and
+// triangle arrays by parallel workers, each owning a range of records, so no text is parsed and
+// nothing is staged in between. Both formats are little-endian on disk, like every platform we
+// build for, so values are copied out unchanged.
+
+#define STL_HEADER_BYTES 80
+#define STL_TRIANGLE_BYTES 50
+// Generous for any header we'd write or meet; PLY headers are a few hundred bytes
+#define PLY_MAX_HEADER_BYTES 65536
+
+template<typename T>
+static T ReadValue(const uint8_t* p)
+{
+	T value;
+	memcpy(&value, p, sizeof(T));
+	return value;
+}
+
+glm::mat4 Parser::GetImportTransform(float scale)
+{
+	// Models are exported Z-up; the renderer is Y-up
+	glm::mat4 transform = glm::mat4(1.0f);
+	transform = glm::scale(transform, glm::vec3(scale));
+	transform = glm::rotate(transform, PI / 2, glm::vec3(1, 0, 0));
+	return transform;
+}
+
+bool Parser::LoadFile(const char* fileName, float scale, glm::vec3 colour)
+{
+	std::string name(fileName);
+	size_t dot = name.find_last_of('.');
+	std::string extension = dot == std::string::npos ? "" : name.substr(dot);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return (char)tolower(c); });
+
+	if (extension == ".stl") return ParseSTL(fileName, scale, colour);
+	if (extension == ".ply") return ParsePLY(fileName, scale, colour);
+	return ParseFile(fileName, scale, colour);
+}
+
+void Parser::CompleteLoad(std::shared_ptr<Mesh> mesh, size_t memoryBefore)
+{
+	m_mesh = std::move(mesh);
+
+	// Adjacency for smooth normals (and anything else that walks faces around a vertex)
+	BuildVertexFaceAdjacency();
+
+	size_t memoryAfter = GetCurrentMemoryUsage();
+	m_peakLoadMemory = memoryAfter > memoryBefore ? memoryAfter - memoryBefore : 0;
+
+	if (!m_logging) return;
+	std::cout << "Loaded " << m_mesh->triangles.size() << " triangles and " << m_mesh->vertices.size() << " vertices, mesh uses "
+		<< m_mesh->GetMemoryUsage() / (1024.0 * 1024.0) << "MB, load peak " << m_peakLoadMemory / (1024.0 * 1024.0)
+		<< "MB (process peak " << GetPeakMemoryUsage() / (1024.0 * 1024.0) << "MB)" << std::endl;
+}
+
+bool Parser::ParseSTL(const char* fileName, float scale, glm::vec3 colour)
+{
+	size_t memoryBefore = GetCurrentMemoryUsage();
+
+	MappedFile file;
+	if (!file.Open(fileName))
+	{
+		std::cerr << "Error: cannot open STL file." << std::endl;
+		return false;
+	}
+	const uint8_t* data = file.GetData();
+	uint64_t size = file.GetSize();
+	uint64_t triangleCount = size >= STL_HEADER_BYTES + 4 ? ReadValue<uint32_t>(data + STL_HEADER_BYTES) : 0;
+	// An ASCII file fails this too, as its "triangle count" is four characters of text
+	if (size < STL_HEADER_BYTES + 4 || STL_HEADER_BYTES + 4 + triangleCount * STL_TRIANGLE_BYTES > size || triangleCount * 3 > INT_MAX)
+	{
+		std::cerr << "Error: not a binary STL file." << std::endl;
+		return false;
+	}
+
+	// STL has no shared vertices: every triangle brings its own three, for welding to merge
+	std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+	mesh->triangles.resize(triangleCount);
+	mesh->vertices.resize(triangleCount * 3);
+	glm::mat4 transform = GetImportTransform(scale);
+	const uint8_t* records = data + STL_HEADER_BYTES + 4;
+	ParallelForRange((int)triangleCount, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				// The stored normal is skipped: it is often zero, and ours must follow the JSON winding
+				const uint8_t* corners = records + (size_t)i * STL_TRIANGLE_BYTES + 12;
+				glm::vec3 v[3];
+				for (int c = 0; c < 3; c++)
+				{
+					glm::vec3 position(ReadValue<float>(corners + c * 12), ReadValue<float>(corners + c * 12 + 4), ReadValue<float>(corners + c * 12 + 8));
+					mesh->vertices[i * 3 + c] = Vertex(position);
+					v[c] = glm::vec4(position, 1.f) * transform;
+				}
+				glm::vec3 normal = cross(normalize(v[2] - v[0]), normalize(v[1] - v[0]));
+				mesh->triangles[i] = Triangle(i, v[0], v[1], v[2], i * 3, i * 3 + 1, i * 3 + 2, normal, colour);
+			}
+		}, 1024);
+
+	CompleteLoad(std::move(mesh), memoryBefore);
+	return true;
+}
+
+namespace
+{
+	enum class PlyType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64, Invalid };
+
+	struct PlyProperty
+	{
+		std::string name;
+		PlyType type = PlyType::Invalid;
+		// Lists store a count of countType, then that many items of type
+		bool isList = false;
+		PlyType countType = PlyType::Invalid;
+	};
+
+	struct PlyElement
+	{
+		std::string name;
+		uint64_t count = 0;
+		std::vector<PlyProperty> properties;
+	};
+
+	PlyType ParsePlyType(const std::string& name)
+	{
+		if (name == "char" || name == "int8") return PlyType::Int8;
+		if (name == "uchar" || name == "uint8") return PlyType::UInt8;
+		if (name == "short" || name == "int16") return PlyType::Int16;
+		if (name == "ushort" || name == "uint16") return PlyType::UInt16;
+		if (name == "int" || name == "int32") return PlyType::Int32;
+		if (name == "uint" || name == "uint32") return PlyType::UInt32;
+		if (name == "float" || name == "float32") return PlyType::Float32;
+		if (name == "double" || name == "float64") return PlyType::Float64;
+		return PlyType::Invalid;
+	}
+
+	int PlyTypeSize(PlyType type)
+	{
+		switch (type)
+		{
+		case PlyType::Int8: case PlyType::UInt8: return 1;
+		case PlyType::Int16: case PlyType::UInt16: return 2;
+		case PlyType::Float64: return 8;
+		default: return 4;
+		}
+	}
+
+	double ReadPlyValue(const uint8_t* p, PlyType type)
+	{
+		switch (type)
+		{
+		case PlyType::Int8: return ReadValue<int8_t>(p);
+		case PlyType::UInt8: return ReadValue<uint8_t>(p);
+		case PlyType::Int16: return ReadValue<int16_t>(p);
+		case PlyType::UInt16: return ReadValue<uint16_t>(p);
+		case PlyType::Int32: return ReadValue<int32_t>(p);
+		case PlyType::UInt32: return ReadValue<uint32_t>(p);
+		case PlyType::Float32: return ReadValue<float>(p);
+		default: return ReadValue<double>(p);
+		}
+	}
+
+	// Index types are read without a detour through double, as they are the bulk of a face
+	int64_t ReadPlyIndex(const uint8_t* p, PlyType type)
+	{
+		switch (type)
+		{
+		case PlyType::Int8: return ReadValue<int8_t>(p);
+		case PlyType::UInt8: return ReadValue<uint8_t>(p);
+		case PlyType::Int16: return ReadValue<int16_t>(p);
+		case PlyType::UInt16: return ReadValue<uint16_t>(p);
+		case PlyType::Int32: return ReadValue<int32_t>(p);
+		case PlyType::UInt32: return ReadValue<uint32_t>(p);
+		default: return -1;
+		}
+	}
+
+	// Elements up to "end_header"; false for anything but binary little-endian 1.0
+	bool ParsePlyHeader(const uint8_t* data, uint64_t size, std::vector<PlyElement>& elements, uint64_t& headerBytes)
+	{
+		std::string header((const char*)data, (size_t)std::min<uint64_t>(size, PLY_MAX_HEADER_BYTES));
+		size_t end = header.find("end_header");
+		if (header.compare(0, 3, "ply") != 0 || end == std::string::npos) return false;
+		size_t endOfLine = header.find('\n', end);
+		if (endOfLine == std::string::npos) return false;
+		headerBytes = endOfLine + 1;
+
+		std::istringstream lines(header.substr(0, end));
+		std::string line;
+		bool binaryLittleEndian = false;
+		while (std::getline(lines, line))
+		{
+			std::istringstream tokens(line);
+			std::string keyword;
+			tokens >> keyword;
+			if (keyword == "format")
+			{
+				std::string format, version;
+				tokens >> format >> version;
+				binaryLittleEndian = format == "binary_little_endian" && version == "1.0";
+			}
+			else if (keyword == "element")
+			{
+				PlyElement& element = elements.emplace_back();
+				tokens >> element.name >> element.count;
+			}
+			else if (keyword == "property" && !elements.empty())
+			{
+				PlyProperty& property = elements.back().properties.emplace_back();
+				std::string type;
+				tokens >> type;
+				if (type == "list")
+				{
+					std::string countType, itemType;
+					tokens >> countType >> itemType;
+					property.isList = true;
+					property.countType = ParsePlyType(countType);
+					property.type = ParsePlyType(itemType);
+					if (property.countType == PlyType::Invalid) return false;
+				}
+				else
+				{
+					property.type = ParsePlyType(type);
+				}
+				tokens >> property.name;
+				if (property.type == PlyType::Invalid) return false;
+			}
+		}
+		return binaryLittleEndian;
+	}
+}
+
+bool Parser::ParsePLY(const char* fileName, float scale, glm::vec3 colour)
+{
+	size_t memoryBefore = GetCurrentMemoryUsage();
+
+	MappedFile file;
+	if (!file.Open(fileName))
+	{
+		std::cerr << "Error: cannot open PLY file." << std::endl;
+		return false;
+	}
+	const uint8_t* data = file.GetData();
+	uint64_t size = file.GetSize();
+	std::vector<PlyElement> elements;
+	uint64_t offset = 0;
+	if (!ParsePlyHeader(data, size, elements, offset))
+	{
+		std::cerr << "Error: only binary little-endian PLY files are supported." << std::endl;
+		return false;
+	}
+
+	std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+	std::vector<Triangle>& triangles = mesh->triangles;
+	std::vector<Vertex>& vertices = mesh->vertices;
+	glm::mat4 transform = GetImportTransform(scale);
+	bool facesRead = false;
+
+	for (const PlyElement& element : elements)
+	{
+		// Layout of one record: the scalars are at fixed offsets up to the first list
+		int fixedBytes = 0, listCount = 0, listOffset = 0;
+		const PlyProperty* list = nullptr;
+		int xOffset = -1, yOffset = -1, zOffset = -1;
+		PlyType xType = PlyType::Invalid, yType = PlyType::Invalid, zType = PlyType::Invalid;
+		for (const PlyProperty& property : element.properties)
+		{
+			if (property.isList)
+			{
+				listCount++;
+				list = &property;
+				listOffset = fixedBytes;
+				continue;
+			}
+			if (listCount == 0)
+			{
+				if (property.name == "x") { xOffset = fixedBytes; xType = property.type; }
+				if (property.name == "y") { yOffset = fixedBytes; yType = property.type; }
+				if (property.name == "z") { zOffset = fixedBytes; zType = property.type; }
+			}
+			fixedBytes += PlyTypeSize(property.type);
+		}
+
+		if (element.name == "vertex")
+		{
+			if (listCount > 0 || xOffset < 0 || yOffset < 0 || zOffset < 0 || element.count > INT_MAX || offset + element.count * fixedBytes > size)
+			{
+				std::cerr << "Error: PLY vertices need fixed-size records with x, y and z." << std::endl;
+				return false;
+			}
+			bool allFloat = xType == PlyType::Float32 && yType == PlyType::Float32 && zType == PlyType::Float32;
+			vertices.resize(element.count);
+			const uint8_t* records = data + offset;
+			ParallelForRange((int)element.count, [&](int begin, int last)
+				{
+					for (int v = begin; v < last; v++)
+					{
+						const uint8_t* record = records + (size_t)v * fixedBytes;
+						glm::vec3 position = allFloat
+							? glm::vec3(ReadValue<float>(record + xOffset), ReadValue<float>(record + yOffset), ReadValue<float>(record + zOffset))
+							: glm::vec3((float)ReadPlyValue(record + xOffset, xType), (float)ReadPlyValue(record + yOffset, yType), (float)ReadPlyValue(record + zOffset, zType));
+						vertices[v] = Vertex(position);
+					}
+				}, 4096);
+			offset += element.count * fixedBytes;
+			continue;
+		}
+
+		if (element.name == "face" && listCount == 1 && list->type != PlyType::Float32 && list->type != PlyType::Float64 && element.count <= INT_MAX)
+		{
+			int countBytes = PlyTypeSize(list->countType), indexBytes = PlyTypeSize(list->type);
+			int faceCount = (int)element.count;
+
+			// Meshes written as triangles throughout have fixed-size faces, which the parallel
+			// check confirms: if every face up to i holds 3 indices, face i is where it's assumed
+			// to be. Otherwise the faces are walked once to find where each starts.
+			int triangleStride = fixedBytes + countBytes + 3 * indexBytes;
+			std::atomic<bool> allTriangles = offset + (uint64_t)faceCount * triangleStride <= size;
+			if (allTriangles)
+			{
+				ParallelForRange(faceCount, [&](int begin, int last)
+					{
+						for (int f = begin; f < last && allTriangles.load(std::memory_order_relaxed); f++)
+							if (ReadPlyIndex(data + offset + (size_t)f * triangleStride + listOffset, list->countType) != 3)
+								allTriangles = false;
+					}, 4096);
+			}
+			std::vector<uint64_t> faceStarts;
+			std::vector<int> firstTriangles;
+			int triangleCount = faceCount;
+			if (!allTriangles)
+			{
+				// Polygons become fans, so each face's first triangle is needed as well
+				faceStarts.resize(faceCount + 1);
+				firstTriangles.resize(faceCount + 1);
+				uint64_t position = offset;
+				int64_t triangleTotal = 0;
+				bool truncated = false;
+				for (int f = 0; f < faceCount && !truncated; f++)
+				{
+					if (position + listOffset + countBytes > size)
+					{
+						truncated = true;
+						break;
+					}
+					int64_t corners = ReadPlyIndex(data + position + listOffset, list->countType);
+					faceStarts[f] = position;
+					firstTriangles[f] = (int)triangleTotal;
+					triangleTotal += std::max<int64_t>(0, corners - 2);
+					position += fixedBytes + countBytes + std::max<int64_t>(0, corners) * indexBytes;
+					truncated = triangleTotal > INT_MAX || position > size;
+				}
+				if (truncated)
+				{
+					std::cerr << "Error: PLY faces run past the end of the file." << std::endl;
+					return false;
+				}
+				faceStarts[faceCount] = position;
+				firstTriangles[faceCount] = (int)triangleTotal;
+				triangleCount = (int)triangleTotal;
+			}
+
+			triangles.resize(triangleCount);
+			std::atomic<bool> indicesValid = true;
+			int vertexCount = (int)vertices.size();
+			ParallelForRange(faceCount, [&](int begin, int last)
+				{
+					for (int f = begin; f < last; f++)
+					{
+						const uint8_t* face = data + (allTriangles ? offset + (size_t)f * triangleStride : faceStarts[f]);
+						int corners = allTriangles ? 3 : (int)ReadPlyIndex(face + listOffset, list->countType);
+						const uint8_t* indices = face + listOffset + countBytes;
+						int triangleIdx = allTriangles ? f : firstTriangles[f];
+						int first = (int)ReadPlyIndex(indices, list->type);
+						for (int c = 2; c < corners; c++)
+						{
+							int64_t idx[3] = { first, ReadPlyIndex(indices + (c - 1) * indexBytes, list->type), ReadPlyIndex(indices + c * indexBytes, list->type) };
+							if (idx[0] < 0 || idx[0] >= vertexCount || idx[1] < 0 || idx[1] >= vertexCount || idx[2] < 0 || idx[2] >= vertexCount)
+							{
+								indicesValid = false;
+								idx[0] = idx[1] = idx[2] = 0;
+							}
+							glm::vec3 v[3];
+							for (int k = 0; k < 3; k++)
+								v[k] = glm::vec4(vertices[idx[k]].GetPosition(), 1.f) * transform;
+							glm::vec3 normal = cross(normalize(v[2] - v[0]), normalize(v[1] - v[0]));
+							triangles[triangleIdx] = Triangle(triangleIdx, v[0], v[1], v[2], (int)idx[0], (int)idx[1], (int)idx[2], normal, colour);
+							triangleIdx++;
+						}
+					}
+				}, 1024);
+			if (!indicesValid)
+			{
+				std::cerr << "Error: PLY face refers to a vertex that doesn't exist." << std::endl;
+				return false;
+			}
+			offset = allTriangles ? offset + (uint64_t)faceCount * triangleStride : faceStarts[faceCount];
+			facesRead = true;
+			continue;
+		}
+
+		// Anything else is skipped, which for list elements means walking their records
+		if (listCount == 0)
+		{
+			offset += element.count * fixedBytes;
+		}
+		else
+		{
+			for (uint64_t r = 0; r < element.count && offset <= size; r++)
+			{
+				for (const PlyProperty& property : element.properties)
+				{
+					if (!property.isList)
+					{
+						offset += PlyTypeSize(property.type);
+						continue;
+					}
+					if (offset + PlyTypeSize(property.countType) > size)
+					{
+						offset = size + 1;
+						break;
+					}
+					int64_t items = ReadPlyIndex(data + offset, property.countType);
+					offset += PlyTypeSize(property.countType) + std::max<int64_t>(0, items) * PlyTypeSize(property.type);
+				}
+			}
+		}
+		if (offset > size)
+		{
+			std::cerr << "Error: PLY element " << element.name << " runs past the end of the file." << std::endl;
+			return false;
+		}
+	}
+
+	if (!facesRead)
+	{
+		std::cerr << "Error: PLY file has no vertices or faces." << std::endl;
+		return false;
+	}
+
+	CompleteLoad(std::move(mesh), memoryBefore);
+	return true;
+}
+
+bool Parser::WriteSTL(const Mesh& mesh, const std::string& path)
+{
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp) return false;
+
+	uint8_t header[STL_HEADER_BYTES] = {};
+	uint32_t triangleCount = (uint32_t)mesh.triangles.size();
+	bool ok = fwrite(header, 1, sizeof(header), fp) == sizeof(header) && fwrite(&triangleCount, 4, 1, fp) == 1;
+	std::vector<uint8_t> records((size_t)triangleCount * STL_TRIANGLE_BYTES, 0);
+	ParallelForRange((int)triangleCount, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				// Normal left zero, attribute bytes too; loaders work the normal out themselves
+				uint8_t* corners = &records[(size_t)i * STL_TRIANGLE_BYTES + 12];
+				for (int c = 0; c < 3; c++)
+				{
+					glm::vec3 position = mesh.vertices[mesh.triangles[i].verIndices[c]].GetPosition();
+					memcpy(corners + c * 12, &position.x, 4);
+					memcpy(corners + c * 12 + 4, &position.y, 4);
+					memcpy(corners + c * 12 + 8, &position.z, 4);
+				}
+			}
+		}, 4096);
+	ok = ok && fwrite(records.data(), 1, records.size(), fp) == records.size();
+	return fclose(fp) == 0 && ok;
+}
+
+bool Parser::WritePLY(const Mesh& mesh, const std::string& path)
+{
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp) return false;
+
+	std::string header = "ply\nformat binary_little_endian 1.0\nelement vertex " + std::to_string(mesh.vertices.size())
+		+ "\nproperty float x\nproperty float y\nproperty float z\nelement face " + std::to_string(mesh.triangles.size())
+		+ "\nproperty list uchar int vertex_indices\nend_header\n";
+	bool ok = fwrite(header.data(), 1, header.size(), fp) == header.size();
+
+	std::vector<float> positions(mesh.vertices.size() * 3);
+	for (size_t v = 0; v < mesh.vertices.size(); v++)
+	{
+		positions[v * 3] = mesh.vertices[v].position.x;
+		positions[v * 3 + 1] = mesh.vertices[v].position.y;
+		positions[v * 3 + 2] = mesh.vertices[v].position.z;
+	}
+	ok = ok && fwrite(positions.data(), sizeof(float), positions.size(), fp) == positions.size();
+
+	const int faceBytes = 1 + 3 * 4;
+	std::vector<uint8_t> faces(mesh.triangles.size() * faceBytes);
+	ParallelForRange((int)mesh.triangles.size(), [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				faces[(size_t)i * faceBytes] = 3;
+				memcpy(&faces[(size_t)i * faceBytes + 1], mesh.triangles[i].verIndices, 3 * 4);
+			}
+		}, 4096);
+	ok = ok && fwrite(faces.data(), 1, faces.size(), fp) == faces.size();
+	return fclose(fp) == 0 && ok;
+}
+
+std::string Parser::CompareLoaders(const std::string& jsonPath, float scale)
+{
+	std::string basePath = jsonPath.substr(0, jsonPath.find_last_of('.'));
+	std::string paths[] = { jsonPath, basePath + ".stl", basePath + ".ply" };
+	const char* formatNames[] = { "JSON", "Binary STL", "Binary PLY" };
+
+	std::string summary;
+	size_t triangleCount = 0;
+	for (int format = 0; format < 3; format++)
+	{
+		Parser parser;
+
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+		bool loaded = parser.LoadFile(paths[format].c_str(), scale, glm::vec3(1.f));
+
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+		if (!loaded) return summary + "Failed to load " + paths[format] + "\n";
+		if (format == 0)
+		{
+			// The binary files are made from the JSON mesh, so all three hold the same triangles
+			triangleCount = parser.GetMesh()->triangles.size();
+			if (!WriteSTL(*parser.GetMesh(), paths[1]) || !WritePLY(*parser.GetMesh(), paths[2]))
+				return "Failed to write " + paths[1] + " or " + paths[2] + "\n";
+		}
+
+		double seconds = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0;
+		MappedFile file;
+		double megabytes = file.Open(paths[format]) ? file.GetSize() / (1024.0 * 1024.0) : 0.0;
+		double megabytesPerSecond = seconds > 0 ? megabytes / seconds : 0;
+		double trianglesPerSecond = seconds > 0 ? triangleCount / seconds : 0;
+
+		std::cout << formatNames[format] << ": " << megabytes << "MB in " << seconds * 1000.0 << "ms, " << megabytesPerSecond << " MB/s, "
+			<< trianglesPerSecond / 1000000.0 << " Mtriangles/s" << std::endl;
+
+		char line[160];
+		snprintf(line, sizeof(line), "%s: %.1fMB in %.0fms, %.0f MB/s, %.2f Mtriangles/s\n", formatNames[format], megabytes, seconds * 1000.0, megabytesPerSecond, trianglesPerSecond / 1000000.0);
+		summary += line;
+	}
+
+	return summary;
+}
@@ -0,0 +1,41 @@
+#include "utils.h"
+
+#ifdef WL_PLATFORM_WINDOWS
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+size_t GetCurrentMemoryUsage()
+{
+#ifdef WL_PLATFORM_WINDOWS
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return pmc.WorkingSetSize;
+	return 0;
+#else
+	long pages = 0;
+	FILE* fp = fopen("/proc/self/statm", "r");
+	if (!fp) return 0;
+	if (fscanf(fp, "%*s %ld", &pages) != 1) pages = 0;
+	fclose(fp);
+	return (size_t)pages * (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+size_t GetPeakMemoryUsage()
+{
+#ifdef WL_PLATFORM_WINDOWS
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return pmc.PeakWorkingSetSize;
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	return (size_t)usage.ru_maxrss * 1024;
+#endif
+}
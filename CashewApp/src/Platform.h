@@ -0,0 +1,5 @@
+#pragma once
+
+// Process memory in bytes, as reported by the OS (0 if unavailable)
+size_t GetCurrentMemoryUsage();
+size_t GetPeakMemoryUsage();
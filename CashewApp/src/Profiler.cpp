@@ -0,0 +1,193 @@
+#include "utils.h"
+#include <fstream>
+#include <iomanip>
+
+#define PROFILE_PHASES (int)ProfilePhase::Count
+#define PROFILE_COUNTERS (int)ProfileCounter::Count
+
+struct ProfileCounterSample
+{
+	uint64_t timeNs;
+	uint64_t values[PROFILE_COUNTERS];
+};
+
+struct ProfilerState
+{
+	std::mutex mutex;
+	// Never freed: a thread's totals must stay readable after the thread is gone
+	std::vector<std::unique_ptr<ProfileThreadData>> threads;
+	uint64_t phaseTotals[PROFILE_PHASES] = {};
+	uint64_t counterTotals[PROFILE_COUNTERS] = {};
+	float phaseHistory[PROFILE_PHASES][Profiler::HistoryLength] = {};
+	float counterHistory[PROFILE_COUNTERS][Profiler::HistoryLength] = {};
+	int historyOffset = 0;
+
+	std::atomic<bool> capturing{ false };
+	int captureFramesLeft = 0;
+	std::vector<ProfileCounterSample> counterSamples;
+
+	std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+};
+
+static ProfilerState& GetState()
+{
+	static ProfilerState state;
+	return state;
+}
+
+const char* Profiler::GetName(ProfilePhase phase)
+{
+	const char* names[] = { "Frame", "Ray generation", "Traversal", "Shading", "Ray sorting", "Tone mapping", "Image upload" };
+	return names[(int)phase];
+}
+
+const char* Profiler::GetName(ProfileCounter counter)
+{
+	const char* names[] = { "Rays cast", "Nodes visited", "Triangles tested" };
+	return names[(int)counter];
+}
+
+uint64_t Profiler::Now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - GetState().origin).count();
+}
+
+ProfileThreadData* Profiler::RegisterThread()
+{
+	ProfilerState& state = GetState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	ProfileThreadData* data = state.threads.emplace_back(std::make_unique<ProfileThreadData>()).get();
+	data->threadIdx = (int)state.threads.size();
+	return data;
+}
+
+void Profiler::AddTime(ProfilePhase phase, uint64_t startNs, uint64_t endNs)
+{
+	ProfileThreadData& data = GetThreadData();
+	std::atomic<uint64_t>& total = data.phaseNs[(int)phase];
+	total.store(total.load(std::memory_order_relaxed) + (endNs - startNs), std::memory_order_relaxed);
+	if (GetState().capturing.load(std::memory_order_relaxed))
+		data.events.push_back({ phase, startNs, endNs });
+}
+
+void Profiler::EndFrame()
+{
+	ProfilerState& state = GetState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+
+	// Totals only ever grow; this frame is the difference to the last fold
+	uint64_t phaseSums[PROFILE_PHASES] = {}, counterSums[PROFILE_COUNTERS] = {};
+	for (const std::unique_ptr<ProfileThreadData>& data : state.threads)
+	{
+		for (int p = 0; p < PROFILE_PHASES; p++)
+			phaseSums[p] += data->phaseNs[p].load(std::memory_order_relaxed);
+		for (int c = 0; c < PROFILE_COUNTERS; c++)
+			counterSums[c] += data->counters[c].load(std::memory_order_relaxed);
+	}
+
+	int slot = state.historyOffset;
+	for (int p = 0; p < PROFILE_PHASES; p++)
+	{
+		state.phaseHistory[p][slot] = (phaseSums[p] - state.phaseTotals[p]) / 1000000.f;
+		state.phaseTotals[p] = phaseSums[p];
+	}
+	ProfileCounterSample sample = { Now(), {} };
+	for (int c = 0; c < PROFILE_COUNTERS; c++)
+	{
+		sample.values[c] = counterSums[c] - state.counterTotals[c];
+		state.counterHistory[c][slot] = (float)sample.values[c];
+		state.counterTotals[c] = counterSums[c];
+	}
+	state.historyOffset = (slot + 1) % HistoryLength;
+
+	if (state.capturing)
+	{
+		state.counterSamples.push_back(sample);
+		if (--state.captureFramesLeft <= 0)
+			state.capturing = false;
+	}
+}
+
+const float* Profiler::GetHistory(ProfilePhase phase)
+{
+	return GetState().phaseHistory[(int)phase];
+}
+
+const float* Profiler::GetHistory(ProfileCounter counter)
+{
+	return GetState().counterHistory[(int)counter];
+}
+
+int Profiler::GetHistoryOffset()
+{
+	return GetState().historyOffset;
+}
+
+float Profiler::GetLastFrame(ProfilePhase phase)
+{
+	ProfilerState& state = GetState();
+	return state.phaseHistory[(int)phase][(state.historyOffset + HistoryLength - 1) % HistoryLength];
+}
+
+float Profiler::GetLastFrame(ProfileCounter counter)
+{
+	ProfilerState& state = GetState();
+	return state.counterHistory[(int)counter][(state.historyOffset + HistoryLength - 1) % HistoryLength];
+}
+
+float Profiler::GetAverage(ProfilePhase phase)
+{
+	const float* history = GetHistory(phase);
+	return std::accumulate(history, history + HistoryLength, 0.f) / HistoryLength;
+}
+
+void Profiler::StartCapture(int frameCount)
+{
+	ProfilerState& state = GetState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	// Nobody records events while no capture runs, so the buffers can be cleared here
+	for (const std::unique_ptr<ProfileThreadData>& data : state.threads)
+		data->events.clear();
+	state.counterSamples.clear();
+	state.captureFramesLeft = std::max(1, frameCount);
+	state.capturing = true;
+}
+
+bool Profiler::IsCapturing()
+{
+	return GetState().capturing;
+}
+
+bool Profiler::ExportChromeTrace(const std::string& path)
+{
+	ProfilerState& state = GetState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	if (state.capturing) return false;
+
+	std::ofstream file(path);
+	if (!file) return false;
+	file << std::fixed << std::setprecision(3);
+
+	// Complete ("X") events per timed scope and one counter ("C") event per frame, times in microseconds
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	bool first = true;
+	for (const std::unique_ptr<ProfileThreadData>& data : state.threads)
+	{
+		for (const ProfileEvent& event : data->events)
+		{
+			file << (first ? "" : ",\n") << "{\"name\":\"" << GetName(event.phase) << "\",\"cat\":\"cashew\",\"ph\":\"X\",\"pid\":1,\"tid\":" << data->threadIdx
+				<< ",\"ts\":" << event.startNs / 1000.0 << ",\"dur\":" << (event.endNs - event.startNs) / 1000.0 << "}";
+			first = false;
+		}
+	}
+	for (const ProfileCounterSample& sample : state.counterSamples)
+	{
+		file << (first ? "" : ",\n") << "{\"name\":\"Per frame\",\"ph\":\"C\",\"pid\":1,\"tid\":0,\"ts\":" << sample.timeNs / 1000.0 << ",\"args\":{";
+		for (int c = 0; c < PROFILE_COUNTERS; c++)
+			file << (c ? "," : "") << "\"" << GetName((ProfileCounter)c) << "\":" << sample.values[c];
+		file << "}}";
+		first = false;
+	}
+	file << "\n]}\n";
+	return (bool)file;
+}
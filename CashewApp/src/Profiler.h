@@ -0,0 +1,112 @@
+#pragma once
+
+// Per-phase timers and hot-path counters. Every thread accumulates into its own cache line and the
+// UI thread folds those into one frame of history per EndFrame, so recording never contends.
+// PROFILE_SCOPE and PROFILE_COUNT compile to nothing in Dist builds.
+
+#ifndef WL_DIST
+#define CASHEW_PROFILING
+#endif
+
+enum class ProfilePhase
+{
+	Frame,
+	RayGeneration,
+	Traversal,
+	Shading,
+	RaySorting,
+	ToneMapping,
+	ImageUpload,
+	Count
+};
+
+enum class ProfileCounter
+{
+	RaysCast,
+	NodesVisited,
+	TrianglesTested,
+	Count
+};
+
+struct ProfileEvent
+{
+	ProfilePhase phase;
+	uint64_t startNs, endNs;
+};
+
+struct alignas(64) ProfileThreadData
+{
+	// Written only by the owning thread; atomics so the UI thread may read them mid-frame
+	std::atomic<uint64_t> phaseNs[(int)ProfilePhase::Count] = {};
+	std::atomic<uint64_t> counters[(int)ProfileCounter::Count] = {};
+	// Timed scopes while a trace capture runs
+	std::vector<ProfileEvent> events;
+	int threadIdx = 0;
+};
+
+class Profiler
+{
+public:
+	static const int HistoryLength = 240;
+
+	static const char* GetName(ProfilePhase phase);
+	static const char* GetName(ProfileCounter counter);
+
+	// Folds every thread's totals into one frame of history; call once per frame from the UI thread
+	static void EndFrame();
+	// HistoryLength values for PlotHistogram: phase milliseconds summed over all threads, or counts.
+	// The oldest frame is at GetHistoryOffset().
+	static const float* GetHistory(ProfilePhase phase);
+	static const float* GetHistory(ProfileCounter counter);
+	static int GetHistoryOffset();
+	static float GetLastFrame(ProfilePhase phase);
+	static float GetLastFrame(ProfileCounter counter);
+	static float GetAverage(ProfilePhase phase);
+
+	// Records every timed scope over the next frameCount frames
+	static void StartCapture(int frameCount);
+	static bool IsCapturing();
+	// Writes the last capture as Chrome trace events (chrome://tracing or ui.perfetto.dev).
+	// Call between frames, while no worker is inside a timed scope.
+	static bool ExportChromeTrace(const std::string& path);
+
+	// Hot path, use the macros below
+	static uint64_t Now();
+	static void AddTime(ProfilePhase phase, uint64_t startNs, uint64_t endNs);
+	static void AddCount(ProfileCounter counter, uint64_t n)
+	{
+		std::atomic<uint64_t>& value = GetThreadData().counters[(int)counter];
+		// Single writer, so a plain load and store is enough and avoids a locked add
+		value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+private:
+	static ProfileThreadData& GetThreadData()
+	{
+		static thread_local ProfileThreadData* threadData = nullptr;
+		if (!threadData) threadData = RegisterThread();
+		return *threadData;
+	}
+	static ProfileThreadData* RegisterThread();
+};
+
+class ScopedProfileTimer
+{
+public:
+	ScopedProfileTimer(ProfilePhase phase) : m_phase(phase), m_start(Profiler::Now()) {}
+	~ScopedProfileTimer() { Profiler::AddTime(m_phase, m_start, Profiler::Now()); }
+
+private:
+	ProfilePhase m_phase;
+	uint64_t m_start;
+};
+
+#ifdef CASHEW_PROFILING
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(phase) ScopedProfileTimer PROFILE_CONCAT(profileTimer, __LINE__)(phase)
+#define PROFILE_COUNT(counter, n) Profiler::AddCount(counter, n)
+#else
+#define PROFILE_SCOPE(phase)
+#define PROFILE_COUNT(counter, n)
+#endif
@@ -0,0 +1,172 @@
+#include "utils.h"
+#include <condition_variable>
+#include <cstring>
+#include <random>
+
+bool QueryClient::Connect(const std::string& socketPath)
+{
+	m_socket = Socket::ConnectLocal(socketPath);
+	return m_socket.IsValid();
+}
+
+bool QueryClient::SendBatch(QueryType type, uint32_t batchId, const void* requests, uint32_t count)
+{
+	QueryFrameHeader header = { QUERY_PROTOCOL_MAGIC, type, batchId, count };
+	SocketBuffer frame[2] = { { &header, sizeof(header) }, { requests, count * GetQueryRequestSize(type) } };
+	return m_socket.SendAll(frame, 2);
+}
+
+bool QueryClient::ReceiveBatch(QueryFrameHeader& header, std::vector<uint8_t>& results)
+{
+	if (!m_socket.ReceiveAll(&header, sizeof(header)) || header.magic != QUERY_PROTOCOL_MAGIC) return false;
+	results.resize(header.count * GetQueryResultSize(header.type));
+	return m_socket.ReceiveAll(results.data(), results.size());
+}
+
+bool QueryClient::Query(QueryType type, const void* requests, uint32_t count, std::vector<uint8_t>& results)
+{
+	QueryFrameHeader header;
+	return SendBatch(type, 0, requests, count) && ReceiveBatch(header, results) && header.type == type;
+}
+
+bool QueryClient::GetStats(SceneStatsResult& stats)
+{
+	std::vector<uint8_t> results;
+	if (!Query(QueryType::Stats, nullptr, 0, results) || results.size() != sizeof(stats)) return false;
+	memcpy(&stats, results.data(), sizeof(stats));
+	return true;
+}
+
+double QueryClient::MeasureThroughput(const std::vector<PreparedBatch>& batches, int batchCount, int pipelineDepth, size_t& bytesMoved)
+{
+	std::mutex mutex;
+	std::condition_variable changed;
+	int inFlight = 0;
+	bool failed = false;
+	bytesMoved = 0;
+
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+	std::thread sender([&]()
+		{
+			for (int b = 0; b < batchCount; b++)
+			{
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					changed.wait(lock, [&]() { return failed || inFlight < pipelineDepth; });
+					if (failed) return;
+					inFlight++;
+				}
+				const PreparedBatch& batch = batches[b % batches.size()];
+				if (!SendBatch(batch.type, (uint32_t)b, batch.requests.data(), batch.count))
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					failed = true;
+					changed.notify_all();
+					return;
+				}
+			}
+		});
+
+	std::vector<uint8_t> results;
+	size_t queries = 0;
+	for (int b = 0; b < batchCount; b++)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (failed) break;
+		}
+		QueryFrameHeader header;
+		const PreparedBatch& batch = batches[b % batches.size()];
+		// Answers come back in request order; anything else means the stream is out of step
+		bool valid = ReceiveBatch(header, results) && header.batchId == (uint32_t)b && header.count == batch.count;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!valid)
+		{
+			failed = true;
+			m_socket.Shutdown();
+		}
+		else
+		{
+			queries += header.count;
+			bytesMoved += sizeof(header) * 2 + batch.requests.size() + results.size();
+			inFlight--;
+		}
+		changed.notify_all();
+	}
+	sender.join();
+
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(end - begin).count();
+	return failed || seconds <= 0 ? 0.0 : queries / seconds;
+}
+
+bool QueryClient::RunLoadGenerator(const std::string& socketPath, int batchSize, int batchCount, int pipelineDepth)
+{
+	QueryClient client;
+	SceneStatsResult stats;
+	if (!client.Connect(socketPath))
+	{
+		std::cerr << "Error: could not connect to " << socketPath << "." << std::endl;
+		return false;
+	}
+	if (!client.GetStats(stats) || stats.triangles == 0)
+	{
+		std::cerr << "Error: the server has no scene loaded." << std::endl;
+		return false;
+	}
+
+	glm::vec3 bmin(stats.boundsMin[0], stats.boundsMin[1], stats.boundsMin[2]);
+	glm::vec3 bmax(stats.boundsMax[0], stats.boundsMax[1], stats.boundsMax[2]);
+	glm::vec3 centre = (bmin + bmax) * 0.5f, extent = bmax - bmin;
+	float radius = glm::length(extent);
+
+	// Requests are generated up front and cycled, so the timing only covers the round trips
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> unit(-1.f, 1.f);
+	auto randomPoint = [&]() { return centre + glm::vec3(unit(rng), unit(rng), unit(rng)) * extent * 0.5f; };
+	std::vector<PreparedBatch> batches;
+	const QueryType types[] = { QueryType::Ray, QueryType::Inside, QueryType::ClosestPoint };
+	for (int b = 0; b < 12; b++)
+	{
+		PreparedBatch& batch = batches.emplace_back();
+		batch.type = types[b % 3];
+		batch.count = (uint32_t)batchSize;
+		batch.requests.resize(batchSize * GetQueryRequestSize(batch.type));
+		for (int i = 0; i < batchSize; i++)
+		{
+			glm::vec3 point = randomPoint();
+			if (batch.type == QueryType::Ray)
+			{
+				glm::vec3 origin = centre + glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) + glm::vec3(1e-3f)) * radius;
+				glm::vec3 direction = glm::normalize(point - origin);
+				reinterpret_cast<RayQuery*>(batch.requests.data())[i] = { { origin.x, origin.y, origin.z }, { direction.x, direction.y, direction.z }, 1e30f };
+			}
+			else if (batch.type == QueryType::Inside)
+				reinterpret_cast<InsideQuery*>(batch.requests.data())[i] = { { point.x, point.y, point.z } };
+			else
+				reinterpret_cast<ClosestPointQuery*>(batch.requests.data())[i] = { { point.x, point.y, point.z }, radius };
+		}
+	}
+
+	std::string result = "Scene v" + std::to_string(stats.version) + ": " + std::to_string(stats.triangles) + " triangles, "
+		+ std::to_string(stats.instances) + " instances, " + std::to_string(batchCount) + " batches of " + std::to_string(batchSize) + "\n";
+	int depths[2] = { 1, std::max(1, pipelineDepth) };
+	for (int depth : depths)
+	{
+		size_t bytes = 0;
+		double queriesPerSecond = client.MeasureThroughput(batches, batchCount, depth, bytes);
+		if (queriesPerSecond == 0.0)
+		{
+			std::cout << result;
+			std::cerr << "Error: connection failed during the benchmark." << std::endl;
+			return false;
+		}
+		double seconds = (double)batchCount * batchSize / queriesPerSecond;
+		result += std::to_string(depth) + " in flight: " + std::to_string((int)queriesPerSecond) + " queries/s, "
+			+ std::to_string((int)(bytes / seconds / (1024 * 1024))) + "MB/s, " + std::to_string((int)(seconds * 1e6 / batchCount)) + "us per batch\n";
+	}
+	std::cout << result;
+	return true;
+}
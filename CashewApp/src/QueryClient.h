@@ -0,0 +1,34 @@
+#pragma once
+
+// Client side of QueryServer, plus a load generator that benchmarks it
+class QueryClient
+{
+public:
+	bool Connect(const std::string& socketPath);
+
+	// One batch, one round trip. results receives count records of the type's result size.
+	bool Query(QueryType type, const void* requests, uint32_t count, std::vector<uint8_t>& results);
+	bool GetStats(SceneStatsResult& stats);
+
+	// Mixed ray, inside and closest-point batches inside the served scene's bounds,
+	// timed once without pipelining and once with pipelineDepth batches in flight; false if the
+	// server can't be reached, has no scene or drops the connection
+	static bool RunLoadGenerator(const std::string& socketPath, int batchSize, int batchCount, int pipelineDepth);
+
+private:
+	struct PreparedBatch
+	{
+		QueryType type;
+		uint32_t count;
+		std::vector<uint8_t> requests;
+	};
+
+	bool SendBatch(QueryType type, uint32_t batchId, const void* requests, uint32_t count);
+	bool ReceiveBatch(QueryFrameHeader& header, std::vector<uint8_t>& results);
+	// Sends batchCount batches, cycling through batches, from one thread while another collects the
+	// answers, with at most pipelineDepth in flight. Returns queries per second, 0 on failure.
+	double MeasureThroughput(const std::vector<PreparedBatch>& batches, int batchCount, int pipelineDepth, size_t& bytesMoved);
+
+private:
+	Socket m_socket;
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+// Wire format between QueryServer and QueryClient. Every frame is a header followed by count
+// fixed-size records. Records are plain structs in host byte order (the socket is local), so both
+// sides read them in place straight out of the receive buffer.
+
+#define QUERY_PROTOCOL_MAGIC 0x31484343u	// "CCH1"
+// Bigger batches are refused, so a corrupt header cannot make the server allocate gigabytes
+#define QUERY_MAX_BATCH_SIZE (1 << 20)
+
+enum class QueryType : uint32_t
+{
+	Ray = 1,			// RayQuery -> RayResult
+	Inside = 2,			// InsideQuery -> uint8_t, 1 when the point is inside
+	ClosestPoint = 3,	// ClosestPointQuery -> ClosestPointResult
+	Stats = 4,			// no records -> one SceneStatsResult
+};
+
+struct QueryFrameHeader
+{
+	uint32_t magic;
+	QueryType type;
+	uint32_t batchId;	// echoed back, so pipelined responses can be matched to their requests
+	uint32_t count;		// records following the header
+};
+
+struct RayQuery
+{
+	float origin[3];
+	float direction[3];
+	float maxDistance;
+};
+
+struct RayResult
+{
+	float t, u, v;
+	int32_t triIdx;		// -1 on a miss
+	int32_t instIdx;
+};
+
+struct InsideQuery
+{
+	float point[3];
+};
+
+struct ClosestPointQuery
+{
+	float point[3];
+	float maxDistance;
+};
+
+struct ClosestPointResult
+{
+	float point[3];
+	float distance;
+	int32_t triIdx;		// -1 when nothing lies within maxDistance
+	int32_t instIdx;
+};
+
+struct SceneStatsResult
+{
+	uint64_t version;
+	uint32_t meshes, instances, triangles, vertices;
+	float boundsMin[3], boundsMax[3];
+};
+
+static_assert(sizeof(QueryFrameHeader) == 16 && sizeof(RayQuery) == 28 && sizeof(RayResult) == 20, "query records must stay packed");
+
+inline size_t GetQueryRequestSize(QueryType type)
+{
+	switch (type)
+	{
+	case QueryType::Ray: return sizeof(RayQuery);
+	case QueryType::Inside: return sizeof(InsideQuery);
+	case QueryType::ClosestPoint: return sizeof(ClosestPointQuery);
+	default: return 0;
+	}
+}
+
+inline size_t GetQueryResultSize(QueryType type)
+{
+	switch (type)
+	{
+	case QueryType::Ray: return sizeof(RayResult);
+	case QueryType::Inside: return sizeof(uint8_t);
+	case QueryType::ClosestPoint: return sizeof(ClosestPointResult);
+	case QueryType::Stats: return sizeof(SceneStatsResult);
+	default: return 0;
+	}
+}
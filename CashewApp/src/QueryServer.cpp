@@ -0,0 +1,205 @@
+#include "utils.h"
+#include <condition_variable>
+#include <queue>
+
+QueryServer::QueryServer(const QueryService& service, int pipelineDepth)
+	: m_service(service), m_pipelineDepth(std::max(1, pipelineDepth))
+{
+}
+
+bool QueryServer::Run(const std::string& socketPath)
+{
+	m_listener = Socket::ListenLocal(socketPath);
+	if (!m_listener.IsValid())
+	{
+		std::cout << "Could not listen on " << socketPath << std::endl;
+		return false;
+	}
+	std::cout << "Serving queries on " << socketPath << std::endl;
+
+	while (true)
+	{
+		Socket socket = m_listener.Accept();
+		if (!socket.IsValid()) break;
+		// Each accept cleans up after the clients that left, so a long-running server keeps
+		// only the threads of live connections
+		ReapConnections();
+		m_connections.push_back(std::make_unique<Connection>());
+		Connection& connection = *m_connections.back();
+		connection.thread = std::thread([this, &connection, socket = std::move(socket)]() mutable
+			{
+				ServeConnection(std::move(socket));
+				connection.finished = true;
+			});
+	}
+
+	for (std::unique_ptr<Connection>& connection : m_connections)
+		connection->thread.join();
+	m_connections.clear();
+	return true;
+}
+
+void QueryServer::ReapConnections()
+{
+	for (std::unique_ptr<Connection>& connection : m_connections)
+	{
+		if (connection->finished)
+			connection->thread.join();
+	}
+	m_connections.erase(std::remove_if(m_connections.begin(), m_connections.end(),
+		[](const std::unique_ptr<Connection>& connection) { return !connection->thread.joinable(); }), m_connections.end());
+}
+
+void QueryServer::ServeConnection(Socket connection)
+{
+	// Request buffers cycle from the free queue through the receiver to the ready queue and back
+	std::vector<Batch> batches(m_pipelineDepth);
+	std::queue<int> freeBatches, readyBatches;
+	for (int i = 0; i < m_pipelineDepth; i++)
+		freeBatches.push(i);
+	std::mutex mutex;
+	std::condition_variable changed;
+	bool closed = false;
+
+	std::thread receiver([&]()
+		{
+			while (true)
+			{
+				int batchIdx = -1;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					changed.wait(lock, [&]() { return closed || !freeBatches.empty(); });
+					if (closed) return;
+					batchIdx = freeBatches.front();
+					freeBatches.pop();
+				}
+
+				Batch& batch = batches[batchIdx];
+				bool valid = connection.ReceiveAll(&batch.header, sizeof(batch.header));
+				valid = valid && batch.header.magic == QUERY_PROTOCOL_MAGIC && batch.header.count <= QUERY_MAX_BATCH_SIZE
+					&& GetQueryResultSize(batch.header.type) != 0;
+				if (valid)
+				{
+					batch.payload.resize(batch.header.count * GetQueryRequestSize(batch.header.type));
+					valid = connection.ReceiveAll(batch.payload.data(), batch.payload.size());
+				}
+
+				// A disconnect or a frame we can't parse ends the connection; -1 tells the answerer
+				std::lock_guard<std::mutex> lock(mutex);
+				readyBatches.push(valid ? batchIdx : -1);
+				changed.notify_all();
+				if (!valid) return;
+			}
+		});
+
+	QueryFrameHeader responseHeader;
+	std::vector<uint8_t> results;
+	while (true)
+	{
+		int batchIdx = -1;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [&]() { return !readyBatches.empty(); });
+			batchIdx = readyBatches.front();
+			readyBatches.pop();
+		}
+		if (batchIdx == -1) break;
+
+		AnswerBatch(batches[batchIdx], responseHeader, results);
+		SocketBuffer response[2] = { { &responseHeader, sizeof(responseHeader) }, { results.data(), responseHeader.count * GetQueryResultSize(responseHeader.type) } };
+		bool sent = connection.SendAll(response, 2);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!sent)
+		{
+			// Unblocks the receiver whether it waits for a buffer or for the client
+			closed = true;
+			connection.Shutdown();
+			changed.notify_all();
+			break;
+		}
+		freeBatches.push(batchIdx);
+		changed.notify_all();
+	}
+	receiver.join();
+}
+
+void QueryServer::AnswerBatch(const Batch& batch, QueryFrameHeader& responseHeader, std::vector<uint8_t>& results) const
+{
+	responseHeader = batch.header;
+	int count = (int)batch.header.count;
+	if (batch.header.type == QueryType::Stats) count = 1;
+	// Never shrinks, so the high-water mark is allocated once per connection
+	size_t resultBytes = count * GetQueryResultSize(batch.header.type);
+	if (results.size() < resultBytes) results.resize(resultBytes);
+	const uint8_t* requests = batch.payload.data();
+	uint8_t* out = results.data();
+
+	// The whole batch sees one snapshot, even if a new model is published meanwhile
+	bool published = m_service.Read([&](const Scene& scene, uint64_t version)
+		{
+			switch (batch.header.type)
+			{
+			case QueryType::Ray:
+				ParallelForRange(count, [&](int first, int last)
+					{
+						const RayQuery* queries = reinterpret_cast<const RayQuery*>(requests);
+						RayResult* answers = reinterpret_cast<RayResult*>(out);
+						for (int i = first; i < last; i++)
+						{
+							const RayQuery& query = queries[i];
+							Ray ray(glm::vec3(query.origin[0], query.origin[1], query.origin[2]), glm::vec3(query.direction[0], query.direction[1], query.direction[2]));
+							ray.t = query.maxDistance;
+							scene.FindNearest(ray);
+							answers[i] = { ray.t, ray.u, ray.v, ray.hitObjIdx, ray.hitInstIdx };
+						}
+					}, 256);
+				break;
+			case QueryType::Inside:
+				ParallelForRange(count, [&](int first, int last)
+					{
+						const InsideQuery* queries = reinterpret_cast<const InsideQuery*>(requests);
+						for (int i = first; i < last; i++)
+							out[i] = scene.IsPointInside(glm::vec3(queries[i].point[0], queries[i].point[1], queries[i].point[2])) ? 1 : 0;
+					}, 256);
+				break;
+			case QueryType::ClosestPoint:
+				ParallelForRange(count, [&](int first, int last)
+					{
+						const ClosestPointQuery* queries = reinterpret_cast<const ClosestPointQuery*>(requests);
+						ClosestPointResult* answers = reinterpret_cast<ClosestPointResult*>(out);
+						for (int i = first; i < last; i++)
+						{
+							PointQuery query(glm::vec3(queries[i].point[0], queries[i].point[1], queries[i].point[2]), queries[i].maxDistance);
+							scene.ClosestPoint(query);
+							answers[i] = { { query.closest.x, query.closest.y, query.closest.z }, sqrtf(query.distSq), query.hitObjIdx, query.hitInstIdx };
+						}
+					}, 256);
+				break;
+			case QueryType::Stats:
+			{
+				SceneStatsResult& stats = *reinterpret_cast<SceneStatsResult*>(out);
+				stats = {};
+				stats.version = version;
+				stats.meshes = scene.GetMeshCount();
+				stats.instances = scene.GetInstanceCount();
+				for (int i = 0; i < scene.GetMeshCount(); i++)
+				{
+					stats.triangles += (uint32_t)scene.GetMesh(i).triangles.size();
+					stats.vertices += (uint32_t)scene.GetMesh(i).vertices.size();
+				}
+				glm::vec3 bmin, bmax;
+				scene.GetBounds(bmin, bmax);
+				for (int a = 0; a < 3; a++)
+				{
+					stats.boundsMin[a] = bmin[a];
+					stats.boundsMax[a] = bmax[a];
+				}
+				break;
+			}
+			}
+		});
+
+	// Nothing to query against yet: an empty answer
+	responseHeader.count = published ? count : 0;
+}
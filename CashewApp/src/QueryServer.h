@@ -0,0 +1,39 @@
+#pragma once
+
+// Headless server answering batched geometry queries from the published scene over a local socket.
+// Each connection gets a receiving thread and an answering thread joined by a short queue of
+// request buffers, so the next batch is already arriving while the current one is traced and sent.
+class QueryServer
+{
+public:
+	explicit QueryServer(const QueryService& service, int pipelineDepth = 4);
+
+	// Serves clients until the process ends; false if the socket could not be opened
+	bool Run(const std::string& socketPath);
+
+private:
+	struct Batch
+	{
+		QueryFrameHeader header;
+		// Keeps its capacity between batches, so steady traffic stops allocating
+		std::vector<uint8_t> payload;
+	};
+
+	struct Connection
+	{
+		std::thread thread;
+		std::atomic<bool> finished{ false };
+	};
+
+	void ServeConnection(Socket connection);
+	// Joins and drops the connections whose clients have gone
+	void ReapConnections();
+	// Writes the answers straight into results, which is then sent as is
+	void AnswerBatch(const Batch& batch, QueryFrameHeader& responseHeader, std::vector<uint8_t>& results) const;
+
+private:
+	const QueryService& m_service;
+	int m_pipelineDepth;
+	Socket m_listener;
+	std::vector<std::unique_ptr<Connection>> m_connections;
+};
@@ -0,0 +1,207 @@
+#include "utils.h"
+#include <random>
+
+#define STRESS_BATCH_SIZE 64
+
+QueryService::~QueryService()
+{
+	// No reader may still be inside a query here, so everything can go
+	delete m_current.load();
+}
+
+QueryService::ReadGuard::ReadGuard(const QueryService& service)
+{
+	// Each thread starts looking at its own slot, so it usually claims it on the first try
+	static thread_local size_t preferredSlot = std::hash<std::thread::id>()(std::this_thread::get_id());
+	for (size_t i = 0;; i++)
+	{
+		ReaderSlot& slot = service.m_readers[(preferredSlot + i) % MaxReaders];
+		uint64_t free = 0;
+		// The slot must show our epoch before we look at the snapshot pointer: a publisher that
+		// misses it swapped the pointer first, so we can only ever load the new snapshot
+		if (slot.epoch.load(std::memory_order_relaxed) == 0 && slot.epoch.compare_exchange_strong(free, service.m_epoch.load()))
+		{
+			m_slot = &slot;
+			return;
+		}
+		if (i % MaxReaders == MaxReaders - 1) std::this_thread::yield();
+	}
+}
+
+QueryService::ReadGuard::~ReadGuard()
+{
+	m_slot->epoch.store(0);
+}
+
+uint64_t QueryService::Publish(std::unique_ptr<const Scene> scene)
+{
+	std::lock_guard<std::mutex> lock(m_publishMutex);
+
+	const Snapshot* snapshot = new Snapshot{ std::move(scene), ++m_version };
+	const Snapshot* previous = m_current.exchange(snapshot);
+	// Readers that entered at this epoch or earlier may still hold the previous snapshot
+	uint64_t retireEpoch = m_epoch.fetch_add(1);
+	if (previous)
+		m_retired.emplace_back(retireEpoch, std::unique_ptr<const Snapshot>(previous));
+
+	m_stats.published++;
+	m_stats.version = snapshot->version;
+	ReclaimLocked();
+	return snapshot->version;
+}
+
+uint64_t QueryService::PublishMesh(std::shared_ptr<const Mesh> mesh, const BvhBuildOptions& options)
+{
+	std::unique_ptr<Scene> scene = std::make_unique<Scene>();
+	scene->SetBuildOptions(options, false);
+	scene->LoadModelToScene(std::move(mesh));
+	return Publish(std::move(scene));
+}
+
+void QueryService::Reclaim()
+{
+	std::lock_guard<std::mutex> lock(m_publishMutex);
+	ReclaimLocked();
+}
+
+void QueryService::ReclaimLocked()
+{
+	uint64_t oldestReader = std::numeric_limits<uint64_t>::max();
+	for (const ReaderSlot& slot : m_readers)
+	{
+		uint64_t epoch = slot.epoch.load();
+		if (epoch != 0) oldestReader = std::min(oldestReader, epoch);
+	}
+
+	size_t before = m_retired.size();
+	m_retired.erase(std::remove_if(m_retired.begin(), m_retired.end(),
+		[oldestReader](const std::pair<uint64_t, std::unique_ptr<const Snapshot>>& retired) { return retired.first < oldestReader; }),
+		m_retired.end());
+	m_stats.reclaimed += before - m_retired.size();
+	m_stats.pendingReclaim = m_retired.size();
+}
+
+uint64_t QueryService::FindNearest(Ray& ray) const
+{
+	uint64_t answeredBy = 0;
+	Read([&](const Scene& scene, uint64_t version)
+		{
+			scene.FindNearest(ray);
+			answeredBy = version;
+		});
+	return answeredBy;
+}
+
+uint64_t QueryService::IsOccluded(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, bool& occluded) const
+{
+	uint64_t answeredBy = 0;
+	occluded = false;
+	Read([&](const Scene& scene, uint64_t version)
+		{
+			occluded = scene.IsOccluded(origin, direction, maxDistance);
+			answeredBy = version;
+		});
+	return answeredBy;
+}
+
+uint64_t QueryService::IsPointInside(const glm::vec3& point, bool& inside) const
+{
+	uint64_t answeredBy = 0;
+	inside = false;
+	Read([&](const Scene& scene, uint64_t version)
+		{
+			inside = scene.IsPointInside(point);
+			answeredBy = version;
+		});
+	return answeredBy;
+}
+
+QueryServiceStats QueryService::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(m_publishMutex);
+	return m_stats;
+}
+
+std::string QueryService::StressTest(std::shared_ptr<const Mesh> mesh, const BvhBuildOptions& options, int readerThreads, float seconds)
+{
+	if (!mesh || mesh->triangles.empty()) return "Load a mesh before running the stress test.";
+	readerThreads = std::max(1, readerThreads);
+
+	QueryService service;
+	service.PublishMesh(mesh, options);
+
+	// Bounds of the published scene, so queries aim at the imported triangles
+	glm::vec3 bmin, bmax;
+	service.Read([&](const Scene& scene, uint64_t)
+		{
+			scene.GetBounds(bmin, bmax);
+		});
+	glm::vec3 centre = (bmin + bmax) * 0.5f;
+	float radius = glm::length(bmax - bmin);
+
+	std::atomic<bool> stop{ false };
+	std::vector<size_t> queryCounts(readerThreads, 0);
+	std::vector<double> slowestBatch(readerThreads, 0.0);
+	std::vector<std::thread> readers;
+	for (int r = 0; r < readerThreads; r++)
+	{
+		readers.emplace_back([&, r]()
+			{
+				std::mt19937 rng(r + 1);
+				std::uniform_real_distribution<float> unit(-1.f, 1.f);
+				while (!stop.load(std::memory_order_relaxed))
+				{
+					std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+					service.Read([&](const Scene& scene, uint64_t)
+						{
+							for (int q = 0; q < STRESS_BATCH_SIZE; q++)
+							{
+								glm::vec3 target = centre + glm::vec3(unit(rng), unit(rng), unit(rng)) * (bmax - bmin) * 0.5f;
+								glm::vec3 origin = centre + glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) + glm::vec3(1e-3f)) * radius;
+								// Half nearest hits, a quarter shadow rays, a quarter point-inside tests
+								if (q % 2 == 0)
+								{
+									Ray ray(origin, glm::normalize(target - origin));
+									scene.FindNearest(ray);
+								}
+								else if (q % 4 == 1)
+									scene.IsOccluded(origin, glm::normalize(target - origin), glm::length(target - origin));
+								else
+									scene.IsPointInside(target);
+							}
+						});
+					std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+					slowestBatch[r] = std::max(slowestBatch[r], std::chrono::duration<double, std::micro>(end - begin).count());
+					queryCounts[r] += STRESS_BATCH_SIZE;
+				}
+			});
+	}
+
+	// Keep reloading the model underneath the readers for the whole run
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	double elapsed = 0.0;
+	int publishes = 0;
+	do
+	{
+		service.PublishMesh(mesh, options);
+		publishes++;
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	} while (elapsed < seconds);
+
+	stop = true;
+	for (std::thread& reader : readers)
+		reader.join();
+	service.Reclaim();
+
+	size_t totalQueries = std::accumulate(queryCounts.begin(), queryCounts.end(), size_t(0));
+	double worstBatch = *std::max_element(slowestBatch.begin(), slowestBatch.end());
+	QueryServiceStats stats = service.GetStats();
+
+	std::string result = std::to_string(readerThreads) + " readers: " + std::to_string((int)(totalQueries / elapsed)) + " queries/s while publishing "
+		+ std::to_string(publishes) + " snapshots (" + std::to_string((int)(elapsed * 1000.0 / publishes)) + "ms per build)\n"
+		+ "Slowest batch of " + std::to_string(STRESS_BATCH_SIZE) + ": " + std::to_string((int)worstBatch) + "us, "
+		+ std::to_string(stats.reclaimed) + " snapshots reclaimed, " + std::to_string(stats.pendingReclaim) + " pending, last version "
+		+ std::to_string(stats.version);
+	std::cout << result << std::endl;
+	return result;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+struct QueryServiceStats
+{
+	uint64_t version = 0;			// snapshot new queries see, 0 before the first publish
+	size_t published = 0;			// snapshots published so far
+	size_t reclaimed = 0;			// retired snapshots freed once no reader could still see them
+	size_t pendingReclaim = 0;		// retired snapshots waiting for older readers to leave
+};
+
+// Serves ray, occlusion and point-inside queries from any number of threads against an immutable
+// Scene snapshot. Publish swaps a new snapshot in without ever making a reader wait; the one it
+// replaces is freed once every reader that entered before the swap has left (epoch-based reclamation).
+class QueryService
+{
+public:
+	// Readers that can be inside a query at the same moment; more than this spin until a slot frees up
+	static const int MaxReaders = 256;
+
+	QueryService() = default;
+	~QueryService();
+
+	QueryService(const QueryService&) = delete;
+	QueryService& operator=(const QueryService&) = delete;
+
+	// Takes a fully built scene that nothing edits from now on and returns its version.
+	// Publishers are serialized among themselves but never wait for readers.
+	uint64_t Publish(std::unique_ptr<const Scene> scene);
+	// Builds a single-instance scene of mesh on the calling thread, then publishes it
+	uint64_t PublishMesh(std::shared_ptr<const Mesh> mesh, const BvhBuildOptions& options = BvhBuildOptions());
+	// Frees retired snapshots no reader can see any more; Publish does this too
+	void Reclaim();
+
+	// Runs query(scene, version) against the current snapshot, so a batch of queries sees one
+	// consistent version. Returns false without calling it when nothing has been published.
+	template<typename F>
+	bool Read(F&& query) const
+	{
+		ReadGuard guard(*this);
+		const Snapshot* snapshot = m_current.load();
+		if (!snapshot) return false;
+		query(*snapshot->scene, snapshot->version);
+		return true;
+	}
+
+	// Single queries; each returns the version that answered, 0 when nothing is published
+	uint64_t FindNearest(Ray& ray) const;
+	uint64_t IsOccluded(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, bool& occluded) const;
+	uint64_t IsPointInside(const glm::vec3& point, bool& inside) const;
+
+	QueryServiceStats GetStats() const;
+
+	// Hammers a fresh service with mixed queries from readerThreads threads while the calling thread
+	// keeps republishing mesh, and reports query throughput and the slowest batch
+	static std::string StressTest(std::shared_ptr<const Mesh> mesh, const BvhBuildOptions& options, int readerThreads, float seconds);
+
+private:
+	struct Snapshot
+	{
+		std::unique_ptr<const Scene> scene;
+		uint64_t version;
+	};
+
+	// Padded so readers announcing their epoch don't share cache lines
+	struct alignas(64) ReaderSlot
+	{
+		std::atomic<uint64_t> epoch{ 0 };	// 0 while the slot is free
+	};
+
+	// Announces the global epoch for the lifetime of a query. Any snapshot retired at or after
+	// that epoch stays alive until the guard is gone.
+	class ReadGuard
+	{
+	public:
+		ReadGuard(const QueryService& service);
+		~ReadGuard();
+
+	private:
+		ReaderSlot* m_slot;
+	};
+
+	void ReclaimLocked();
+
+private:
+	std::atomic<const Snapshot*> m_current{ nullptr };
+	// Starts at 1 so a slot holding 0 is free
+	std::atomic<uint64_t> m_epoch{ 1 };
+	mutable ReaderSlot m_readers[MaxReaders];
+
+	// Everything below belongs to publishers
+	mutable std::mutex m_publishMutex;
+	std::vector<std::pair<uint64_t, std::unique_ptr<const Snapshot>>> m_retired;
+	uint64_t m_version = 0;
+	QueryServiceStats m_stats;
+};
@@ -0,0 +1,215 @@
+#include "utils.h"
+#include <cstring>
+#include <deque>
+
+// Edge of a square tile in pixels; big enough that a round trip is small next to tracing it,
+// small enough that the last tiles of a frame don't leave workers idle for long
+#define RENDER_TILE_SIZE 64
+// Requests each worker has queued, so it starts the next tile while the last one travels back
+#define RENDER_TILES_IN_FLIGHT 2
+
+int RenderCoordinator::Connect(const std::vector<std::string>& addresses)
+{
+	for (const std::string& address : addresses)
+	{
+		Socket socket = Socket::Connect(address);
+		if (!socket.IsValid())
+		{
+			std::cerr << "Error: no render worker at " << address << "." << std::endl;
+			continue;
+		}
+		WorkerConnection& worker = m_workers.emplace_back();
+		worker.address = address;
+		worker.socket = std::move(socket);
+	}
+	return (int)m_workers.size();
+}
+
+float RenderCoordinator::LoadScene(const std::string& path, float scale, glm::vec3& boundsMin, glm::vec3& boundsMax)
+{
+	if (m_workers.empty() || path.size() > RENDER_MAX_PATH_LENGTH) return -1.f;
+
+	// Every worker loads at the same time; the answers are collected afterwards
+	LoadSceneRequest request = { scale, (uint32_t)path.size() };
+	RenderMessageHeader header = { RENDER_PROTOCOL_MAGIC, RenderMessageType::LoadScene, 0, (uint32_t)(sizeof(request) + path.size()) };
+	SocketBuffer message[3] = { { &header, sizeof(header) }, { &request, sizeof(request) }, { path.data(), path.size() } };
+	for (WorkerConnection& worker : m_workers)
+		worker.failed = !worker.socket.SendAll(message, 3);
+
+	float slowest = 0.f;
+	bool loaded = true;
+	for (WorkerConnection& worker : m_workers)
+	{
+		RenderMessageHeader response;
+		LoadSceneResult result;
+		worker.failed = worker.failed || !worker.socket.ReceiveAll(&response, sizeof(response)) || response.magic != RENDER_PROTOCOL_MAGIC
+			|| response.payloadBytes != sizeof(result) || !worker.socket.ReceiveAll(&result, sizeof(result)) || result.sceneId < 0;
+		if (worker.failed)
+		{
+			std::cerr << "Error: render worker " << worker.address << " could not load " << path << "." << std::endl;
+			loaded = false;
+			continue;
+		}
+		worker.sceneId = result.sceneId;
+		slowest = std::max(slowest, result.loadSeconds);
+		boundsMin = glm::vec3(result.boundsMin[0], result.boundsMin[1], result.boundsMin[2]);
+		boundsMax = glm::vec3(result.boundsMax[0], result.boundsMax[1], result.boundsMax[2]);
+	}
+	return loaded ? slowest : -1.f;
+}
+
+bool RenderCoordinator::RenderFrame(const RenderCamera& camera, uint32_t width, uint32_t height, int samplesPerPixel, std::vector<uint32_t>& pixels,
+	int workerLimit, std::vector<int>* tilesPerWorker)
+{
+	int workerCount = workerLimit < 0 ? (int)m_workers.size() : std::min(workerLimit, (int)m_workers.size());
+	pixels.assign((size_t)width * height, 0);
+
+	RenderTileRequest frame = {};
+	frame.frameIndex = m_frameIndex++;
+	frame.imageWidth = width;
+	frame.imageHeight = height;
+	frame.samplesPerPixel = (uint32_t)std::max(1, samplesPerPixel);
+	frame.camera = camera;
+
+	uint32_t tilesX = (width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+	uint32_t tilesY = (height + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+	std::deque<int> pending((size_t)tilesX * tilesY);
+	std::iota(pending.begin(), pending.end(), 0);
+	std::mutex pendingMutex;
+	std::vector<int> tilesRendered(workerCount, 0);
+
+	// A worker that finishes early has left by the time another one fails and gives tiles back,
+	// so go round again with whoever is still up
+	while (!pending.empty())
+	{
+		std::vector<std::thread> threads;
+		for (int w = 0; w < workerCount; w++)
+		{
+			if (m_workers[w].failed || m_workers[w].sceneId < 0) continue;
+			threads.emplace_back(&RenderCoordinator::RenderTiles, this, std::ref(m_workers[w]), std::cref(frame), std::ref(pending), std::ref(pendingMutex),
+				std::ref(pixels), std::ref(tilesRendered[w]));
+		}
+		if (threads.empty()) return false;
+		for (std::thread& thread : threads)
+			thread.join();
+	}
+
+	if (tilesPerWorker) *tilesPerWorker = tilesRendered;
+	return true;
+}
+
+void RenderCoordinator::RenderTiles(WorkerConnection& worker, const RenderTileRequest& frame, std::deque<int>& pending, std::mutex& pendingMutex,
+	std::vector<uint32_t>& pixels, int& tilesRendered)
+{
+	uint32_t tilesX = (frame.imageWidth + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+	auto makeRequest = [&](int tile)
+		{
+			RenderTileRequest request = frame;
+			request.sceneId = worker.sceneId;
+			request.x = (tile % tilesX) * RENDER_TILE_SIZE;
+			request.y = (tile / tilesX) * RENDER_TILE_SIZE;
+			request.width = std::min((uint32_t)RENDER_TILE_SIZE, frame.imageWidth - request.x);
+			request.height = std::min((uint32_t)RENDER_TILE_SIZE, frame.imageHeight - request.y);
+			return request;
+		};
+
+	std::deque<int> inFlight;
+	std::vector<uint32_t> tilePixels;
+	while (!worker.failed)
+	{
+		while (inFlight.size() < RENDER_TILES_IN_FLIGHT)
+		{
+			int tile;
+			{
+				std::lock_guard<std::mutex> lock(pendingMutex);
+				if (pending.empty()) break;
+				tile = pending.front();
+				pending.pop_front();
+			}
+			inFlight.push_back(tile);
+			RenderTileRequest request = makeRequest(tile);
+			RenderMessageHeader header = { RENDER_PROTOCOL_MAGIC, RenderMessageType::RenderTile, (uint32_t)tile, sizeof(request) };
+			SocketBuffer message[2] = { { &header, sizeof(header) }, { &request, sizeof(request) } };
+			if (!worker.socket.SendAll(message, 2))
+			{
+				worker.failed = true;
+				break;
+			}
+		}
+		if (worker.failed || inFlight.empty()) break;
+
+		// Answers come back in request order; anything else means the stream is out of step
+		int tile = inFlight.front();
+		RenderTileRequest request = makeRequest(tile);
+		RenderMessageHeader response;
+		tilePixels.resize((size_t)request.width * request.height);
+		if (!worker.socket.ReceiveAll(&response, sizeof(response)) || response.magic != RENDER_PROTOCOL_MAGIC || response.jobId != (uint32_t)tile
+			|| response.payloadBytes != tilePixels.size() * 4 || !worker.socket.ReceiveAll(tilePixels.data(), response.payloadBytes))
+		{
+			worker.failed = true;
+			break;
+		}
+		inFlight.pop_front();
+
+		// Tiles never overlap, so every worker writes into the frame without a lock
+		for (uint32_t row = 0; row < request.height; row++)
+			memcpy(&pixels[(size_t)(request.y + row) * frame.imageWidth + request.x], &tilePixels[(size_t)row * request.width], request.width * 4);
+		tilesRendered++;
+	}
+
+	if (worker.failed)
+	{
+		std::cerr << "Error: lost render worker " << worker.address << ", " << inFlight.size() << " tiles go back to the others." << std::endl;
+		worker.socket.Close();
+		std::lock_guard<std::mutex> lock(pendingMutex);
+		pending.insert(pending.end(), inFlight.begin(), inFlight.end());
+	}
+}
+
+std::string RenderCoordinator::RunScalingBenchmark(const std::string& modelPath, float scale, const std::vector<std::string>& addresses,
+	uint32_t width, uint32_t height, int samplesPerPixel)
+{
+	RenderCoordinator coordinator;
+	if (coordinator.Connect(addresses) == 0) return "No render workers answered.";
+
+	glm::vec3 bmin, bmax;
+	float loadSeconds = coordinator.LoadScene(modelPath, scale, bmin, bmax);
+	if (loadSeconds < 0.f) return "The workers could not load " + modelPath + ".";
+
+	// Looking down +z at the whole model from far enough away to fit it in a 45 degree view
+	glm::vec3 centre = (bmin + bmax) * 0.5f;
+	float radius = glm::length(bmax - bmin) * 0.5f;
+	float tanHalfFov = tanf(0.5f * 45.f * PI / 180.f);
+	glm::vec3 position = centre - glm::vec3(0.f, 0.f, radius / tanHalfFov * 1.1f);
+	glm::vec3 right = glm::vec3(1.f, 0.f, 0.f) * tanHalfFov * ((float)width / height);
+	glm::vec3 up = glm::vec3(0.f, 1.f, 0.f) * tanHalfFov;
+	RenderCamera camera = { { position.x, position.y, position.z }, { 0.f, 0.f, 1.f }, { right.x, right.y, right.z }, { up.x, up.y, up.z } };
+
+	char line[192];
+	snprintf(line, sizeof(line), "%dx%d, %d spp, %d workers, slowest load %.2fs\n", width, height, samplesPerPixel, coordinator.GetWorkerCount(), loadSeconds);
+	std::string summary = line;
+
+	// Once with everyone first, so no worker pays for first touches in the timed frames
+	std::vector<uint32_t> pixels;
+	coordinator.RenderFrame(camera, width, height, samplesPerPixel, pixels);
+
+	double baseSeconds = 0.0;
+	for (int workers = 1; workers <= coordinator.GetWorkerCount(); workers++)
+	{
+		std::vector<int> tilesPerWorker;
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		bool rendered = coordinator.RenderFrame(camera, width, height, samplesPerPixel, pixels, workers, &tilesPerWorker);
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		if (!rendered) return summary + "Every worker failed.";
+
+		double seconds = std::chrono::duration<double>(end - begin).count();
+		if (workers == 1) baseSeconds = seconds;
+		auto minmax = std::minmax_element(tilesPerWorker.begin(), tilesPerWorker.end());
+		snprintf(line, sizeof(line), "%d workers: %.1fms, %.2f Mpixels/s, %.2fx, %d-%d tiles each\n", workers, seconds * 1000.0,
+			width * height / seconds / 1000000.0, seconds > 0 ? baseSeconds / seconds : 0.0, *minmax.first, *minmax.second);
+		summary += line;
+	}
+
+	std::cout << summary;
+	return summary;
+}
\ No newline at end of file
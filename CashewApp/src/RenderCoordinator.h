@@ -0,0 +1,45 @@
+#pragma once
+
+// Splits frames into tiles and renders them on RenderWorker processes, local or on other machines.
+// Tiles are handed out one by one to whichever worker is ready for more, so faster workers take
+// a bigger share; tiles a failed worker was holding go back to the others.
+class RenderCoordinator
+{
+public:
+	// Connects to every address that answers and returns how many did
+	int Connect(const std::vector<std::string>& addresses);
+	int GetWorkerCount() const { return (int)m_workers.size(); }
+
+	// Has every worker load the model, or find it resident from an earlier frame. Returns the
+	// slowest worker's load time in seconds, or a negative value if any worker couldn't load it.
+	float LoadScene(const std::string& path, float scale, glm::vec3& boundsMin, glm::vec3& boundsMax);
+
+	// Renders width x height into pixels (RGBA8) on the first workerLimit workers, all of them by
+	// default. tilesPerWorker, when given, receives how many tiles each worker rendered.
+	// False if every worker failed before the frame was done.
+	bool RenderFrame(const RenderCamera& camera, uint32_t width, uint32_t height, int samplesPerPixel, std::vector<uint32_t>& pixels,
+		int workerLimit = -1, std::vector<int>* tilesPerWorker = nullptr);
+
+	// Renders the same frame of the model with 1, 2, ... N of the workers and reports time,
+	// pixel throughput, speedup and how evenly the tiles were spread
+	static std::string RunScalingBenchmark(const std::string& modelPath, float scale, const std::vector<std::string>& addresses,
+		uint32_t width, uint32_t height, int samplesPerPixel);
+
+private:
+	struct WorkerConnection
+	{
+		std::string address;
+		Socket socket;
+		int sceneId = -1;
+		bool failed = false;
+	};
+
+	// One worker's share of a frame: takes tiles from pending until none are left, keeping a few
+	// in flight. On failure the tiles it held are put back into pending.
+	void RenderTiles(WorkerConnection& worker, const RenderTileRequest& frame, std::deque<int>& pending, std::mutex& pendingMutex,
+		std::vector<uint32_t>& pixels, int& tilesRendered);
+
+private:
+	std::vector<WorkerConnection> m_workers;
+	uint32_t m_frameIndex = 0;
+};
\ No newline at end of file
@@ -0,0 +1,61 @@
+#pragma once
+
+// Wire format between RenderCoordinator and RenderWorker. Every message is a header followed by
+// payloadBytes of payload; records are plain structs in host byte order, as every machine we
+// render on is little-endian.
+
+#define RENDER_PROTOCOL_MAGIC 0x31524343u	// "CCR1"
+// Bigger tiles and longer model paths are refused, so a corrupt header cannot make a worker
+// allocate gigabytes
+#define RENDER_MAX_TILE_PIXELS (1 << 20)
+#define RENDER_MAX_PATH_LENGTH 4096
+
+enum class RenderMessageType : uint32_t
+{
+	LoadScene = 1,		// LoadSceneRequest and the model path -> LoadSceneResult
+	RenderTile = 2,		// RenderTileRequest -> width * height RGBA8 pixels, none if the tile failed
+};
+
+struct RenderMessageHeader
+{
+	uint32_t magic;
+	RenderMessageType type;
+	uint32_t jobId;		// echoed back, so pipelined answers can be matched to their requests
+	uint32_t payloadBytes;
+};
+
+// The model path follows, pathLength bytes without a terminator. The path is resolved on the
+// worker, so every machine needs the model at the same place.
+struct LoadSceneRequest
+{
+	float scale;
+	uint32_t pathLength;
+};
+
+struct LoadSceneResult
+{
+	int32_t sceneId;		// what tiles name the scene by on this worker; -1 if it failed to load
+	uint32_t triangles;
+	float boundsMin[3], boundsMax[3];
+	float loadSeconds;		// 0 when the model was resident already
+};
+
+// Pinhole camera: pixel (u, v) in [-1, 1] looks along forward + u * right + v * up, with right
+// and up already scaled by the tangent of half the field of view
+struct RenderCamera
+{
+	float position[3];
+	float forward[3], right[3], up[3];
+};
+
+struct RenderTileRequest
+{
+	int32_t sceneId;
+	uint32_t frameIndex;		// seeds the jitter, so a tile renders the same on any worker
+	uint32_t imageWidth, imageHeight;
+	uint32_t x, y, width, height;
+	uint32_t samplesPerPixel;
+	RenderCamera camera;
+};
+
+static_assert(sizeof(RenderMessageHeader) == 16 && sizeof(RenderTileRequest) == 84, "render records must stay packed");
\ No newline at end of file
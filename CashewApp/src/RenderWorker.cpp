@@ -0,0 +1,165 @@
+#include "utils.h"
+
+bool RenderWorker::Run(const std::string& address)
+{
+	m_listener = Socket::Listen(address);
+	if (!m_listener.IsValid())
+	{
+		std::cout << "Could not listen on " << address << std::endl;
+		return false;
+	}
+	std::cout << "Rendering tiles on " << address << std::endl;
+
+	while (true)
+	{
+		Socket connection = m_listener.Accept();
+		if (!connection.IsValid()) break;
+		m_connections.emplace_back(&RenderWorker::ServeConnection, this, std::move(connection));
+	}
+
+	for (std::thread& connection : m_connections)
+		connection.join();
+	return true;
+}
+
+void RenderWorker::ServeConnection(Socket connection)
+{
+	// The coordinator keeps a few requests queued in the socket, so the next tile is already
+	// waiting when this one has been sent
+	RenderMessageHeader header;
+	std::vector<char> path;
+	std::vector<glm::vec4> hdr;
+	std::vector<uint32_t> pixels;
+	while (connection.ReceiveAll(&header, sizeof(header)) && header.magic == RENDER_PROTOCOL_MAGIC)
+	{
+		if (header.type == RenderMessageType::LoadScene && header.payloadBytes >= sizeof(LoadSceneRequest))
+		{
+			LoadSceneRequest request;
+			if (!connection.ReceiveAll(&request, sizeof(request)) || request.pathLength > RENDER_MAX_PATH_LENGTH
+				|| header.payloadBytes != sizeof(request) + request.pathLength) break;
+			path.resize(request.pathLength);
+			if (!connection.ReceiveAll(path.data(), path.size())) break;
+
+			LoadSceneResult result = LoadScene(std::string(path.begin(), path.end()), request.scale);
+			RenderMessageHeader response = { RENDER_PROTOCOL_MAGIC, header.type, header.jobId, sizeof(result) };
+			SocketBuffer message[2] = { { &response, sizeof(response) }, { &result, sizeof(result) } };
+			if (!connection.SendAll(message, 2)) break;
+		}
+		else if (header.type == RenderMessageType::RenderTile && header.payloadBytes == sizeof(RenderTileRequest))
+		{
+			RenderTileRequest request;
+			if (!connection.ReceiveAll(&request, sizeof(request))) break;
+
+			const Scene* scene = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(m_scenesMutex);
+				if (request.sceneId >= 0 && request.sceneId < (int)m_scenes.size()) scene = m_scenes[request.sceneId]->scene.get();
+			}
+			bool valid = scene && request.width > 0 && request.height > 0 && (uint64_t)request.width * request.height <= RENDER_MAX_TILE_PIXELS
+				&& request.x + request.width <= request.imageWidth && request.y + request.height <= request.imageHeight;
+			if (valid) RenderTile(*scene, request, hdr, pixels);
+
+			// An unknown scene or a bad tile gets an empty answer; the coordinator decides what to do
+			RenderMessageHeader response = { RENDER_PROTOCOL_MAGIC, header.type, header.jobId, valid ? request.width * request.height * 4 : 0 };
+			SocketBuffer message[2] = { { &response, sizeof(response) }, { pixels.data(), response.payloadBytes } };
+			if (!connection.SendAll(message, 2)) break;
+		}
+		else
+		{
+			// A frame we can't parse leaves the stream out of step: drop the connection
+			break;
+		}
+	}
+}
+
+LoadSceneResult RenderWorker::LoadScene(const std::string& path, float scale)
+{
+	std::lock_guard<std::mutex> loadLock(m_loadMutex);
+	std::string key = path + "@" + std::to_string(scale);
+	{
+		std::lock_guard<std::mutex> lock(m_scenesMutex);
+		for (const std::unique_ptr<ResidentScene>& resident : m_scenes)
+		{
+			if (resident->key != key) continue;
+			LoadSceneResult result = resident->info;
+			result.loadSeconds = 0.f;
+			return result;
+		}
+	}
+
+	LoadSceneResult result = {};
+	result.sceneId = -1;
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+	Parser parser;
+	if (!parser.LoadFile(path.c_str(), scale, glm::vec3(1.f)))
+	{
+		std::cout << "Failed to load " << path << std::endl;
+		return result;
+	}
+	parser.CalculateVertexNormals();
+	std::unique_ptr<Scene> scene = std::make_unique<Scene>();
+	scene->LoadModelToScene(parser.GetMesh());
+
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+	glm::vec3 bmin, bmax;
+	scene->GetBounds(bmin, bmax);
+	result.triangles = (uint32_t)parser.GetMesh()->triangles.size();
+	for (int a = 0; a < 3; a++)
+	{
+		result.boundsMin[a] = bmin[a];
+		result.boundsMax[a] = bmax[a];
+	}
+	result.loadSeconds = std::chrono::duration<float>(end - begin).count();
+
+	std::lock_guard<std::mutex> lock(m_scenesMutex);
+	result.sceneId = (int32_t)m_scenes.size();
+	std::unique_ptr<ResidentScene> resident = std::make_unique<ResidentScene>();
+	resident->key = key;
+	resident->scene = std::move(scene);
+	resident->info = result;
+	m_scenes.push_back(std::move(resident));
+	std::cout << "Loaded " << path << " as scene " << result.sceneId << " in " << result.loadSeconds << "s" << std::endl;
+	return result;
+}
+
+void RenderWorker::RenderTile(const Scene& scene, const RenderTileRequest& request, std::vector<glm::vec4>& hdr, std::vector<uint32_t>& pixels) const
+{
+	const RenderCamera& camera = request.camera;
+	glm::vec3 position(camera.position[0], camera.position[1], camera.position[2]);
+	glm::vec3 forward(camera.forward[0], camera.forward[1], camera.forward[2]);
+	glm::vec3 right(camera.right[0], camera.right[1], camera.right[2]);
+	glm::vec3 up(camera.up[0], camera.up[1], camera.up[2]);
+	int samples = std::max(1, (int)request.samplesPerPixel);
+
+	hdr.resize((size_t)request.width * request.height);
+	pixels.resize(hdr.size());
+	ParallelForRange((int)request.height, [&](int first, int last)
+		{
+			for (int row = first; row < last; row++)
+			{
+				uint32_t y = request.y + row;
+				for (uint32_t column = 0; column < request.width; column++)
+				{
+					uint32_t x = request.x + column;
+					// Seeded by the pixel, not the tile, so the image doesn't depend on how it was split
+					RandomStream rng(request.frameIndex, (uint64_t)y * request.imageWidth + x);
+					glm::vec3 colour(0.f);
+					for (int s = 0; s < samples; s++)
+					{
+						float jitterX = samples == 1 ? 0.5f : rng.NextFloat();
+						float jitterY = samples == 1 ? 0.5f : rng.NextFloat();
+						float u = (x + jitterX) / request.imageWidth * 2.f - 1.f;
+						float v = (y + jitterY) / request.imageHeight * 2.f - 1.f;
+						Ray ray(position, glm::normalize(forward + right * u + up * v));
+						scene.FindNearest(ray);
+						colour += ray.hitObjIdx == -1 ? glm::vec3(SKY_RADIANCE) : scene.GetShading(ray);
+					}
+					hdr[(size_t)row * request.width + column] = glm::vec4(colour, 0.f);
+				}
+			}
+		}, 1);
+
+	ConvertToRGBA8(hdr.data(), pixels.data(), request.width, request.height, ToneMapSettings(), 1.f / samples);
+}
\ No newline at end of file
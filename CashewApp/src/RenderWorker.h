@@ -0,0 +1,32 @@
+#pragma once
+
+// Headless process rendering image tiles for a RenderCoordinator. Models are loaded on first
+// request and stay resident, shared by every connection, so later frames only pay for tracing.
+class RenderWorker
+{
+public:
+	// Serves coordinators until the process ends; false if the socket could not be opened
+	bool Run(const std::string& address);
+
+private:
+	void ServeConnection(Socket connection);
+	LoadSceneResult LoadScene(const std::string& path, float scale);
+	// Shaded preview of the tile, samplesPerPixel jittered rays per pixel, tone mapped to RGBA8
+	void RenderTile(const Scene& scene, const RenderTileRequest& request, std::vector<glm::vec4>& hdr, std::vector<uint32_t>& pixels) const;
+
+private:
+	struct ResidentScene
+	{
+		std::string key;		// path and scale
+		std::unique_ptr<const Scene> scene;
+		LoadSceneResult info;
+	};
+
+	Socket m_listener;
+	std::vector<std::thread> m_connections;
+	// One load at a time, so two coordinators asking for the same model load it once
+	std::mutex m_loadMutex;
+	// Never shrinks, so a scene stays where it is while tiles are traced in it
+	std::mutex m_scenesMutex;
+	std::vector<std::unique_ptr<ResidentScene>> m_scenes;
+};
\ No newline at end of file
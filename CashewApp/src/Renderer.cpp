@@ -1,10 +1,19 @@
 #include "utils.h"
 
 #include <execution>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
 #include <glm/glm.hpp>
 
 #include "Walnut/Random.h"
 
+#define LOD_PIXELS_PER_TRIANGLE 2.f
+// Bounces every path survives before Russian roulette may end it
+#define PATH_MIN_BOUNCES 3
+// Secondary rays start this far off the surface, along its geometric normal
+#define PATH_RAY_OFFSET 1e-4f
+
 Renderer::Renderer()
 {
 	m_cameraPos = glm::vec3(0.f, 0.f, -3.f);
@@ -12,82 +21,684 @@ Renderer::Renderer()
 
 void Renderer::OnResize(uint32_t width, uint32_t height)
 {
-	if (m_FinalImage)
-	{
-		if (m_FinalImage->GetWidth() == width && m_FinalImage->GetHeight() == height)
-			return;
+	if (m_width == width && m_height == height)
+		return;
 
-		m_FinalImage->Resize(width, height);
-	}
-	else
+	m_width = width;
+	m_height = height;
+	// Frame buffers and the vectors below keep their capacity, so shrinking and growing back
+	// within the largest size seen so far allocates nothing
+	if (m_ImageVerticalIter.size() < height)
 	{
-		m_FinalImage = std::make_shared<Walnut::Image>(width, height, Walnut::ImageFormat::RGBA);
+		size_t first = m_ImageVerticalIter.size();
+		m_ImageVerticalIter.resize(height);
+		std::iota(m_ImageVerticalIter.begin() + first, m_ImageVerticalIter.end(), (uint32_t)first);
 	}
+	m_rowCosts.resize(height);
+	m_hdrBuffer.resize((size_t)width * height);
+	m_accumulatedSamples = 0;
+}
 
-	delete[] m_FinalImageData;
-	m_FinalImageData = new uint32_t[width * height];
+bool Renderer::Present()
+{
+	FrameBuffer* frame = m_frames.AcquireFront();
+	if (!frame) return false;
 
-	m_ImageHorizontalIter.resize(width);
-	m_ImageVerticalIter.resize(height);
-	for (uint32_t i = 0; i < height; i++)
-		m_ImageVerticalIter[i] = i;
-	for (uint32_t i = 0; i < width; i++)
-		m_ImageHorizontalIter[i] = i;
+	{
+		PROFILE_SCOPE(ProfilePhase::ImageUpload);
+		if (!m_FinalImage)
+			m_FinalImage = std::make_shared<Walnut::Image>(frame->width, frame->height, Walnut::ImageFormat::RGBA);
+		else if (m_FinalImage->GetWidth() != frame->width || m_FinalImage->GetHeight() != frame->height)
+			m_FinalImage->Resize(frame->width, frame->height);
+		m_FinalImage->SetData(frame->pixels.get());
+	}
+	m_frames.Release(frame);
+	return true;
 }
 
 void Renderer::Render(const Camera& camera, const Scene& scene)
 {
+	PROFILE_SCOPE(ProfilePhase::Frame);
+
 	m_Camera = &camera;
 	m_Scene = &scene;
 
-	if (!m_FinalImageData) return;
+	if (m_width == 0 || m_height == 0) return;
 
-	std::for_each(std::execution::par, m_ImageVerticalIter.begin(), m_ImageVerticalIter.end(),
-		[this](uint32_t y)
+	uint32_t width = m_width;
+	bool pathTraced = m_renderMode == RenderMode::PathTraced;
+	if (!pathTraced || camera.GetPosition() != m_accumulatedCameraPos || camera.GetDirection() != m_accumulatedCameraDir)
+		m_accumulatedSamples = 0;
+	m_accumulatedCameraPos = camera.GetPosition();
+	m_accumulatedCameraDir = camera.GetDirection();
+	m_frameIndex++;
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+	if (pathTraced && m_pathScheduling != PathScheduling::PerPixel)
+	{
+		bool sortRays = m_pathScheduling == PathScheduling::SortedWavefront;
+		WavefrontStats stats = scene.IsSmoothShading()
+			? TracePathsWavefront<true>(m_frameIndex, sortRays, m_hdrBuffer.data(), m_accumulatedSamples > 0)
+			: TracePathsWavefront<false>(m_frameIndex, sortRays, m_hdrBuffer.data(), m_accumulatedSamples > 0);
+		PROFILE_COUNT(ProfileCounter::RaysCast, stats.raysCast);
+		// The whole frame is traced a bounce at a time, so there are no per-row costs to report
+		std::fill(m_rowCosts.begin(), m_rowCosts.end(), RowCost());
+	}
+	else
+	{
+		// Picked once per frame, so no pixel pays for the shading branch
+		void (Renderer::*renderRow)(uint32_t, bool) = scene.IsSmoothShading() ? &Renderer::RenderRow<true> : &Renderer::RenderRow<false>;
+		std::for_each(std::execution::par, m_ImageVerticalIter.begin(), m_ImageVerticalIter.begin() + m_height,
+			[this, renderRow, pathTraced](uint32_t y)
+			{
+				(this->*renderRow)(y, pathTraced);
+			});
+	}
+
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(end - begin).count();
+	uint64_t pixelCount = (uint64_t)width * m_height;
+	m_samplesPerSecond = pathTraced && seconds > 0 ? pixelCount / seconds : 0.0;
+	if (pathTraced) m_accumulatedSamples++;
+
+	{
+		PROFILE_SCOPE(ProfilePhase::ToneMapping);
+		// Heatmap colours are display values already
+		bool heatmap = m_renderMode == RenderMode::NodeHeatmap || m_renderMode == RenderMode::TriangleHeatmap;
+		// Straight into a buffer of the queue, which Present or a headless consumer takes as it is
+		FrameBuffer* frame = m_frames.AcquireBack(width, m_height);
+		if (frame)
 		{
-			std::for_each(std::execution::par, m_ImageHorizontalIter.begin(), m_ImageHorizontalIter.end(),
-			[this, y](uint32_t x)
-				{
-					m_FinalImageData[x + y * m_FinalImage->GetWidth()] = ConvertToRGBA(Trace(x, y));
-				});
-		});
+			ConvertToRGBA8(m_hdrBuffer.data(), frame->pixels.get(), width, m_height, heatmap ? ToneMapSettings() : m_toneMapping,
+				pathTraced ? 1.f / m_accumulatedSamples : 1.f);
+			m_frames.Submit(frame);
+		}
+	}
+
+	TraversalCost frameCost;
+	uint64_t nodes = 0, triangles = 0;
+	for (const RowCost& cost : m_rowCosts)
+	{
+		nodes += cost.nodes;
+		triangles += cost.triangles;
+		frameCost.maxNodes = std::max(frameCost.maxNodes, cost.maxNodes);
+		frameCost.maxTriangles = std::max(frameCost.maxTriangles, cost.maxTriangles);
+	}
+	frameCost.averageNodes = pixelCount ? (float)nodes / pixelCount : 0.f;
+	frameCost.averageTriangles = pixelCount ? (float)triangles / pixelCount : 0.f;
+	m_lastFrameCost = frameCost;
+}
 
-	m_FinalImage->SetData(m_FinalImageData);
+bool Renderer::SaveHDR(const std::string& path) const
+{
+	if (m_hdrBuffer.empty()) return false;
+
+	uint32_t width = m_width, height = m_height;
+	float scale = m_renderMode == RenderMode::PathTraced && m_accumulatedSamples > 0 ? 1.f / m_accumulatedSamples : 1.f;
+	std::ofstream file(path, std::ios::binary);
+	// Negative scale marks little-endian floats; PFM rows run bottom to top, as the buffer does
+	file << "PF\n" << width << " " << height << "\n-1.0\n";
+	std::vector<float> row(width * 3);
+	for (uint32_t y = 0; y < height; y++)
+	{
+		for (uint32_t x = 0; x < width; x++)
+		{
+			const glm::vec4& colour = m_hdrBuffer[x + y * width];
+			for (int c = 0; c < 3; c++)
+				row[x * 3 + c] = colour[c] * scale;
+		}
+		file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+	}
+	return (bool)file;
+}
+
+void Renderer::SelectLevelsOfDetail(const Camera& camera, Scene& scene, bool cameraMoving) const
+{
+	if (m_height == 0) return;
+
+	bool bySize = m_lodMode == LevelOfDetailMode::Always || (m_lodMode == LevelOfDetailMode::WhileMoving && cameraMoving);
+	// Pixels covered by one unit of size at unit distance
+	float focalPixels = camera.GetProjection()[1][1] * 0.5f * m_height;
+	for (int instIdx = 0; instIdx < scene.GetInstanceCount(); instIdx++)
+	{
+		const Instance& instance = scene.GetInstance(instIdx);
+		int level = 0;
+		if (bySize)
+		{
+			glm::vec3 centre = (instance.aabbMin + instance.aabbMax) * 0.5f;
+			float radius = glm::length(instance.aabbMax - instance.aabbMin) * 0.5f;
+			float distance = glm::length(centre - camera.GetPosition());
+			// With the camera inside the bounds the instance may fill the screen
+			if (distance > radius)
+			{
+				float diameterPixels = 2.f * radius / distance * focalPixels;
+				float wantedTriangles = diameterPixels * diameterPixels / LOD_PIXELS_PER_TRIANGLE;
+				int levelCount = scene.GetLevelCount(instance.meshIdx);
+				while (level + 1 < levelCount && scene.GetLevelTriangleCount(instance.meshIdx, level + 1) >= wantedTriangles)
+					level++;
+			}
+			// Nobody inspects detail mid-motion; the scene clamps this to the coarsest level
+			if (cameraMoving) level++;
+		}
+		scene.SetInstanceLevel(instIdx, level);
+	}
+}
+
+template<bool Smooth>
+void Renderer::RenderRow(uint32_t y, bool pathTraced)
+{
+	uint32_t width = m_width;
+	// Each row draws from its own stream, so no worker ever waits on another for random numbers
+	RandomStream rng(m_frameIndex, y);
+	// A row at a time, phase by phase, so the timers run once per row instead of per pixel
+	thread_local std::vector<Ray> rays;
+	rays.resize(width);
+	{
+		PROFILE_SCOPE(ProfilePhase::RayGeneration);
+		if (pathTraced)
+		{
+			// Jittered within the pixel, so the average is antialiased too
+			for (uint32_t x = 0; x < width; x++)
+				rays[x] = GenerateJitteredRay(x, y, rng);
+		}
+		else
+		{
+			for (uint32_t x = 0; x < width; x++)
+				rays[x] = GenerateRay(x, y);
+		}
+	}
+	{
+		PROFILE_SCOPE(ProfilePhase::Traversal);
+		for (uint32_t x = 0; x < width; x++)
+			m_Scene->FindNearest<Smooth>(rays[x]);
+	}
+	RowCost cost = {};
+	for (uint32_t x = 0; x < width; x++)
+	{
+		cost.nodes += rays[x].nodesVisited;
+		cost.triangles += rays[x].trianglesTested;
+		cost.maxNodes = std::max(cost.maxNodes, rays[x].nodesVisited);
+		cost.maxTriangles = std::max(cost.maxTriangles, rays[x].trianglesTested);
+	}
+	m_rowCosts[y] = cost;
+	PROFILE_COUNT(ProfileCounter::RaysCast, width);
+	PROFILE_COUNT(ProfileCounter::NodesVisited, cost.nodes);
+	PROFILE_COUNT(ProfileCounter::TrianglesTested, cost.triangles);
+	{
+		PROFILE_SCOPE(ProfilePhase::Shading);
+		glm::vec4* row = &m_hdrBuffer[(size_t)y * width];
+		if (pathTraced)
+		{
+			int raysCast = 0;
+			for (uint32_t x = 0; x < width; x++)
+			{
+				glm::vec4 sample(TracePath<Smooth>(rays[x], rng, raysCast), 0.f);
+				row[x] = m_accumulatedSamples == 0 ? sample : row[x] + sample;
+			}
+			PROFILE_COUNT(ProfileCounter::RaysCast, raysCast);
+		}
+		else if (m_renderMode == RenderMode::Shaded)
+		{
+			for (uint32_t x = 0; x < width; x++)
+				row[x] = glm::vec4(Shade<Smooth>(rays[x]), 0.f);
+		}
+		else
+		{
+			for (uint32_t x = 0; x < width; x++)
+				row[x] = glm::vec4(ShadeHeatmap(rays[x]), 0.f);
+		}
+	}
 }
 
-glm::vec3 Renderer::Trace(uint32_t x, uint32_t y)
+Ray Renderer::GenerateRay(uint32_t x, uint32_t y) const
 {
-	Ray ray(m_Camera->GetPosition(), m_Camera->GetRayDirections()[x + y * m_FinalImage->GetWidth()]);
+	return Ray(m_Camera->GetPosition(), m_Camera->GetRayDirections()[x + y * m_width]);
+}
 
-	m_Scene->FindNearest(ray);
+Ray Renderer::GenerateJitteredRay(uint32_t x, uint32_t y, RandomStream& rng) const
+{
+	glm::vec2 coord((x + rng.NextFloat()) / m_width, (y + rng.NextFloat()) / m_height);
+	coord = coord * 2.0f - 1.0f;
+	// Same construction as the camera's cached directions, at a random point in the pixel
+	glm::vec4 target = m_Camera->GetInverseProjection() * glm::vec4(coord.x, coord.y, 1, 1);
+	glm::vec3 direction = glm::vec3(m_Camera->GetInverseView() * glm::vec4(glm::normalize(glm::vec3(target) / target.w), 0));
+	return Ray(m_Camera->GetPosition(), direction);
+}
 
+template<bool Smooth>
+glm::vec3 Renderer::Shade(const Ray& ray) const
+{
 	if (ray.hitObjIdx == -1)
 	{
-		glm::vec3 skyColour = glm::vec3(0.41176f, 0.41176f, 0.41176f);
+		glm::vec3 skyColour = glm::vec3(SKY_RADIANCE);
 		return skyColour;
 	}
 
-	return m_Scene->GetShading(ray);
+	return m_Scene->GetShading<Smooth>(ray);
+}
+
+// Orthonormal basis around n (Duff et al. 2017)
+static void BuildBasis(const glm::vec3& n, glm::vec3& t, glm::vec3& b)
+{
+	float sign = copysignf(1.f, n.z);
+	float a = -1.f / (sign + n.z);
+	float c = n.x * n.y * a;
+	t = glm::vec3(1.f + sign * n.x * n.x * a, sign * c, -sign * n.x);
+	b = glm::vec3(c, sign + n.y * n.y * a, -n.y);
+}
+
+static glm::vec3 SampleCosineHemisphere(const glm::vec3& n, RandomStream& rng)
+{
+	float phi = 2.f * PI * rng.NextFloat();
+	float r2 = rng.NextFloat();
+	float r = sqrtf(r2);
+	glm::vec3 t, b;
+	BuildBasis(n, t, b);
+	return glm::normalize(t * (r * cosf(phi)) + b * (r * sinf(phi)) + n * sqrtf(std::max(0.f, 1.f - r2)));
+}
+
+static glm::vec3 SampleUniformSphere(RandomStream& rng)
+{
+	float z = 1.f - 2.f * rng.NextFloat();
+	float r = sqrtf(std::max(0.f, 1.f - z * z));
+	float phi = 2.f * PI * rng.NextFloat();
+	return glm::vec3(r * cosf(phi), r * sinf(phi), z);
 }
 
-bool Renderer::IsPointInside(glm::vec3 point, Scene& scene) const
+// Power heuristic weight of a sample drawn with pdf a, when b could also have produced it
+static float PowerHeuristic(float a, float b)
 {
-	// Shoot ray from query point in negative z-axis
-	glm::vec3 direction = glm::vec3(0.f, 0.f, -1.f);
-	Ray ray(point, direction);
+	return a * a / (a * a + b * b);
+}
 
-	scene.FindNearest(ray);
+template<bool Smooth>
+glm::vec3 Renderer::TracePath(Ray ray, RandomStream& rng, int& raysCast) const
+{
+	PathState path;
+	ShadowRay shadowRays[2];
+	int shadowRayCount;
+	for (;;)
+	{
+		bool continues = ScatterPath<Smooth>(ray, path, rng, shadowRays, shadowRayCount, ray);
+		for (int s = 0; s < shadowRayCount; s++)
+		{
+			raysCast++;
+			if (!m_Scene->IsOccluded(shadowRays[s].origin, shadowRays[s].direction, shadowRays[s].distance))
+				path.radiance += shadowRays[s].contribution;
+		}
+		if (!continues) break;
 
-	// If we don't hit anything, it lies ouside
-	if (ray.hitObjIdx == -1) return false;
+		raysCast++;
+		m_Scene->FindNearest<Smooth>(ray);
+	}
+	return path.radiance;
+}
 
-	// Shoot a second ray from intersection point
-	ray = Ray(ray.GetIntersectionPoint(), direction);
+template<bool Smooth>
+bool Renderer::ScatterPath(const Ray& ray, PathState& path, RandomStream& rng, ShadowRay shadowRays[2], int& shadowRayCount, Ray& bounceRay) const
+{
+	const glm::vec3 sky(SKY_RADIANCE);
+	// The sky is sampled uniformly over the sphere for next-event estimation
+	const float skyPdf = 1.f / (4.f * PI);
+	shadowRayCount = 0;
 
-	scene.FindNearest(ray);
+	if (ray.hitObjIdx == -1)
+	{
+		// Escaped: the sky seen by BSDF sampling, weighted against the sky samples taken at the last hit
+		float weight = path.bounce == 0 ? 1.f : PowerHeuristic(path.bsdfPdf, skyPdf);
+		path.radiance += path.throughput * sky * weight;
+		return false;
+	}
+
+	SurfaceHit hit = m_Scene->GetSurface<Smooth>(ray);
+	// Lit from whichever side the path arrives on
+	if (glm::dot(hit.geometricNormal, ray.D) > 0.f) hit.geometricNormal = -hit.geometricNormal;
+	if (glm::dot(hit.normal, hit.geometricNormal) < 0.f) hit.normal = -hit.normal;
+	glm::vec3 origin = hit.position + hit.geometricNormal * PATH_RAY_OFFSET;
+	glm::vec3 brdf = hit.albedo * (1.f / PI);
+
+	// Next-event estimation to the point light; a delta light can only be reached this way.
+	// No distance falloff, matching the shaded preview.
+	glm::vec3 toLight = m_Scene->GetLightPos() - origin;
+	float lightDistance = glm::length(toLight);
+	toLight /= lightDistance;
+	float cosLight = glm::dot(hit.normal, toLight);
+	if (cosLight > 0.f)
+		shadowRays[shadowRayCount++] = { origin, toLight, lightDistance, path.throughput * brdf * cosLight * m_Scene->GetLightIntensity() };
+
+	// Next-event estimation to the sky, combined with the BSDF-sampled escapes above. On the last
+	// bounce no BSDF sample follows, so the sky sample carries the full weight. Russian roulette
+	// and rejected bounce directions keep the combined estimate unbiased and need no correction.
+	glm::vec3 skyDirection = SampleUniformSphere(rng);
+	float cosSky = glm::dot(hit.normal, skyDirection);
+	if (cosSky > 0.f && glm::dot(hit.geometricNormal, skyDirection) > 0.f)
+	{
+		float weight = path.bounce == m_maxBounces ? 1.f : PowerHeuristic(skyPdf, cosSky / PI);
+		shadowRays[shadowRayCount++] = { origin, skyDirection, 1e30f, path.throughput * brdf * sky * cosSky * (weight / skyPdf) };
+	}
 
-	// If we don't hit anything, the query point was inside
-	if (ray.hitObjIdx == -1) return true;
+	if (path.bounce == m_maxBounces) return false;
+	if (path.bounce >= PATH_MIN_BOUNCES)
+	{
+		float survival = std::min(0.95f, std::max(path.throughput.x, std::max(path.throughput.y, path.throughput.z)));
+		if (rng.NextFloat() >= survival) return false;
+		path.throughput /= survival;
+	}
 
-	return false;
+	// Cosine-weighted bounce: the cosine and the pdf cancel, leaving the albedo
+	glm::vec3 direction = SampleCosineHemisphere(hit.normal, rng);
+	float cosBounce = glm::dot(hit.normal, direction);
+	if (cosBounce <= 0.f || glm::dot(hit.geometricNormal, direction) <= 0.f) return false;
+	path.bsdfPdf = cosBounce / PI;
+	path.throughput *= hit.albedo;
+	path.bounce++;
+
+	bounceRay = Ray(origin, direction);
+	return true;
 }
+
+// The wavefront kernels in RendererWavefront.cpp use these too
+template glm::vec3 Renderer::TracePath<true>(Ray ray, RandomStream& rng, int& raysCast) const;
+template glm::vec3 Renderer::TracePath<false>(Ray ray, RandomStream& rng, int& raysCast) const;
+template bool Renderer::ScatterPath<true>(const Ray& ray, PathState& path, RandomStream& rng, ShadowRay shadowRays[2], int& shadowRayCount, Ray& bounceRay) const;
+template bool Renderer::ScatterPath<false>(const Ray& ray, PathState& path, RandomStream& rng, ShadowRay shadowRays[2], int& shadowRayCount, Ray& bounceRay) const;
+
+// Blue through cyan, green and yellow to red as t goes from 0 to 1, white beyond
+static glm::vec3 HeatmapColour(float t)
+{
+	if (t > 1.f) return glm::vec3(1.f);
+	const glm::vec3 stops[] = { { 0.f, 0.f, 1.f }, { 0.f, 1.f, 1.f }, { 0.f, 1.f, 0.f }, { 1.f, 1.f, 0.f }, { 1.f, 0.f, 0.f } };
+	float s = t * 4.f;
+	int i = std::min((int)s, 3);
+	return glm::mix(stops[i], stops[i + 1], s - i);
+}
+
+glm::vec3 Renderer::ShadeHeatmap(const Ray& ray) const
+{
+	int cost = m_renderMode == RenderMode::NodeHeatmap ? ray.nodesVisited : ray.trianglesTested;
+	return HeatmapColour((float)cost / std::max(1, m_heatmapScale));
+}
+
+bool Renderer::IsPointInside(glm::vec3 point, const Scene& scene) const
+{
+	return scene.IsPointInside(point);
+}
+
+double Renderer::MeasureRaysPerSecond(const Camera& camera, const Scene& scene) const
+{
+	const std::vector<glm::vec3>& rayDirections = camera.GetRayDirections();
+	int rayCount = (int)rayDirections.size();
+
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+	ParallelForRange(rayCount, [&](int first, int last)
+		{
+			for (int i = first; i < last; i++)
+			{
+				Ray ray(camera.GetPosition(), rayDirections[i]);
+				scene.FindNearest(ray);
+			}
+		}, 256);
+
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+	double seconds = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0;
+	return seconds > 0 ? rayCount / seconds : 0;
+}
+
+std::string Renderer::CompareNodeFormats(const Camera& camera, Scene& scene) const
+{
+	const char* formatNames[] = { "Full", "Quantized16", "Quantized8" };
+	if (camera.GetRayDirections().empty()) return "Render once before comparing.";
+
+	BvhNodeFormat previousFormat = scene.GetNodeFormat();
+	std::string summary;
+	for (int format = 0; format < 3; format++)
+	{
+		scene.SetNodeFormat(static_cast<BvhNodeFormat>(format));
+
+		double raysPerSecond = MeasureRaysPerSecond(camera, scene);
+		double nodeMemory = scene.GetNodeMemory() / (1024.0 * 1024.0);
+
+		std::cout << formatNames[format] << ": " << nodeMemory << "MB of nodes, " << raysPerSecond / 1000000.0 << " Mrays/s" << std::endl;
+
+		char line[128];
+		snprintf(line, sizeof(line), "%s: %.2fMB, %.2f Mrays/s\n", formatNames[format], nodeMemory, raysPerSecond / 1000000.0);
+		summary += line;
+	}
+	scene.SetNodeFormat(previousFormat);
+
+	return summary;
+}
+
+std::string Renderer::CompareBuilders(const Camera& camera, Scene& scene) const
+{
+	const char* builderNames[] = { "Midpoint", "Spatial split", "Linear", "Linear + treelets" };
+	const BvhBuilder builders[] = { BvhBuilder::Midpoint, BvhBuilder::SpatialSplit, BvhBuilder::Linear, BvhBuilder::Linear };
+	if (camera.GetRayDirections().empty()) return "Render once before comparing.";
+
+	BvhBuildOptions previousOptions = scene.GetBuildOptions();
+	std::string summary;
+	for (int builder = 0; builder < 4; builder++)
+	{
+		BvhBuildOptions options = previousOptions;
+		options.builder = builders[builder];
+		options.treeletOptimization = builder == 3;
+
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+		scene.SetBuildOptions(options);
+
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+		double buildMs = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000.0;
+		double raysPerSecond = MeasureRaysPerSecond(camera, scene);
+
+		int nodes = 0, references = 0;
+		float sahCost = 0.f;
+		for (int meshIdx = 0; meshIdx < scene.GetMeshCount(); meshIdx++)
+		{
+			const Bvh& bvh = scene.GetBvh(meshIdx);
+			nodes += bvh.GetNodeCount();
+			references += bvh.GetReferenceCount();
+			sahCost += bvh.ComputeSAHCost();
+		}
+
+		std::cout << builderNames[builder] << ": build " << buildMs << "ms, " << nodes << " nodes, " << references << " references, SAH "
+			<< sahCost << ", " << raysPerSecond / 1000000.0 << " Mrays/s" << std::endl;
+
+		char line[160];
+		snprintf(line, sizeof(line), "%s: build %.1fms, SAH %.1f, %d refs, %.2f Mrays/s\n", builderNames[builder], buildMs, sahCost, references, raysPerSecond / 1000000.0);
+		summary += line;
+	}
+	scene.SetBuildOptions(previousOptions);
+
+	return summary;
+}
+
+std::string Renderer::CompareMeshOrder(const Camera& camera, const Scene& scene) const
+{
+	if (camera.GetRayDirections().empty()) return "Render once before comparing.";
+	if (scene.GetMeshCount() == 0) return "Load a model first.";
+
+	std::shared_ptr<const Mesh> asLoaded = scene.GetSharedMesh(0);
+	std::shared_ptr<Mesh> reordered = std::make_shared<Mesh>(*asLoaded);
+	ReorderForLocality(*reordered);
+
+	const char* orderNames[] = { "As loaded", "Reordered" };
+	std::shared_ptr<const Mesh> meshes[] = { asLoaded, reordered };
+	const std::vector<glm::vec3>& rayDirections = camera.GetRayDirections();
+	int rayCount = (int)rayDirections.size();
+	std::string summary;
+	for (int order = 0; order < 2; order++)
+	{
+		Scene scratch;
+		scratch.SetBuildOptions(scene.GetBuildOptions(), false);
+		scratch.LoadModelToScene(meshes[order]);
+
+		double tracedPerSecond = MeasureRaysPerSecond(camera, scratch);
+
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+		ParallelForRange(rayCount, [&](int first, int last)
+			{
+				for (int i = first; i < last; i++)
+				{
+					Ray ray(camera.GetPosition(), rayDirections[i]);
+					scratch.FindNearest(ray);
+					if (ray.hitObjIdx != -1) scratch.GetSurface(ray);
+				}
+			}, 256);
+
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+		double seconds = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0;
+		double shadedPerSecond = seconds > 0 ? rayCount / seconds : 0;
+
+		std::cout << orderNames[order] << ": " << tracedPerSecond / 1000000.0 << " Mrays/s traced, " << shadedPerSecond / 1000000.0 << " Mrays/s shaded" << std::endl;
+
+		char line[128];
+		snprintf(line, sizeof(line), "%s: %.2f Mrays/s traced, %.2f Mrays/s shaded\n", orderNames[order], tracedPerSecond / 1000000.0, shadedPerSecond / 1000000.0);
+		summary += line;
+	}
+
+	return summary;
+}
+
+std::string Renderer::CompareKernels(const Camera& camera, Scene& scene) const
+{
+	if (camera.GetRayDirections().empty()) return "Render once before comparing.";
+	if (scene.GetMeshCount() == 0) return "Load a model first.";
+
+	const std::vector<glm::vec3>& rayDirections = camera.GetRayDirections();
+	int rayCount = (int)rayDirections.size();
+	bool& smoothShading = scene.GetSmoothShading();
+	bool wasSmooth = smoothShading;
+
+	// Times work over every primary ray; it returns whether the ray counts, so nothing it
+	// computes can be optimised away
+	auto measure = [&](auto work, int& counted)
+		{
+			std::atomic<int> total(0);
+			std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+			ParallelForRange(rayCount, [&](int first, int last)
+				{
+					int count = 0;
+					for (int i = first; i < last; i++)
+						count += work(i) ? 1 : 0;
+					total += count;
+				}, 256);
+			std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+			counted = total;
+			double seconds = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0;
+			return seconds > 0 ? rayCount / seconds / 1000000.0 : 0.0;
+		};
+
+	std::string summary;
+	char line[160];
+	int lit, litKernel;
+	for (int smooth = 0; smooth < 2; smooth++)
+	{
+		smoothShading = smooth != 0;
+		// As every ray paid for it before: barycentrics always recorded, the shading mode tested per hit
+		double runtime = measure([&](int i)
+			{
+				Ray ray(camera.GetPosition(), rayDirections[i]);
+				scene.FindNearest(ray);
+				return ray.hitObjIdx != -1 && scene.GetShading(ray).x > 0.f;
+			}, lit);
+		double kernel = smooth
+			? measure([&](int i)
+				{
+					Ray ray(camera.GetPosition(), rayDirections[i]);
+					scene.FindNearest<true>(ray);
+					return ray.hitObjIdx != -1 && scene.GetShading<true>(ray).x > 0.f;
+				}, litKernel)
+			: measure([&](int i)
+				{
+					Ray ray(camera.GetPosition(), rayDirections[i]);
+					scene.FindNearest<false>(ray);
+					return ray.hitObjIdx != -1 && scene.GetShading<false>(ray).x > 0.f;
+				}, litKernel);
+
+		const char* name = smooth ? "Smooth" : "Flat";
+		std::cout << name << " shading: " << runtime << " Mrays/s branching per ray, " << kernel << " Mrays/s specialized, "
+			<< lit << "/" << litKernel << " lit" << std::endl;
+		snprintf(line, sizeof(line), "%s shading: %.2f Mrays/s branching, %.2f Mrays/s specialized (%+.0f%%)\n",
+			name, runtime, kernel, runtime > 0 ? (kernel / runtime - 1.0) * 100.0 : 0.0);
+		summary += line;
+	}
+	smoothShading = wasSmooth;
+
+	// Shadow rays from every primary hit to the light, traced as closest-hit queries limited to
+	// the light's distance and as any-hit queries that stop at the first blocker
+	std::vector<glm::vec4> shadowRays(rayCount);
+	ParallelForRange(rayCount, [&](int first, int last)
+		{
+			for (int i = first; i < last; i++)
+			{
+				Ray ray(camera.GetPosition(), rayDirections[i]);
+				scene.FindNearest<false>(ray);
+				shadowRays[i] = glm::vec4(0.f);
+				if (ray.hitObjIdx == -1) continue;
+				SurfaceHit hit = scene.GetSurface<false>(ray);
+				if (glm::dot(hit.geometricNormal, ray.D) > 0.f) hit.geometricNormal = -hit.geometricNormal;
+				glm::vec3 origin = hit.position + hit.geometricNormal * PATH_RAY_OFFSET;
+				// Origin in xyz, the light's distance in w; zero marks a miss
+				shadowRays[i] = glm::vec4(origin, glm::length(scene.GetLightPos() - origin));
+			}
+		}, 256);
+	auto shadowDirection = [&](const glm::vec4& shadowRay) { return (scene.GetLightPos() - glm::vec3(shadowRay)) / shadowRay.w; };
+	int occluded, occludedAnyHit;
+	double closestHit = measure([&](int i)
+		{
+			if (shadowRays[i].w == 0.f) return false;
+			Ray ray(glm::vec3(shadowRays[i]), shadowDirection(shadowRays[i]));
+			ray.t = shadowRays[i].w;
+			scene.FindNearest<false>(ray);
+			return ray.hitObjIdx != -1;
+		}, occluded);
+	double anyHit = measure([&](int i)
+		{
+			return shadowRays[i].w != 0.f && scene.IsOccluded(glm::vec3(shadowRays[i]), shadowDirection(shadowRays[i]), shadowRays[i].w);
+		}, occludedAnyHit);
+
+	std::cout << "Shadow rays: " << closestHit << " Mrays/s closest hit, " << anyHit << " Mrays/s any hit, "
+		<< occluded << "/" << occludedAnyHit << " occluded" << std::endl;
+	snprintf(line, sizeof(line), "Shadow rays: %.2f Mrays/s closest hit, %.2f Mrays/s any hit (%+.0f%%)\n",
+		closestHit, anyHit, closestHit > 0 ? (anyHit / closestHit - 1.0) * 100.0 : 0.0);
+	summary += line;
+	return summary;
+}
+
+std::string Renderer::ReportTreeStatistics(const Scene& scene) const
+{
+	if (scene.GetMeshCount() == 0) return "Load a model first.";
+
+	std::ostringstream report;
+	report << std::fixed << std::setprecision(2);
+	for (int meshIdx = 0; meshIdx < scene.GetMeshCount(); meshIdx++)
+	{
+		BvhTreeStats stats = scene.GetBvh(meshIdx).ComputeTreeStats();
+		report << "Mesh " << meshIdx << ": " << stats.nodeCount << " nodes, " << stats.leafCount << " leaves, depth " << stats.maxDepth
+			<< " (leaf average " << stats.averageLeafDepth << "), SAH " << stats.sahCost << "\n";
+		report << "  Leaf size " << stats.minLeafSize << "-" << stats.maxLeafSize << ", average " << stats.averageLeafSize << ":";
+		for (int bucket = 0; bucket < BVH_LEAF_SIZE_BUCKETS; bucket++)
+		{
+			int low = bucket == 0 ? 1 : (1 << (bucket - 1)) + 1, high = 1 << bucket;
+			report << " [" << low;
+			if (bucket == BVH_LEAF_SIZE_BUCKETS - 1) report << "+";
+			else if (high > low) report << "-" << high;
+			report << "] " << stats.leafSizeHistogram[bucket];
+		}
+		report << "\n  Sibling overlap: average " << stats.averageSiblingOverlap * 100.f << "%, worst " << stats.maxSiblingOverlap * 100.f
+			<< "%, summed " << stats.totalSiblingOverlap << "x root\n";
+	}
+	const TraversalCost& cost = m_lastFrameCost;
+	report << "Last frame per primary ray: " << cost.averageNodes << " nodes (max " << cost.maxNodes << "), "
+		<< cost.averageTriangles << " triangles (max " << cost.maxTriangles << ")\n";
+
+	std::string summary = report.str();
+	std::cout << summary;
+	return summary;
+}
\ No newline at end of file
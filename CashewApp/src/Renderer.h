@@ -7,28 +7,173 @@
 class Scene;
 class Camera;
 
+// Radiance of the uniform sky every miss sees, here and on render workers
+#define SKY_RADIANCE 0.41176f
+
+enum class RenderMode
+{
+	Shaded,
+	NodeHeatmap,		// colour by BVH nodes the primary ray visited
+	TriangleHeatmap,	// colour by triangles it tested
+	PathTraced			// global illumination, one path per pixel per frame, averaged until the view changes
+};
+
+enum class LevelOfDetailMode
+{
+	Off,			// always the full mesh
+	WhileMoving,	// by screen size while the camera moves, full detail once it stops
+	Always			// by screen size, one level coarser while the camera moves
+};
+
+enum class PathScheduling
+{
+	PerPixel,			// each worker follows a row of paths to the end, one path at a time
+	Wavefront,			// every path advances one bounce at a time and each bounce's rays are traced as a batch
+	SortedWavefront		// as Wavefront, with every batch sorted by origin and direction before it is traced
+};
+
+// Primary ray traversal cost over the last frame
+struct TraversalCost
+{
+	float averageNodes = 0.f, averageTriangles = 0.f;
+	int maxNodes = 0, maxTriangles = 0;
+};
+
+// A path between bounces
+struct PathState
+{
+	glm::vec3 radiance = glm::vec3(0.f);
+	glm::vec3 throughput = glm::vec3(1.f);
+	float bsdfPdf = 0.f;	// of the direction the current ray was sampled in; 0 for the camera ray
+	int bounce = 0;
+};
+
+// A next-event estimation ray and the radiance it adds to its path if nothing blocks it
+struct ShadowRay
+{
+	glm::vec3 origin, direction;
+	float distance;			// negative for an unused slot
+	glm::vec3 contribution;
+};
+
+// Rays cast over one wavefront frame and where its time went
+struct WavefrontStats
+{
+	uint64_t raysCast = 0;
+	double seconds = 0.0, traceSeconds = 0.0, sortSeconds = 0.0;
+};
+
 class Renderer
 {
 public:
 	Renderer();
 
 	void OnResize(uint32_t width, uint32_t height);
+	// Traces a frame into a buffer of the frame queue and submits it. Needs no window, so it may
+	// run on a worker thread, or headless with the frames taken from GetFrames.
 	void Render(const Camera& camera, const Scene& scene);
+	// On the UI thread: uploads the newest finished frame to the final image, creating or resizing
+	// it to match. False if no frame was finished since the last call.
+	bool Present();
 
+	// Null until the first Present
 	std::shared_ptr<Walnut::Image> GetFinalImage() const { return m_FinalImage; }
+	FrameQueue& GetFrames() { return m_frames; }
+
+	bool IsPointInside(glm::vec3 point, const Scene& scene) const;
+
+	void SetRenderMode(RenderMode mode) { m_renderMode = mode; }
+	// Cost at which the heatmap turns red; anything above is drawn white
+	int& GetHeatmapScale() { return m_heatmapScale; }
+	const TraversalCost& GetLastFrameCost() const { return m_lastFrameCost; }
 
-	bool IsPointInside(glm::vec3 point, Scene& scene) const;
+	// Path tracing accumulates until this is called, or the camera or viewport changes
+	void ResetAccumulation() { m_accumulatedSamples = 0; }
+	int GetAccumulatedSamples() const { return m_accumulatedSamples; }
+	// Paths traced per second over the last frame, one per pixel
+	double GetSamplesPerSecond() const { return m_samplesPerSecond; }
+	ToneMapSettings& GetToneMapping() { return m_toneMapping; }
+	// Writes the last frame's linear colours, before tone mapping, as a PFM image
+	bool SaveHDR(const std::string& path) const;
+
+	// Bounces after the primary hit; Russian roulette usually ends paths well before this
+	int& GetMaxBounces() { return m_maxBounces; }
+	void SetPathScheduling(PathScheduling scheduling) { m_pathScheduling = scheduling; }
+	void SetLevelOfDetailMode(LevelOfDetailMode mode) { m_lodMode = mode; }
+	// Points each instance at the coarsest level of its mesh that still has a triangle for every
+	// couple of pixels its bounds cover on screen, before rendering
+	void SelectLevelsOfDetail(const Camera& camera, Scene& scene, bool cameraMoving) const;
+
+	// Depth, leaf sizes, SAH cost and sibling overlap of every mesh's BVH
+	std::string ReportTreeStatistics(const Scene& scene) const;
+
+	// Traces the camera's primary rays once per BVH node format and reports rays/sec for each
+	std::string CompareNodeFormats(const Camera& camera, Scene& scene) const;
+	// Rebuilds the scene with each BVH builder and reports build time, tree quality and rays/sec
+	std::string CompareBuilders(const Camera& camera, Scene& scene) const;
+	// Builds the first mesh as it is and reordered for locality into scratch scenes and reports
+	// rays/sec for the camera's primary hits, alone and with their surfaces shaded
+	std::string CompareMeshOrder(const Camera& camera, const Scene& scene) const;
+	// Path traces one frame per pixel, as an unsorted wavefront and as a sorted one and reports
+	// rays/sec for each
+	std::string CompareRaySorting(const Camera& camera, const Scene& scene);
+	// Traces and shades the camera's primary rays with the shading mode picked per ray and with
+	// the kernel compiled for it, flat and smooth, and casts shadow rays from the hits as closest-
+	// and as any-hit queries; reports rays/sec for each
+	std::string CompareKernels(const Camera& camera, Scene& scene) const;
 
 	glm::vec3& GetCameraPos() { return m_cameraPos; };
 
 private:
-	glm::vec3 Trace(uint32_t x, uint32_t y);
+	// Traces and shades row y of the frame. Smooth is the scene's shading mode, compiled in so the
+	// kernels below carry no per-ray branch on it; Render picks the instantiation once per frame.
+	template<bool Smooth>
+	void RenderRow(uint32_t y, bool pathTraced);
+	Ray GenerateRay(uint32_t x, uint32_t y) const;
+	template<bool Smooth>
+	glm::vec3 Shade(const Ray& ray) const;
+	glm::vec3 ShadeHeatmap(const Ray& ray) const;
+	Ray GenerateJitteredRay(uint32_t x, uint32_t y, RandomStream& rng) const;
+	// Continues a path from a primary ray that has already been traced; returns its radiance
+	// and adds the rays it cast to raysCast
+	template<bool Smooth>
+	glm::vec3 TracePath(Ray ray, RandomStream& rng, int& raysCast) const;
+	// One bounce of a path whose ray has been traced: adds what it sees of the sky, fills up to
+	// two shadow rays and, unless the path ends here, samples the next ray into bounceRay
+	template<bool Smooth>
+	bool ScatterPath(const Ray& ray, PathState& path, RandomStream& rng, ShadowRay shadowRays[2], int& shadowRayCount, Ray& bounceRay) const;
+	// Path traces the whole frame a bounce at a time (RendererWavefront.cpp), writing or adding
+	// one sample per pixel to hdr
+	template<bool Smooth>
+	WavefrontStats TracePathsWavefront(uint32_t frameIndex, bool sortRays, glm::vec4* hdr, bool accumulate) const;
+	double MeasureRaysPerSecond(const Camera& camera, const Scene& scene) const;
 
 private:
-	uint32_t* m_FinalImageData = nullptr;
+	uint32_t m_width = 0, m_height = 0;
+	FrameQueue m_frames;
 	std::shared_ptr<Walnut::Image> m_FinalImage;
 	const Scene* m_Scene;
 	const Camera* m_Camera;
 	glm::vec3 m_cameraPos;
-	std::vector<uint32_t> m_ImageHorizontalIter, m_ImageVerticalIter;
+	// 0 .. height - 1, for std::for_each over rows; only ever grows
+	std::vector<uint32_t> m_ImageVerticalIter;
+
+	RenderMode m_renderMode = RenderMode::Shaded;
+	LevelOfDetailMode m_lodMode = LevelOfDetailMode::WhileMoving;
+	int m_heatmapScale = 64;
+	// Per row, so workers never share a counter; summed once the frame is done
+	struct RowCost { int nodes, triangles, maxNodes, maxTriangles; };
+	std::vector<RowCost> m_rowCosts;
+	TraversalCost m_lastFrameCost;
+
+	int m_maxBounces = 8;
+	PathScheduling m_pathScheduling = PathScheduling::PerPixel;
+	// Linear colour per pixel before tone mapping; the running sum of every sample when path tracing
+	std::vector<glm::vec4> m_hdrBuffer;
+	ToneMapSettings m_toneMapping;
+	int m_accumulatedSamples = 0;
+	// Frame count since the renderer was created; decorrelates the random streams of successive frames
+	uint32_t m_frameIndex = 0;
+	double m_samplesPerSecond = 0.0;
+	glm::vec3 m_accumulatedCameraPos, m_accumulatedCameraDir;
 };
\ No newline at end of file
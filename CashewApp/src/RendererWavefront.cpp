@@ -0,0 +1,243 @@
+#include "utils.h"
+
+// Batches smaller than this are traced in the order they come: sorting would cost more than it saves
+#define WAVEFRONT_SORT_MIN_RAYS 4096
+// Rays a worker traces at a time, in queue order
+#define WAVEFRONT_TRACE_CHUNK 256
+
+// Reorders queue, a list of indices into rays, so that rays leaving nearby points in similar
+// directions are traced one after another: the Morton code of the origin over the batch's
+// bounds in the high bits, the octant of the direction in the low three.
+template<typename RayType, typename GetOrigin, typename GetDirection>
+static void SortRayQueue(std::vector<int>& queue, const RayType* rays, GetOrigin getOrigin, GetDirection getDirection)
+{
+	int count = (int)queue.size();
+	if (count < WAVEFRONT_SORT_MIN_RAYS) return;
+
+	std::vector<glm::vec3> origins(count);
+	glm::vec3 bmin(1e30f), bmax(-1e30f);
+	std::mutex boundsMutex;
+	ParallelForRange(count, [&](int begin, int end)
+		{
+			glm::vec3 chunkMin(1e30f), chunkMax(-1e30f);
+			for (int i = begin; i < end; i++)
+			{
+				origins[i] = getOrigin(rays[queue[i]]);
+				chunkMin = fminf(chunkMin, origins[i]);
+				chunkMax = fmaxf(chunkMax, origins[i]);
+			}
+			std::lock_guard<std::mutex> lock(boundsMutex);
+			bmin = fminf(bmin, chunkMin);
+			bmax = fmaxf(bmax, chunkMax);
+		});
+
+	std::vector<uint32_t> codes(count);
+	ComputeMortonCodes(origins.data(), count, bmin, bmax, codes.data());
+	std::vector<uint64_t> keys(count);
+	ParallelForRange(count, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				glm::vec3 direction = getDirection(rays[queue[i]]);
+				uint64_t octant = (direction.x < 0.f ? 1 : 0) | (direction.y < 0.f ? 2 : 0) | (direction.z < 0.f ? 4 : 0);
+				keys[i] = ((uint64_t)codes[i] << 3) | octant;
+			}
+		});
+	RadixSortPairs(keys, queue);
+}
+
+template<bool Smooth>
+WavefrontStats Renderer::TracePathsWavefront(uint32_t frameIndex, bool sortRays, glm::vec4* hdr, bool accumulate) const
+{
+	WavefrontStats stats;
+	uint32_t width = m_width;
+	int pathCount = (int)(width * m_height);
+	std::chrono::steady_clock::time_point frameBegin = std::chrono::steady_clock::now();
+
+	auto traceQueue = [&](const std::vector<int>& queue, auto traceOne)
+		{
+			std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+			{
+				PROFILE_SCOPE(ProfilePhase::Traversal);
+				ParallelForRange((int)queue.size(), [&](int first, int last)
+					{
+						for (int i = first; i < last; i++)
+							traceOne(queue[i]);
+					}, WAVEFRONT_TRACE_CHUNK);
+			}
+			std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+			stats.traceSeconds += std::chrono::duration<double>(end - begin).count();
+			stats.raysCast += queue.size();
+		};
+	auto sortQueue = [&](std::vector<int>& queue, auto sort)
+		{
+			std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+			{
+				PROFILE_SCOPE(ProfilePhase::RaySorting);
+				sort(queue);
+			}
+			std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+			stats.sortSeconds += std::chrono::duration<double>(end - begin).count();
+		};
+
+	// Each path keeps its own random stream, so the order paths are visited in never changes the image
+	std::vector<PathState> paths(pathCount);
+	std::vector<RandomStream> rngs(pathCount, RandomStream(0));
+	std::vector<Ray> rays(pathCount);
+	{
+		PROFILE_SCOPE(ProfilePhase::RayGeneration);
+		ParallelForRange(pathCount, [&](int begin, int end)
+			{
+				for (int p = begin; p < end; p++)
+				{
+					rngs[p] = RandomStream(frameIndex, p);
+					rays[p] = GenerateJitteredRay(p % width, p / width, rngs[p]);
+				}
+			});
+	}
+
+	// Camera rays in pixel order are coherent already
+	std::vector<int> queue(pathCount);
+	std::iota(queue.begin(), queue.end(), 0);
+	traceQueue(queue, [&](int p) { m_Scene->FindNearest<Smooth>(rays[p]); });
+
+	// Two shadow ray slots per path in the queue, lined up with it
+	std::vector<ShadowRay> shadowRays;
+	std::vector<int> shadowQueue;
+	std::vector<uint8_t> continues;
+	while (!queue.empty())
+	{
+		int count = (int)queue.size();
+		shadowRays.resize((size_t)count * 2);
+		continues.resize(count);
+		{
+			PROFILE_SCOPE(ProfilePhase::Shading);
+			ParallelForRange(count, [&](int begin, int end)
+				{
+					for (int i = begin; i < end; i++)
+					{
+						int p = queue[i];
+						ShadowRay* slots = &shadowRays[(size_t)i * 2];
+						int shadowRayCount;
+						continues[i] = ScatterPath<Smooth>(rays[p], paths[p], rngs[p], slots, shadowRayCount, rays[p]);
+						for (int s = shadowRayCount; s < 2; s++)
+							slots[s].distance = -1.f;
+					}
+				});
+		}
+
+		// Shadow rays: trace the batch, then add what got through to the paths in queue order
+		shadowQueue.clear();
+		for (int s = 0; s < count * 2; s++)
+			if (shadowRays[s].distance >= 0.f) shadowQueue.push_back(s);
+		if (sortRays)
+		{
+			sortQueue(shadowQueue, [&](std::vector<int>& q)
+				{
+					SortRayQueue(q, shadowRays.data(), [](const ShadowRay& r) { return r.origin; }, [](const ShadowRay& r) { return r.direction; });
+				});
+		}
+		traceQueue(shadowQueue, [&](int s)
+			{
+				ShadowRay& shadowRay = shadowRays[s];
+				if (m_Scene->IsOccluded(shadowRay.origin, shadowRay.direction, shadowRay.distance))
+					shadowRay.contribution = glm::vec3(0.f);
+			});
+		ParallelForRange(count, [&](int begin, int end)
+			{
+				for (int i = begin; i < end; i++)
+					for (int s = i * 2; s < i * 2 + 2; s++)
+						if (shadowRays[s].distance >= 0.f) paths[queue[i]].radiance += shadowRays[s].contribution;
+			});
+
+		// Bounce rays of the paths still going
+		int next = 0;
+		for (int i = 0; i < count; i++)
+			if (continues[i]) queue[next++] = queue[i];
+		queue.resize(next);
+		if (sortRays)
+		{
+			sortQueue(queue, [&](std::vector<int>& q)
+				{
+					SortRayQueue(q, rays.data(), [](const Ray& r) { return r.O; }, [](const Ray& r) { return r.D; });
+				});
+		}
+		traceQueue(queue, [&](int p) { m_Scene->FindNearest<Smooth>(rays[p]); });
+	}
+
+	ParallelForRange(pathCount, [&](int begin, int end)
+		{
+			for (int p = begin; p < end; p++)
+			{
+				glm::vec4 sample(paths[p].radiance, 0.f);
+				hdr[p] = accumulate ? hdr[p] + sample : sample;
+			}
+		});
+
+	std::chrono::steady_clock::time_point frameEnd = std::chrono::steady_clock::now();
+	stats.seconds = std::chrono::duration<double>(frameEnd - frameBegin).count();
+	return stats;
+}
+
+template WavefrontStats Renderer::TracePathsWavefront<true>(uint32_t frameIndex, bool sortRays, glm::vec4* hdr, bool accumulate) const;
+template WavefrontStats Renderer::TracePathsWavefront<false>(uint32_t frameIndex, bool sortRays, glm::vec4* hdr, bool accumulate) const;
+
+std::string Renderer::CompareRaySorting(const Camera& camera, const Scene& scene)
+{
+	if (m_width == 0 || camera.GetRayDirections().empty()) return "Render once before comparing.";
+	if (scene.GetMeshCount() == 0) return "Load a model first.";
+
+	m_Camera = &camera;
+	m_Scene = &scene;
+	uint32_t width = m_width, height = m_height;
+	bool smooth = scene.IsSmoothShading();
+	std::vector<glm::vec4> samples((size_t)width * height);
+
+	// The per-pixel baseline, scheduled as Render does it: a row of paths per task
+	std::atomic<uint64_t> perPixelRays(0);
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	ParallelForRange((int)height, [&](int first, int last)
+		{
+			for (int y = first; y < last; y++)
+			{
+				RandomStream rng(m_frameIndex, y);
+				int raysCast = 0;
+				for (uint32_t x = 0; x < width; x++)
+				{
+					Ray ray = GenerateJitteredRay(x, y, rng);
+					raysCast++;
+					glm::vec3 radiance;
+					if (smooth)
+					{
+						m_Scene->FindNearest<true>(ray);
+						radiance = TracePath<true>(ray, rng, raysCast);
+					}
+					else
+					{
+						m_Scene->FindNearest<false>(ray);
+						radiance = TracePath<false>(ray, rng, raysCast);
+					}
+					samples[(size_t)y * width + x] = glm::vec4(radiance, 0.f);
+				}
+				perPixelRays += raysCast;
+			}
+		}, 1);
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	double perPixelSeconds = std::chrono::duration<double>(end - begin).count();
+
+	WavefrontStats unsorted = smooth ? TracePathsWavefront<true>(m_frameIndex, false, samples.data(), false) : TracePathsWavefront<false>(m_frameIndex, false, samples.data(), false);
+	WavefrontStats sorted = smooth ? TracePathsWavefront<true>(m_frameIndex, true, samples.data(), false) : TracePathsWavefront<false>(m_frameIndex, true, samples.data(), false);
+
+	auto megaRays = [](uint64_t rays, double seconds) { return seconds > 0 ? rays / seconds / 1000000.0 : 0.0; };
+	std::cout << "Per pixel: " << perPixelRays << " rays, " << megaRays(perPixelRays, perPixelSeconds) << " Mrays/s" << std::endl;
+	std::cout << "Wavefront: " << unsorted.raysCast << " rays, " << megaRays(unsorted.raysCast, unsorted.seconds) << " Mrays/s, "
+		<< megaRays(unsorted.raysCast, unsorted.traceSeconds) << " Mrays/s traversal only" << std::endl;
+	std::cout << "Sorted wavefront: " << sorted.raysCast << " rays, " << megaRays(sorted.raysCast, sorted.seconds) << " Mrays/s, "
+		<< megaRays(sorted.raysCast, sorted.traceSeconds) << " Mrays/s traversal only, " << sorted.sortSeconds * 1000.0 << "ms sorting" << std::endl;
+
+	char summary[384];
+	snprintf(summary, sizeof(summary), "Per pixel: %.2f Mrays/s\nWavefront: %.2f Mrays/s (%.2f traversal only)\nSorted wavefront: %.2f Mrays/s (%.2f traversal only, %.1fms sorting)\n",
+		megaRays(perPixelRays, perPixelSeconds), megaRays(unsorted.raysCast, unsorted.seconds), megaRays(unsorted.raysCast, unsorted.traceSeconds),
+		megaRays(sorted.raysCast, sorted.seconds), megaRays(sorted.raysCast, sorted.traceSeconds), sorted.sortSeconds * 1000.0);
+	return summary;
+}
\ No newline at end of file
@@ -3,48 +3,329 @@
 Scene::Scene()
 {
 	// Initialise all objects in scene
-	m_Bvh = new Bvh();
 	m_lightPos = glm::vec3(4.f, 2.f, 10.f);
 }
 
-void Scene::LoadModelToScene(const std::vector<Triangle>& triangles, const std::vector<Vertex>& vertices)
+size_t Scene::GetRequiredMemory(const Mesh& mesh, const BvhBuildOptions& options)
 {
-	m_triangles.clear();
-	m_vertices.clear();
+	return Bvh::GetRequiredMemory((int)mesh.triangles.size(), options) + Arena::SizeOf<glm::vec3>(mesh.vertices.size());
+}
+
+void Scene::LoadModelToScene(std::shared_ptr<const Mesh> mesh)
+{
+	m_tlas.Clear();
+	m_meshes.clear();
+	m_streamedMesh.reset();
+
+	// One block for everything the scene derives from the mesh, reused by the next load of a similar size
+	m_arena.Reserve(GetRequiredMemory(*mesh, m_buildOptions));
+
+	int meshIdx = AddMesh(std::move(mesh));
+	AddInstance(meshIdx, glm::mat4(1.f));
+}
+
+bool Scene::LoadStreamedModel(const std::string& path, size_t cacheBudget)
+{
+	std::shared_ptr<ClusteredMesh> streamedMesh = std::make_shared<ClusteredMesh>();
+	if (!streamedMesh->Open(path, cacheBudget)) return false;
+
+	m_tlas.Clear();
+	m_meshes.clear();
+	m_streamedMesh = std::move(streamedMesh);
+	return true;
+}
+
+int Scene::AddMesh(std::shared_ptr<const Mesh> mesh)
+{
+	// Meshes added after a load don't fit the reserved block; the arena keeps
+	// them in overflow blocks until the next load resets it
+	SceneMesh& sceneMesh = m_meshes.emplace_back();
+	sceneMesh.mesh = std::move(mesh);
+	sceneMesh.bvh = std::make_unique<Bvh>(m_arena);
+	BuildSceneMesh(sceneMesh);
+
+	return (int)m_meshes.size() - 1;
+}
+
+void Scene::BuildSceneMesh(SceneMesh& sceneMesh)
+{
+	BuildLevel(sceneMesh.mesh, *sceneMesh.bvh, sceneMesh.vertexNormals);
+	for (MeshLevel& level : sceneMesh.lods)
+		BuildLevel(level.mesh, *level.bvh, level.vertexNormals);
+}
+
+void Scene::BuildLevel(const std::shared_ptr<const Mesh>& mesh, Bvh& bvh, glm::vec3*& vertexNormals)
+{
+	// Packed normals for shading, so the hot path doesn't stride over whole Vertex structs
+	size_t vertexCount = mesh->vertices.size();
+	vertexNormals = m_arena.Allocate<glm::vec3>(vertexCount);
+	for (size_t i = 0; i < vertexCount; i++)
+		vertexNormals[i] = mesh->vertices[i].normal;
+
+	bvh.SetRebuildThresholds(m_partialRebuildThreshold, m_fullRebuildThreshold);
+	bvh.BuildBVH(mesh, m_buildOptions);
+}
+
+void Scene::SetLevelsOfDetail(int meshIdx, std::vector<std::shared_ptr<const Mesh>> levels)
+{
+	SceneMesh& sceneMesh = m_meshes[meshIdx];
+	ResetInstanceLevels(meshIdx);
+	sceneMesh.lods.clear();
+	for (std::shared_ptr<const Mesh>& mesh : levels)
+	{
+		MeshLevel& level = sceneMesh.lods.emplace_back();
+		level.mesh = std::move(mesh);
+		level.bvh = std::make_unique<Bvh>(m_arena);
+		BuildLevel(level.mesh, *level.bvh, level.vertexNormals);
+		level.bvh->SetNodeFormat(m_buildOptions.nodeFormat);
+	}
+}
+
+int Scene::GetLevelTriangleCount(int meshIdx, int level) const
+{
+	const SceneMesh& sceneMesh = m_meshes[meshIdx];
+	const Mesh& mesh = level == 0 ? *sceneMesh.mesh : *sceneMesh.lods[level - 1].mesh;
+	return (int)mesh.triangles.size();
+}
+
+void Scene::SetInstanceLevel(int instIdx, int level)
+{
+	const Instance& instance = m_tlas.GetInstance(instIdx);
+	const SceneMesh& sceneMesh = m_meshes[instance.meshIdx];
+	level = std::clamp(level, 0, (int)sceneMesh.lods.size());
+	if (level == instance.level) return;
+	m_tlas.SetBlas(instIdx, level == 0 ? sceneMesh.bvh.get() : sceneMesh.lods[level - 1].bvh.get(), level);
+}
+
+void Scene::ResetInstanceLevels(int meshIdx)
+{
+	for (int instIdx = 0; instIdx < m_tlas.GetInstanceCount(); instIdx++)
+	{
+		if (m_tlas.GetInstance(instIdx).meshIdx == meshIdx)
+			SetInstanceLevel(instIdx, 0);
+	}
+}
+
+void Scene::SetBuildOptions(const BvhBuildOptions& options, bool rebuildExisting)
+{
+	m_buildOptions = options;
+	if (!rebuildExisting) return;
+
+	size_t bytes = 0;
+	for (const SceneMesh& sceneMesh : m_meshes)
+	{
+		bytes += GetRequiredMemory(*sceneMesh.mesh, m_buildOptions);
+		for (const MeshLevel& level : sceneMesh.lods)
+			bytes += GetRequiredMemory(*level.mesh, m_buildOptions);
+	}
+	m_arena.Reserve(bytes);
+
+	for (SceneMesh& sceneMesh : m_meshes)
+		BuildSceneMesh(sceneMesh);
+	m_tlas.Refresh();
+}
+
+int Scene::AddInstance(int meshIdx, const glm::mat4& transform)
+{
+	return m_tlas.AddInstance(m_meshes[meshIdx].bvh.get(), meshIdx, transform);
+}
 
-	for (auto& triangle : triangles)
+void Scene::SetInstanceTransform(int instIdx, const glm::mat4& transform)
+{
+	m_tlas.SetTransform(instIdx, transform);
+}
+
+BvhUpdateStats Scene::AnimateMesh(int meshIdx, const std::function<glm::vec3(const glm::vec3&)>& deform)
+{
+	SceneMesh& sceneMesh = m_meshes[meshIdx];
+	// First frame: the loaded mesh becomes the rest pose every frame is deformed from
+	if (!sceneMesh.restMesh)
+		sceneMesh.restMesh = sceneMesh.mesh;
+	// Levels simplified from any earlier pose no longer match
+	if (!sceneMesh.lods.empty())
+	{
+		ResetInstanceLevels(meshIdx);
+		sceneMesh.lods.clear();
+	}
+
+	// Never written while someone else may read it, e.g. a level of detail being built from the
+	// pose before last; then a fresh copy takes its place
+	std::shared_ptr<Mesh> next = std::move(sceneMesh.spareMesh);
+	if (!next || next.use_count() > 1)
+		next = std::make_shared<Mesh>(*sceneMesh.restMesh);
+	sceneMesh.spareMesh = std::move(sceneMesh.animatedMesh);
+	sceneMesh.animatedMesh = next;
+
+	const Mesh& rest = *sceneMesh.restMesh;
+	Mesh& animated = *next;
+	ParallelForRange((int)animated.triangles.size(), [&rest, &animated, &deform](int begin, int end)
+		{
+			for (int t = begin; t < end; t++)
+			{
+				Triangle& triangle = animated.triangles[t];
+				for (int k = 0; k < 3; k++)
+					triangle.verticesPos[k] = deform(rest.triangles[t].verticesPos[k]);
+				const glm::vec3& v0 = triangle.verticesPos[0];
+				const glm::vec3& v1 = triangle.verticesPos[1];
+				const glm::vec3& v2 = triangle.verticesPos[2];
+				triangle.normal = cross(normalize(v2 - v0), normalize(v1 - v0));
+				triangle.centroid = (v0 + v1 + v2) * 0.3333f;
+			}
+		});
+
+	ComputeVertexNormals(animated, NormalWeighting::Uniform);
+	ParallelForRange((int)animated.vertices.size(), [&sceneMesh, &animated](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+				sceneMesh.vertexNormals[i] = animated.vertices[i].normal;
+		});
+
+	sceneMesh.mesh = next;
+	BvhUpdateStats stats = sceneMesh.bvh->UpdateGeometry(sceneMesh.mesh);
+	m_tlas.RefreshMesh(meshIdx);
+	return stats;
+}
+
+void Scene::SetRebuildThresholds(float partial, float full)
+{
+	m_partialRebuildThreshold = partial;
+	m_fullRebuildThreshold = full;
+	for (SceneMesh& sceneMesh : m_meshes)
 	{
-		m_triangles.push_back(triangle);
+		sceneMesh.bvh->SetRebuildThresholds(partial, full);
+		for (MeshLevel& level : sceneMesh.lods)
+			level.bvh->SetRebuildThresholds(partial, full);
 	}
+}
 
-	for (auto& vertex : vertices)
+void Scene::SetNodeFormat(BvhNodeFormat format)
+{
+	m_buildOptions.nodeFormat = format;
+	for (SceneMesh& sceneMesh : m_meshes)
 	{
-		m_vertices.push_back(vertex);
+		sceneMesh.bvh->SetNodeFormat(format);
+		for (MeshLevel& level : sceneMesh.lods)
+			level.bvh->SetNodeFormat(format);
 	}
+}
 
-	m_Bvh->BuildBVH(m_triangles);
+size_t Scene::GetNodeMemory() const
+{
+	size_t bytes = 0;
+	for (const SceneMesh& sceneMesh : m_meshes)
+	{
+		bytes += sceneMesh.bvh->GetNodeMemory();
+		for (const MeshLevel& level : sceneMesh.lods)
+			bytes += level.bvh->GetNodeMemory();
+	}
+	return bytes;
 }
 
+template<bool Barycentrics>
 void Scene::FindNearest(Ray& ray) const
 {
-	if (m_triangles.empty()) return;
+	m_tlas.Intersect<false, Barycentrics>(ray);
+	if (m_streamedMesh) m_streamedMesh->Intersect(ray);
+}
+
+template void Scene::FindNearest<true>(Ray& ray) const;
+template void Scene::FindNearest<false>(Ray& ray) const;
 
-	m_Bvh->IntersectBVH(ray, 0);
+bool Scene::IsOccluded(const glm::vec3& origin, const glm::vec3& direction, float maxDistance) const
+{
+	Ray ray(origin, direction);
+	ray.t = maxDistance;
+	if (m_tlas.Intersect<true, false>(ray)) return true;
+	if (m_streamedMesh) m_streamedMesh->Intersect(ray);
+	return ray.hitObjIdx != -1;
 }
 
-glm::vec3 Scene::ComputeShadingNormal(int triIdx, float u, float v) const
+void Scene::ClosestPoint(PointQuery& query) const
 {
-	const Triangle& triangle = m_triangles[triIdx];
+	m_tlas.ClosestPoint(query);
+	if (m_streamedMesh) m_streamedMesh->ClosestPoint(query);
+}
 
-	return glm::vec3((1 - u - v) * m_vertices[triangle.verIndices[0]].normal + u * m_vertices[triangle.verIndices[1]].normal + v * m_vertices[triangle.verIndices[2]].normal);
+void Scene::GetBounds(glm::vec3& bmin, glm::vec3& bmax) const
+{
+	m_tlas.GetBounds(bmin, bmax);
+	if (m_streamedMesh)
+	{
+		glm::vec3 streamedMin, streamedMax;
+		m_streamedMesh->GetBounds(streamedMin, streamedMax);
+		bmin = fminf(bmin, streamedMin);
+		bmax = fmaxf(bmax, streamedMax);
+	}
+}
+
+bool Scene::IsPointInside(const glm::vec3& point) const
+{
+	// Shoot ray from query point in negative z-axis
+	glm::vec3 direction = glm::vec3(0.f, 0.f, -1.f);
+	Ray ray(point, direction);
+
+	FindNearest(ray);
+
+	// If we don't hit anything, it lies ouside
+	if (ray.hitObjIdx == -1) return false;
+
+	// Shoot a second ray from intersection point
+	ray = Ray(ray.GetIntersectionPoint(), direction);
+
+	FindNearest(ray);
+
+	// If we don't hit anything, the query point was inside
+	if (ray.hitObjIdx == -1) return true;
+
+	return false;
 }
 
+glm::vec3 Scene::ComputeShadingNormal(const Mesh& mesh, const glm::vec3* normals, int triIdx, float u, float v) const
+{
+	const Triangle& triangle = mesh.triangles[triIdx];
+
+	return glm::vec3((1 - u - v) * normals[triangle.verIndices[0]] + u * normals[triangle.verIndices[1]] + v * normals[triangle.verIndices[2]]);
+}
+
+template<bool Smooth>
+SurfaceHit Scene::GetSurface(const Ray& ray) const
+{
+	SurfaceHit hit;
+	hit.position = ray.O + ray.t * ray.D;
+	// Streamed triangles keep no vertex normals, and they are already in world space
+	if (ray.hitInstIdx == -1)
+	{
+		hit.normal = hit.geometricNormal = ray.faceNormal;
+		hit.albedo = ray.colour;
+		return hit;
+	}
+
+	const Instance& instance = m_tlas.GetInstance(ray.hitInstIdx);
+	const SceneMesh& sceneMesh = m_meshes[instance.meshIdx];
+	// Triangle indices are those of the level the instance was traced at
+	const Mesh& mesh = instance.level == 0 ? *sceneMesh.mesh : *sceneMesh.lods[instance.level - 1].mesh;
+	const glm::vec3* vertexNormals = instance.level == 0 ? sceneMesh.vertexNormals : sceneMesh.lods[instance.level - 1].vertexNormals;
+	// Traversal only recorded which triangle was hit; its attributes are in object space
+	const Triangle& triangle = mesh.triangles[ray.hitObjIdx];
+	hit.albedo = triangle.colour;
+	hit.geometricNormal = glm::normalize(instance.normalMatrix * triangle.normal);
+	if constexpr (Smooth)
+		hit.normal = glm::normalize(instance.normalMatrix * ComputeShadingNormal(mesh, vertexNormals, ray.hitObjIdx, ray.u, ray.v));
+	else
+		hit.normal = hit.geometricNormal;
+	return hit;
+}
+
+template<bool Smooth>
 glm::vec3 Scene::GetShading(const Ray& ray) const
 {
-	glm::vec3 albedo = m_triangles[ray.hitObjIdx].colour;
-	glm::vec3 I = ray.O + ray.t * ray.D;
-	glm::vec3 dirToLight = (m_lightPos - I);
-	glm::vec3 N = m_smoothShading ? ComputeShadingNormal(ray.hitObjIdx, ray.u, ray.v) : ray.faceNormal;
-	float dotProduct = std::max(0.f, glm::dot(glm::normalize(dirToLight), N));
-	return albedo * dotProduct * (1/PI) * m_lightIntensity;
-}
\ No newline at end of file
+	SurfaceHit hit = GetSurface<Smooth>(ray);
+	glm::vec3 dirToLight = (m_lightPos - hit.position);
+	float dotProduct = std::max(0.f, glm::dot(glm::normalize(dirToLight), hit.normal));
+	return hit.albedo * dotProduct * (1/PI) * m_lightIntensity;
+}
+
+template SurfaceHit Scene::GetSurface<true>(const Ray& ray) const;
+template SurfaceHit Scene::GetSurface<false>(const Ray& ray) const;
+template glm::vec3 Scene::GetShading<true>(const Ray& ray) const;
+template glm::vec3 Scene::GetShading<false>(const Ray& ray) const;
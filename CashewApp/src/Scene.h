@@ -1,27 +1,131 @@
 #pragma once
 
-class Bvh;
+// A simplified version of a scene mesh with its own bottom-level Bvh
+struct MeshLevel
+{
+	std::shared_ptr<const Mesh> mesh;
+	std::unique_ptr<Bvh> bvh;
+	glm::vec3* vertexNormals = nullptr;
+};
+
+// A unique mesh with its bottom-level Bvh, shared by every instance placing it
+struct SceneMesh
+{
+	std::shared_ptr<const Mesh> mesh;
+	// Set once the mesh is animated: every frame deforms restMesh into a mesh nobody else holds
+	// and publishes it as mesh, so meshes handed out stay immutable. animatedMesh is the one
+	// published last, spareMesh the one before, reused once no one holds it any more.
+	std::shared_ptr<const Mesh> restMesh;
+	std::shared_ptr<Mesh> animatedMesh, spareMesh;
+	std::unique_ptr<Bvh> bvh;
+	glm::vec3* vertexNormals = nullptr;
+	// Levels of detail 1 and up, coarsest last; level 0 is the mesh above
+	std::vector<MeshLevel> lods;
+};
+
+// What shading needs to know about a ray's hit, in world space
+struct SurfaceHit
+{
+	glm::vec3 position;
+	glm::vec3 normal;			// interpolated when smooth shading is on
+	glm::vec3 geometricNormal;	// of the triangle itself
+	glm::vec3 albedo;
+};
 
 class Scene
 {
 public:
 	Scene();
 
-	void LoadModelToScene(const std::vector<Triangle>& triangles, const std::vector<Vertex>& vertices);
+	// Replaces the scene with a single, untransformed instance of mesh
+	void LoadModelToScene(std::shared_ptr<const Mesh> mesh);
+	// Replaces the scene with a cluster file from ClusteredMesh::Build, paged in from disk on
+	// demand within cacheBudget bytes. Hits on it carry hitInstIdx -1 and are flat shaded.
+	bool LoadStreamedModel(const std::string& path, size_t cacheBudget);
+	int AddMesh(std::shared_ptr<const Mesh> mesh);
+	int AddInstance(int meshIdx, const glm::mat4& transform);
+	void SetInstanceTransform(int instIdx, const glm::mat4& transform);
+
+	// Moves every vertex of a mesh to deform(rest position) and refits its Bvh instead of rebuilding
+	BvhUpdateStats AnimateMesh(int meshIdx, const std::function<glm::vec3(const glm::vec3&)>& deform);
+	void SetRebuildThresholds(float partial, float full);
+
+	// Attaches meshes from BuildLevelsOfDetail as levels 1 and up of a mesh, replacing any it had.
+	// Animating the mesh drops them again, since they no longer match its shape.
+	void SetLevelsOfDetail(int meshIdx, std::vector<std::shared_ptr<const Mesh>> levels);
+	// Counting the full mesh as level 0
+	int GetLevelCount(int meshIdx) const { return 1 + (int)m_meshes[meshIdx].lods.size(); }
+	int GetLevelTriangleCount(int meshIdx, int level) const;
+	// Points an instance at another level of its mesh; out of range levels are clamped
+	void SetInstanceLevel(int instIdx, int level);
+
+	// Queries only read the scene, so any number of threads may run them while nothing edits it
+	void FindNearest(Ray& ray) const { FindNearest<true>(ray); }
+	// Closest hit without u and v unless Barycentrics, for renderers that picked their kernel
+	// once per frame: flat shading never reads them
+	template<bool Barycentrics>
 	void FindNearest(Ray& ray) const;
+	// Any hit within maxDistance ends the search
+	bool IsOccluded(const glm::vec3& origin, const glm::vec3& direction, float maxDistance) const;
+	bool IsPointInside(const glm::vec3& point) const;
+	void ClosestPoint(PointQuery& query) const;
 
-	glm::vec3 ComputeShadingNormal(int triIdx, float u, float v) const;
+	glm::vec3 ComputeShadingNormal(const Mesh& mesh, const glm::vec3* vertexNormals, int triIdx, float u, float v) const;
+	// Normal, colour and position looked up once for the ray's nearest hit; Smooth interpolates the
+	// vertex normals and needs a ray traced with barycentrics. The plain versions follow the
+	// smooth shading setting.
+	template<bool Smooth>
+	SurfaceHit GetSurface(const Ray& ray) const;
+	SurfaceHit GetSurface(const Ray& ray) const { return m_smoothShading ? GetSurface<true>(ray) : GetSurface<false>(ray); }
+	// Lambert term for the point light, as the rasterised preview shows it
+	template<bool Smooth>
 	glm::vec3 GetShading(const Ray& ray) const;
+	glm::vec3 GetShading(const Ray& ray) const { return m_smoothShading ? GetShading<true>(ray) : GetShading<false>(ray); }
 
 	glm::vec3& GetLightPos() { return m_lightPos; };
 	float& GetLightIntensity() { return m_lightIntensity; };
+	const glm::vec3& GetLightPos() const { return m_lightPos; };
+	float GetLightIntensity() const { return m_lightIntensity; };
 	bool& GetSmoothShading() { return m_smoothShading; };
+	bool IsSmoothShading() const { return m_smoothShading; }
+
+	const ArenaStats& GetMemoryStats() const { return m_arena.GetStats(); }
+	int GetMeshCount() const { return (int)m_meshes.size(); }
+	int GetInstanceCount() const { return m_tlas.GetInstanceCount(); }
+	const Instance& GetInstance(int instIdx) const { return m_tlas.GetInstance(instIdx); }
+	const Bvh& GetBvh(int meshIdx) const { return *m_meshes[meshIdx].bvh; }
+	const Mesh& GetMesh(int meshIdx) const { return *m_meshes[meshIdx].mesh; }
+	// For work that may outlive the scene's hold on the mesh, like background simplification
+	std::shared_ptr<const Mesh> GetSharedMesh(int meshIdx) const { return m_meshes[meshIdx].mesh; }
+	void GetBounds(glm::vec3& bmin, glm::vec3& bmax) const;
+	// Null unless LoadStreamedModel was the last load
+	const std::shared_ptr<ClusteredMesh>& GetStreamedMesh() const { return m_streamedMesh; }
+
+	void SetNodeFormat(BvhNodeFormat format);
+	BvhNodeFormat GetNodeFormat() const { return m_buildOptions.nodeFormat; }
+	// Rebuilds every bottom-level tree with the new options, keeping all instances.
+	// Without rebuildExisting the options only apply to meshes loaded from now on.
+	void SetBuildOptions(const BvhBuildOptions& options, bool rebuildExisting = true);
+	const BvhBuildOptions& GetBuildOptions() const { return m_buildOptions; }
+	// Node bytes traversal touches across all bottom-level trees
+	size_t GetNodeMemory() const;
+
+private:
+	static size_t GetRequiredMemory(const Mesh& mesh, const BvhBuildOptions& options);
+	void BuildSceneMesh(SceneMesh& sceneMesh);
+	void BuildLevel(const std::shared_ptr<const Mesh>& mesh, Bvh& bvh, glm::vec3*& vertexNormals);
+	// Moves every instance of the mesh back to full detail before its levels go away
+	void ResetInstanceLevels(int meshIdx);
 
 private:
-	Bvh* m_Bvh;
-	std::vector<Triangle> m_triangles;
-	std::vector<Vertex> m_vertices;
+	// Declared before the meshes so the arena outlives the nodes allocated from it
+	Arena m_arena;
+	std::vector<SceneMesh> m_meshes;
+	Tlas m_tlas;
+	std::shared_ptr<ClusteredMesh> m_streamedMesh;
 	glm::vec3 m_lightPos;
 	float m_lightIntensity = 2.f;
 	bool m_smoothShading = true;
-};
\ No newline at end of file
+	BvhBuildOptions m_buildOptions;
+	float m_partialRebuildThreshold = 1.2f, m_fullRebuildThreshold = 2.f;
+};
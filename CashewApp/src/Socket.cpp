@@ -0,0 +1,299 @@
+#include "utils.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifdef WL_PLATFORM_WINDOWS
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef WL_PLATFORM_WINDOWS
+using NativeSocket = SOCKET;
+
+static bool InitSockets()
+{
+	// Winsock needs one WSAStartup per process before any socket call
+	static bool initialized = []()
+	{
+		WSADATA data;
+		return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+	}();
+	return initialized;
+}
+
+static void CloseNative(NativeSocket handle) { closesocket(handle); }
+#else
+using NativeSocket = int;
+
+static bool InitSockets() { return true; }
+
+static void CloseNative(NativeSocket handle) { close(handle); }
+#endif
+
+#ifdef MSG_NOSIGNAL
+// A peer that went away must fail the send, not raise SIGPIPE
+static const int SendFlags = MSG_NOSIGNAL;
+#else
+static const int SendFlags = 0;
+#endif
+
+static bool MakeLocalAddress(const std::string& path, sockaddr_un& address)
+{
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) return false;
+	memcpy(address.sun_path, path.c_str(), path.size());
+	return true;
+}
+
+static void DisableNagle(NativeSocket handle)
+{
+	int enabled = 1;
+	setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (const char*)&enabled, sizeof(enabled));
+}
+
+// Splits "host:port"; false for anything else, such as a socket path or a Windows drive letter
+static bool ParseTcpAddress(const std::string& address, std::string& host, int& port)
+{
+	size_t colon = address.find_last_of(':');
+	if (colon == std::string::npos || colon == 0 || colon + 1 == address.size()) return false;
+	if (address.find_first_of("/\\") != std::string::npos) return false;
+	for (size_t i = colon + 1; i < address.size(); i++)
+		if (address[i] < '0' || address[i] > '9') return false;
+	host = address.substr(0, colon);
+	port = atoi(address.c_str() + colon + 1);
+	return port > 0 && port < 65536;
+}
+
+Socket::~Socket()
+{
+	Close();
+}
+
+Socket::Socket(Socket&& other) noexcept
+	: m_handle(other.m_handle), m_unlinkPath(std::move(other.m_unlinkPath)), m_tcp(other.m_tcp)
+{
+	other.m_handle = InvalidHandle;
+}
+
+Socket& Socket::operator=(Socket&& other) noexcept
+{
+	if (this != &other)
+	{
+		Close();
+		m_handle = other.m_handle;
+		m_unlinkPath = std::move(other.m_unlinkPath);
+		m_tcp = other.m_tcp;
+		other.m_handle = InvalidHandle;
+	}
+	return *this;
+}
+
+Socket Socket::ListenLocal(const std::string& path, int backlog)
+{
+	sockaddr_un address;
+	if (!InitSockets() || !MakeLocalAddress(path, address)) return Socket();
+
+	Socket listener((Handle)socket(AF_UNIX, SOCK_STREAM, 0));
+	if (!listener.IsValid()) return Socket();
+
+	// A server that was killed leaves its socket file behind, which would make bind fail
+	remove(path.c_str());
+	if (bind((NativeSocket)listener.m_handle, (sockaddr*)&address, sizeof(address)) != 0) return Socket();
+	listener.m_unlinkPath = path;
+	if (listen((NativeSocket)listener.m_handle, backlog) != 0) return Socket();
+	return listener;
+}
+
+Socket Socket::ConnectLocal(const std::string& path)
+{
+	sockaddr_un address;
+	if (!InitSockets() || !MakeLocalAddress(path, address)) return Socket();
+
+	Socket connection((Handle)socket(AF_UNIX, SOCK_STREAM, 0));
+	if (!connection.IsValid()) return Socket();
+	if (connect((NativeSocket)connection.m_handle, (sockaddr*)&address, sizeof(address)) != 0) return Socket();
+	return connection;
+}
+
+Socket Socket::ListenTcp(int port, int backlog)
+{
+	if (!InitSockets()) return Socket();
+
+	Socket listener((Handle)socket(AF_INET, SOCK_STREAM, 0));
+	if (!listener.IsValid()) return Socket();
+
+	// A restarted worker must be able to take its port back while old connections linger
+	int reuse = 1;
+	setsockopt((NativeSocket)listener.m_handle, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons((uint16_t)port);
+	if (bind((NativeSocket)listener.m_handle, (sockaddr*)&address, sizeof(address)) != 0) return Socket();
+	if (listen((NativeSocket)listener.m_handle, backlog) != 0) return Socket();
+	listener.m_tcp = true;
+	return listener;
+}
+
+Socket Socket::ConnectTcp(const std::string& host, int port)
+{
+	if (!InitSockets()) return Socket();
+
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* addresses = nullptr;
+	if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) return Socket();
+
+	Socket connection;
+	for (addrinfo* address = addresses; address && !connection.IsValid(); address = address->ai_next)
+	{
+		Socket candidate((Handle)socket(address->ai_family, address->ai_socktype, address->ai_protocol));
+		if (candidate.IsValid() && connect((NativeSocket)candidate.m_handle, address->ai_addr, (int)address->ai_addrlen) == 0)
+			connection = std::move(candidate);
+	}
+	freeaddrinfo(addresses);
+	if (connection.IsValid()) DisableNagle((NativeSocket)connection.m_handle);
+	return connection;
+}
+
+Socket Socket::Listen(const std::string& address, int backlog)
+{
+	std::string host;
+	int port;
+	return ParseTcpAddress(address, host, port) ? ListenTcp(port, backlog) : ListenLocal(address, backlog);
+}
+
+Socket Socket::Connect(const std::string& address)
+{
+	std::string host;
+	int port;
+	return ParseTcpAddress(address, host, port) ? ConnectTcp(host, port) : ConnectLocal(address);
+}
+
+Socket Socket::Accept() const
+{
+	if (!IsValid()) return Socket();
+	auto handle = accept((NativeSocket)m_handle, nullptr, nullptr);
+	Socket connection((Handle)handle);
+	if (m_tcp && connection.IsValid()) DisableNagle((NativeSocket)connection.m_handle);
+	return connection;
+}
+
+bool Socket::SendAll(const void* data, size_t bytes) const
+{
+	SocketBuffer buffer = { data, bytes };
+	return SendAll(&buffer, 1);
+}
+
+bool Socket::SendAll(const SocketBuffer* buffers, int count) const
+{
+	if (!IsValid()) return false;
+
+	// Partial sends are resumed from wherever the OS stopped, buffer by buffer
+	int first = 0;
+	size_t offset = 0;
+	while (first < count)
+	{
+#ifdef WL_PLATFORM_WINDOWS
+		WSABUF pieces[16];
+		DWORD pieceCount = 0;
+		for (int i = first; i < count && pieceCount < 16; i++, pieceCount++)
+		{
+			size_t skip = i == first ? offset : 0;
+			pieces[pieceCount].buf = (CHAR*)buffers[i].data + skip;
+			pieces[pieceCount].len = (ULONG)(buffers[i].size - skip);
+		}
+		DWORD sentBytes = 0;
+		if (WSASend((NativeSocket)m_handle, pieces, pieceCount, &sentBytes, 0, nullptr, nullptr) != 0) return false;
+		size_t sent = sentBytes;
+#else
+		iovec pieces[16];
+		int pieceCount = 0;
+		for (int i = first; i < count && pieceCount < 16; i++, pieceCount++)
+		{
+			size_t skip = i == first ? offset : 0;
+			pieces[pieceCount].iov_base = (char*)buffers[i].data + skip;
+			pieces[pieceCount].iov_len = buffers[i].size - skip;
+		}
+		msghdr message = {};
+		message.msg_iov = pieces;
+		message.msg_iovlen = pieceCount;
+		ssize_t result = sendmsg((NativeSocket)m_handle, &message, SendFlags);
+		if (result < 0)
+		{
+			if (errno == EINTR) continue;
+			return false;
+		}
+		size_t sent = (size_t)result;
+#endif
+		while (first < count && sent >= buffers[first].size - offset)
+		{
+			sent -= buffers[first].size - offset;
+			offset = 0;
+			first++;
+		}
+		offset += sent;
+	}
+	return true;
+}
+
+bool Socket::ReceiveAll(void* data, size_t bytes) const
+{
+	if (!IsValid()) return false;
+
+	char* out = (char*)data;
+	while (bytes > 0)
+	{
+		int chunk = (int)std::min(bytes, (size_t)1 << 30);
+		auto received = recv((NativeSocket)m_handle, out, chunk, 0);
+		if (received == 0) return false;
+		if (received < 0)
+		{
+#ifndef WL_PLATFORM_WINDOWS
+			if (errno == EINTR) continue;
+#endif
+			return false;
+		}
+		out += received;
+		bytes -= (size_t)received;
+	}
+	return true;
+}
+
+void Socket::Shutdown()
+{
+	if (!IsValid()) return;
+#ifdef WL_PLATFORM_WINDOWS
+	shutdown((NativeSocket)m_handle, SD_BOTH);
+#else
+	shutdown((NativeSocket)m_handle, SHUT_RDWR);
+#endif
+}
+
+void Socket::Close()
+{
+	if (IsValid())
+	{
+		CloseNative((NativeSocket)m_handle);
+		m_handle = InvalidHandle;
+	}
+	if (!m_unlinkPath.empty())
+	{
+		remove(m_unlinkPath.c_str());
+		m_unlinkPath.clear();
+	}
+}
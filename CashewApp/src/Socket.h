@@ -0,0 +1,57 @@
+#pragma once
+
+// One piece of a gathered send
+struct SocketBuffer
+{
+	const void* data;
+	size_t size;
+};
+
+// Blocking stream socket over BSD sockets or Winsock. Local sockets are Unix domain
+// sockets, which Windows supports from Windows 10 1803 on; TCP ones reach other machines.
+class Socket
+{
+public:
+	Socket() = default;
+	~Socket();
+
+	Socket(Socket&& other) noexcept;
+	Socket& operator=(Socket&& other) noexcept;
+	Socket(const Socket&) = delete;
+	Socket& operator=(const Socket&) = delete;
+
+	// Replaces any stale socket file at path; the file is removed again on Close
+	static Socket ListenLocal(const std::string& path, int backlog = 16);
+	static Socket ConnectLocal(const std::string& path);
+	// On every interface; connections have Nagle's algorithm off, as small requests can't wait
+	static Socket ListenTcp(int port, int backlog = 16);
+	static Socket ConnectTcp(const std::string& host, int port);
+	// "host:port" is TCP, anything else the path of a local socket
+	static Socket Listen(const std::string& address, int backlog = 16);
+	static Socket Connect(const std::string& address);
+	// Invalid once the listening socket is closed
+	Socket Accept() const;
+
+	bool IsValid() const { return m_handle != InvalidHandle; }
+
+	// Each blocks until everything went through; false once the connection failed or the peer left
+	bool SendAll(const void* data, size_t bytes) const;
+	// Hands all buffers to the OS in one call, so headers and payloads need no staging copy
+	bool SendAll(const SocketBuffer* buffers, int count) const;
+	bool ReceiveAll(void* data, size_t bytes) const;
+
+	// Wakes up a thread blocked in Accept or ReceiveAll on this socket
+	void Shutdown();
+	void Close();
+
+private:
+	using Handle = intptr_t;
+	static const Handle InvalidHandle = -1;
+
+	explicit Socket(Handle handle) : m_handle(handle) {}
+
+private:
+	Handle m_handle = InvalidHandle;
+	std::string m_unlinkPath;
+	bool m_tcp = false;
+};
@@ -0,0 +1,154 @@
+#include "utils.h"
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+// Keys one radix sort worker histograms and scatters at a time
+#define RADIX_SORT_CHUNK 16384
+
+// Spreads the low 10 bits of v out to every third bit
+static uint32_t ExpandBits10(uint32_t v)
+{
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+// Spreads the low 21 bits of v out to every third bit
+static uint64_t ExpandBits21(uint64_t v)
+{
+	v &= 0x1fffff;
+	v = (v | (v << 32)) & 0x1f00000000ffffull;
+	v = (v | (v << 16)) & 0x1f0000ff0000ffull;
+	v = (v | (v << 8)) & 0x100f00f00f00f00full;
+	v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+	v = (v | (v << 2)) & 0x1249249249249249ull;
+	return v;
+}
+
+template<typename Key>
+static void ComputeMortonCodesT(const glm::vec3* points, int count, const glm::vec3& bmin, const glm::vec3& bmax, Key* codes)
+{
+	const float cells = sizeof(Key) == 4 ? 1024.f : 2097152.f;
+	glm::vec3 extent = bmax - bmin;
+	glm::vec3 scale;
+	for (int a = 0; a < 3; a++)
+		scale[a] = extent[a] > 0.f ? cells / extent[a] : 0.f;
+
+	ParallelForRange(count, [&](int first, int last)
+		{
+			for (int i = first; i < last; i++)
+			{
+				glm::vec3 p = (points[i] - bmin) * scale;
+				Key code = 0;
+				for (int a = 0; a < 3; a++)
+				{
+					uint32_t coord = (uint32_t)std::clamp(p[a], 0.f, cells - 1.f);
+					if constexpr (sizeof(Key) == 4)
+						code |= ExpandBits10(coord) << (2 - a);
+					else
+						code |= ExpandBits21(coord) << (2 - a);
+				}
+				codes[i] = code;
+			}
+		});
+}
+
+void ComputeMortonCodes(const glm::vec3* points, int count, const glm::vec3& bmin, const glm::vec3& bmax, uint32_t* codes)
+{
+	ComputeMortonCodesT(points, count, bmin, bmax, codes);
+}
+
+void ComputeMortonCodes(const glm::vec3* points, int count, const glm::vec3& bmin, const glm::vec3& bmax, uint64_t* codes)
+{
+	ComputeMortonCodesT(points, count, bmin, bmax, codes);
+}
+
+template<typename Key>
+static void RadixSortPairsT(std::vector<Key>& keys, std::vector<int>& values)
+{
+	int count = (int)keys.size();
+	int chunkCount = std::max(1, (count + RADIX_SORT_CHUNK - 1) / RADIX_SORT_CHUNK);
+	std::vector<Key> keysOut(count);
+	std::vector<int> valuesOut(count);
+	std::vector<int> offsets((size_t)chunkCount * RADIX_BUCKETS);
+
+	for (int shift = 0; shift < (int)sizeof(Key) * 8; shift += RADIX_BITS)
+	{
+		ParallelForRange(chunkCount, [&](int firstChunk, int lastChunk)
+			{
+				for (int chunk = firstChunk; chunk < lastChunk; chunk++)
+				{
+					int* histogram = &offsets[(size_t)chunk * RADIX_BUCKETS];
+					std::fill(histogram, histogram + RADIX_BUCKETS, 0);
+					int end = std::min(count, (chunk + 1) * RADIX_SORT_CHUNK);
+					for (int i = chunk * RADIX_SORT_CHUNK; i < end; i++)
+						histogram[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+				}
+			}, 1);
+
+		// Digit-major prefix sum: digit 0 of every chunk in order, then digit 1, ...
+		int total = 0;
+		bool singleDigit = false;
+		for (int digit = 0; digit < RADIX_BUCKETS; digit++)
+		{
+			int digitStart = total;
+			for (int chunk = 0; chunk < chunkCount; chunk++)
+			{
+				int& offset = offsets[(size_t)chunk * RADIX_BUCKETS + digit];
+				int chunkDigitCount = offset;
+				offset = total;
+				total += chunkDigitCount;
+			}
+			singleDigit |= total - digitStart == count;
+		}
+		// Every key has the same digit here, as the high bits of narrow codes do: nothing moves
+		if (singleDigit) continue;
+
+		ParallelForRange(chunkCount, [&](int firstChunk, int lastChunk)
+			{
+				for (int chunk = firstChunk; chunk < lastChunk; chunk++)
+				{
+					int* cursor = &offsets[(size_t)chunk * RADIX_BUCKETS];
+					int end = std::min(count, (chunk + 1) * RADIX_SORT_CHUNK);
+					for (int i = chunk * RADIX_SORT_CHUNK; i < end; i++)
+					{
+						int dst = cursor[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+						keysOut[dst] = keys[i];
+						valuesOut[dst] = values[i];
+					}
+				}
+			}, 1);
+		keys.swap(keysOut);
+		values.swap(valuesOut);
+	}
+}
+
+void RadixSortPairs(std::vector<uint32_t>& keys, std::vector<int>& values)
+{
+	RadixSortPairsT(keys, values);
+}
+
+void RadixSortPairs(std::vector<uint64_t>& keys, std::vector<int>& values)
+{
+	RadixSortPairsT(keys, values);
+}
+
+std::vector<int> ComputeMortonOrder(const glm::vec3* points, int count)
+{
+	glm::vec3 bmin(1e30f), bmax(-1e30f);
+	for (int i = 0; i < count; i++)
+	{
+		bmin = fminf(bmin, points[i]);
+		bmax = fmaxf(bmax, points[i]);
+	}
+
+	std::vector<uint32_t> codes(count);
+	ComputeMortonCodes(points, count, bmin, bmax, codes.data());
+	std::vector<int> order(count);
+	std::iota(order.begin(), order.end(), 0);
+	RadixSortPairs(codes, order);
+	return order;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+// Morton (Z-order) codes and the radix sort that orders things by them. Points close on the
+// curve are close in space, so sorting by code is a cheap way to make neighbours in space
+// neighbours in memory: the linear BVH builder and mesh reordering both start from it.
+
+// Codes of count points quantized onto a grid over [bmin, bmax]: 10 bits per axis for 32-bit
+// codes, 21 bits per axis for 64-bit ones. x takes the highest bit of each triple.
+void ComputeMortonCodes(const glm::vec3* points, int count, const glm::vec3& bmin, const glm::vec3& bmax, uint32_t* codes);
+void ComputeMortonCodes(const glm::vec3* points, int count, const glm::vec3& bmin, const glm::vec3& bmax, uint64_t* codes);
+
+// Stable LSD radix sort of keys, 8 bits per pass, carrying values along. Passes run in parallel
+// over fixed chunks and are skipped when every key has the same digit.
+void RadixSortPairs(std::vector<uint32_t>& keys, std::vector<int>& values);
+void RadixSortPairs(std::vector<uint64_t>& keys, std::vector<int>& values);
+
+// Indices of count points in Morton order over their own bounds, 30-bit codes
+std::vector<int> ComputeMortonOrder(const glm::vec3* points, int count);
\ No newline at end of file
@@ -0,0 +1,267 @@
+#include "utils.h"
+
+int Tlas::AddInstance(const Bvh* blas, int meshIdx, const glm::mat4& transform)
+{
+    Instance& instance = m_instances.emplace_back();
+    instance.meshIdx = meshIdx;
+    instance.blas = blas;
+    UpdateInstance(instance, transform);
+
+    // Instance counts are tiny next to triangle counts, a full rebuild is cheap
+    Build();
+    return (int)m_instances.size() - 1;
+}
+
+void Tlas::SetTransform(int instIdx, const glm::mat4& transform)
+{
+    UpdateInstance(m_instances[instIdx], transform);
+    Refit();
+}
+
+void Tlas::SetBlas(int instIdx, const Bvh* blas, int level)
+{
+    Instance& instance = m_instances[instIdx];
+    instance.blas = blas;
+    instance.level = level;
+    // Simplified levels may bulge slightly past the full mesh's bounds
+    UpdateInstance(instance, instance.transform);
+    Refit();
+}
+
+void Tlas::RefreshMesh(int meshIdx)
+{
+    for (Instance& instance : m_instances)
+    {
+        if (instance.meshIdx == meshIdx)
+            UpdateInstance(instance, instance.transform);
+    }
+    Refit();
+}
+
+void Tlas::Refresh()
+{
+    for (Instance& instance : m_instances)
+        UpdateInstance(instance, instance.transform);
+    Build();
+}
+
+void Tlas::Clear()
+{
+    m_instances.clear();
+    m_nodes.clear();
+    m_instIndices.clear();
+    nodesUsed = 0;
+}
+
+void Tlas::UpdateInstance(Instance& instance, const glm::mat4& transform)
+{
+    instance.transform = transform;
+    instance.invTransform = glm::inverse(transform);
+    glm::mat3 linear = glm::mat3(transform);
+    instance.normalMatrix = glm::transpose(glm::inverse(linear));
+    instance.minScale = std::min(glm::length(linear[0]), std::min(glm::length(linear[1]), glm::length(linear[2])));
+
+    // World bounds from the eight transformed corners of the bottom-level root box
+    glm::vec3 bmin, bmax;
+    instance.blas->GetBounds(bmin, bmax);
+    instance.aabbMin = glm::vec3(1e30f);
+    instance.aabbMax = glm::vec3(-1e30f);
+    for (int i = 0; i < 8; i++)
+    {
+        glm::vec3 corner(i & 1 ? bmax.x : bmin.x, i & 2 ? bmax.y : bmin.y, i & 4 ? bmax.z : bmin.z);
+        glm::vec3 p = glm::vec3(transform * glm::vec4(corner, 1.f));
+        instance.aabbMin = fminf(instance.aabbMin, p);
+        instance.aabbMax = fmaxf(instance.aabbMax, p);
+    }
+}
+
+void Tlas::Build()
+{
+    int count = (int)m_instances.size();
+    m_nodes.resize(std::max(1, count * 2));
+    m_instIndices.resize(count);
+    for (int i = 0; i < count; i++)
+        m_instIndices[i] = i;
+
+    BVHNode& root = m_nodes[m_rootNodeIdx];
+    root.leftFirst = 0;
+    root.triCount = count;
+    nodesUsed = 1;
+    UpdateNodeBounds(m_rootNodeIdx);
+    Subdivide(m_rootNodeIdx);
+}
+
+void Tlas::Refit()
+{
+    // Children are always allocated after their parent, so a reverse sweep is bottom-up
+    for (int nodeIdx = nodesUsed - 1; nodeIdx >= 0; nodeIdx--)
+    {
+        BVHNode& node = m_nodes[nodeIdx];
+        if (node.isLeaf())
+        {
+            UpdateNodeBounds(nodeIdx);
+            continue;
+        }
+        const BVHNode& left = m_nodes[node.leftFirst];
+        const BVHNode& right = m_nodes[node.leftFirst + 1];
+        node.aabbMin = fminf(left.aabbMin, right.aabbMin);
+        node.aabbMax = fmaxf(left.aabbMax, right.aabbMax);
+    }
+}
+
+void Tlas::Subdivide(int nodeIdx)
+{
+    // Same midpoint split as the bottom level, down to one instance per leaf
+    BVHNode& node = m_nodes[nodeIdx];
+    if (node.triCount <= 1) return;
+    glm::vec3 extent = node.aabbMax - node.aabbMin;
+    int axis = 0;
+    if (extent.y > extent.x) axis = 1;
+    if (extent.z > extent[axis]) axis = 2;
+    float splitPos = node.aabbMin[axis] + extent[axis] * 0.5f;
+    int i = node.leftFirst;
+    int j = i + node.triCount - 1;
+    while (i <= j)
+    {
+        const Instance& instance = m_instances[m_instIndices[i]];
+        if ((instance.aabbMin[axis] + instance.aabbMax[axis]) * 0.5f < splitPos)
+            i++;
+        else
+            std::swap(m_instIndices[i], m_instIndices[j--]);
+    }
+    int leftCount = i - node.leftFirst;
+    if (leftCount == 0 || leftCount == node.triCount) return;
+    int leftChildIdx = nodesUsed++;
+    int rightChildIdx = nodesUsed++;
+    m_nodes[leftChildIdx].leftFirst = node.leftFirst;
+    m_nodes[leftChildIdx].triCount = leftCount;
+    m_nodes[rightChildIdx].leftFirst = i;
+    m_nodes[rightChildIdx].triCount = node.triCount - leftCount;
+    node.leftFirst = leftChildIdx;
+    node.triCount = 0;
+    UpdateNodeBounds(leftChildIdx);
+    UpdateNodeBounds(rightChildIdx);
+    Subdivide(leftChildIdx);
+    Subdivide(rightChildIdx);
+}
+
+void Tlas::UpdateNodeBounds(int nodeIdx)
+{
+    BVHNode& node = m_nodes[nodeIdx];
+    node.aabbMin = glm::vec3(1e30f);
+    node.aabbMax = glm::vec3(-1e30f);
+    for (int first = node.leftFirst, i = 0; i < node.triCount; i++)
+    {
+        const Instance& instance = m_instances[m_instIndices[first + i]];
+        node.aabbMin = fminf(node.aabbMin, instance.aabbMin);
+        node.aabbMax = fmaxf(node.aabbMax, instance.aabbMax);
+    }
+}
+
+void Tlas::GetBounds(glm::vec3& bmin, glm::vec3& bmax) const
+{
+    if (m_instances.empty())
+    {
+        bmin = glm::vec3(1e30f);
+        bmax = glm::vec3(-1e30f);
+        return;
+    }
+    bmin = m_nodes[m_rootNodeIdx].aabbMin;
+    bmax = m_nodes[m_rootNodeIdx].aabbMax;
+}
+
+template<bool AnyHit, bool Barycentrics>
+bool Tlas::Intersect(Ray& ray) const
+{
+    if (m_instances.empty()) return false;
+
+    return IntersectTLAS<AnyHit, Barycentrics>(ray, m_rootNodeIdx);
+}
+
+template<bool AnyHit, bool Barycentrics>
+bool Tlas::IntersectTLAS(Ray& ray, int nodeIdx) const
+{
+    const BVHNode& node = m_nodes[nodeIdx];
+    ray.nodesVisited++;
+    if (!Bvh::IntersectAABB(ray, node.aabbMin, node.aabbMax)) return false;
+    if (!node.isLeaf())
+    {
+        bool hit = IntersectTLAS<AnyHit, Barycentrics>(ray, node.leftFirst);
+        if (AnyHit && hit) return true;
+        return IntersectTLAS<AnyHit, Barycentrics>(ray, node.leftFirst + 1) || hit;
+    }
+
+    bool hit = false;
+    for (int i = 0; i < node.triCount; i++)
+    {
+        int instIdx = m_instIndices[node.leftFirst + i];
+        const Instance& instance = m_instances[instIdx];
+
+        // Direction is not renormalized, so t means the same distance in both spaces
+        Ray localRay(glm::vec3(instance.invTransform * glm::vec4(ray.O, 1.f)), glm::vec3(instance.invTransform * glm::vec4(ray.D, 0.f)));
+        localRay.t = ray.t;
+        bool instanceHit = instance.blas->Intersect<AnyHit, Barycentrics>(localRay);
+        ray.nodesVisited += localRay.nodesVisited;
+        ray.trianglesTested += localRay.trianglesTested;
+        if (instanceHit)
+        {
+            ray.t = localRay.t;
+            ray.hitObjIdx = localRay.hitObjIdx;
+            ray.hitInstIdx = instIdx;
+            if constexpr (Barycentrics)
+            {
+                ray.u = localRay.u;
+                ray.v = localRay.v;
+            }
+            if (AnyHit) return true;
+            hit = true;
+        }
+    }
+    return hit;
+}
+
+template bool Tlas::Intersect<false, true>(Ray& ray) const;
+template bool Tlas::Intersect<false, false>(Ray& ray) const;
+template bool Tlas::Intersect<true, false>(Ray& ray) const;
+
+void Tlas::ClosestPoint(PointQuery& query) const
+{
+    if (m_instances.empty()) return;
+
+    ClosestPointTLAS(query, m_rootNodeIdx);
+}
+
+void Tlas::ClosestPointTLAS(PointQuery& query, int nodeIdx) const
+{
+    const BVHNode& node = m_nodes[nodeIdx];
+    if (Bvh::DistanceSqToAABB(query.P, node.aabbMin, node.aabbMax) >= query.distSq) return;
+    if (!node.isLeaf())
+    {
+        ClosestPointTLAS(query, node.leftFirst);
+        ClosestPointTLAS(query, node.leftFirst + 1);
+        return;
+    }
+
+    for (int i = 0; i < node.triCount; i++)
+    {
+        int instIdx = m_instIndices[node.leftFirst + i];
+        const Instance& instance = m_instances[instIdx];
+
+        // A world distance d is at most d / minScale in object space, so nothing closer is cut off
+        float maxLocalDistance = sqrtf(query.distSq) / std::max(instance.minScale, 1e-20f);
+        PointQuery localQuery(glm::vec3(instance.invTransform * glm::vec4(query.P, 1.f)), maxLocalDistance);
+        instance.blas->ClosestPoint(localQuery);
+        if (localQuery.hitObjIdx == -1) continue;
+
+        glm::vec3 closest = glm::vec3(instance.transform * glm::vec4(localQuery.closest, 1.f));
+        glm::vec3 d = closest - query.P;
+        float distSq = glm::dot(d, d);
+        if (distSq < query.distSq)
+        {
+            query.distSq = distSq;
+            query.closest = closest;
+            query.hitObjIdx = localQuery.hitObjIdx;
+            query.hitInstIdx = instIdx;
+        }
+    }
+}
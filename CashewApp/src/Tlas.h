@@ -0,0 +1,63 @@
+#pragma once
+
+// One placement of a mesh in the scene. Only the transform lives here,
+// the geometry and its bottom-level Bvh are shared between all instances.
+struct Instance
+{
+    int meshIdx;
+    const Bvh* blas;
+    glm::mat4 transform, invTransform;
+    glm::mat3 normalMatrix;
+    glm::vec3 aabbMin, aabbMax; // world space
+    float minScale;             // shortest axis after transform, turns world distances into object space
+    int level = 0;              // level of detail blas belongs to, 0 for the full mesh
+};
+
+// Top-level BVH over instance bounds. Rays are moved into object space at the
+// leaves and handed to the instance's bottom-level Bvh.
+class Tlas
+{
+public:
+    Tlas() = default;
+
+    int AddInstance(const Bvh* blas, int meshIdx, const glm::mat4& transform);
+    // Moving an instance only refits the top level, the bottom-level trees are untouched
+    void SetTransform(int instIdx, const glm::mat4& transform);
+    // Swaps the bottom-level tree, e.g. for another level of detail of the same mesh
+    void SetBlas(int instIdx, const Bvh* blas, int level);
+    // Recomputes the world bounds of every instance of a mesh whose bottom-level tree changed
+    void RefreshMesh(int meshIdx);
+    // Same after every bottom-level tree was rebuilt
+    void Refresh();
+    void Clear();
+
+    void Build();
+    void Refit();
+
+    // Same kernels as Bvh::Intersect, run in every instance the ray reaches
+    template<bool AnyHit = false, bool Barycentrics = true>
+    bool Intersect(Ray& ray) const;
+    // Exact for rigid and uniformly scaled instances; under non-uniform scale each instance
+    // returns its nearest point in object space
+    void ClosestPoint(PointQuery& query) const;
+
+    const Instance& GetInstance(int instIdx) const { return m_instances[instIdx]; }
+    int GetInstanceCount() const { return (int)m_instances.size(); }
+    // World bounds of all instances; inverted (min > max) while the scene is empty
+    void GetBounds(glm::vec3& bmin, glm::vec3& bmax) const;
+
+private:
+    void UpdateInstance(Instance& instance, const glm::mat4& transform);
+    void Subdivide(int nodeIdx);
+    void UpdateNodeBounds(int nodeIdx);
+    template<bool AnyHit, bool Barycentrics>
+    bool IntersectTLAS(Ray& ray, int nodeIdx) const;
+    void ClosestPointTLAS(PointQuery& query, int nodeIdx) const;
+
+private:
+    std::vector<Instance> m_instances;
+    std::vector<BVHNode> m_nodes;
+    std::vector<int> m_instIndices;
+    int nodesUsed = 0;
+    static const int m_rootNodeIdx = 0;
+};
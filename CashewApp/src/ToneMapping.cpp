@@ -0,0 +1,151 @@
+#include "utils.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TONEMAP_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#define TONEMAP_TILE_SIZE 64
+// Inputs are clamped to [0, TONEMAP_MAX_INPUT] first; NaNs become 0 and infinities saturate.
+// Low enough for ACES to square without overflowing, high enough that every operator is white
+#define TONEMAP_MAX_INPUT 1e4f
+
+// Thresholds of a 4x4 Bayer matrix, centred on zero, in units of one output step
+static const float s_bayer[4][4] =
+{
+	{ -0.46875f,  0.03125f, -0.34375f,  0.15625f },
+	{  0.28125f, -0.21875f,  0.40625f, -0.09375f },
+	{ -0.28125f,  0.21875f, -0.40625f,  0.09375f },
+	{  0.46875f, -0.03125f,  0.34375f, -0.15625f }
+};
+
+static inline float ToneMapScalar(float x, ToneMapOperator op)
+{
+	x = x > 0.f ? std::min(x, TONEMAP_MAX_INPUT) : 0.f;
+	switch (op)
+	{
+	case ToneMapOperator::Reinhard: return x / (1.f + x);
+	case ToneMapOperator::Aces: return std::min(1.f, (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f));
+	default: return std::min(x, 1.f);
+	}
+}
+
+// Polynomial in square roots that stays within a quarter of an output step of the exact sRGB curve
+// above the linear segment, so the vector path needs no pow
+static inline float EncodeSRGBScalar(float x)
+{
+	if (x <= 0.0031308f) return 12.92f * x;
+	float s1 = sqrtf(x), s2 = sqrtf(s1), s3 = sqrtf(s2);
+	return std::min(1.f, 0.662002687f * s1 + 0.684122060f * s2 - 0.323583601f * s3 - 0.0225411470f * x);
+}
+
+static void ConvertTileScalar(const glm::vec4* hdr, uint32_t* rgba, uint32_t width, uint32_t x0, uint32_t x1, uint32_t y0, uint32_t y1, const ToneMapSettings& settings, float scale)
+{
+	for (uint32_t y = y0; y < y1; y++)
+	{
+		for (uint32_t x = x0; x < x1; x++)
+		{
+			const glm::vec4& colour = hdr[x + y * width];
+			float offset = settings.dither ? 0.5f + s_bayer[y & 3][x & 3] : 0.5f;
+			uint32_t pixel = 255u << 24;
+			for (int c = 0; c < 3; c++)
+			{
+				float v = ToneMapScalar(colour[c] * scale, settings.op);
+				if (settings.srgb) v = EncodeSRGBScalar(v);
+				pixel |= (uint32_t)std::min(255.f, v * 255.f + offset) << (c * 8);
+			}
+			rgba[x + y * width] = pixel;
+		}
+	}
+}
+
+#ifdef TONEMAP_SSE2
+// One pixel per register, (r, g, b, a) in the lanes, so every operation is channel-wise
+static inline __m128 ToneMapSSE(__m128 x, ToneMapOperator op)
+{
+	const __m128 one = _mm_set1_ps(1.f);
+	// maxps returns its second operand for a NaN, so the order matters
+	x = _mm_min_ps(_mm_max_ps(x, _mm_setzero_ps()), _mm_set1_ps(TONEMAP_MAX_INPUT));
+	switch (op)
+	{
+	case ToneMapOperator::Reinhard:
+		return _mm_div_ps(x, _mm_add_ps(one, x));
+	case ToneMapOperator::Aces:
+	{
+		__m128 numerator = _mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), x), _mm_set1_ps(0.03f)));
+		__m128 denominator = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), x), _mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+		return _mm_min_ps(one, _mm_div_ps(numerator, denominator));
+	}
+	default:
+		return _mm_min_ps(x, one);
+	}
+}
+
+static inline __m128 EncodeSRGBSSE(__m128 x)
+{
+	__m128 s1 = _mm_sqrt_ps(x), s2 = _mm_sqrt_ps(s1), s3 = _mm_sqrt_ps(s2);
+	__m128 curve = _mm_mul_ps(_mm_set1_ps(0.662002687f), s1);
+	curve = _mm_add_ps(curve, _mm_mul_ps(_mm_set1_ps(0.684122060f), s2));
+	curve = _mm_sub_ps(curve, _mm_mul_ps(_mm_set1_ps(0.323583601f), s3));
+	curve = _mm_sub_ps(curve, _mm_mul_ps(_mm_set1_ps(0.0225411470f), x));
+	curve = _mm_min_ps(curve, _mm_set1_ps(1.f));
+	__m128 linear = _mm_mul_ps(_mm_set1_ps(12.92f), x);
+	__m128 useLinear = _mm_cmple_ps(x, _mm_set1_ps(0.0031308f));
+	return _mm_or_ps(_mm_and_ps(useLinear, linear), _mm_andnot_ps(useLinear, curve));
+}
+
+static void ConvertTileSSE(const glm::vec4* hdr, uint32_t* rgba, uint32_t width, uint32_t x0, uint32_t x1, uint32_t y0, uint32_t y1, const ToneMapSettings& settings, float scale)
+{
+	const __m128 scaleRGB = _mm_setr_ps(scale, scale, scale, 0.f);
+	const __m128 alpha = _mm_setr_ps(0.f, 0.f, 0.f, 255.f);
+	const __m128 maxValue = _mm_set1_ps(255.f);
+	for (uint32_t y = y0; y < y1; y++)
+	{
+		// Rounding offsets of the four pixels starting at a multiple of 4, alpha lanes left alone
+		__m128 offsets[4];
+		for (int i = 0; i < 4; i++)
+		{
+			float offset = settings.dither ? 0.5f + s_bayer[y & 3][i] : 0.5f;
+			offsets[i] = _mm_setr_ps(offset, offset, offset, 0.f);
+		}
+
+		uint32_t x = x0;
+		for (; x + 4 <= x1; x += 4)
+		{
+			const float* source = &hdr[x + y * width].x;
+			__m128i quantized[4];
+			for (int i = 0; i < 4; i++)
+			{
+				__m128 v = ToneMapSSE(_mm_mul_ps(_mm_loadu_ps(source + i * 4), scaleRGB), settings.op);
+				if (settings.srgb) v = EncodeSRGBSSE(v);
+				v = _mm_add_ps(_mm_mul_ps(v, maxValue), offsets[(x + i) & 3]);
+				quantized[i] = _mm_cvttps_epi32(_mm_min_ps(_mm_add_ps(v, alpha), maxValue));
+			}
+			// 32-bit lanes down to bytes: r, g, b, a of four pixels in memory order
+			__m128i packed = _mm_packus_epi16(_mm_packs_epi32(quantized[0], quantized[1]), _mm_packs_epi32(quantized[2], quantized[3]));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&rgba[x + y * width]), packed);
+		}
+		if (x < x1) ConvertTileScalar(hdr, rgba, width, x, x1, y, y + 1, settings, scale);
+	}
+}
+#endif
+
+void ConvertToRGBA8(const glm::vec4* hdr, uint32_t* rgba, uint32_t width, uint32_t height, const ToneMapSettings& settings, float scale)
+{
+	uint32_t tilesX = (width + TONEMAP_TILE_SIZE - 1) / TONEMAP_TILE_SIZE;
+	uint32_t tilesY = (height + TONEMAP_TILE_SIZE - 1) / TONEMAP_TILE_SIZE;
+	scale *= settings.exposure;
+	ParallelForRange((int)(tilesX * tilesY), [&](int first, int last)
+		{
+			for (int tile = first; tile < last; tile++)
+			{
+				uint32_t x0 = (tile % tilesX) * TONEMAP_TILE_SIZE, y0 = (tile / tilesX) * TONEMAP_TILE_SIZE;
+				uint32_t x1 = std::min(width, x0 + TONEMAP_TILE_SIZE), y1 = std::min(height, y0 + TONEMAP_TILE_SIZE);
+#ifdef TONEMAP_SSE2
+				ConvertTileSSE(hdr, rgba, width, x0, x1, y0, y1, settings, scale);
+#else
+				ConvertTileScalar(hdr, rgba, width, x0, x1, y0, y1, settings, scale);
+#endif
+			}
+		}, 1);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+enum class ToneMapOperator
+{
+	Clamp,		// values above 1 saturate
+	Reinhard,	// x / (1 + x) per channel
+	Aces		// Narkowicz's fit of the ACES filmic curve
+};
+
+struct ToneMapSettings
+{
+	ToneMapOperator op = ToneMapOperator::Clamp;
+	float exposure = 1.f;
+	// Encode for an sRGB display; off keeps the linear values the renderer has always shown
+	bool srgb = false;
+	// 4x4 ordered dither before quantizing, which hides banding in smooth gradients
+	bool dither = false;
+};
+
+// Converts width * height linear colours to packed RGBA8 (alpha 255), scaling each by scale
+// first, e.g. 1 / samples for an accumulation buffer. Runs on tiles in parallel, four pixels at
+// a time with SSE2 where available.
+void ConvertToRGBA8(const glm::vec4* hdr, uint32_t* rgba, uint32_t width, uint32_t height, const ToneMapSettings& settings, float scale = 1.f);
@@ -5,16 +5,60 @@
 #include "Walnut/Timer.h"
 
 #include "utils.h"
+#include <future>
 
 using namespace Walnut;
 
+// Model names typed without an extension are the JSON files the app has always loaded
+static std::string GetModelFileName(const std::string& name)
+{
+	size_t slash = name.find_last_of("/\\");
+	size_t dot = name.find_last_of('.');
+	bool hasExtension = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+	return hasExtension ? name : name + ".json";
+}
+
 class ExampleLayer : public Walnut::Layer
 {
 public:
 	ExampleLayer() : m_Camera(45.0f, 0.1f, 100.f) {}
 	virtual void OnUpdate(float ts) override
 	{
-		m_Camera.OnUpdate(ts);
+		{
+			// Moving the camera recomputes every primary ray direction
+			PROFILE_SCOPE(ProfilePhase::RayGeneration);
+			m_cameraMoving = m_Camera.OnUpdate(ts);
+		}
+
+		// Simplification runs on its own thread; its levels join the scene between frames
+		if (m_lodFuture.valid() && m_lodFuture.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+		{
+			std::vector<std::shared_ptr<const Mesh>> levels = m_lodFuture.get();
+			// Unless the scene was reloaded meanwhile
+			if (m_lodMeshIdx < m_Scene.GetMeshCount() && m_Scene.GetSharedMesh(m_lodMeshIdx) == m_lodSource)
+			{
+				m_Scene.SetLevelsOfDetail(m_lodMeshIdx, levels);
+				m_sceneChanged = true;
+				m_lodOutputText = "Triangles per level:";
+				for (int level = 0; level < m_Scene.GetLevelCount(m_lodMeshIdx); level++)
+					m_lodOutputText += " " + std::to_string(m_Scene.GetLevelTriangleCount(m_lodMeshIdx, level));
+			}
+			m_lodSource.reset();
+		}
+
+		if (m_animate && m_Scene.GetInstanceCount() > 0)
+		{
+			m_animationTime += ts;
+			float time = m_animationTime, amplitude = m_animationAmplitude;
+			int meshIdx = m_Scene.GetInstance(m_selectedInstance).meshIdx;
+
+			Timer timer;
+			m_lastUpdateStats = m_Scene.AnimateMesh(meshIdx, [time, amplitude](const glm::vec3& p)
+				{
+					return glm::vec3(p.x, p.y + amplitude * sinf(p.x * 3.f + time * 2.f), p.z);
+				});
+			m_LastUpdateTime = timer.ElapsedMillis();
+		}
 	}
 
 	virtual void OnUIRender() override
@@ -23,13 +67,107 @@ public:
 
 		ImGui::Text("Render Settings");
 
-		ImGui::Checkbox("Smooth Shading", &m_Scene.GetSmoothShading());
+		if (ImGui::Checkbox("Smooth Shading", &m_Scene.GetSmoothShading()))
+		{
+			m_sceneChanged = true;
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Compare kernels"))
+		{
+			m_statsOutputText = m_Renderer.CompareKernels(m_Camera, m_Scene);
+		}
 		ImGui::Text("Last render: %.3fms", m_LastRenderTime);
 		ImGui::Checkbox("Interactive", &m_interactive);
 		if (ImGui::Button("Render"))
 		{
-			Render();
+			// Started with the viewport below, once nothing else this frame can edit the scene
+			m_renderRequested = true;
 		}
+		const char* nodeFormats[] = { "Full", "Quantized 16-bit", "Quantized 8-bit" };
+		if (ImGui::Combo("BVH nodes", &m_nodeFormat, nodeFormats, IM_ARRAYSIZE(nodeFormats)))
+		{
+			m_Scene.SetNodeFormat(static_cast<BvhNodeFormat>(m_nodeFormat));
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Compare"))
+		{
+			m_statsOutputText = m_Renderer.CompareNodeFormats(m_Camera, m_Scene);
+		}
+		if (ImGui::Button("Compare BVH builders"))
+		{
+			m_statsOutputText = m_Renderer.CompareBuilders(m_Camera, m_Scene);
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Compare mesh order"))
+		{
+			m_statsOutputText = m_Renderer.CompareMeshOrder(m_Camera, m_Scene);
+		}
+		const char* renderModes[] = { "Shaded", "Nodes visited", "Triangles tested", "Path traced" };
+		if (ImGui::Combo("Render mode", &m_renderMode, renderModes, IM_ARRAYSIZE(renderModes)))
+		{
+			m_Renderer.SetRenderMode(static_cast<RenderMode>(m_renderMode));
+		}
+		if (m_renderMode == static_cast<int>(RenderMode::PathTraced))
+		{
+			ImGui::DragInt("Max bounces", &m_Renderer.GetMaxBounces(), 0.1f, 0, 64);
+			const char* pathSchedulings[] = { "Per pixel", "Wavefront", "Sorted wavefront" };
+			if (ImGui::Combo("Scheduling", &m_pathScheduling, pathSchedulings, IM_ARRAYSIZE(pathSchedulings)))
+			{
+				m_Renderer.SetPathScheduling(static_cast<PathScheduling>(m_pathScheduling));
+			}
+			ImGui::SameLine();
+			if (ImGui::Button("Compare ray sorting"))
+			{
+				m_statsOutputText = m_Renderer.CompareRaySorting(m_Camera, m_Scene);
+			}
+			ImGui::Text("%d samples per pixel, %.2f Msamples/s", m_Renderer.GetAccumulatedSamples(), m_Renderer.GetSamplesPerSecond() / 1000000.0);
+		}
+		else if (m_renderMode != static_cast<int>(RenderMode::Shaded))
+		{
+			ImGui::DragInt("Heatmap scale", &m_Renderer.GetHeatmapScale(), 1.f, 1, 4096);
+			const TraversalCost& cost = m_Renderer.GetLastFrameCost();
+			ImGui::Text("Per ray: %.1f nodes (max %d), %.1f triangles (max %d)", cost.averageNodes, cost.maxNodes, cost.averageTriangles, cost.maxTriangles);
+		}
+		ToneMapSettings& toneMapping = m_Renderer.GetToneMapping();
+		const char* toneMapOperators[] = { "Clamp", "Reinhard", "ACES" };
+		int toneMapOperator = static_cast<int>(toneMapping.op);
+		if (ImGui::Combo("Tone mapping", &toneMapOperator, toneMapOperators, IM_ARRAYSIZE(toneMapOperators)))
+		{
+			toneMapping.op = static_cast<ToneMapOperator>(toneMapOperator);
+		}
+		ImGui::DragFloat("Exposure", &toneMapping.exposure, 0.01f, 0.f, 16.f);
+		ImGui::Checkbox("sRGB", &toneMapping.srgb);
+		ImGui::SameLine();
+		ImGui::Checkbox("Dither", &toneMapping.dither);
+		ImGui::SameLine();
+		if (ImGui::Button("Save HDR"))
+		{
+			m_statsOutputText = m_Renderer.SaveHDR("render.pfm") ? "Last frame written to render.pfm" : "Could not write render.pfm";
+		}
+		if (ImGui::Button("Tree statistics"))
+		{
+			m_statsOutputText = m_Renderer.ReportTreeStatistics(m_Scene);
+		}
+		const char* lodModes[] = { "Off", "While moving", "Always" };
+		if (ImGui::Combo("Level of detail", &m_lodMode, lodModes, IM_ARRAYSIZE(lodModes)))
+		{
+			m_Renderer.SetLevelOfDetailMode(static_cast<LevelOfDetailMode>(m_lodMode));
+			m_sceneChanged = true;
+		}
+		ImGui::SliderInt("LOD levels", &m_lodLevels, 1, 8);
+		if (m_lodFuture.valid())
+		{
+			ImGui::Text("Simplifying...");
+		}
+		else if (ImGui::Button("Generate LODs") && m_Scene.GetInstanceCount() > 0)
+		{
+			m_lodMeshIdx = m_Scene.GetInstance(m_selectedInstance).meshIdx;
+			m_lodSource = m_Scene.GetSharedMesh(m_lodMeshIdx);
+			std::shared_ptr<const Mesh> mesh = m_lodSource;
+			int levelCount = m_lodLevels;
+			m_lodFuture = std::async(std::launch::async, [mesh, levelCount]() { return BuildLevelsOfDetail(*mesh, levelCount); });
+		}
+		ImGui::Text("%s", m_lodOutputText.c_str());
 		
 		ImGui::Separator();
 		ImGui::Spacing();
@@ -38,6 +176,14 @@ public:
 
 		ImGui::Separator();
 
+		const ArenaStats& memoryStats = m_Scene.GetMemoryStats();
+		ImGui::Text("Scene Memory");
+		ImGui::Text("Reserved: %.2fMB, used: %.2fMB, peak: %.2fMB", memoryStats.bytesReserved / (1024.f * 1024.f),
+			memoryStats.bytesUsed / (1024.f * 1024.f), memoryStats.peakBytesUsed / (1024.f * 1024.f));
+		ImGui::Text("Allocations: %zu, blocks: %zu, reuses: %zu", memoryStats.allocations, memoryStats.blockAllocations, memoryStats.reuses);
+
+		ImGui::Separator();
+
 		ImGui::Text("Light Settings");
 
 		ImGui::DragFloat("Light X", &m_Scene.GetLightPos().x, 0.1f);
@@ -60,6 +206,14 @@ public:
 		m_ViewportWidth = ImGui::GetContentRegionAvail().x;
 		m_ViewportHeight = ImGui::GetContentRegionAvail().y;
 
+		// The next frame is traced on a worker thread while the last one is uploaded and drawn here
+		if (m_interactive || m_renderRequested)
+		{
+			Render();
+			m_renderRequested = false;
+		}
+		m_Renderer.Present();
+
 		auto image = m_Renderer.GetFinalImage();
 		if (image)
 		{
@@ -69,41 +223,176 @@ public:
 		ImGui::End();
 		ImGui::PopStyleVar();
 
-		if (m_interactive)
+		RenderProfilerPanel();
+		// Done before the next update can move the camera or edit the scene under it
+		WaitForRender();
+		Profiler::EndFrame();
+	}
+	void RenderProfilerPanel()
+	{
+		ImGui::Begin("Profiler");
+#ifdef CASHEW_PROFILING
+		char overlay[64];
+		for (int p = 0; p < (int)ProfilePhase::Count; p++)
 		{
-			Render();
+			ProfilePhase phase = static_cast<ProfilePhase>(p);
+			snprintf(overlay, sizeof(overlay), "%.2fms (avg %.2fms)", Profiler::GetLastFrame(phase), Profiler::GetAverage(phase));
+			ImGui::PlotHistogram(Profiler::GetName(phase), Profiler::GetHistory(phase), Profiler::HistoryLength, Profiler::GetHistoryOffset(), overlay, 0.f, FLT_MAX, ImVec2(0, 40));
+		}
+		ImGui::TextDisabled("Phases other than Frame add up the time of every worker thread.");
+		for (int c = 0; c < (int)ProfileCounter::Count; c++)
+		{
+			ProfileCounter counter = static_cast<ProfileCounter>(c);
+			snprintf(overlay, sizeof(overlay), "%.0f", Profiler::GetLastFrame(counter));
+			ImGui::PlotHistogram(Profiler::GetName(counter), Profiler::GetHistory(counter), Profiler::HistoryLength, Profiler::GetHistoryOffset(), overlay, 0.f, FLT_MAX, ImVec2(0, 40));
+		}
+
+		ImGui::InputInt("Trace frames", &m_traceFrames);
+		if (Profiler::IsCapturing())
+		{
+			ImGui::Text("Capturing...");
+		}
+		else
+		{
+			if (ImGui::Button("Capture trace"))
+			{
+				Profiler::StartCapture(m_traceFrames);
+			}
+			ImGui::SameLine();
+			if (ImGui::Button("Export trace"))
+			{
+				bool exported = Profiler::ExportChromeTrace("profile_trace.json");
+				m_profilerOutputText = exported ? "Trace written to profile_trace.json" : "Could not write profile_trace.json";
+			}
 		}
+		ImGui::Text("%s", m_profilerOutputText.c_str());
+#else
+		ImGui::Text("Profiling is compiled out of Dist builds.");
+#endif
+		ImGui::End();
 	}
 	void RenderJSONStatsFields()
 	{
 		ImGui::Text("Load model");
 
 		static char jsonFileBuffer[128];
-		ImGui::InputText("JSON File Name", jsonFileBuffer, IM_ARRAYSIZE(jsonFileBuffer));
+		// Names without an extension are read as .json; .stl and .ply go to the binary loaders
+		ImGui::InputText("File Name", jsonFileBuffer, IM_ARRAYSIZE(jsonFileBuffer));
 		ImGui::InputFloat("Scale", &m_scale);
 		ImGui::InputFloat3("Colour", colour);
-		if (ImGui::Button("Load"))
+		const char* normalWeightings[] = { "Uniform", "Area", "Angle" };
+		ImGui::Combo("Normal weighting", &m_normalWeighting, normalWeightings, IM_ARRAYSIZE(normalWeightings));
+		ImGui::Checkbox("Weld vertices", &m_weldVertices);
+		if (m_weldVertices)
+		{
+			ImGui::SameLine();
+			ImGui::InputFloat("Tolerance", &m_weldTolerance, 0.f, 0.f, "%.1e");
+		}
+		// Zero loads the file as is; each level splits every triangle into four
+		ImGui::SliderInt("Subdivision levels", &m_subdivisionLevels, 0, 4);
+		// Off keeps the file's own order, which is what "Compare mesh order" measures against
+		ImGui::Checkbox("Reorder for locality", &m_reorderForLocality);
+		const char* builders[] = { "Midpoint", "Spatial split", "Linear (LBVH)" };
+		ImGui::Combo("BVH builder", &m_builder, builders, IM_ARRAYSIZE(builders));
+		if (m_builder == static_cast<int>(BvhBuilder::SpatialSplit))
+		{
+			ImGui::DragFloat("Split budget", &m_spatialSplitBudget, 0.01f, 0.f, 4.f);
+		}
+		if (m_builder == static_cast<int>(BvhBuilder::Linear))
 		{
-			std::string file(jsonFileBuffer);
+			ImGui::Checkbox("Treelet optimization", &m_treeletOptimization);
+		}
+		bool load = ImGui::Button("Load");
+		ImGui::SameLine();
+		bool add = ImGui::Button("Add to scene");
+		if (load || add)
+		{
+			std::string file = GetModelFileName(jsonFileBuffer);
 			std::string path = "./data/";
-			std::string jsonExt = ".json";
 			glm::vec3 vecColour = glm::vec3(colour[0], colour[1], colour[2]);
-			if (m_Parser.ParseFile(path.append(file).append(jsonExt).c_str(), m_scale, vecColour/255.f))
+			if (m_Parser.LoadFile(path.append(file).c_str(), m_scale, vecColour/255.f))
 			{
-				m_Parser.CalculateVertexNormals();
-				m_Scene.LoadModelToScene(m_Parser.GetTriangles(), m_Parser.GetVertices());
-				m_loadOutputText = "File " + file + ".json loaded.";
+				WeldStats weldStats;
+				if (m_weldVertices) weldStats = m_Parser.WeldVertices(m_weldTolerance);
+				m_Parser.Subdivide(m_subdivisionLevels);
+				m_Parser.CalculateVertexNormals(static_cast<NormalWeighting>(m_normalWeighting));
+				if (m_reorderForLocality) m_Parser.ReorderForLocality();
+				BvhBuildOptions buildOptions = m_Scene.GetBuildOptions();
+				if (buildOptions.builder != static_cast<BvhBuilder>(m_builder) || buildOptions.spatialSplitBudget != m_spatialSplitBudget
+					|| buildOptions.treeletOptimization != m_treeletOptimization)
+				{
+					buildOptions.builder = static_cast<BvhBuilder>(m_builder);
+					buildOptions.spatialSplitBudget = m_spatialSplitBudget;
+					buildOptions.treeletOptimization = m_treeletOptimization;
+					// A plain load replaces every mesh anyway, so don't rebuild the current ones first
+					m_Scene.SetBuildOptions(buildOptions, !load);
+				}
+				if (load)
+				{
+					m_Scene.LoadModelToScene(m_Parser.GetMesh());
+					m_instancePlacements.assign(1, InstancePlacement());
+				}
+				else
+				{
+					m_Scene.AddInstance(m_Scene.AddMesh(m_Parser.GetMesh()), glm::mat4(1.f));
+					m_instancePlacements.push_back(InstancePlacement());
+				}
+				m_selectedInstance = m_Scene.GetInstanceCount() - 1;
+				m_sceneChanged = true;
+				m_loadOutputText = "File " + file + " loaded (" + std::to_string(m_Parser.GetPeakLoadMemory() / (1024 * 1024)) + "MB peak).";
+				if (m_weldVertices)
+					m_loadOutputText += "\nWelding removed " + std::to_string(weldStats.verticesRemoved) + " vertices, " + std::to_string(weldStats.trianglesRemoved) + " triangles.";
 				m_error = false;
 			}
 			else
 			{
 				m_error = true;
-				m_loadOutputText = "File " + file + ".json failed to load.";
+				m_loadOutputText = "File " + file + " failed to load.";
 			}
 		}
+		ImGui::SameLine();
+		if (ImGui::Button("Compare loaders"))
+		{
+			// Writes <name>.stl and <name>.ply next to the JSON file to time them against it
+			std::string jsonName(jsonFileBuffer);
+			m_loadOutputText = Parser::CompareLoaders("./data/" + jsonName.substr(0, jsonName.find_last_of('.')) + ".json", m_scale);
+			m_error = false;
+		}
 
 		ImGui::TextColored(m_error ? ImVec4(255, 0, 0, 255) : ImVec4(0, 255, 0, 255), m_loadOutputText.c_str());
 
+		// Out-of-core meshes: the loaded file written as clusters, then traced from disk
+		ImGui::InputInt("Cache budget (MB)", &m_clusterCacheMB);
+		m_clusterCacheMB = std::max(1, m_clusterCacheMB);
+		std::string clusterPath = "./data/" + std::string(jsonFileBuffer) + ".clusters";
+		if (ImGui::Button("Convert to clusters") && m_Parser.GetMesh())
+		{
+			m_error = !ClusteredMesh::Build(*m_Parser.GetMesh(), clusterPath);
+			m_loadOutputText = m_error ? "Failed to write " + clusterPath : "Wrote " + clusterPath;
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Stream clusters"))
+		{
+			m_error = !m_Scene.LoadStreamedModel(clusterPath, (size_t)m_clusterCacheMB * 1024 * 1024);
+			if (!m_error)
+			{
+				m_instancePlacements.clear();
+				m_selectedInstance = 0;
+				m_sceneChanged = true;
+			}
+			m_loadOutputText = m_error ? "Failed to open " + clusterPath : "Streaming " + clusterPath;
+		}
+		if (const std::shared_ptr<ClusteredMesh>& streamedMesh = m_Scene.GetStreamedMesh())
+		{
+			streamedMesh->SetCacheBudget((size_t)m_clusterCacheMB * 1024 * 1024);
+			ClusterCacheStats stats = streamedMesh->GetCacheStats();
+			ImGui::Text("%d of %d clusters resident, %.1fMB (peak %.1fMB), %.1f%% hits, %.1fMB read", stats.residentClusters, streamedMesh->GetClusterCount(),
+				stats.residentBytes / (1024.0 * 1024.0), stats.peakResidentBytes / (1024.0 * 1024.0),
+				100.0 * stats.hits / std::max<uint64_t>(1, stats.hits + stats.misses), stats.bytesRead / (1024.0 * 1024.0));
+		}
+
+		RenderInstanceFields();
+
 		ImGui::Separator();
 		ImGui::Spacing();
 		ImGui::Text("Mesh Statistics");
@@ -142,18 +431,93 @@ public:
 			m_statsOutputText = inside ? "Point is inside loaded mesh." : "Point is outside loaded mesh.";
 		}
 
+		ImGui::SliderInt("Query threads", &m_queryThreads, 1, 64);
+		if (ImGui::Button("Stress query service"))
+		{
+			// Concurrent queries against snapshots of the last loaded mesh while it is reloaded underneath them
+			m_statsOutputText = QueryService::StressTest(m_Parser.GetMesh(), m_Scene.GetBuildOptions(), m_queryThreads, 2.f);
+		}
+
 		ImGui::TextColored(m_error ? ImVec4(255, 0, 0, 255) : ImVec4(0, 255, 0, 255), m_statsOutputText.c_str());
 	}
+	void RenderInstanceFields()
+	{
+		int instanceCount = m_Scene.GetInstanceCount();
+		if (instanceCount == 0) return;
+
+		ImGui::Text("Instances: %d of %d unique meshes", instanceCount, m_Scene.GetMeshCount());
+		if (ImGui::Button("Duplicate"))
+		{
+			// New instance of the selected one's mesh, nudged sideways so it is visible
+			InstancePlacement placement = m_instancePlacements[m_selectedInstance];
+			placement.position.x += 1.f;
+			int meshIdx = m_Scene.GetInstance(m_selectedInstance).meshIdx;
+			m_selectedInstance = m_Scene.AddInstance(meshIdx, placement.GetTransform());
+			m_instancePlacements.push_back(placement);
+			m_sceneChanged = true;
+		}
+		ImGui::SliderInt("Instance", &m_selectedInstance, 0, instanceCount - 1);
+
+		InstancePlacement& placement = m_instancePlacements[m_selectedInstance];
+		bool moved = ImGui::DragFloat3("Position", &placement.position.x, 0.05f);
+		moved |= ImGui::DragFloat("Rotation Y", &placement.rotationY, 0.5f);
+		moved |= ImGui::DragFloat("Instance scale", &placement.scale, 0.01f, 0.01f, 100.f);
+		if (moved)
+		{
+			m_Scene.SetInstanceTransform(m_selectedInstance, placement.GetTransform());
+		}
+
+		ImGui::Checkbox("Animate", &m_animate);
+		ImGui::SameLine();
+		ImGui::DragFloat("Amplitude", &m_animationAmplitude, 0.01f, 0.f, 10.f);
+		bool thresholdsChanged = ImGui::DragFloat("Partial rebuild at", &m_partialRebuildThreshold, 0.01f, 1.f, 10.f);
+		thresholdsChanged |= ImGui::DragFloat("Full rebuild at", &m_fullRebuildThreshold, 0.01f, 1.f, 10.f);
+		if (thresholdsChanged)
+		{
+			m_Scene.SetRebuildThresholds(m_partialRebuildThreshold, m_fullRebuildThreshold);
+		}
+		if (m_animate)
+		{
+			ImGui::Text("Last update: %.3fms, SAH x%.2f, %d subtrees rebuilt%s", m_LastUpdateTime, m_lastUpdateStats.sahRatio,
+				m_lastUpdateStats.subtreesRebuilt, m_lastUpdateStats.fullRebuild ? ", full rebuild" : "");
+		}
+	}
 	void Render()
 	{
-		Timer timer;
+		WaitForRender();
 
 		m_Renderer.OnResize(m_ViewportWidth, m_ViewportHeight);
 		m_Camera.OnResize(m_ViewportWidth, m_ViewportHeight);
-		m_Renderer.Render(m_Camera, m_Scene);
-
-		m_LastRenderTime = timer.ElapsedMillis();
+		m_Renderer.SelectLevelsOfDetail(m_Camera, m_Scene, m_cameraMoving);
+		// Camera moves are caught by the renderer; anything edited through the UI is not
+		if (m_animate || m_sceneChanged || ImGui::IsAnyItemActive())
+			m_Renderer.ResetAccumulation();
+		m_sceneChanged = false;
+		m_renderFuture = std::async(std::launch::async, [this]()
+			{
+				Timer timer;
+				m_Renderer.Render(m_Camera, m_Scene);
+				m_LastRenderTime = timer.ElapsedMillis();
+			});
 	}
+	void WaitForRender()
+	{
+		if (m_renderFuture.valid()) m_renderFuture.get();
+	}
+private:
+	struct InstancePlacement
+	{
+		glm::vec3 position = glm::vec3(0);
+		float rotationY = 0.f, scale = 1.f;
+
+		glm::mat4 GetTransform() const
+		{
+			glm::mat4 transform = glm::translate(glm::mat4(1.f), position);
+			transform = glm::rotate(transform, glm::radians(rotationY), glm::vec3(0, 1, 0));
+			return glm::scale(transform, glm::vec3(scale));
+		}
+	};
+
 private:
 	Renderer m_Renderer;
 	Camera m_Camera;
@@ -163,13 +527,130 @@ private:
 	bool m_error = false, m_interactive = false, m_smoothShading = false;
 	uint32_t m_ViewportWidth = 0, m_ViewportHeight = 0;
 	float m_LastRenderTime = 0, m_scale = 1.f;
+	bool m_animate = false;
+	float m_animationTime = 0.f, m_animationAmplitude = 0.2f, m_LastUpdateTime = 0.f;
+	float m_partialRebuildThreshold = 1.2f, m_fullRebuildThreshold = 2.f;
+	BvhUpdateStats m_lastUpdateStats;
+	int m_normalWeighting = 0, m_nodeFormat = 0, m_selectedInstance = 0, m_builder = 0, m_renderMode = 0, m_pathScheduling = 0;
+	bool m_cameraMoving = false, m_sceneChanged = false;
+	int m_lodMode = static_cast<int>(LevelOfDetailMode::WhileMoving), m_lodLevels = 4, m_lodMeshIdx = 0;
+	std::future<std::vector<std::shared_ptr<const Mesh>>> m_lodFuture;
+	std::future<void> m_renderFuture;
+	bool m_renderRequested = false;
+	std::shared_ptr<const Mesh> m_lodSource;
+	std::string m_lodOutputText;
+	float m_spatialSplitBudget = 0.3f;
+	bool m_treeletOptimization = true;
+	bool m_reorderForLocality = true;
+	bool m_weldVertices = false;
+	// Fraction of the mesh's bounding box diagonal
+	float m_weldTolerance = 1e-6f;
+	int m_subdivisionLevels = 0;
+	int m_traceFrames = 10;
+	int m_clusterCacheMB = 512;
+	std::string m_profilerOutputText;
+	int m_queryThreads = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+	std::vector<InstancePlacement> m_instancePlacements;
 	glm::vec3 m_queryPoint = glm::vec3(0);
 	float colour[3] = { 255.f, 0.f, 255.f };
 	std::string fileName = "Type in the JSON file you want to load.";
 };
 
+// Modes that run without a window and exit when done; -1 when argv asks for none of them
+//   --serve <model.json> <socket> [scale]
+//   --query-bench <socket> [batchSize] [batches] [pipelineDepth]
+//   --build-clusters <model.json> <out.clusters> [scale] [clusterTriangles]
+//   --stream-bench <file.clusters> [budgetMB] [rays]
+//   --load-bench <model.json> [scale]
+//   --render-worker <address>
+//   --render-bench <model.json> <width> <height> <samplesPerPixel> <address> [address...]
+//   --batch <directory> <report.csv|report.json> [parsers] [checkers] [queueDepth] [readers]
+// Models may be .json, binary .stl or binary .ply. Addresses are host:port for TCP or the path
+// of a local socket.
+static int RunHeadless(int argc, char** argv)
+{
+	if (argc < 2) return -1;
+	std::string mode = argv[1];
+	if (mode == "--serve" && argc >= 4)
+	{
+		Parser parser;
+		float scale = argc >= 5 ? (float)atof(argv[4]) : 1.f;
+		if (!parser.LoadFile(argv[2], scale, glm::vec3(1.f)))
+		{
+			std::cout << "Failed to load " << argv[2] << std::endl;
+			return 1;
+		}
+		parser.CalculateVertexNormals();
+
+		QueryService service;
+		service.PublishMesh(parser.GetMesh());
+		QueryServer server(service);
+		return server.Run(argv[3]) ? 0 : 1;
+	}
+	if (mode == "--query-bench" && argc >= 3)
+	{
+		int batchSize = argc >= 4 ? atoi(argv[3]) : 4096;
+		int batches = argc >= 5 ? atoi(argv[4]) : 256;
+		int pipelineDepth = argc >= 6 ? atoi(argv[5]) : 4;
+		return QueryClient::RunLoadGenerator(argv[2], std::max(1, batchSize), std::max(1, batches), pipelineDepth) ? 0 : 1;
+	}
+	if (mode == "--build-clusters" && argc >= 4)
+	{
+		Parser parser;
+		float scale = argc >= 5 ? (float)atof(argv[4]) : 1.f;
+		if (!parser.LoadFile(argv[2], scale, glm::vec3(1.f)))
+		{
+			std::cout << "Failed to load " << argv[2] << std::endl;
+			return 1;
+		}
+		ClusterBuildOptions options;
+		if (argc >= 6) options.clusterTriangles = std::max(1, atoi(argv[5]));
+		return ClusteredMesh::Build(*parser.GetMesh(), argv[3], options) ? 0 : 1;
+	}
+	if (mode == "--stream-bench" && argc >= 3)
+	{
+		size_t budgetMB = argc >= 4 ? (size_t)std::max(1, atoi(argv[3])) : 512;
+		int rayCount = argc >= 5 ? atoi(argv[4]) : 1 << 20;
+		return ClusteredMesh::RunBenchmark(argv[2], budgetMB * 1024 * 1024, std::max(1, rayCount)) ? 0 : 1;
+	}
+	if (mode == "--load-bench" && argc >= 3)
+	{
+		float scale = argc >= 4 ? (float)atof(argv[3]) : 1.f;
+		Parser::CompareLoaders(argv[2], scale);
+		return 0;
+	}
+	if (mode == "--render-worker" && argc >= 3)
+	{
+		RenderWorker worker;
+		return worker.Run(argv[2]) ? 0 : 1;
+	}
+	if (mode == "--render-bench" && argc >= 7)
+	{
+		std::vector<std::string> addresses(argv + 6, argv + argc);
+		uint32_t width = (uint32_t)std::max(1, atoi(argv[3]));
+		uint32_t height = (uint32_t)std::max(1, atoi(argv[4]));
+		RenderCoordinator::RunScalingBenchmark(argv[2], 1.f, addresses, width, height, std::max(1, atoi(argv[5])));
+		return 0;
+	}
+	if (mode == "--batch" && argc >= 4)
+	{
+		// Thread counts left out or 0 use one per hardware thread, except the reader
+		BatchOptions options;
+		if (argc >= 5) options.parsers = atoi(argv[4]);
+		if (argc >= 6) options.checkers = atoi(argv[5]);
+		if (argc >= 7) options.queueDepth = atoi(argv[6]);
+		if (argc >= 8) options.readers = atoi(argv[7]);
+		return BatchPipeline::RunDirectory(argv[2], argv[3], options) ? 0 : 1;
+	}
+	return -1;
+}
+
 Walnut::Application* Walnut::CreateApplication(int argc, char** argv)
 {
+	int exitCode = RunHeadless(argc, argv);
+	if (exitCode >= 0)
+		std::exit(exitCode);
+
 	Walnut::ApplicationSpecification spec;
 	spec.Name = "Cashew App";
 
@@ -4,7 +4,16 @@
 #include <thread>
 #include <chrono>
 #include <mutex>
+#include <condition_variable>
 #include <map>
+#include <list>
+#include <deque>
+#include <functional>
+#include <atomic>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+#include <execution>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
@@ -12,22 +21,72 @@
 #include "filereadstream.h"
 
 // constants
-#define EPSILON			0.0000001
+#define EPSILON			0.0000001f
 #define PI				3.14159265358979323846264f
 #define INVPI			1.57079632679f
 #define OWN_MULTI_THREADING 1
 
 // Colours
+// Clamped, so values outside [0, 1] saturate instead of wrapping around. Whole frames go through
+// ConvertToRGBA8 in ToneMapping.h instead.
 inline uint32_t ConvertToRGBA(const glm::vec3& colour)
 {
-	uint8_t r = colour.x * 255.0f;
-	uint8_t g = colour.y * 255.0f;
-	uint8_t b = colour.z * 255.0f;
+	uint8_t r = std::clamp(colour.x, 0.f, 1.f) * 255.0f;
+	uint8_t g = std::clamp(colour.y, 0.f, 1.f) * 255.0f;
+	uint8_t b = std::clamp(colour.z, 0.f, 1.f) * 255.0f;
 	uint8_t a = 255.0f;
 	uint32_t result = (a << 24) | (b << 16) | (g << 8) | r;
 	return result;
 }
 
+// Threading
+// Splits [0, count) into contiguous chunks and runs func(begin, end) for each on the parallel STL pool.
+// Chunks are walked serially, so simple loops inside func stay vectorizable.
+template<typename Func>
+inline void ParallelForRange(int count, Func func, int minChunkSize = 1024)
+{
+	if (count <= 0) return;
+	int maxChunks = std::max(1, (int)std::thread::hardware_concurrency() * 4);
+	int chunkCount = std::max(1, std::min(maxChunks, (count + minChunkSize - 1) / minChunkSize));
+	std::vector<int> chunks(chunkCount);
+	std::iota(chunks.begin(), chunks.end(), 0);
+	std::for_each(std::execution::par, chunks.begin(), chunks.end(),
+		[&func, count, chunkCount](int chunk)
+		{
+			int begin = (int)((int64_t)count * chunk / chunkCount);
+			int end = (int)((int64_t)count * (chunk + 1) / chunkCount);
+			func(begin, end);
+		});
+}
+
+// Sampling
+// PCG32: a few instructions per number and no shared state, so every worker or pixel can own a
+// stream. Streams built from different (seed, stream) pairs are statistically independent.
+class RandomStream
+{
+public:
+	RandomStream(uint64_t seed, uint64_t stream = 0) : m_state(0), m_increment((stream << 1) | 1)
+	{
+		NextUInt();
+		m_state += seed;
+		NextUInt();
+	}
+
+	uint32_t NextUInt()
+	{
+		uint64_t previous = m_state;
+		m_state = previous * 6364136223846793005ull + m_increment;
+		uint32_t xorShifted = (uint32_t)(((previous >> 18) ^ previous) >> 27);
+		uint32_t rotation = (uint32_t)(previous >> 59);
+		return (xorShifted >> rotation) | (xorShifted << ((32 - rotation) & 31));
+	}
+	// Uniform in [0, 1)
+	float NextFloat() { return (NextUInt() >> 8) * (1.f / 16777216.f); }
+
+private:
+	uint64_t m_state, m_increment;
+};
+
 inline glm::vec3 fminf(const glm::vec3& a, const glm::vec3& b) { return glm::vec3(fminf(a.x, b.x), fminf(a.y, b.y), fminf(a.z, b.z)); }
 inline glm::vec3 fmaxf(const glm::vec3& a, const glm::vec3& b) { return glm::vec3(fmaxf(a.x, b.x), fmaxf(a.y, b.y), fmaxf(a.z, b.z)); }
 inline float Area(float a, float b, float c)
@@ -41,71 +100,73 @@ inline float Area(float a, float b, float c)
 class Ray
 {
 public:
-	Ray() : t(1e34f), hitObjIdx(-1) {};
-	Ray(glm::vec3 O, glm::vec3 D) : O(O), D(D), t(1e34f), hitObjIdx(-1) {};
+	Ray() : t(1e34f), hitObjIdx(-1), hitInstIdx(-1), nodesVisited(0), trianglesTested(0) {};
+	Ray(glm::vec3 O, glm::vec3 D) : O(O), D(D), t(1e34f), hitObjIdx(-1), hitInstIdx(-1), nodesVisited(0), trianglesTested(0) {};
 
 public:
 	glm::vec3 GetIntersectionPoint() { return O + t * D; }
 
 public:
 	glm::vec3 O, D;
-	glm::vec3 faceNormal, colour;
+	// The hit: u and v are only kept by kernels that need them for smooth shading
 	float t, u, v;
-	int hitObjIdx;
+	int hitObjIdx, hitInstIdx;
+	// Set for hits on a streamed mesh only, whose triangle may be evicted before it is shaded
+	glm::vec3 faceNormal, colour;
+	// Traversal cost, summed over both BVH levels
+	int nodesVisited, trianglesTested;
+};
+
+// Nearest surface point to a query point, searched within sqrt(distSq)
+struct PointQuery
+{
+	PointQuery(glm::vec3 P, float maxDistance = 1e17f) : P(P), distSq(maxDistance * maxDistance), hitObjIdx(-1), hitInstIdx(-1) {};
+
+	glm::vec3 P, closest;
+	float distSq;
+	int hitObjIdx, hitInstIdx;
 };
 
 struct Vertex
 {
 	glm::vec3 position;
 	glm::vec3 normal;
-	std::vector<int> faces;
 
 	Vertex() = default;
-	Vertex(glm::vec3 v) : position(v) {};
+	Vertex(glm::vec3 v) : position(v), normal(0) {};
 
 	const glm::vec3 GetPosition() const { return position; }
-	void	AddFace(int faceIdx) { faces.push_back(faceIdx); }
 };
 
 struct Triangle
 {
 	int id;
-	std::vector<glm::vec3> verticesPos;
-	std::vector<int> verIndices;
+	glm::vec3 verticesPos[3];
+	int verIndices[3];
 	glm::vec3 normal, centroid;
 	glm::vec3 colour;
 
 	Triangle()
 	{
 		id = 0;
-		verticesPos.reserve(3);
-		verticesPos.push_back(glm::vec3(0));
-		verticesPos.push_back(glm::vec3(0));
-		verticesPos.push_back(glm::vec3(0));
+		verticesPos[0] = verticesPos[1] = verticesPos[2] = glm::vec3(0);
+		verIndices[0] = verIndices[1] = verIndices[2] = -1;
 	}
 	Triangle(int id, glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, int vIdx1, int vIdx2, int vIdx3, glm::vec3 n, glm::vec3 colour)
-		: id(id), normal(n), colour(colour)
+		: id(id), verticesPos{ v0, v1, v2 }, verIndices{ vIdx1, vIdx2, vIdx3 }, normal(n), colour(colour)
 	{
-		verIndices.reserve(3);
-		verIndices.push_back(vIdx1);
-		verIndices.push_back(vIdx2);
-		verIndices.push_back(vIdx3);
-		verticesPos.reserve(3);
-		verticesPos.push_back(v0);
-		verticesPos.push_back(v1);
-		verticesPos.push_back(v2);
 		centroid = (v0 + v1 + v2) * 0.3333f;
 	};
 	Triangle(int id, glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, glm::vec3 n)
-		: id(id), normal(n)
+		: id(id), verticesPos{ v0, v1, v2 }, verIndices{ -1, -1, -1 }, normal(n)
 	{
-		verticesPos.reserve(3);
-		verticesPos.push_back(v0);
-		verticesPos.push_back(v1);
-		verticesPos.push_back(v2);
 	};
 
-	void Intersect(Ray& ray)
+	// Records only where the ray now ends: t, this triangle and, with Barycentrics, u and v.
+	// Normal and colour are looked up once traversal has found the nearest hit. True if the
+	// ray got shorter.
+	template<bool Barycentrics = true>
+	bool Intersect(Ray& ray) const
 	{
 		glm::vec3 v0 = verticesPos[0];
 		glm::vec3 v1 = verticesPos[1];
@@ -114,26 +175,58 @@ struct Triangle
 		glm::vec3 edge2 = v2 - v0;
 		glm::vec3 h = glm::cross(ray.D, edge2);
 		float a = glm::dot(edge1, h);
-		if (a > -EPSILON && a < EPSILON) return; // the ray is parallel to the triangle	
-		float f = 1.0 / a;
+		if (a > -EPSILON && a < EPSILON) return false; // the ray is parallel to the triangle
+		float f = 1.f / a;
 		glm::vec3 s = ray.O - v0;
 		float u = f * glm::dot(s, h);
-		if (u < 0.0 || u > 1.0) return;
+		if (u < 0.f || u > 1.f) return false;
 		glm::vec3 q = glm::cross(s, edge1);
 		float v = f * glm::dot(ray.D, q);
-		if (v < 0.0 || u + v > 1.0) return;
+		if (v < 0.f || u + v > 1.f) return false;
 		float t = f * glm::dot(edge2, q);
 		if (t > EPSILON && t < ray.t)
 		{
 			ray.t = t;
 			ray.hitObjIdx = id;
-			ray.u = u;
-			ray.v = v;
-			ray.faceNormal = normal;
-			ray.colour = colour;
-			return;
+			if constexpr (Barycentrics)
+			{
+				ray.u = u;
+				ray.v = v;
+			}
+			return true;
 		}
-		return;
+		return false;
+	}
+
+	// Closest point on the triangle to p, by the Voronoi region p falls into (Ericson, RTCD 5.1.5)
+	glm::vec3 ClosestPoint(const glm::vec3& p) const
+	{
+		const glm::vec3& a = verticesPos[0];
+		const glm::vec3& b = verticesPos[1];
+		const glm::vec3& c = verticesPos[2];
+		glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+		float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+		if (d1 <= 0.f && d2 <= 0.f) return a;
+
+		glm::vec3 bp = p - b;
+		float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+		if (d3 >= 0.f && d4 <= d3) return b;
+
+		float vc = d1 * d4 - d3 * d2;
+		if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f) return a + ab * (d1 / (d1 - d3));
+
+		glm::vec3 cp = p - c;
+		float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+		if (d6 >= 0.f && d5 <= d6) return c;
+
+		float vb = d5 * d2 - d1 * d6;
+		if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f) return a + ac * (d2 / (d2 - d6));
+
+		float va = d3 * d6 - d5 * d4;
+		if (va <= 0.f && (d4 - d3) >= 0.f && (d5 - d6) >= 0.f) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+		float denom = 1.f / (va + vb + vc);
+		return a + ab * (vb * denom) + ac * (vc * denom);
 	}
 };
 
@@ -182,8 +275,28 @@ public:
 		float bmin[4], bmax[4];
 };
 
+#include "Platform.h"
+#include "Profiler.h"
+#include "Arena.h"
+#include "SpatialSort.h"
+#include "Mesh.h"
 #include "Parser.h"
+#include "ToneMapping.h"
+#include "FrameQueue.h"
 #include "Renderer.h"
 #include "Camera.h"
+#include "Bvh.h"
+#include "Tlas.h"
+#include "MappedFile.h"
+#include "ClusteredMesh.h"
 #include "Scene.h"
-#include "Bvh.h"
\ No newline at end of file
+#include "QueryService.h"
+#include "Socket.h"
+#include "QueryProtocol.h"
+#include "QueryServer.h"
+#include "QueryClient.h"
+#include "RenderProtocol.h"
+#include "RenderWorker.h"
+#include "RenderCoordinator.h"
+#include "BoundedQueue.h"
+#include "BatchPipeline.h"
\ No newline at end of file